@@ -1,9 +1,10 @@
 /**
  * makeGen is a program that generates a Makefile for a given number of source
  * files. It generates a simple make file with the user-specified CFLAGS and
- * source files. The makefile includes two rules "all" and "clean". The "all"
- * rule compiles all the source files into a single ELF executable. The "clean"
- * rule removes the executable.
+ * source files. By default the makefile includes two rules "all" and "clean".
+ * The "all" rule compiles all the source files into a single ELF executable.
+ * The "clean" rule removes the executable. The options below add rules for
+ * per-object builds, benchmarking, profiling and testing.
  *
  * Sample usage:
  * Given the following source files:
@@ -14,14 +15,68 @@
  *   my_program
  * makeGen can be invoked as follows:
  *   makeGen myProgram -f -Wall -g -O0 -s file1.c file2.c file3.c
+ *
+ * Hot-path sources can be amalgamated into a single translation unit that is
+ * compiled at -O3, which lets the compiler inline across them without the
+ * link cost of full LTO:
+ *   makeGen myProgram -f -Wall -g -O0 -s file1.c file2.c file3.c
+ *       -hot file2.c file3.c
+ * or, picking the hottest sources from a perf profile:
+ *   makeGen myProgram -f -Wall -g -O0 -s file1.c file2.c file3.c
+ *       -hotprofile perf.data 2
+ *
+ * The CFLAGS can also be tuned by benchmarking. Every combination of the
+ * "|" separated alternatives given to -tune is built in its own directory and
+ * benchmarked, and the fastest one is added to the CFLAGS:
+ *   makeGen --autotune myProgram -f -Wall -g -s file1.c file2.c file3.c
+ *       -bench '$EXE input.txt' -tune "-O2|-O3" "|-march=native"
+ *       "|-funroll-loops"
+ * The benchmark command is run by the shell with $EXE naming the executable.
+ *
+ * Listing several compilers after -cc builds the project with each of them
+ * and keeps the one with the fastest executable:
+ *   makeGen myProgram -f -O2 -s file1.c file2.c -cc gcc clang -bench '$EXE'
+ *
+ * A project built by another build system can be imported from the
+ * compile_commands.json it writes, into a per-object makefile:
+ *   makeGen --from-compdb myProgram build/compile_commands.json
+ * and a hand-written makefile from a dry run of it, which it then replaces:
+ *   makeGen --from-makefile myProgram
  */
 
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <dirent.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "support/embedded/affected.c.inc"
+#include "support/embedded/bench.c.inc"
+#include "support/embedded/benchhistory.c.inc"
+#include "support/embedded/buildtime.c.inc"
+#include "support/embedded/cgreport.c.inc"
+#include "support/embedded/envtune.c.inc"
+#include "support/embedded/flamegraph.c.inc"
+#include "support/embedded/fpsampler.c.inc"
+#include "support/embedded/heapprof.c.inc"
+#include "support/embedded/ioprof.c.inc"
+#include "support/embedded/latency.c.inc"
+#include "support/embedded/latency.h.inc"
+#include "support/embedded/lockprof.c.inc"
+#include "support/embedded/microbench.c.inc"
+#include "support/embedded/microbench.h.inc"
+#include "support/embedded/numarun.c.inc"
+#include "support/embedded/objcache.c.inc"
+#include "support/embedded/optreport.c.inc"
+#include "support/embedded/scaling.c.inc"
+#include "support/embedded/stacks.h.inc"
+
 /* Some macros to make the code more readable. */
 #define MIN_ARGS 4
 #define FLAG_NOT_FOUND -1
@@ -30,6 +85,132 @@
 #define CFLAGS_FLAG "-f"
 #define SOURCE_FLAG "-s"
 #define COMPILER_FLAG "-cc"
+#define HOT_FLAG "-hot"
+#define HOT_PROFILE_FLAG "-hotprofile"
+#define DEFAULT_HOT_PROFILE_COUNT 4
+#define AMALGAMATION_NAME "makegen_hot"
+#define AUTOTUNE_FLAG "--autotune"
+#define FROM_COMPDB_FLAG "--from-compdb"
+#define FROM_MAKEFILE_FLAG "--from-makefile"
+#define MAKE_DRY_RUN "make -pnB 2>/dev/null"
+#define MAKEFILE_BACKUP MAKEFILE_NAME ".orig"
+#define MAX_MAKE_DEPTH 64
+#define BENCH_FLAG "-bench"
+#define TUNE_FLAG "-tune"
+#define RUNS_FLAG "-runs"
+#define DEFAULT_RUNS "10"
+#define DEFAULT_WARMUP "2"
+#define SIGNIFICANT_CONFIDENCE 0.95
+#define SUPPORT_DIR ".makegen"
+#define TUNE_DIR SUPPORT_DIR "/tune"
+#define SHOOTOUT_DIR SUPPORT_DIR "/shootout"
+#define BENCH_TOOL SUPPORT_DIR "/bench"
+#define HISTORY_TOOL SUPPORT_DIR "/benchhistory"
+#define BENCH_HISTORY SUPPORT_DIR "/bench-history.tsv"
+#define OBJCACHE_TOOL SUPPORT_DIR "/objcache"
+#define SCALING_TOOL SUPPORT_DIR "/scaling"
+#define SCALING_DIR SUPPORT_DIR "/scaling-results"
+#define NUMA_TOOL SUPPORT_DIR "/numarun"
+#define NUMA_DIR SUPPORT_DIR "/numa"
+#define ENV_TOOL SUPPORT_DIR "/envtune"
+#define ENV_DIR SUPPORT_DIR "/env"
+#define AB_DIR SUPPORT_DIR "/ab"
+#define DEFAULT_BENCH_THRESHOLD "5"
+#define OBJECTS_FLAG "-objects"
+#define BUILD_DIR "build"
+#define IMPORT_BUILD_DIR SUPPORT_DIR "/build"
+#define AFFECTED_TOOL SUPPORT_DIR "/affected"
+#define MICROBENCH_FLAG "-microbench"
+#define MICROBENCH_PREFIX "bench_"
+#define TESTS_FLAG "-tests"
+#define TEST_PREFIX "test_"
+#define TEST_INPUTS_MARKER "test-inputs:"
+#define DEFAULT_TEST_TIMEOUT "60"
+#define PROFILE_FLAG "-profile"
+#define PROFILE_DIR SUPPORT_DIR "/profile"
+#define OPT_REPORT_DIR SUPPORT_DIR "/opt-report"
+#define DEFAULT_WORKLOAD "$EXE"
+#define DEFAULT_PERF_FREQUENCY "999"
+#define DEFAULT_CG_TOLERANCE "1"
+#define LATENCY_FLAG "-latency"
+#define LATENCY_TOOL SUPPORT_DIR "/latency"
+#define DEFAULT_LATENCY_THRESHOLD "10"
+#define BUDGET_FLAG "-budget"
+#define BUILDTIME_TOOL SUPPORT_DIR "/buildtime"
+#define BUILD_BUDGET_DIR SUPPORT_DIR "/build-budget"
+#define DEFAULT_BUDGET_THRESHOLD "10"
+#define ALLOCATOR_FLAG "-allocator"
+#define SYSTEM_ALLOCATOR "system"
+#define ALLOCATOR_DIR SUPPORT_DIR "/allocators"
+#define COMPDB_FLAG "-compdb"
+#define COMPDB_NAME "compile_commands.json"
+#define COMPDB_COPY SUPPORT_DIR "/" COMPDB_NAME
+#define MAX_LINE_LENGTH 4096
+
+/** A run of invocation arguments, such as the CFLAGS or the source files. */
+typedef struct {
+  char **items;
+  int count;
+} ArgList;
+
+/** Everything gathered from the invocation that shapes the makefile. */
+typedef struct {
+  char *executableName;
+  char *compiler;
+  ArgList cflags;
+  ArgList sources;
+  char **sourceFlags;
+  ArgList hotSources;
+  char *benchCommand;
+  ArgList runs;
+  char *tunedFlags;
+  double tuneConfidence;
+  double compilerConfidence;
+  bool perObject;
+  char *buildDir;
+  char *mainSource;
+  ArgList microbenches;
+  ArgList tests;
+  char *workload;
+  char *latencyCommand;
+  bool buildBudget;
+  ArgList budgets;
+  ArgList allocators;
+  char **allocatorLibs;
+  int allocator;
+  bool compileCommands;
+  char *linkFlags;
+} MakeConfig;
+
+/** A compile, archive or link step found in a dry run of a makefile. */
+typedef struct {
+  char *directory;
+  ArgList args;
+  char *source;
+  char *output;
+  ArgList inputs;
+  char *linkFlags;
+} BuildStep;
+
+/** The steps found in a dry run, by kind. */
+typedef struct {
+  BuildStep *compiles;
+  int compileCount;
+  BuildStep *archives;
+  int archiveCount;
+  BuildStep *links;
+  int linkCount;
+  int dependencyFlags;
+} DryRun;
+
+/** Flags that may follow the source files, each with its own arguments. */
+static const char *const OPTION_FLAGS[] = {COMPILER_FLAG, HOT_FLAG,
+                                           HOT_PROFILE_FLAG, BENCH_FLAG,
+                                           TUNE_FLAG, RUNS_FLAG, OBJECTS_FLAG,
+                                           PROFILE_FLAG, LATENCY_FLAG,
+                                           BUDGET_FLAG, TESTS_FLAG,
+                                           MICROBENCH_FLAG, ALLOCATOR_FLAG,
+                                           COMPDB_FLAG, NULL};
 
 /** Helper function declarations. */
 static void printUsage();
@@ -38,16 +219,122 @@ __attribute__((deprecated, unused)) static int findSourceFlag(int argc,
                                                               char **argv);
 static bool makeFileExists();
 static void printHeader(FILE *makeFile);
-static void printRules(FILE *makeFile, char *executableName);
+static void printDefinitions(FILE *makeFile, MakeConfig *config);
+static void printList(FILE *makeFile, ArgList list, ArgList exclude);
+static void printRules(FILE *makeFile, MakeConfig *config);
+static void printBenchRules(FILE *makeFile, MakeConfig *config);
+static void printObjectRules(FILE *makeFile, MakeConfig *config);
+static void printMicrobenchRules(FILE *makeFile, MakeConfig *config);
+static void printTestRules(FILE *makeFile, MakeConfig *config);
+static void printProfileRules(FILE *makeFile, MakeConfig *config);
+static void printLatencyRules(FILE *makeFile, MakeConfig *config);
+static void printBudgetRules(FILE *makeFile);
+static void printAffectedRules(FILE *makeFile, MakeConfig *config);
+static void printShellEscaped(FILE *makeFile, const char *text);
 static void alertSuccess();
 static void findFlags(int argc, char **argv, int *sourceFlagIdx,
-                      int *compilerFlagIdx);
+                      int *sourceEnd);
+static bool isOptionFlag(const char *arg);
+static ArgList findOption(int argc, char **argv, int sourceEnd,
+                          const char *flag);
+static bool listContains(ArgList list, const char *item);
+static void validateHotSources(MakeConfig *config);
+static void selectHotSources(MakeConfig *config, ArgList profileArgs);
+static bool lineMentionsSource(const char *line, const char *source);
+static void autotune(MakeConfig *config, ArgList dimensions);
+static int expandSearchSpace(ArgList dimensions, char ***variants);
+static int countAlternatives(const char *dimension);
+static void appendAlternative(char *flags, size_t size, const char *dimension,
+                              int pick);
+static void formatBuildCommand(char *buffer, size_t size, MakeConfig *config,
+                               const char *compiler, const char *extraFlags,
+                               const char *output);
+static void buildInParallel(char **commands, int count, bool *built);
+static bool benchmarkExecutables(MakeConfig *config, char **labels,
+                                 char **executables, int count,
+                                 const char *resultsPath);
+static int runProgram(char **args);
+static void writeSupportFile(const char *name, const char *const *lines);
+static void writeCompileCommands(MakeConfig *config);
+static void printCompileCommand(FILE *database, MakeConfig *config,
+                                const char *directory, const char *source,
+                                const char *extraFlags, bool first);
+static void printJsonEscaped(FILE *file, const char *text);
+static bool buildSupportTool(MakeConfig *config, const char *name,
+                             const char *const *lines);
+static bool readBenchResult(const char *path, int *best, double *confidence);
+static bool readBenchMeans(const char *path, double *means, int count);
+static void shootout(MakeConfig *config, ArgList compilers);
+static void appendToList(ArgList *list, char *item);
+static ArgList discoverFiles(MakeConfig *config, const char *prefix);
+static int compareStrings(const void *a, const void *b);
+static char *findMainSource(MakeConfig *config);
+static bool definesMain(const char *path);
+static char *readTestInputs(const char *path);
+static void selectAllocators(MakeConfig *config, ArgList requested);
+static char *findAllocator(MakeConfig *config, const char *name);
+static char *readCommandOutput(const char *command);
+static const char *linkLibs(MakeConfig *config);
+static void printAllocatorRules(FILE *makeFile, MakeConfig *config);
+static int writeMakeFile(MakeConfig *config);
+static bool importCompileCommands(MakeConfig *config, const char *path);
+static bool addCompileCommand(MakeConfig *config, ArgList **flagLists,
+                              const char *directory, ArgList args,
+                              const char *file);
+static void factorFlags(MakeConfig *config, ArgList *flagLists);
+static char *readWholeFile(const char *path);
+static char *parseJsonString(const char **cursor);
+static bool skipJsonValue(const char **cursor);
+static ArgList splitCommand(const char *command);
+static char *rebasePath(const char *directory, const char *path);
+static bool existsInDirectory(const char *directory, const char *path);
+static char *quoteFlag(const char *flag);
+static bool importMakeFile(MakeConfig *config, const char *executableName);
+static void readDryRunCommand(DryRun *dryRun, const char *line,
+                              const char *directory, ArgList *removed);
+static void addBuildStep(DryRun *dryRun, const char *directory, ArgList args,
+                         ArgList *removed);
+static bool looksLikeCompiler(const char *program);
+static void appendStep(BuildStep **steps, int *count, BuildStep step);
 
 /**
  * Main function for make file generator.
  */
 int main(int argc, char **argv) {
 
+  // Autotuning takes the regular invocation after its own flag.
+  bool tuning = argc > 1 && strcmp(argv[1], AUTOTUNE_FLAG) == 0;
+  if (tuning) {
+    argc--;
+    argv++;
+  }
+
+  // Importing takes the sources and flags from a compilation database
+  // instead of the invocation.
+  if (argc > 2 && strcmp(argv[1], FROM_COMPDB_FLAG) == 0) {
+    MakeConfig config = {0};
+    config.executableName = argv[2];
+    if (makeFileExists()) {
+      printf("Unable to create makefile:\n");
+      printf("makeFile already exists in this directory.\n");
+      return 1;
+    }
+    if (!importCompileCommands(&config, argc > 3 ? argv[3] : COMPDB_NAME)) {
+      return 1;
+    }
+    return writeMakeFile(&config);
+  }
+
+  // Importing a makefile reads what it builds from a dry run of it, and
+  // replaces it.
+  if (argc > 1 && strcmp(argv[1], FROM_MAKEFILE_FLAG) == 0) {
+    MakeConfig config = {0};
+    if (!importMakeFile(&config, argc > 2 ? argv[2] : NULL)) {
+      return 1;
+    }
+    return writeMakeFile(&config);
+  }
+
   // Check for correct number of arguments.
   if (argc == 1 || argc < MIN_ARGS) {
     printUsage();
@@ -57,24 +344,10 @@ int main(int argc, char **argv) {
   // Validate the invocation.
   validateInvocation(argv);
 
-  int sourceFlagIdx, compilerFlagIdx;
+  int sourceFlagIdx, sourceEnd;
 
   // Find the flags, if they exist.
-  findFlags(argc, argv, &sourceFlagIdx, &compilerFlagIdx);
-  char *compiler;
-
-  // If the compiler flag is found, set the compiler.
-  if (compilerFlagIdx != FLAG_NOT_FOUND && compilerFlagIdx + 1 < argc) {
-    // The compiler flag is present the compiler must be specified in the next
-    // argument.
-    compiler = argv[compilerFlagIdx + 1];
-  }
-
-  // If the compiler flag is not found, or the compiler is not specified, set
-  // the compiler to gcc.
-  else {
-    compiler = "gcc";
-  }
+  findFlags(argc, argv, &sourceFlagIdx, &sourceEnd);
 
   // If there are no source files, exit.
   if (sourceFlagIdx == FLAG_NOT_FOUND) {
@@ -84,6 +357,113 @@ int main(int argc, char **argv) {
     return 1;
   }
 
+  MakeConfig config = {0};
+
+  // Gather the executable name, the CFLAGS and the source files.
+  config.executableName = argv[1];
+  config.cflags.items = argv + CFLAGS_FLAG_LOCATION + 1;
+  config.cflags.count = sourceFlagIdx - CFLAGS_FLAG_LOCATION - 1;
+  config.sources.items = argv + sourceFlagIdx + 1;
+  config.sources.count = sourceEnd - sourceFlagIdx - 1;
+
+  // If the compiler flag is found and the compiler is specified, use it.
+  // Otherwise, set the compiler to gcc. Listing several compilers compares
+  // them once the rest of the invocation is known.
+  ArgList compilerArgs = findOption(argc, argv, sourceEnd, COMPILER_FLAG);
+  config.compiler = compilerArgs.count > 0 ? compilerArgs.items[0] : "gcc";
+
+  // Gather the hot sources, either named directly or picked from a profile.
+  config.hotSources = findOption(argc, argv, sourceEnd, HOT_FLAG);
+  ArgList profileArgs = findOption(argc, argv, sourceEnd, HOT_PROFILE_FLAG);
+  validateHotSources(&config);
+  if (profileArgs.count > 0) {
+    selectHotSources(&config, profileArgs);
+  }
+
+  // Gather the benchmark command and how many times to run it.
+  ArgList benchArgs = findOption(argc, argv, sourceEnd, BENCH_FLAG);
+  config.benchCommand = benchArgs.count > 0 ? benchArgs.items[0] : NULL;
+  config.runs = findOption(argc, argv, sourceEnd, RUNS_FLAG);
+
+  // Find the microbenchmarks and tests next to the sources, when asked to.
+  // They link against the project objects, so they need every source
+  // compiled on its own.
+  ArgList microbenchArgs = findOption(argc, argv, sourceEnd, MICROBENCH_FLAG);
+  if (microbenchArgs.items != NULL) {
+    config.microbenches = discoverFiles(
+        &config, microbenchArgs.count > 0 ? microbenchArgs.items[0]
+                                          : MICROBENCH_PREFIX);
+  }
+  ArgList testArgs = findOption(argc, argv, sourceEnd, TESTS_FLAG);
+  if (testArgs.items != NULL) {
+    config.tests = discoverFiles(
+        &config, testArgs.count > 0 ? testArgs.items[0] : TEST_PREFIX);
+  }
+  config.perObject = findOption(argc, argv, sourceEnd, OBJECTS_FLAG).items !=
+                     NULL;
+  if (!config.perObject &&
+      (config.microbenches.count > 0 || config.tests.count > 0)) {
+    config.perObject = true;
+    printf("Note: each source is compiled on its own under %s/, for the "
+           "microbenchmarks and tests to link against.\n",
+           BUILD_DIR);
+  }
+  config.mainSource = config.perObject ? findMainSource(&config) : NULL;
+
+  // Tests and microbenchmarks link against every object but the one with
+  // main(), so that source stays out of the amalgamation rather than take
+  // the hot code with it.
+  if (config.mainSource != NULL &&
+      listContains(config.hotSources, config.mainSource)) {
+    ArgList hot = {NULL, 0};
+    for (int i = 0; i < config.hotSources.count; i++) {
+      if (strcmp(config.hotSources.items[i], config.mainSource) != 0) {
+        appendToList(&hot, config.hotSources.items[i]);
+      }
+    }
+    config.hotSources = hot;
+    printf("Note: %s defines main(), so it is compiled on its own rather "
+           "than in the amalgamation.\n",
+           config.mainSource);
+  }
+
+  // Gather the workload the profiling rules run, which defaults to the
+  // benchmark command.
+  ArgList profileWorkload = findOption(argc, argv, sourceEnd, PROFILE_FLAG);
+  if (profileWorkload.count > 0) {
+    config.workload = profileWorkload.items[0];
+  } else if (profileWorkload.items != NULL) {
+    config.workload =
+        config.benchCommand != NULL ? config.benchCommand : DEFAULT_WORKLOAD;
+  }
+
+  // Gather the command the latency rules run, which also defaults to the
+  // benchmark command.
+  ArgList latencyArgs = findOption(argc, argv, sourceEnd, LATENCY_FLAG);
+  if (latencyArgs.count > 0) {
+    config.latencyCommand = latencyArgs.items[0];
+  } else if (latencyArgs.items != NULL) {
+    config.latencyCommand =
+        config.benchCommand != NULL ? config.benchCommand : DEFAULT_WORKLOAD;
+  }
+
+  // Gather the build time budgets, in seconds, for the clean build and the
+  // rebuild.
+  config.budgets = findOption(argc, argv, sourceEnd, BUDGET_FLAG);
+  config.buildBudget = config.budgets.items != NULL;
+
+  // Write a compilation database only when asked to, so that a plain
+  // invocation leaves nothing but the makefile.
+  config.compileCommands =
+      findOption(argc, argv, sourceEnd, COMPDB_FLAG).items != NULL;
+
+  // Find the alternative allocators that are installed. The first one found
+  // is linked into the executable.
+  ArgList allocatorArgs = findOption(argc, argv, sourceEnd, ALLOCATOR_FLAG);
+  if (allocatorArgs.count > 0) {
+    selectAllocators(&config, allocatorArgs);
+  }
+
   // If the makefile already exists, exit.
   if (makeFileExists()) {
     printf("Unable to create makefile:\n");
@@ -91,9 +471,25 @@ int main(int argc, char **argv) {
     return 1;
   }
 
-  // Gather the executable name.
-  char *executableName = argv[1];
+  // With several compilers, compare them and keep the best one.
+  if (compilerArgs.count > 1) {
+    shootout(&config, compilerArgs);
+  }
+
+  // Benchmark the candidate flag sets and keep the fastest.
+  if (tuning) {
+    autotune(&config, findOption(argc, argv, sourceEnd, TUNE_FLAG));
+  }
+
+  return writeMakeFile(&config);
+}
 
+/**
+ * Writes the makefile and the support files its rules use.
+ * @param config The invocation configuration.
+ * @return The exit status for makeGen.
+ */
+static int writeMakeFile(MakeConfig *config) {
   // Create the makefile.
   FILE *makeFile = fopen(MAKEFILE_NAME, "w+");
 
@@ -110,28 +506,64 @@ int main(int argc, char **argv) {
   // Print the header.
   printHeader(makeFile);
 
-  // Print compiler and CFLAGS definitions
-  fprintf(makeFile, "CC=%s\n", compiler);
-  fprintf(makeFile, "CFLAGS=");
+  // Print the compiler, CFLAGS and source file definitions.
+  printDefinitions(makeFile, config);
+
+  // Print the automatically generated rules.
+  printRules(makeFile, config);
+
+  // Close the makefile.
+  fclose(makeFile);
 
-  // Print the user specified CFLAGS.
-  for (int i = CFLAGS_FLAG_LOCATION + 1; i < sourceFlagIdx; i++) {
-    fprintf(makeFile, "%s ", argv[i]);
+  // Write the compilation database that editors and linters read.
+  if (config->compileCommands) {
+    writeCompileCommands(config);
   }
-  fprintf(makeFile, "\n");
 
-  // Print the source files.
-  fprintf(makeFile, "TARGETS=");
-  int sourceEnd = compilerFlagIdx == FLAG_NOT_FOUND ? argc : compilerFlagIdx;
-  for (int i = sourceFlagIdx + 1; i < sourceEnd; i++) {
-    fprintf(makeFile, "%s ", argv[i]);
+  // Ship the benchmark runner and object cache that the bench rules build.
+  if (config->benchCommand != NULL) {
+    writeSupportFile("bench.c", BENCH_SOURCE);
+    writeSupportFile("benchhistory.c", BENCHHISTORY_SOURCE);
+    writeSupportFile("objcache.c", OBJCACHE_SOURCE);
+    writeSupportFile("scaling.c", SCALING_SOURCE);
+    writeSupportFile("numarun.c", NUMARUN_SOURCE);
+    writeSupportFile("envtune.c", ENVTUNE_SOURCE);
   }
 
-  // Print the automatically generated rules.
-  printRules(makeFile, executableName);
+  // Ship the harness the microbenchmarks link against.
+  if (config->microbenches.count > 0) {
+    writeSupportFile("microbench.c", MICROBENCH_SOURCE);
+    writeSupportFile("microbench.h", MICROBENCH_HEADER);
+  }
 
-  // Close the makefile.
-  fclose(makeFile);
+  // Ship the stack folder and the shims for the profiling rules.
+  if (config->workload != NULL) {
+    writeSupportFile("flamegraph.c", FLAMEGRAPH_SOURCE);
+    writeSupportFile("stacks.h", STACKS_HEADER);
+    writeSupportFile("fpsampler.c", FPSAMPLER_SOURCE);
+    writeSupportFile("heapprof.c", HEAPPROF_SOURCE);
+    writeSupportFile("lockprof.c", LOCKPROF_SOURCE);
+    writeSupportFile("ioprof.c", IOPROF_SOURCE);
+    writeSupportFile("optreport.c", OPTREPORT_SOURCE);
+    writeSupportFile("cgreport.c", CGREPORT_SOURCE);
+  }
+
+  // Ship the build timer.
+  if (config->buildBudget) {
+    writeSupportFile("buildtime.c", BUILDTIME_SOURCE);
+  }
+
+  // Ship the impact analysis, which needs the dependency files of a
+  // per-object build.
+  if (config->perObject) {
+    writeSupportFile("affected.c", AFFECTED_SOURCE);
+  }
+
+  // Ship the latency harness and the header the program records with.
+  if (config->latencyCommand != NULL) {
+    writeSupportFile("latency.c", LATENCY_SOURCE);
+    writeSupportFile("latency.h", LATENCY_HEADER);
+  }
 
   // Alert the user that the makefile was created.
   alertSuccess();
@@ -155,89 +587,3258 @@ static void validateInvocation(char **argv) {
   }
 }
 
+/**
+ * Finds the source flag and the end of the source file list.
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @param sourceFlagIdx Set to the index of the source flag, or -1.
+ * @param sourceEnd Set to the index of the first option flag after the
+ * source files, or argc if there is none.
+ */
 static void findFlags(int argc, char **argv, int *sourceFlagIdx,
-                      int *compilerFlagIdx) {
+                      int *sourceEnd) {
   *sourceFlagIdx = FLAG_NOT_FOUND;
-  *compilerFlagIdx = FLAG_NOT_FOUND;
+  *sourceEnd = argc;
   for (int i = 0; i < argc; i++) {
     if (strcmp(argv[i], SOURCE_FLAG) == 0 && *sourceFlagIdx == FLAG_NOT_FOUND) {
       *sourceFlagIdx = i;
+    } else if (isOptionFlag(argv[i]) && *sourceFlagIdx != FLAG_NOT_FOUND) {
+      *sourceEnd = i;
+      break;
     }
-    if (strcmp(argv[i], COMPILER_FLAG) == 0 &&
-        *sourceFlagIdx != FLAG_NOT_FOUND &&
-        *compilerFlagIdx == FLAG_NOT_FOUND) {
-      *compilerFlagIdx = i;
+  }
+}
+
+/**
+ * Checks if the given argument is one of the flags that follow the sources.
+ * @param arg The argument.
+ * @return True if the argument is an option flag, false otherwise.
+ */
+static bool isOptionFlag(const char *arg) {
+  for (int i = 0; OPTION_FLAGS[i] != NULL; i++) {
+    if (strcmp(arg, OPTION_FLAGS[i]) == 0) {
+      return true;
     }
   }
+  return false;
 }
 
 /**
- * @deprecated
- * Find the source flag in the given arguments, if it exists.
+ * Finds an option flag after the source files and gathers its arguments.
  * @param argc The number of arguments.
  * @param argv The arguments.
- * @return The index of the source flag, or -1 if it does not exist.
+ * @param sourceEnd The index where the option flags start.
+ * @param flag The option flag to look for.
+ * @return The arguments up to the next option flag, or an empty list if the
+ * flag is not present.
  */
-__attribute__((deprecated, unused)) static int findSourceFlag(int argc,
-                                                              char **argv) {
-
-  // Get the source flag location.
-  int sourceFlagIdx = FLAG_NOT_FOUND;
-  for (int i = 3; i < argc; i++) {
-    if (strcmp(argv[i], SOURCE_FLAG) == 0) {
-      sourceFlagIdx = i;
+static ArgList findOption(int argc, char **argv, int sourceEnd,
+                          const char *flag) {
+  ArgList args = {NULL, 0};
+  for (int i = sourceEnd; i < argc; i++) {
+    if (strcmp(argv[i], flag) == 0) {
+      args.items = argv + i + 1;
+      while (i + 1 + args.count < argc &&
+             !isOptionFlag(argv[i + 1 + args.count])) {
+        args.count++;
+      }
       break;
     }
   }
+  return args;
+}
 
-  return sourceFlagIdx;
+/**
+ * Checks if a list contains the given item.
+ * @param list The list to search.
+ * @param item The item to look for.
+ * @return True if the item is in the list, false otherwise.
+ */
+static bool listContains(ArgList list, const char *item) {
+  for (int i = 0; i < list.count; i++) {
+    if (strcmp(list.items[i], item) == 0) {
+      return true;
+    }
+  }
+  return false;
 }
 
 /**
- * Checks if the makefile already exists in the current directory.
- * @return True if the makefile exists, false otherwise.
+ * Makes sure every hot source is also one of the project source files, and
+ * drops any named more than once.
+ * @param config The invocation configuration.
  */
-static bool makeFileExists() { return access(MAKEFILE_NAME, F_OK) != -1; }
+static void validateHotSources(MakeConfig *config) {
+  ArgList unique = {NULL, 0};
+  for (int i = 0; i < config->hotSources.count; i++) {
+    char *source = config->hotSources.items[i];
+    if (!listContains(config->sources, source)) {
+      printf("Invalid invocation.\n");
+      printf("Error: Hot source \"%s\" is not one of the source files.\n",
+             source);
+      exit(1);
+    }
+    if (!listContains(unique, source)) {
+      appendToList(&unique, source);
+    }
+  }
+  config->hotSources = unique;
+}
 
 /**
- * Prints a correct usage message to stdout.
+ * Picks the hot sources from a perf profile. The sources are taken in the
+ * order perf reports them, hottest first.
+ * @param config The invocation configuration.
+ * @param profileArgs The profile path, optionally followed by how many
+ * sources to pick.
  */
-static void printUsage() {
-  printf("Usage:\n");
-  printf("makeGen {executableName} -f {CFLAGS} -s {SOURCE FILES} [-cc {desired "
-         "compiler}]\n");
-  printf("Fields in brackets are optional.\n");
+static void selectHotSources(MakeConfig *config, ArgList profileArgs) {
+  int wanted = DEFAULT_HOT_PROFILE_COUNT;
+  if (profileArgs.count > 1) {
+    wanted = atoi(profileArgs.items[1]);
+  }
+  if (wanted <= 0) {
+    printf("Invalid invocation.\n");
+    printf("Error: The number of hot sources to pick from \"%s\" must be "
+           "at least 1.\n",
+           profileArgs.items[0]);
+    exit(1);
+  }
+
+  char command[MAX_LINE_LENGTH];
+  snprintf(command, sizeof(command),
+           "perf report -i '%s' --stdio --no-children --sort srcfile "
+           "2>/dev/null",
+           profileArgs.items[0]);
+
+  FILE *report = popen(command, "r");
+  if (report == NULL) {
+    printf("Unable to read profile \"%s\".\n", profileArgs.items[0]);
+    exit(1);
+  }
+
+  // Keep any hot sources that were also named directly. They have been
+  // checked to be distinct sources, so the list never outgrows the sources.
+  ArgList selected = {malloc(sizeof(char *) * config->sources.count), 0};
+  for (int i = 0; i < config->hotSources.count; i++) {
+    if (!listContains(selected, config->hotSources.items[i])) {
+      selected.items[selected.count++] = config->hotSources.items[i];
+    }
+  }
+
+  char line[MAX_LINE_LENGTH];
+  int picked = 0;
+  while (picked < wanted && fgets(line, sizeof(line), report) != NULL) {
+    if (line[0] == '#') {
+      continue;
+    }
+    for (int i = 0; i < config->sources.count; i++) {
+      char *source = config->sources.items[i];
+      if (lineMentionsSource(line, source) &&
+          !listContains(selected, source)) {
+        selected.items[selected.count++] = source;
+        picked++;
+        break;
+      }
+    }
+  }
+  pclose(report);
+
+  if (picked == 0) {
+    printf("Unable to select hot sources:\n");
+    printf("No source files found in profile \"%s\".\n",
+           profileArgs.items[0]);
+    exit(1);
+  }
+
+  config->hotSources = selected;
 }
 
 /**
- * Prints the header to the makefile.
+ * Checks if a perf report line refers to the given source file. perf may
+ * print the file with a directory prefix, so only the base name is matched.
+ * @param line The report line.
+ * @param source The source file.
+ * @return True if the line refers to the source, false otherwise.
  */
-static void printHeader(FILE *makeFile) {
-  fprintf(makeFile, "# Automatically generated makefile\n");
-  fprintf(makeFile, "# Generated using makeGen by Juan Jovel\n");
-  fprintf(makeFile, "\n");
+static bool lineMentionsSource(const char *line, const char *source) {
+  const char *baseName = strrchr(source, '/');
+  baseName = baseName == NULL ? source : baseName + 1;
+  size_t length = strlen(baseName);
+
+  for (const char *match = strstr(line, baseName); match != NULL;
+       match = strstr(match + 1, baseName)) {
+    bool startsWord = match == line || match[-1] == '/' || match[-1] == ' ' ||
+                      match[-1] == '\t';
+    char next = match[length];
+    bool endsWord = next == '\0' || next == ':' || next == ' ' ||
+                    next == '\t' || next == '\n';
+    if (startsWord && endsWord) {
+      return true;
+    }
+  }
+  return false;
 }
 
 /**
- * Prints the automatically generated rules to the makefile.
+ * Builds every combination of the tuning alternatives, benchmarks them
+ * against each other and keeps the fastest flags in the configuration.
+ * Exits if nothing could be built or benchmarked.
+ * @param config The invocation configuration.
+ * @param dimensions The tuning arguments, each a "|" separated list of
+ * alternative flags.
  */
-static void printRules(FILE *makeFile, char *executableName) {
-  fprintf(makeFile, "\n\n");
+static void autotune(MakeConfig *config, ArgList dimensions) {
+  if (config->benchCommand == NULL || dimensions.count == 0) {
+    printf("Invalid invocation.\n");
+    printf("Error: Autotuning needs both \"-bench\" and \"-tune\".\n");
+    printUsage();
+    exit(1);
+  }
 
-  fprintf(makeFile, "all:\n");
-  fprintf(makeFile, "\t$(CC) $(CFLAGS) -o %s $(TARGETS)\n", executableName);
+  char **variants;
+  int count = expandSearchSpace(dimensions, &variants);
+  printf("Autotuning %d flag sets.\n", count);
 
-  fprintf(makeFile, "\n");
+  // Build every variant in its own directory, in parallel.
+  char **commands = malloc(sizeof(char *) * count);
+  char **executables = malloc(sizeof(char *) * count);
+  bool *built = malloc(sizeof(bool) * count);
+  mkdir(SUPPORT_DIR, 0755);
+  mkdir(TUNE_DIR, 0755);
+  for (int i = 0; i < count; i++) {
+    char directory[MAX_LINE_LENGTH], output[MAX_LINE_LENGTH];
+    snprintf(directory, sizeof(directory), "%s/%d", TUNE_DIR, i);
+    mkdir(directory, 0755);
+    snprintf(output, sizeof(output), "%s/%d/%s", TUNE_DIR, i,
+             config->executableName);
+    executables[i] = strdup(output);
 
-  fprintf(makeFile, "clean:\n");
-  fprintf(makeFile, "\trm -f %s\n", executableName);
+    commands[i] = malloc(MAX_LINE_LENGTH);
+    formatBuildCommand(commands[i], MAX_LINE_LENGTH, config, config->compiler,
+                       variants[i], output);
+    size_t length = strlen(commands[i]);
+    int written = snprintf(commands[i] + length, MAX_LINE_LENGTH - length,
+                           " > %s/build.log 2>&1", directory);
+    if (written < 0 || (size_t)written >= MAX_LINE_LENGTH - length) {
+      printf("Skipping \"%s\": the build command is too long.\n",
+             variants[i]);
+      free(commands[i]);
+      commands[i] = NULL;
+    }
+  }
+  buildInParallel(commands, count, built);
 
-  fprintf(makeFile, "\n");
+  // Benchmark the variants that built against each other.
+  char **labels = malloc(sizeof(char *) * count);
+  int *benchmarked = malloc(sizeof(int) * count);
+  int benchCount = 0;
+  for (int i = 0; i < count; i++) {
+    if (commands[i] == NULL) {
+      continue;
+    }
+    if (!built[i]) {
+      printf("Skipping \"%s\": build failed, see %s/%d/build.log\n",
+             variants[i], TUNE_DIR, i);
+      continue;
+    }
+    labels[benchCount] = variants[i][0] == '\0' ? "(none)" : variants[i];
+    executables[benchCount] = executables[i];
+    benchmarked[benchCount++] = i;
+  }
 
-  fprintf(makeFile, "# End automatically generated makeFile\n");
+  int best;
+  const char *resultsPath = TUNE_DIR "/results.json";
+  if (benchCount == 0 ||
+      !benchmarkExecutables(config, labels, executables, benchCount,
+                            resultsPath) ||
+      !readBenchResult(resultsPath, &best, &config->tuneConfidence)) {
+    printf("Unable to autotune:\n");
+    printf("No flag set could be built and benchmarked.\n");
+    exit(1);
+  }
+
+  config->tunedFlags = variants[benchmarked[best]];
+  printf("Autotune picked \"%s\" with %.1f%% confidence.\n", config->tunedFlags,
+         100.0 * config->tuneConfidence);
+  if (config->tuneConfidence < SIGNIFICANT_CONFIDENCE) {
+    printf("The difference to the runner-up is not statistically "
+           "significant; consider more runs.\n");
+  }
 }
 
 /**
- * Alerts the user that the makefile was succesfully created.
+ * Builds the project once with each compiler and compares build time,
+ * executable size and, when a benchmark command is given, runtime. The
+ * compiler with the fastest executable, or the fastest build when there is
+ * no benchmark, becomes the configured compiler. An executable that is not
+ * significantly faster than the runner-up keeps the first compiler that
+ * built the project.
+ * @param config The invocation configuration.
+ * @param compilers The compilers to compare.
  */
-static void alertSuccess() { printf("Successfully created makefile.\n"); }
+static void shootout(MakeConfig *config, ArgList compilers) {
+  int count = compilers.count;
+  char **executables = malloc(sizeof(char *) * count);
+  char **labels = malloc(sizeof(char *) * count);
+  double *buildTimes = malloc(sizeof(double) * count);
+  double *runtimes = malloc(sizeof(double) * count);
+  long *sizes = malloc(sizeof(long) * count);
+  int builtCount = 0;
+
+  // Build with each compiler in turn, so the builds do not slow each other
+  // down and their times can be compared.
+  mkdir(SUPPORT_DIR, 0755);
+  mkdir(SHOOTOUT_DIR, 0755);
+  for (int i = 0; i < count; i++) {
+    char directory[MAX_LINE_LENGTH], output[MAX_LINE_LENGTH];
+    char command[MAX_LINE_LENGTH];
+    snprintf(directory, sizeof(directory), "%s/%d", SHOOTOUT_DIR, i);
+    mkdir(directory, 0755);
+    snprintf(output, sizeof(output), "%s/%d/%s", SHOOTOUT_DIR, i,
+             config->executableName);
+    formatBuildCommand(command, sizeof(command), config, compilers.items[i],
+                       "", output);
+    size_t length = strlen(command);
+    int written = snprintf(command + length, sizeof(command) - length,
+                           " > %s/build.log 2>&1", directory);
+    if (written < 0 || (size_t)written >= sizeof(command) - length) {
+      printf("Skipping %s: the build command is too long.\n",
+             compilers.items[i]);
+      continue;
+    }
+
+    printf("Building with %s.\n", compilers.items[i]);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    fflush(stdout);
+    int status = system(command);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    struct stat info;
+    if (status != 0 || stat(output, &info) != 0) {
+      printf("Skipping %s: build failed, see %s/build.log\n",
+             compilers.items[i], directory);
+      continue;
+    }
+
+    labels[builtCount] = compilers.items[i];
+    executables[builtCount] = strdup(output);
+    buildTimes[builtCount] =
+        (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    sizes[builtCount] = info.st_size;
+    runtimes[builtCount++] = 0;
+  }
+
+  if (builtCount == 0) {
+    printf("Unable to compare compilers:\n");
+    printf("The project could not be built with any of them.\n");
+    exit(1);
+  }
+
+  // Benchmark the executables against each other. The benchmark runner is
+  // built with the first compiler known to work.
+  bool benchmarked = false;
+  int best = 0;
+  double confidence = 0;
+  const char *resultsPath = SHOOTOUT_DIR "/results.json";
+  config->compiler = labels[0];
+  if (config->benchCommand != NULL) {
+    benchmarked = benchmarkExecutables(config, labels, executables,
+                                       builtCount, resultsPath) &&
+                  readBenchMeans(resultsPath, runtimes, builtCount) &&
+                  readBenchResult(resultsPath, &best, &confidence);
+  }
+
+  // Pick the compiler with the fastest build when there is no benchmark.
+  double *scores = benchmarked ? runtimes : buildTimes;
+  if (!benchmarked) {
+    for (int i = 1; i < builtCount; i++) {
+      if (scores[i] < scores[best]) {
+        best = i;
+      }
+    }
+  }
+
+  // Print the comparison table.
+  printf("\n%-24s %12s %12s %12s %10s\n", "compiler", "build (s)",
+         "size (KB)", "runtime (s)", "vs best");
+  for (int i = 0; i < builtCount; i++) {
+    char runtime[32] = "-";
+    if (benchmarked) {
+      snprintf(runtime, sizeof(runtime), "%.6f", runtimes[i]);
+    }
+    printf("%-24s %12.3f %12.1f %12s %+9.1f%%%s\n", labels[i], buildTimes[i],
+           sizes[i] / 1024.0, runtime,
+           100.0 * (scores[i] - scores[best]) / scores[best],
+           i == best ? "  *" : "");
+  }
+
+  // A fastest executable that is not significantly faster is no reason to
+  // switch away from the first compiler listed.
+  if (benchmarked && confidence < SIGNIFICANT_CONFIDENCE) {
+    printf("%s had the fastest executable, but only with %.1f%% "
+           "confidence.\n",
+           labels[best], 100.0 * confidence);
+    printf("The difference is not statistically significant, so keeping "
+           "%s; consider more runs.\n",
+           config->compiler);
+    return;
+  }
+
+  config->compiler = labels[best];
+  if (benchmarked) {
+    config->compilerConfidence = confidence;
+    printf("Using %s, which had the fastest executable with %.1f%% "
+           "confidence.\n",
+           config->compiler, 100.0 * confidence);
+  } else {
+    printf("Using %s, which had the fastest build.\n", config->compiler);
+  }
+}
+
+/**
+ * Expands the tuning dimensions into every combination of their
+ * alternatives.
+ * @param dimensions The tuning arguments, each a "|" separated list of
+ * alternative flags. An empty alternative leaves the dimension out.
+ * @param variants Set to the flag set of each combination.
+ * @return The number of combinations.
+ */
+static int expandSearchSpace(ArgList dimensions, char ***variants) {
+  int total = 1;
+  for (int d = 0; d < dimensions.count; d++) {
+    total *= countAlternatives(dimensions.items[d]);
+  }
+
+  *variants = malloc(sizeof(char *) * total);
+  for (int v = 0; v < total; v++) {
+    char flags[MAX_LINE_LENGTH] = "";
+    int rest = v;
+    for (int d = 0; d < dimensions.count; d++) {
+      int alternatives = countAlternatives(dimensions.items[d]);
+      appendAlternative(flags, sizeof(flags), dimensions.items[d],
+                        rest % alternatives);
+      rest /= alternatives;
+    }
+    (*variants)[v] = strdup(flags);
+  }
+  return total;
+}
+
+/**
+ * Counts the "|" separated alternatives of a tuning dimension.
+ */
+static int countAlternatives(const char *dimension) {
+  int count = 1;
+  for (const char *c = dimension; *c != '\0'; c++) {
+    count += *c == '|';
+  }
+  return count;
+}
+
+/**
+ * Appends one alternative of a tuning dimension to a flag set.
+ * @param flags The flag set to append to.
+ * @param size The size of the flag set buffer.
+ * @param dimension The "|" separated alternatives.
+ * @param pick The index of the alternative to append.
+ */
+static void appendAlternative(char *flags, size_t size, const char *dimension,
+                              int pick) {
+  const char *start = dimension;
+  for (int i = 0; i < pick; i++) {
+    start = strchr(start, '|') + 1;
+  }
+  const char *end = strchr(start, '|');
+  int length = end == NULL ? (int)strlen(start) : (int)(end - start);
+  if (length == 0) {
+    return;
+  }
+
+  size_t used = strlen(flags);
+  snprintf(flags + used, size - used, "%s%.*s", used == 0 ? "" : " ", length,
+           start);
+}
+
+/**
+ * Formats a single command that compiles and links the whole project, the
+ * way the generated "all" rule does.
+ * @param buffer The buffer to format into.
+ * @param size The size of the buffer.
+ * @param config The invocation configuration.
+ * @param compiler The compiler to use.
+ * @param extraFlags Flags to add after the CFLAGS.
+ * @param output The executable to create.
+ */
+static void formatBuildCommand(char *buffer, size_t size, MakeConfig *config,
+                               const char *compiler, const char *extraFlags,
+                               const char *output) {
+  size_t used = snprintf(buffer, size, "%s", compiler);
+  for (int i = 0; i < config->cflags.count && used < size; i++) {
+    used +=
+        snprintf(buffer + used, size - used, " %s", config->cflags.items[i]);
+  }
+  if (used < size) {
+    used += snprintf(buffer + used, size - used, " %s -o %s", extraFlags,
+                     output);
+  }
+  for (int i = 0; i < config->sources.count && used < size; i++) {
+    used +=
+        snprintf(buffer + used, size - used, " %s", config->sources.items[i]);
+  }
+  if (config->allocators.count > 0 && used < size) {
+    snprintf(buffer + used, size - used, " %s",
+             config->allocatorLibs[config->allocator]);
+  }
+}
+
+/**
+ * Runs shell commands in parallel, at most one per online CPU at a time.
+ * @param commands The commands to run. A NULL command is not run, and does
+ * not succeed.
+ * @param count The number of commands.
+ * @param built Set to whether each command succeeded.
+ */
+static void buildInParallel(char **commands, int count, bool *built) {
+  long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  pid_t *pids = malloc(sizeof(pid_t) * count);
+  int next = 0, running = 0;
+  fflush(stdout);
+
+  while (next < count || running > 0) {
+    // Start commands until every CPU is busy.
+    while (next < count && running < jobs) {
+      pids[next] = commands[next] != NULL ? fork() : -1;
+      if (pids[next] == 0) {
+        execl("/bin/sh", "sh", "-c", commands[next], (char *)NULL);
+        _exit(127);
+      }
+      built[next] = false;
+      running += pids[next] > 0;
+      next++;
+    }
+
+    // Wait for one of them to finish.
+    int status;
+    pid_t pid = wait(&status);
+    if (pid < 0) {
+      break;
+    }
+    for (int i = 0; i < next; i++) {
+      if (pids[i] == pid) {
+        built[i] = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+      }
+    }
+    running--;
+  }
+
+  free(pids);
+}
+
+/**
+ * Benchmarks executables against each other with the bench tool, using the
+ * configured benchmark command, runs and warmup. The benchmark is pinned to
+ * the last CPU, which is the least likely to be busy with interrupts.
+ * @param config The invocation configuration.
+ * @param labels The label of each executable.
+ * @param executables The executables to benchmark.
+ * @param count The number of executables.
+ * @param resultsPath Where the bench tool writes its results.
+ * @return True if the benchmark ran, false otherwise.
+ */
+static bool benchmarkExecutables(MakeConfig *config, char **labels,
+                                 char **executables, int count,
+                                 const char *resultsPath) {
+  if (!buildSupportTool(config, "bench", BENCH_SOURCE)) {
+    printf("The benchmark runner could not be built.\n");
+    return false;
+  }
+
+  char cpu[32];
+  snprintf(cpu, sizeof(cpu), "%ld", sysconf(_SC_NPROCESSORS_ONLN) - 1);
+  ArgList runArgs = config->runs;
+  char *runs = runArgs.count > 0 ? runArgs.items[0] : DEFAULT_RUNS;
+  char *warmup = runArgs.count > 1 ? runArgs.items[1] : DEFAULT_WARMUP;
+
+  char **args = malloc(sizeof(char *) * (11 + 2 * count));
+  int argCount = 0;
+  args[argCount++] = SUPPORT_DIR "/bench";
+  args[argCount++] = "-n";
+  args[argCount++] = runs;
+  args[argCount++] = "-w";
+  args[argCount++] = warmup;
+  args[argCount++] = "-c";
+  args[argCount++] = cpu;
+  args[argCount++] = "-o";
+  args[argCount++] = (char *)resultsPath;
+  args[argCount++] = "--";
+  for (int i = 0; i < count; i++) {
+    char *command = malloc(MAX_LINE_LENGTH);
+    snprintf(command, MAX_LINE_LENGTH, "export EXE=%s; %s", executables[i],
+             config->benchCommand);
+    args[argCount++] = labels[i];
+    args[argCount++] = command;
+  }
+  args[argCount] = NULL;
+
+  return runProgram(args) == 0;
+}
+
+/**
+ * Runs a program and waits for it to finish.
+ * @param args The program followed by its arguments, ending in NULL.
+ * @return The exit status of the program, or -1 if it could not be run.
+ */
+static int runProgram(char **args) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    execvp(args[0], args);
+    _exit(127);
+  }
+
+  int status;
+  if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)) {
+    return -1;
+  }
+  return WEXITSTATUS(status);
+}
+
+/**
+ * Writes one of the support files shipped with makeGen into the support
+ * directory.
+ * @param name The file name within the support directory.
+ * @param lines The lines of the file, ending in NULL.
+ */
+static void writeSupportFile(const char *name, const char *const *lines) {
+  char path[MAX_LINE_LENGTH];
+  snprintf(path, sizeof(path), "%s/%s", SUPPORT_DIR, name);
+  mkdir(SUPPORT_DIR, 0755);
+
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    printf("FATAL ERROR:\n");
+    printf("Unable to write %s.\n", path);
+    exit(1);
+  }
+  for (int i = 0; lines[i] != NULL; i++) {
+    fputs(lines[i], file);
+  }
+  fclose(file);
+}
+
+/**
+ * Writes the compilation database, with an entry per source giving the
+ * command the makefile compiles it with. Hot sources carry HOT_CFLAGS,
+ * imported sources their own flags and microbenchmarks the support directory
+ * include. The file is only replaced when its contents change, so tools
+ * that index it see no change when nothing did.
+ *
+ * A copy of the database is kept in the support directory. An existing
+ * database that matches neither the new one nor that copy was written by
+ * another tool, such as CMake or Bear, so it is left alone.
+ * @param config The invocation configuration.
+ */
+static void writeCompileCommands(MakeConfig *config) {
+  char directory[MAX_LINE_LENGTH];
+  if (getcwd(directory, sizeof(directory)) == NULL) {
+    printf("Unable to write %s: the directory is unknown.\n", COMPDB_NAME);
+    return;
+  }
+
+  // Write the database to memory first to compare it with the old one.
+  char *contents = NULL;
+  size_t length = 0;
+  FILE *database = open_memstream(&contents, &length);
+  fprintf(database, "[");
+  int entries = 0;
+  for (int i = 0; i < config->sources.count; i++) {
+    char *source = config->sources.items[i];
+    const char *extraFlags = "";
+    if (listContains(config->hotSources, source)) {
+      extraFlags = "-O3";
+    } else if (config->sourceFlags != NULL && config->sourceFlags[i] != NULL) {
+      extraFlags = config->sourceFlags[i];
+    }
+    printCompileCommand(database, config, directory, source, extraFlags,
+                        entries++ == 0);
+  }
+  for (int i = 0; i < config->microbenches.count; i++) {
+    printCompileCommand(database, config, directory,
+                        config->microbenches.items[i], "-I" SUPPORT_DIR,
+                        entries++ == 0);
+  }
+  for (int i = 0; i < config->tests.count; i++) {
+    printCompileCommand(database, config, directory, config->tests.items[i],
+                        "", entries++ == 0);
+  }
+  fprintf(database, "\n]\n");
+  fclose(database);
+
+  // Leave the old database alone if it is the same, or if makeGen did not
+  // write it.
+  char *old = readWholeFile(COMPDB_NAME);
+  bool same = old != NULL && strcmp(old, contents) == 0;
+  bool write = old == NULL;
+  if (old != NULL && !same) {
+    char *copy = readWholeFile(COMPDB_COPY);
+    write = copy != NULL && strcmp(old, copy) == 0;
+    if (!write) {
+      printf("Leaving %s as it is, since makeGen did not write it. Remove "
+             "it to have makeGen write its own.\n",
+             COMPDB_NAME);
+    }
+    free(copy);
+  }
+  free(old);
+
+  // Write the database, and the copy that marks it as makeGen's own.
+  mkdir(SUPPORT_DIR, 0755);
+  const char *paths[] = {COMPDB_NAME, COMPDB_COPY};
+  for (int i = write ? 0 : 1; i < 2 && (write || same); i++) {
+    FILE *file = fopen(paths[i], "w");
+    if (file == NULL) {
+      printf("Unable to write %s.\n", paths[i]);
+    } else {
+      fwrite(contents, 1, length, file);
+      fclose(file);
+    }
+  }
+  free(contents);
+}
+
+/**
+ * Prints one entry of the compilation database.
+ * @param database The database being written.
+ * @param config The invocation configuration.
+ * @param directory The directory the makefile is in.
+ * @param source The source file compiled.
+ * @param extraFlags Flags the makefile adds for this source.
+ * @param first Whether this is the first entry.
+ */
+static void printCompileCommand(FILE *database, MakeConfig *config,
+                                const char *directory, const char *source,
+                                const char *extraFlags, bool first) {
+  char command[MAX_LINE_LENGTH];
+  size_t used = snprintf(command, sizeof(command), "%s", config->compiler);
+  for (int i = 0; i < config->cflags.count && used < sizeof(command); i++) {
+    used += snprintf(command + used, sizeof(command) - used, " %s",
+                     config->cflags.items[i]);
+  }
+  if (config->tunedFlags != NULL && used < sizeof(command)) {
+    used += snprintf(command + used, sizeof(command) - used, " %s",
+                     config->tunedFlags);
+  }
+  if (config->latencyCommand != NULL && used < sizeof(command)) {
+    used += snprintf(command + used, sizeof(command) - used, " -I%s",
+                     SUPPORT_DIR);
+  }
+  if (extraFlags[0] != '\0' && used < sizeof(command)) {
+    used += snprintf(command + used, sizeof(command) - used, " %s",
+                     extraFlags);
+  }
+
+  // Per-object builds compile each source into the build directory.
+  bool ownObject =
+      config->perObject && !listContains(config->hotSources, source);
+  if (ownObject && used < sizeof(command)) {
+    snprintf(command + used, sizeof(command) - used, " -c -o %s/%.*s.o %s",
+             config->buildDir != NULL ? config->buildDir : BUILD_DIR,
+             (int)strlen(source) - 2, source, source);
+  } else if (used < sizeof(command)) {
+    snprintf(command + used, sizeof(command) - used, " -c %s", source);
+  }
+
+  // The command is makefile text, so undo make's escaping of '$' and split
+  // it into words the way the shell would.
+  char *unescaped = command;
+  for (char *c = command; *c != '\0'; c++) {
+    *unescaped++ = *c;
+    if (c[0] == '$' && c[1] == '$') {
+      c++;
+    }
+  }
+  *unescaped = '\0';
+  ArgList args = splitCommand(command);
+
+  fprintf(database, "%s\n  {\n    \"directory\": \"", first ? "" : ",");
+  printJsonEscaped(database, directory);
+  fprintf(database, "\",\n    \"arguments\": [");
+  for (int i = 0; i < args.count; i++) {
+    fprintf(database, "%s\"", i == 0 ? "" : ", ");
+    printJsonEscaped(database, args.items[i]);
+    fprintf(database, "\"");
+    free(args.items[i]);
+  }
+  free(args.items);
+  fprintf(database, "],\n    \"file\": \"");
+  printJsonEscaped(database, source);
+  fprintf(database, "\"\n  }");
+}
+
+/**
+ * Prints text as the inside of a JSON string.
+ */
+static void printJsonEscaped(FILE *file, const char *text) {
+  for (const char *c = text; *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\') {
+      fprintf(file, "\\%c", *c);
+    } else if ((unsigned char)*c < 0x20) {
+      fprintf(file, "\\u%04x", *c);
+    } else {
+      fputc(*c, file);
+    }
+  }
+}
+
+/**
+ * Writes a support tool into the support directory and builds it.
+ * @param config The invocation configuration.
+ * @param name The name of the tool.
+ * @param lines The source of the tool, ending in NULL.
+ * @return True if the tool was built, false otherwise.
+ */
+static bool buildSupportTool(MakeConfig *config, const char *name,
+                             const char *const *lines) {
+  char sourceName[MAX_LINE_LENGTH], command[MAX_LINE_LENGTH];
+  snprintf(sourceName, sizeof(sourceName), "%s.c", name);
+  writeSupportFile(sourceName, lines);
+  snprintf(command, sizeof(command), "%s -O2 -o %s/%s %s/%s.c -lm",
+           config->compiler, SUPPORT_DIR, name, SUPPORT_DIR, name);
+  return system(command) == 0;
+}
+
+/**
+ * Reads the fastest result and its confidence from a benchmark results file.
+ * @param path The results file written by the benchmark runner.
+ * @param best Set to the index of the fastest command.
+ * @param confidence Set to the confidence that it is the fastest.
+ * @return True if both values were found, false otherwise.
+ */
+static bool readBenchResult(const char *path, int *best, double *confidence) {
+  FILE *results = fopen(path, "r");
+  if (results == NULL) {
+    return false;
+  }
+
+  bool foundBest = false, foundConfidence = false;
+  char line[MAX_LINE_LENGTH];
+  while (fgets(line, sizeof(line), results) != NULL) {
+    foundBest = foundBest || sscanf(line, " \"best_index\": %d", best) == 1;
+    foundConfidence = foundConfidence ||
+                      sscanf(line, " \"confidence\": %lf", confidence) == 1;
+  }
+  fclose(results);
+
+  return foundBest && foundConfidence;
+}
+
+/**
+ * Reads the mean time of each command from a benchmark results file.
+ * @param path The results file written by the benchmark runner.
+ * @param means Set to the mean of each command, in order.
+ * @param count The number of commands.
+ * @return True if every mean was found, false otherwise.
+ */
+static bool readBenchMeans(const char *path, double *means, int count) {
+  FILE *results = fopen(path, "r");
+  if (results == NULL) {
+    return false;
+  }
+
+  int found = 0;
+  char line[MAX_LINE_LENGTH];
+  while (found < count && fgets(line, sizeof(line), results) != NULL) {
+    found += sscanf(line, " \"mean\": %lf", &means[found]) == 1;
+  }
+  fclose(results);
+
+  return found == count;
+}
+
+/**
+ * Appends an item to a list that was allocated by the caller, or that is
+ * still empty.
+ * @param list The list to grow.
+ * @param item The item to append.
+ */
+static void appendToList(ArgList *list, char *item) {
+  list->items = realloc(list->items, sizeof(char *) * (list->count + 1));
+  list->items[list->count++] = item;
+}
+
+/**
+ * Finds the C files starting with a prefix in the directories that hold the
+ * sources. Files that are already sources are left out.
+ * @param config The invocation configuration.
+ * @param prefix The file name prefix, such as "bench_".
+ * @return The files found, sorted by path.
+ */
+static ArgList discoverFiles(MakeConfig *config, const char *prefix) {
+  ArgList found = {NULL, 0};
+  ArgList searched = {NULL, 0};
+
+  for (int i = 0; i < config->sources.count; i++) {
+    // Work out the directory of the source.
+    char *source = config->sources.items[i];
+    char *slash = strrchr(source, '/');
+    char *directory =
+        slash == NULL ? strdup(".") : strndup(source, slash - source);
+    if (listContains(searched, directory)) {
+      free(directory);
+      continue;
+    }
+    appendToList(&searched, directory);
+
+    DIR *dir = opendir(directory);
+    if (dir == NULL) {
+      continue;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+      size_t length = strlen(entry->d_name);
+      if (strncmp(entry->d_name, prefix, strlen(prefix)) != 0 || length < 2 ||
+          strcmp(entry->d_name + length - 2, ".c") != 0) {
+        continue;
+      }
+
+      char path[MAX_LINE_LENGTH];
+      if (slash == NULL) {
+        snprintf(path, sizeof(path), "%s", entry->d_name);
+      } else {
+        snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+      }
+      if (!listContains(config->sources, path)) {
+        appendToList(&found, strdup(path));
+      }
+    }
+    closedir(dir);
+  }
+
+  if (found.count > 0) {
+    qsort(found.items, found.count, sizeof(char *), compareStrings);
+  }
+  return found;
+}
+
+/**
+ * Orders strings alphabetically for qsort.
+ */
+static int compareStrings(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * Finds the source that defines main().
+ * @param config The invocation configuration.
+ * @return The source, or NULL if none of them seems to define main().
+ */
+static char *findMainSource(MakeConfig *config) {
+  for (int i = 0; i < config->sources.count; i++) {
+    if (definesMain(config->sources.items[i])) {
+      return config->sources.items[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Checks if a source file defines main(). This looks for a line starting
+ * with "int main(", "void main(" or, for a return type on the line before,
+ * "main(".
+ * @param path The source file.
+ * @return True if the file seems to define main(), false otherwise.
+ */
+static bool definesMain(const char *path) {
+  FILE *source = fopen(path, "r");
+  if (source == NULL) {
+    return false;
+  }
+
+  bool found = false;
+  char line[MAX_LINE_LENGTH];
+  while (!found && fgets(line, sizeof(line), source) != NULL) {
+    char *start = line + strspn(line, " \t");
+    if (strncmp(start, "int ", 4) == 0) {
+      start += 4;
+    } else if (strncmp(start, "void ", 5) == 0) {
+      start += 5;
+    }
+    start += strspn(start, " \t");
+    if (strncmp(start, "main", 4) == 0) {
+      start += 4 + strspn(start + 4, " \t");
+      found = *start == '(';
+    }
+  }
+  fclose(source);
+
+  return found;
+}
+
+/**
+ * Reads the inputs a test declares in a comment such as
+ * "// test-inputs: data/small.txt data/large.txt".
+ * @param path The test source.
+ * @return The inputs, space separated, or NULL if none are declared.
+ */
+static char *readTestInputs(const char *path) {
+  FILE *source = fopen(path, "r");
+  if (source == NULL) {
+    return NULL;
+  }
+
+  char *inputs = NULL;
+  char line[MAX_LINE_LENGTH];
+  while (inputs == NULL && fgets(line, sizeof(line), source) != NULL) {
+    char *start = strstr(line, TEST_INPUTS_MARKER);
+    if (start == NULL) {
+      continue;
+    }
+    start += strlen(TEST_INPUTS_MARKER);
+    start += strspn(start, " \t");
+
+    // Drop the end of a block comment and the trailing whitespace.
+    char *end = strstr(start, "*/");
+    if (end == NULL) {
+      end = start + strlen(start);
+    }
+    while (end > start && isspace((unsigned char)end[-1])) {
+      end--;
+    }
+    if (end > start) {
+      inputs = strndup(start, end - start);
+    }
+  }
+  fclose(source);
+
+  return inputs;
+}
+
+/**
+ * @deprecated
+ * Find the source flag in the given arguments, if it exists.
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @return The index of the source flag, or -1 if it does not exist.
+ */
+__attribute__((deprecated, unused)) static int findSourceFlag(int argc,
+                                                              char **argv) {
+
+  // Get the source flag location.
+  int sourceFlagIdx = FLAG_NOT_FOUND;
+  for (int i = 3; i < argc; i++) {
+    if (strcmp(argv[i], SOURCE_FLAG) == 0) {
+      sourceFlagIdx = i;
+      break;
+    }
+  }
+
+  return sourceFlagIdx;
+}
+
+/**
+ * Checks if the makefile already exists in the current directory.
+ * @return True if the makefile exists, false otherwise.
+ */
+static bool makeFileExists() { return access(MAKEFILE_NAME, F_OK) != -1; }
+
+/**
+ * Prints a correct usage message to stdout.
+ */
+static void printUsage() {
+  printf("Usage:\n");
+  printf("makeGen {executableName} -f {CFLAGS} -s {SOURCE FILES} [-cc {desired "
+         "compilers}]\n");
+  printf("        [-hot {HOT SOURCE FILES}] [-hotprofile {perf.data} "
+         "[{count}]]\n");
+  printf("        [-bench {command}] [-runs {count} [{warmup}]] "
+         "[-objects]\n");
+  printf("        [-profile [{workload command}]] [-latency [{command}]]\n");
+  printf("        [-budget [{clean seconds} [{rebuild seconds}]]] "
+         "[-tests [{prefix}]]\n");
+  printf("        [-microbench [{prefix}]] [-allocator {ALLOCATORS}] "
+         "[-compdb]\n");
+  printf("makeGen --autotune {executableName} -f {CFLAGS} -s {SOURCE FILES} "
+         "-bench {command}\n");
+  printf("        -tune {ALTERNATIVES} [-runs {count} [{warmup}]]\n");
+  printf("makeGen --from-compdb {executableName} "
+         "[{compile_commands.json}]\n");
+  printf("makeGen --from-makefile [{executableName}]\n");
+  printf("Fields in brackets are optional.\n");
+}
+
+/**
+ * Prints the header to the makefile.
+ */
+static void printHeader(FILE *makeFile) {
+  fprintf(makeFile, "# Automatically generated makefile\n");
+  fprintf(makeFile, "# Generated using makeGen by Juan Jovel\n");
+  fprintf(makeFile, "\n");
+}
+
+/**
+ * Prints the compiler, CFLAGS and source file definitions to the makefile.
+ * Hot sources are listed apart from the rest, since they are compiled
+ * together in the amalgamation unit.
+ */
+static void printDefinitions(FILE *makeFile, MakeConfig *config) {
+  ArgList none = {NULL, 0};
+
+  if (config->tunedFlags != NULL) {
+    fprintf(makeFile,
+            "# CFLAGS ending in \"%s\" were picked by makeGen --autotune "
+            "(confidence %.1f%%)\n",
+            config->tunedFlags, 100.0 * config->tuneConfidence);
+  }
+
+  if (config->compilerConfidence > 0) {
+    fprintf(makeFile,
+            "# CC was picked by comparing compilers with makeGen "
+            "(confidence %.1f%%)\n",
+            100.0 * config->compilerConfidence);
+  }
+
+  // Print compiler and CFLAGS definitions
+  fprintf(makeFile, "CC=%s\n", config->compiler);
+  fprintf(makeFile, "CFLAGS=");
+
+  // Print the user specified CFLAGS, followed by any tuned ones.
+  printList(makeFile, config->cflags, none);
+  if (config->tunedFlags != NULL) {
+    fprintf(makeFile, "%s ", config->tunedFlags);
+  }
+
+  // Let the program include latency.h.
+  if (config->latencyCommand != NULL) {
+    fprintf(makeFile, "-I%s ", SUPPORT_DIR);
+  }
+  fprintf(makeFile, "\n");
+
+  // Print the source files.
+  fprintf(makeFile, "TARGETS=");
+  printList(makeFile, config->sources, config->hotSources);
+
+  if (config->hotSources.count > 0) {
+    fprintf(makeFile, "\n");
+    fprintf(makeFile, "HOT_TARGETS=");
+    printList(makeFile, config->hotSources, none);
+    fprintf(makeFile, "\n");
+    fprintf(makeFile, "HOT_CFLAGS=-O3");
+  }
+
+  // Print the object files. The object with main() is left out of the ones
+  // that other executables link against.
+  if (config->perObject) {
+    fprintf(makeFile, "\n");
+    fprintf(makeFile, "BUILD_DIR=%s\n",
+            config->buildDir != NULL ? config->buildDir : BUILD_DIR);
+    fprintf(makeFile, "OBJECTS=$(patsubst %%.c,$(BUILD_DIR)/%%.o,$(TARGETS))");
+    if (config->hotSources.count > 0) {
+      fprintf(makeFile, " $(BUILD_DIR)/%s.o", AMALGAMATION_NAME);
+    }
+    fprintf(makeFile, "\n");
+    fprintf(makeFile, "MAIN_OBJECT=");
+    if (config->mainSource != NULL) {
+      fprintf(makeFile, "$(BUILD_DIR)/%.*s.o",
+              (int)strlen(config->mainSource) - 2, config->mainSource);
+    }
+    fprintf(makeFile, "\n");
+    fprintf(makeFile, "LIB_OBJECTS=$(filter-out $(MAIN_OBJECT),$(OBJECTS))");
+  }
+
+  // Print the allocators. LDLIBS links the selected one, which can be
+  // swapped on the make command line with ALLOCATOR=<name>.
+  if (config->allocators.count > 0) {
+    fprintf(makeFile, "\n");
+    fprintf(makeFile, "ALLOCATOR=%s\n",
+            config->allocators.items[config->allocator]);
+    fprintf(makeFile, "ALLOCATORS=");
+    printList(makeFile, config->allocators, none);
+    fprintf(makeFile, "\n");
+    for (int i = 0; i < config->allocators.count; i++) {
+      fprintf(makeFile, "ALLOCATOR_LIBS_%s=%s\n", config->allocators.items[i],
+              config->allocatorLibs[i]);
+    }
+    fprintf(makeFile, "LDLIBS=$(ALLOCATOR_LIBS_$(ALLOCATOR))\n");
+    fprintf(makeFile, "ALLOCATOR_DIR=%s\n", ALLOCATOR_DIR);
+    fprintf(makeFile, "ALLOCATOR_STAMP=$(ALLOCATOR_DIR)/selected");
+  }
+
+  // Print the libraries an imported makefile linked with.
+  if (config->linkFlags != NULL) {
+    fprintf(makeFile, "\n");
+    fprintf(makeFile, "LDLIBS=%s", config->linkFlags);
+  }
+
+  // Print the microbenchmarks.
+  if (config->microbenches.count > 0) {
+    fprintf(makeFile, "\n");
+    fprintf(makeFile, "MICROBENCHES=");
+    printList(makeFile, config->microbenches, none);
+    fprintf(makeFile, "\n");
+    fprintf(makeFile, "MICROBENCH_BINS="
+                      "$(patsubst %%.c,$(BUILD_DIR)/%%,$(MICROBENCHES))\n");
+    fprintf(makeFile, "MICROBENCH_CPU=$(shell echo $$(($$(nproc) - 1)))\n");
+    fprintf(makeFile, "MICROBENCH_RESULTS=microbench-results.json");
+  }
+
+  // Print the tests. TEST_SHARD of TEST_SHARDS picks every TEST_SHARDS-th
+  // test, so that several machines can split them.
+  if (config->tests.count > 0) {
+    fprintf(makeFile, "\n");
+    fprintf(makeFile, "TESTS=");
+    printList(makeFile, config->tests, none);
+    fprintf(makeFile, "\n");
+    fprintf(makeFile,
+            "TEST_BINS=$(patsubst %%.c,$(BUILD_DIR)/%%,$(TESTS))\n");
+    fprintf(makeFile, "TEST_INPUTS=\n");
+    fprintf(makeFile, "TEST_TIMEOUT=%s\n", DEFAULT_TEST_TIMEOUT);
+    fprintf(makeFile, "TEST_JOBS=$(shell nproc)\n");
+    fprintf(makeFile, "TEST_SHARD=1\n");
+    fprintf(makeFile, "TEST_SHARDS=1\n");
+    fprintf(makeFile, "TEST_LOG=$(BUILD_DIR)/check.log");
+  }
+
+  // Print the benchmark settings. The command is run by the shell with $EXE
+  // naming the executable.
+  if (config->benchCommand != NULL) {
+    ArgList runArgs = config->runs;
+    fprintf(makeFile, "\n");
+    fprintf(makeFile, "BENCH_CMD=");
+    printShellEscaped(makeFile, config->benchCommand);
+    fprintf(makeFile, "\n");
+    fprintf(makeFile, "BENCH_RUNS=%s\n",
+            runArgs.count > 0 ? runArgs.items[0] : DEFAULT_RUNS);
+    fprintf(makeFile, "BENCH_WARMUP=%s\n",
+            runArgs.count > 1 ? runArgs.items[1] : DEFAULT_WARMUP);
+    fprintf(makeFile, "BENCH_CPU=$(shell echo $$(($$(nproc) - 1)))\n");
+    fprintf(makeFile, "BENCH_THRESHOLD=%s\n", DEFAULT_BENCH_THRESHOLD);
+    fprintf(makeFile, "BENCH_RESULTS=bench-results.json\n");
+    fprintf(makeFile, "BENCH_BASELINE=bench-baseline.json\n");
+    fprintf(makeFile, "BENCH_HISTORY=%s\n", BENCH_HISTORY);
+    fprintf(makeFile, "BENCH_HISTORY_HTML=bench-history.html\n");
+    fprintf(makeFile, "BENCH_PROFILE=$(CC) $(CFLAGS)\n");
+    fprintf(makeFile, "AB_DIR=%s\n", AB_DIR);
+    fprintf(makeFile, "SCALING_THREADS=$(shell seq 1 $$(nproc))\n");
+    fprintf(makeFile, "SCALING_PIN=1\n");
+    fprintf(makeFile, "SCALING_DIR=%s\n", SCALING_DIR);
+    fprintf(makeFile, "SCALING_SVG=scaling.svg\n");
+    fprintf(makeFile, "NUMA_NODES=$(shell ls /sys/devices/system/node "
+                      "2>/dev/null | sed -n 's/^node\\([0-9]*\\)$$/\\1/p')\n");
+    fprintf(makeFile, "NUMA_POLICIES=first-touch local interleave "
+                      "$(addprefix bind-,$(NUMA_NODES))\n");
+    fprintf(makeFile, "NUMA_DIR=%s\n", NUMA_DIR);
+    fprintf(makeFile, "ENV_MATRIX=MALLOC_ARENA_MAX=-,1,4 THP=-,never,malloc "
+                      "STACK=-,65536\n");
+    fprintf(makeFile, "ENV_DIR=%s\n", ENV_DIR);
+    fprintf(makeFile, "ENV_LAUNCHER=run-tuned.sh");
+  }
+
+  // Print the profiling settings. The workload is run like the benchmark
+  // command, with $EXE naming the profile build of the executable.
+  if (config->workload != NULL) {
+    fprintf(makeFile, "\n");
+    fprintf(makeFile, "PROFILE_DIR=%s\n", PROFILE_DIR);
+    fprintf(makeFile, "PROFILE_CFLAGS=-g -fno-omit-frame-pointer\n");
+    fprintf(makeFile, "PROFILE_EXE=$(PROFILE_DIR)/%s\n",
+            config->executableName);
+    fprintf(makeFile,
+            "PROFILE_OBJECTS=$(patsubst %%.c,$(PROFILE_DIR)/%%.o,$(TARGETS))");
+    if (config->hotSources.count > 0) {
+      fprintf(makeFile, " $(PROFILE_DIR)/%s.o", AMALGAMATION_NAME);
+    }
+    fprintf(makeFile, "\n");
+    fprintf(makeFile, "WORKLOAD=");
+    printShellEscaped(makeFile, config->workload);
+    fprintf(makeFile, "\n");
+    fprintf(makeFile, "PERF_FREQUENCY=%s\n", DEFAULT_PERF_FREQUENCY);
+    fprintf(makeFile, "FLAMEGRAPH=flamegraph.svg\n");
+    fprintf(makeFile, "HEAPPROF=heapprof.txt\n");
+    fprintf(makeFile, "LOCKPROF=lockprof.txt\n");
+    fprintf(makeFile, "IOPROF=ioprof.txt\n");
+    fprintf(makeFile, "CACHESIM=cachesim.txt\n");
+    fprintf(makeFile, "CACHESIM_BASELINE=cachesim-baseline.txt\n");
+    fprintf(makeFile, "CALLGRAPH=callgraph.txt\n");
+    fprintf(makeFile, "CALLGRAPH_BASELINE=callgraph-baseline.txt\n");
+    fprintf(makeFile, "CG_TOLERANCE=%s\n", DEFAULT_CG_TOLERANCE);
+    fprintf(makeFile, "OPT_REPORT_DIR=%s\n", OPT_REPORT_DIR);
+    fprintf(makeFile, "OPT_PROFILE=$(firstword $(wildcard "
+                      "$(PROFILE_DIR)/folded.txt $(PROFILE_DIR)/perf.data))");
+  }
+
+  // Print the latency settings. The command is run like the benchmark
+  // command, and the interval is the one the program means to issue
+  // operations at, in nanoseconds.
+  if (config->latencyCommand != NULL) {
+    ArgList runArgs = config->runs;
+    fprintf(makeFile, "\n");
+    fprintf(makeFile, "LATENCY_CMD=");
+    printShellEscaped(makeFile, config->latencyCommand);
+    fprintf(makeFile, "\n");
+    fprintf(makeFile, "LATENCY_RUNS=%s\n",
+            runArgs.count > 0 ? runArgs.items[0] : DEFAULT_RUNS);
+    fprintf(makeFile, "LATENCY_WARMUP=%s\n",
+            runArgs.count > 1 ? runArgs.items[1] : DEFAULT_WARMUP);
+    fprintf(makeFile, "LATENCY_INTERVAL=0\n");
+    fprintf(makeFile, "LATENCY_THRESHOLD=%s\n", DEFAULT_LATENCY_THRESHOLD);
+    fprintf(makeFile, "LATENCY_RESULTS=latency.txt\n");
+    fprintf(makeFile, "LATENCY_BASELINE=latency-baseline.txt");
+  }
+
+  // Print the build time budgets. A budget of 0 leaves the build checked
+  // against its baseline alone.
+  if (config->buildBudget) {
+    ArgList budgets = config->budgets;
+    fprintf(makeFile, "\n");
+    fprintf(makeFile, "BUILD_BUDGET_CLEAN=%s\n",
+            budgets.count > 0 ? budgets.items[0] : "0");
+    fprintf(makeFile, "BUILD_BUDGET_REBUILD=%s\n",
+            budgets.count > 1 ? budgets.items[1] : "0");
+    fprintf(makeFile, "BUILD_BUDGET_THRESHOLD=%s\n", DEFAULT_BUDGET_THRESHOLD);
+    fprintf(makeFile, "BUILD_BUDGET_DIR=%s\n", BUILD_BUDGET_DIR);
+    fprintf(makeFile, "BUILD_TOUCH=$(firstword $(TARGETS) $(HOT_TARGETS))\n");
+    fprintf(makeFile, "BUILD_TIMES=build-times.txt\n");
+    fprintf(makeFile, "BUILD_BASELINE=build-times-baseline.txt");
+  }
+}
+
+/**
+ * Prints text for use inside a single-quoted shell word in a recipe. Dollar
+ * signs are doubled for make and single quotes are closed and reopened
+ * around an escaped quote for the shell.
+ */
+static void printShellEscaped(FILE *makeFile, const char *text) {
+  for (const char *c = text; *c != '\0'; c++) {
+    if (*c == '$') {
+      fprintf(makeFile, "$$");
+    } else if (*c == '\'') {
+      fprintf(makeFile, "'\\''");
+    } else {
+      fputc(*c, makeFile);
+    }
+  }
+}
+
+/**
+ * Prints a space separated list to the makefile.
+ * @param list The items to print.
+ * @param exclude Items to leave out.
+ */
+static void printList(FILE *makeFile, ArgList list, ArgList exclude) {
+  for (int i = 0; i < list.count; i++) {
+    if (!listContains(exclude, list.items[i])) {
+      fprintf(makeFile, "%s ", list.items[i]);
+    }
+  }
+}
+
+/**
+ * Prints the automatically generated rules to the makefile.
+ */
+static void printRules(FILE *makeFile, MakeConfig *config) {
+  char *executableName = config->executableName;
+  bool amalgamate = config->hotSources.count > 0;
+
+  fprintf(makeFile, "\n\n");
+
+  if (config->perObject) {
+    printObjectRules(makeFile, config);
+  } else if (amalgamate) {
+    fprintf(makeFile, "all: %s.o\n", AMALGAMATION_NAME);
+    fprintf(makeFile, "\t$(CC) $(CFLAGS) -o %s $(TARGETS) %s.o%s\n",
+            executableName, AMALGAMATION_NAME, linkLibs(config));
+  } else {
+    fprintf(makeFile, "all:\n");
+    fprintf(makeFile, "\t$(CC) $(CFLAGS) -o %s $(TARGETS)%s\n",
+            executableName, linkLibs(config));
+  }
+
+  if (!config->perObject) {
+    fprintf(makeFile, "\n");
+  }
+
+  // The amalgamation unit includes every hot source, so the compiler sees
+  // them as one translation unit. Hot sources must not define static
+  // functions or variables with the same name. Per-object builds keep its
+  // object with the others.
+  const char *hotObjectDir = config->perObject ? "$(BUILD_DIR)/" : "";
+  if (amalgamate) {
+    fprintf(makeFile, "%s.c: %s\n", AMALGAMATION_NAME, MAKEFILE_NAME);
+    fprintf(makeFile, "\tprintf '#include \"%%s\"\\n' $(HOT_TARGETS) > $@\n");
+    fprintf(makeFile, "\n");
+
+    fprintf(makeFile, "%s%s.o: %s.c $(HOT_TARGETS)\n", hotObjectDir,
+            AMALGAMATION_NAME, AMALGAMATION_NAME);
+    if (config->perObject) {
+      fprintf(makeFile, "\t@mkdir -p $(@D)\n");
+    }
+    fprintf(makeFile,
+            "\t$(CC) $(CFLAGS) $(HOT_CFLAGS) -MMD -MP -c -o $@ %s.c\n",
+            AMALGAMATION_NAME);
+    fprintf(makeFile, "\n");
+    if (!config->perObject) {
+      fprintf(makeFile, "-include %s.d\n", AMALGAMATION_NAME);
+      fprintf(makeFile, "\n");
+    }
+  }
+
+  fprintf(makeFile, "clean:\n");
+  if (amalgamate && config->perObject) {
+    fprintf(makeFile, "\trm -f %s %s.c\n", executableName,
+            AMALGAMATION_NAME);
+  } else if (amalgamate) {
+    fprintf(makeFile, "\trm -f %s %s.c %s.o %s.d\n", executableName,
+            AMALGAMATION_NAME, AMALGAMATION_NAME, AMALGAMATION_NAME);
+  } else {
+    fprintf(makeFile, "\trm -f %s\n", executableName);
+  }
+  if (config->perObject) {
+    fprintf(makeFile, "\trm -rf $(BUILD_DIR)\n");
+  }
+
+  // Remove the abcompare worktrees, and git's records of them.
+  if (config->benchCommand != NULL) {
+    fprintf(makeFile,
+            "\t@for side in A B; do if [ -d $(AB_DIR)/$$side ]; then "
+            "git worktree remove --force $(AB_DIR)/$$side; fi; done; \\\n"
+            "\tgit worktree prune 2>/dev/null; true\n");
+  }
+
+  fprintf(makeFile, "\n");
+
+  if (config->benchCommand != NULL) {
+    printBenchRules(makeFile, config);
+  }
+
+  if (config->benchCommand != NULL && config->allocators.count > 0) {
+    printAllocatorRules(makeFile, config);
+  }
+
+  if (config->microbenches.count > 0) {
+    printMicrobenchRules(makeFile, config);
+  }
+
+  if (config->tests.count > 0) {
+    printTestRules(makeFile, config);
+  }
+
+  if (config->workload != NULL) {
+    printProfileRules(makeFile, config);
+  }
+
+  if (config->latencyCommand != NULL) {
+    printLatencyRules(makeFile, config);
+  }
+
+  if (config->buildBudget) {
+    printBudgetRules(makeFile);
+  }
+
+  if (config->perObject) {
+    printAffectedRules(makeFile, config);
+  }
+
+  fprintf(makeFile, "# End automatically generated makeFile\n");
+}
+
+/**
+ * Prints the rules that compile each source to its own object and link the
+ * objects. Each object also gets a dependency file listing the headers it
+ * includes, so editing a header rebuilds the objects that use it.
+ */
+static void printObjectRules(FILE *makeFile, MakeConfig *config) {
+  char *executableName = config->executableName;
+
+  fprintf(makeFile, "all: %s\n", executableName);
+  fprintf(makeFile, "\n");
+
+  fprintf(makeFile, "%s: $(OBJECTS)%s\n", executableName,
+          config->allocators.count > 0 ? " $(ALLOCATOR_STAMP)" : "");
+  fprintf(makeFile, "\t@mkdir -p $(@D)\n");
+  fprintf(makeFile, "\t$(CC) $(CFLAGS) -o $@ $(OBJECTS)%s\n",
+          linkLibs(config));
+  fprintf(makeFile, "\n");
+
+  // The stamp only changes when another allocator is selected, which
+  // relinks the executable.
+  if (config->allocators.count > 0) {
+    fprintf(makeFile, "$(ALLOCATOR_STAMP): FORCE\n");
+    fprintf(makeFile, "\t@mkdir -p $(@D)\n");
+    fprintf(makeFile, "\t@echo '$(ALLOCATOR)' | cmp -s - $@ || "
+                      "echo '$(ALLOCATOR)' > $@\n");
+    fprintf(makeFile, "\n");
+    fprintf(makeFile, "FORCE:\n");
+    fprintf(makeFile, "\n");
+  }
+
+  fprintf(makeFile, "$(BUILD_DIR)/%%.o: %%.c\n");
+  fprintf(makeFile, "\t@mkdir -p $(@D)\n");
+  fprintf(makeFile, "\t$(CC) $(CFLAGS) -MMD -MP -c -o $@ $<\n");
+  fprintf(makeFile, "\n");
+
+  fprintf(makeFile, "-include $(OBJECTS:.o=.d)\n");
+  fprintf(makeFile, "\n");
+
+  // Sources that were compiled with flags of their own keep them.
+  bool overridden = false;
+  for (int i = 0; config->sourceFlags != NULL && i < config->sources.count;
+       i++) {
+    char *source = config->sources.items[i];
+    if (config->sourceFlags[i] != NULL) {
+      fprintf(makeFile, "$(BUILD_DIR)/%.*s.o: CFLAGS += %s\n",
+              (int)strlen(source) - 2, source, config->sourceFlags[i]);
+      overridden = true;
+    }
+  }
+  if (overridden) {
+    fprintf(makeFile, "\n");
+  }
+}
+
+/**
+ * Prints the microbenchmark rules to the makefile. Each bench_*.c file is
+ * linked with the shipped harness and the project objects, except the one
+ * with main(). "microbench" runs the binaries in parallel across the cores,
+ * while "microbench-pinned" runs them one at a time on a single core, which
+ * is slower but more accurate.
+ */
+static void printMicrobenchRules(FILE *makeFile, MakeConfig *config) {
+  const char *combine =
+      "\t@{ echo '{'; sep=; for b in $(MICROBENCH_BINS); do "
+      "printf '%s  \"%s\": ' \"$$sep\" \"$$b\"; cat $$b.json; sep=,; done; "
+      "echo '}'; } > $(MICROBENCH_RESULTS)\n";
+
+  fprintf(makeFile, ".PHONY: microbench microbench-pinned\n");
+  fprintf(makeFile, "\n");
+
+  fprintf(makeFile, "$(BUILD_DIR)/microbench.o: %s/microbench.c "
+                    "%s/microbench.h\n",
+          SUPPORT_DIR, SUPPORT_DIR);
+  fprintf(makeFile, "\t@mkdir -p $(@D)\n");
+  fprintf(makeFile, "\t$(CC) $(CFLAGS) -c -o $@ %s/microbench.c\n",
+          SUPPORT_DIR);
+  fprintf(makeFile, "\n");
+
+  fprintf(makeFile, "$(MICROBENCH_BINS:=.o): CFLAGS += -I%s\n", SUPPORT_DIR);
+  fprintf(makeFile, "\n");
+
+  fprintf(makeFile, "$(MICROBENCH_BINS): %%: %%.o $(BUILD_DIR)/microbench.o "
+                    "$(LIB_OBJECTS)\n");
+  fprintf(makeFile, "\t$(CC) $(CFLAGS) -o $@ $^%s\n", linkLibs(config));
+  fprintf(makeFile, "\n");
+
+  fprintf(makeFile, "-include $(MICROBENCH_BINS:=.d)\n");
+  fprintf(makeFile, "\n");
+
+  fprintf(makeFile, "microbench: $(MICROBENCH_BINS)\n");
+  fprintf(makeFile, "\t@printf '%%s\\n' $(MICROBENCH_BINS) | "
+                    "xargs -P $$(nproc) -I{} sh -c '{} -o {}.json > {}.txt'\n");
+  fprintf(makeFile, "\t@for b in $(MICROBENCH_BINS); do "
+                    "echo \"$$b:\"; cat $$b.txt; done\n");
+  fprintf(makeFile, "%s", combine);
+  fprintf(makeFile, "\n");
+
+  fprintf(makeFile, "microbench-pinned: $(MICROBENCH_BINS)\n");
+  fprintf(makeFile, "\t@for b in $(MICROBENCH_BINS); do echo \"$$b:\"; "
+                    "$$b -c $(MICROBENCH_CPU) -o $$b.json || exit 1; done\n");
+  fprintf(makeFile, "%s", combine);
+  fprintf(makeFile, "\n");
+}
+
+/**
+ * Prints the test rules to the makefile. Each test_*.c file is linked with
+ * the project objects into a binary of its own. Running a test leaves a
+ * stamp beside it when it passes, which depends on the binary, TEST_INPUTS
+ * and the inputs the test declares, so make only reruns the tests that
+ * changed since they last passed. "check" runs the tests of this shard in
+ * parallel, each under a TEST_TIMEOUT second timeout, and sums up.
+ */
+static void printTestRules(FILE *makeFile, MakeConfig *config) {
+  fprintf(makeFile, ".PHONY: check\n");
+  fprintf(makeFile, "\n");
+
+  fprintf(makeFile, "$(TEST_BINS): %%: %%.o $(LIB_OBJECTS)\n");
+  fprintf(makeFile, "\t$(CC) $(CFLAGS) -o $@ $^%s\n", linkLibs(config));
+  fprintf(makeFile, "\n");
+
+  fprintf(makeFile, "-include $(TEST_BINS:=.d)\n");
+  fprintf(makeFile, "\n");
+
+  // A failing test keeps no stamp and shows its output.
+  fprintf(makeFile, "$(TEST_BINS:=.pass): %%.pass: %% $(TEST_INPUTS)\n");
+  fprintf(makeFile,
+          "\t@if timeout $(TEST_TIMEOUT) $< > $<.out 2>&1; then \\\n"
+          "\t  touch $@; echo \"PASS $<\" | tee -a $(TEST_LOG); \\\n"
+          "\telse status=$$?; rm -f $@; \\\n"
+          "\t  if [ $$status = 124 ]; then "
+          "echo \"TIMEOUT $< after $(TEST_TIMEOUT)s\"; \\\n"
+          "\t  else echo \"FAIL $< (exit $$status)\"; fi | "
+          "tee -a $(TEST_LOG); \\\n"
+          "\t  cat $<.out; exit 1; \\\n"
+          "\tfi\n");
+  fprintf(makeFile, "\n");
+
+  for (int i = 0; i < config->tests.count; i++) {
+    char *test = config->tests.items[i];
+    char *inputs = readTestInputs(test);
+    if (inputs != NULL) {
+      fprintf(makeFile, "$(BUILD_DIR)/%.*s.pass: %s\n",
+              (int)strlen(test) - 2, test, inputs);
+      free(inputs);
+    }
+  }
+  fprintf(makeFile, "\n");
+
+  // Stamps that are up to date were skipped, as they passed before.
+  fprintf(makeFile, "check: $(TEST_BINS)\n");
+  fprintf(makeFile,
+          "\t@rm -f $(TEST_LOG); stamps=; i=0; \\\n"
+          "\tfor t in $(TEST_BINS); do \\\n"
+          "\t  if [ $$((i %% $(TEST_SHARDS))) -eq $$(($(TEST_SHARD) - 1)) ]; "
+          "then stamps=\"$$stamps $$t.pass\"; fi; \\\n"
+          "\t  i=$$((i + 1)); \\\n"
+          "\tdone; \\\n"
+          "\t$(MAKE) --no-print-directory -k -j$(TEST_JOBS) $$stamps; "
+          "status=$$?; \\\n"
+          "\ttotal=$$(echo $$stamps | wc -w); touch $(TEST_LOG); \\\n"
+          "\tpassed=$$(grep -c '^PASS' $(TEST_LOG)); "
+          "failed=$$(grep -vc '^PASS' $(TEST_LOG)); \\\n"
+          "\techo \"$$total tests: $$passed passed, $$failed failed, "
+          "$$((total - passed - failed)) skipped as unchanged since they "
+          "passed\"; \\\n"
+          "\texit $$status\n");
+  fprintf(makeFile, "\n");
+}
+
+/**
+ * Prints the benchmark rules to the makefile. "bench" runs the benchmark
+ * command against the executable and saves the results, "bench-baseline"
+ * stores them as the baseline and "bench-check" fails when the results
+ * regress against that baseline. Each "bench" run is also appended to
+ * BENCH_HISTORY under the current commit and BENCH_PROFILE, and
+ * "bench-history" tabulates and charts the results over time.
+ *
+ * "abcompare" checks out two git revisions A and B in worktrees under
+ * AB_DIR and builds both with this makefile. The builds go through the
+ * object cache, so with per-object builds a source that is the same in both
+ * revisions is only compiled once. The two executables are then
+ * benchmarked in interleaved rounds.
+ *
+ * "scaling" benchmarks the executable once per thread count in
+ * SCALING_THREADS, with THREADS and OMP_NUM_THREADS set for the command.
+ * With SCALING_PIN=1 each step is pinned to as many CPUs as it has threads,
+ * physical cores first. The steps run in interleaved rounds like any other
+ * comparison, and the speedup and efficiency of each are then tabulated and
+ * plotted.
+ *
+ * "numa" benchmarks the executable once per placement policy in
+ * NUMA_POLICIES, launched through numarun. numarun applies each policy with
+ * numactl or, failing that, with set_mempolicy, and counts the pages each
+ * run allocated on local and remote nodes.
+ *
+ * "env-tune" benchmarks the executable under every combination of the
+ * runtime settings in ENV_MATRIX, and writes ENV_LAUNCHER to run a command
+ * under the fastest.
+ */
+static void printBenchRules(FILE *makeFile, MakeConfig *config) {
+  char *executableName = config->executableName;
+
+  fprintf(makeFile, ".PHONY: bench bench-baseline bench-check bench-history "
+                    "abcompare scaling numa env-tune\n");
+  fprintf(makeFile, "\n");
+
+  fprintf(makeFile, "%s: %s.c\n", BENCH_TOOL, BENCH_TOOL);
+  fprintf(makeFile, "\t$(CC) -O2 -o $@ %s.c -lm\n", BENCH_TOOL);
+  fprintf(makeFile, "\n");
+
+  fprintf(makeFile, "%s: %s.c\n", HISTORY_TOOL, HISTORY_TOOL);
+  fprintf(makeFile, "\t$(CC) -O2 -o $@ %s.c\n", HISTORY_TOOL);
+  fprintf(makeFile, "\n");
+
+  // Every run is added to the history under the commit it measured, marked
+  // dirty when the tree had uncommitted changes.
+  fprintf(makeFile, "bench: all %s %s\n", BENCH_TOOL, HISTORY_TOOL);
+  fprintf(makeFile,
+          "\t%s -n $(BENCH_RUNS) -w $(BENCH_WARMUP) -c $(BENCH_CPU) -p "
+          "-o $(BENCH_RESULTS) -- %s 'export EXE=./%s; $(BENCH_CMD)'\n",
+          BENCH_TOOL, executableName, executableName);
+  fprintf(makeFile,
+          "\t@commit=$$(git rev-parse --short HEAD 2>/dev/null) || "
+          "commit=none; \\\n"
+          "\tgit diff --quiet HEAD 2>/dev/null || [ $$commit = none ] || "
+          "commit=$$commit-dirty; \\\n"
+          "\t%s append $(BENCH_HISTORY) $(BENCH_RESULTS) $$commit "
+          "\"$(BENCH_PROFILE)\"\n",
+          HISTORY_TOOL);
+  fprintf(makeFile, "\n");
+
+  fprintf(makeFile, "bench-history: %s\n", HISTORY_TOOL);
+  fprintf(makeFile,
+          "\t%s report $(BENCH_HISTORY) $(BENCH_HISTORY_HTML)\n",
+          HISTORY_TOOL);
+  fprintf(makeFile, "\n");
+
+  fprintf(makeFile, "bench-baseline: bench\n");
+  fprintf(makeFile, "\tcp $(BENCH_RESULTS) $(BENCH_BASELINE)\n");
+  fprintf(makeFile, "\n");
+
+  fprintf(makeFile, "bench-check: bench\n");
+  fprintf(makeFile,
+          "\t%s -k $(BENCH_BASELINE) -t $(BENCH_THRESHOLD) $(BENCH_RESULTS)\n",
+          BENCH_TOOL);
+  fprintf(makeFile, "\n");
+
+  fprintf(makeFile, "%s: %s.c\n", OBJCACHE_TOOL, OBJCACHE_TOOL);
+  fprintf(makeFile, "\t$(CC) -O2 -o $@ %s.c\n", OBJCACHE_TOOL);
+  fprintf(makeFile, "\n");
+
+  fprintf(makeFile, "abcompare: %s %s\n", BENCH_TOOL, OBJCACHE_TOOL);
+  fprintf(makeFile, "\t@if [ -z \"$(A)\" ] || [ -z \"$(B)\" ]; then "
+                    "echo \"Usage: make abcompare A=<rev> B=<rev>\"; "
+                    "exit 1; fi\n");
+  fprintf(makeFile,
+          "\t@for side in A B; do \\\n"
+          "\t  if [ $$side = A ]; then rev=\"$(A)\"; else rev=\"$(B)\"; fi; "
+          "\\\n"
+          "\t  if [ -d $(AB_DIR)/$$side ]; then "
+          "git -C $(AB_DIR)/$$side checkout -q -f --detach \"$$rev\"; \\\n"
+          "\t  else git worktree add -q -f --detach $(AB_DIR)/$$side "
+          "\"$$rev\"; fi || exit 1; \\\n"
+          "\t  cp %s $(AB_DIR)/$$side/%s; \\\n"
+          "\t  $(MAKE) -C $(AB_DIR)/$$side all "
+          "CC=\"$(CURDIR)/%s $(CURDIR)/$(AB_DIR)/cache $(CC)\" || exit 1; "
+          "\\\n"
+          "\tdone\n",
+          MAKEFILE_NAME, MAKEFILE_NAME, OBJCACHE_TOOL);
+  fprintf(makeFile,
+          "\t%s -n $(BENCH_RUNS) -w $(BENCH_WARMUP) -c $(BENCH_CPU) "
+          "-o $(AB_DIR)/results.json -- \\\n"
+          "\t  'A:$(A)' 'export EXE=$(AB_DIR)/A/%s; $(BENCH_CMD)' \\\n"
+          "\t  'B:$(B)' 'export EXE=$(AB_DIR)/B/%s; $(BENCH_CMD)'\n",
+          BENCH_TOOL, executableName, executableName);
+  fprintf(makeFile, "\n");
+
+  fprintf(makeFile, "%s: %s.c\n", SCALING_TOOL, SCALING_TOOL);
+  fprintf(makeFile, "\t$(CC) -O2 -o $@ %s.c\n", SCALING_TOOL);
+  fprintf(makeFile, "\n");
+
+  // Each step pins its own shell, so the command and everything it starts
+  // inherit the CPU list.
+  fprintf(makeFile, "scaling: all %s %s\n", BENCH_TOOL, SCALING_TOOL);
+  fprintf(makeFile, "\t@mkdir -p $(SCALING_DIR)\n");
+  fprintf(makeFile,
+          "\t@set --; for t in $(SCALING_THREADS); do \\\n"
+          "\t  pin=; if [ \"$(SCALING_PIN)\" = 1 ]; then "
+          "pin=\"taskset -pc $$(%s cpus $$t) \\$$\\$$ > /dev/null; \"; "
+          "fi; \\\n"
+          "\t  set -- \"$$@\" $$t \"$${pin}export THREADS=$$t "
+          "OMP_NUM_THREADS=$$t; \"'export EXE=./%s; $(BENCH_CMD)'; "
+          "\\\n"
+          "\tdone; \\\n"
+          "\t%s -n $(BENCH_RUNS) -w $(BENCH_WARMUP) "
+          "-o $(SCALING_DIR)/results.json -- \"$$@\"\n",
+          SCALING_TOOL, executableName, BENCH_TOOL);
+  fprintf(makeFile,
+          "\t%s report $(SCALING_DIR)/results.json $(SCALING_SVG)\n",
+          SCALING_TOOL);
+  fprintf(makeFile, "\n");
+
+  fprintf(makeFile, "%s: %s.c\n", NUMA_TOOL, NUMA_TOOL);
+  fprintf(makeFile, "\t$(CC) -O2 -o $@ %s.c\n", NUMA_TOOL);
+  fprintf(makeFile, "\n");
+
+  // The launcher wraps the executable itself, so the policy covers the
+  // program but not the shell running the command. The stats files are
+  // started afresh so that the report only counts this sweep.
+  fprintf(makeFile, "numa: all %s %s\n", BENCH_TOOL, NUMA_TOOL);
+  fprintf(makeFile, "\t@rm -rf $(NUMA_DIR) && mkdir -p $(NUMA_DIR)\n");
+  fprintf(makeFile,
+          "\t@set --; for p in $(NUMA_POLICIES); do \\\n"
+          "\t  set -- \"$$@\" $$p \"export EXE='%s -s $(NUMA_DIR)/$$p.stats "
+          "-p $$p -- ./%s'; \"'$(BENCH_CMD)'; \\\n"
+          "\tdone; \\\n"
+          "\t%s -n $(BENCH_RUNS) -w $(BENCH_WARMUP) "
+          "-o $(NUMA_DIR)/results.json -- \"$$@\"\n",
+          NUMA_TOOL, executableName, BENCH_TOOL);
+  fprintf(makeFile, "\t%s report $(NUMA_DIR)/results.json $(NUMA_DIR)\n",
+          NUMA_TOOL);
+  fprintf(makeFile, "\n");
+
+  fprintf(makeFile, "%s: %s.c\n", ENV_TOOL, ENV_TOOL);
+  fprintf(makeFile, "\t$(CC) -O2 -o $@ %s.c -lm\n", ENV_TOOL);
+  fprintf(makeFile, "\n");
+
+  // Like numa, the settings are applied to the executable alone.
+  fprintf(makeFile, "env-tune: all %s %s\n", BENCH_TOOL, ENV_TOOL);
+  fprintf(makeFile, "\t@mkdir -p $(ENV_DIR)\n");
+  fprintf(makeFile,
+          "\t@set --; for c in $$(%s combos $(ENV_MATRIX)); do \\\n"
+          "\t  set -- \"$$@\" \"$$c\" \"export EXE='%s run $$c -- ./%s'; "
+          "\"'$(BENCH_CMD)'; \\\n"
+          "\tdone; \\\n"
+          "\t%s -n $(BENCH_RUNS) -w $(BENCH_WARMUP) -c $(BENCH_CPU) "
+          "-o $(ENV_DIR)/results.json -- \"$$@\"\n",
+          ENV_TOOL, ENV_TOOL, executableName, BENCH_TOOL);
+  fprintf(makeFile, "\t%s report $(ENV_DIR)/results.json $(ENV_LAUNCHER)\n",
+          ENV_TOOL);
+  fprintf(makeFile, "\n");
+}
+
+/**
+ * Prints the build time rules to the makefile. "build-budget" builds from
+ * clean, then touches BUILD_TOUCH and builds again, with the compiler
+ * wrapped to time every compile and link step. It fails when either build
+ * is over its budget or grew by more than BUILD_BUDGET_THRESHOLD percent
+ * against the baseline, listing the steps that grew the most.
+ * "build-budget-baseline" stores the latest times as the baseline.
+ */
+static void printBudgetRules(FILE *makeFile) {
+  const char *phases[] = {"clean", "rebuild"};
+
+  fprintf(makeFile, ".PHONY: build-budget build-budget-baseline\n");
+  fprintf(makeFile, "\n");
+
+  fprintf(makeFile, "%s: %s.c\n", BUILDTIME_TOOL, BUILDTIME_TOOL);
+  fprintf(makeFile, "\t$(CC) -O2 -o $@ %s.c\n", BUILDTIME_TOOL);
+  fprintf(makeFile, "\n");
+
+  // Each build runs in a sub-make whose compiler is the wrapper, so that it
+  // goes through this makefile's own rules.
+  fprintf(makeFile, "build-budget: %s\n", BUILDTIME_TOOL);
+  fprintf(makeFile,
+          "\t@rm -rf $(BUILD_BUDGET_DIR) && mkdir -p $(BUILD_BUDGET_DIR)\n");
+  fprintf(makeFile, "\t$(MAKE) clean\n");
+  for (int i = 0; i < 2; i++) {
+    if (i > 0) {
+      fprintf(makeFile, "\ttouch $(BUILD_TOUCH)\n");
+    }
+    fprintf(makeFile,
+            "\t%s time $(BUILD_BUDGET_DIR)/%s.txt $(MAKE) all \\\n"
+            "\t  CC=\"$(CURDIR)/%s wrap $(CURDIR)/$(BUILD_BUDGET_DIR)/%s.txt "
+            "$(CC)\"\n",
+            BUILDTIME_TOOL, phases[i], BUILDTIME_TOOL, phases[i]);
+  }
+  fprintf(makeFile,
+          "\t%s check -c $(BUILD_BUDGET_CLEAN) -r $(BUILD_BUDGET_REBUILD) "
+          "-t $(BUILD_BUDGET_THRESHOLD) \\\n"
+          "\t  -k $(BUILD_BASELINE) -o $(BUILD_TIMES) "
+          "$(BUILD_BUDGET_DIR)/clean.txt $(BUILD_BUDGET_DIR)/rebuild.txt\n",
+          BUILDTIME_TOOL);
+  fprintf(makeFile, "\n");
+
+  // The times are saved before they are checked, so a new baseline can be
+  // taken even when the old one is exceeded.
+  fprintf(makeFile, "build-budget-baseline:\n");
+  fprintf(makeFile, "\t-$(MAKE) build-budget\n");
+  fprintf(makeFile, "\tcp $(BUILD_TIMES) $(BUILD_BASELINE)\n");
+  fprintf(makeFile, "\n");
+}
+
+/**
+ * Prints the impact analysis rule to the makefile. "affected" lists the
+ * files changed since the BASE revision, committed or not, and the new
+ * untracked files, and has the affected tool walk back from them through
+ * the dependency files to the objects, binaries and tests they affect. Only
+ * those are then built, and the affected tests run.
+ */
+static void printAffectedRules(FILE *makeFile, MakeConfig *config) {
+  fprintf(makeFile, ".PHONY: affected\n");
+  fprintf(makeFile, "\n");
+
+  fprintf(makeFile, "%s: %s.c\n", AFFECTED_TOOL, AFFECTED_TOOL);
+  fprintf(makeFile, "\t$(CC) -O2 -o $@ %s.c\n", AFFECTED_TOOL);
+  fprintf(makeFile, "\n");
+
+  fprintf(makeFile, "affected: %s\n", AFFECTED_TOOL);
+  fprintf(makeFile, "\t@if [ -z \"$(BASE)\" ]; then "
+                    "echo \"Usage: make affected BASE=<rev>\"; exit 1; fi\n");
+  fprintf(makeFile, "\t@mkdir -p $(BUILD_DIR)\n");
+  fprintf(makeFile, "\t@git diff --name-only --relative $(BASE) "
+                    "> $(BUILD_DIR)/affected-changed.txt\n");
+  fprintf(makeFile, "\t@git ls-files --others --exclude-standard "
+                    "> $(BUILD_DIR)/affected-untracked.txt\n");
+  fprintf(makeFile, "\t@%s -c $(BUILD_DIR)/affected-changed.txt "
+                    "-u $(BUILD_DIR)/affected-untracked.txt \\\n"
+                    "\t  -g $(BUILD_DIR)/affected-goals.txt -e %s "
+                    "-o \"$(OBJECTS)\" -l \"$(LIB_OBJECTS)\"",
+          AFFECTED_TOOL, config->executableName);
+  if (config->tests.count > 0) {
+    fprintf(makeFile, " -t \"$(TEST_BINS)\"");
+  }
+  if (config->microbenches.count > 0) {
+    fprintf(makeFile, " -m \"$(MICROBENCH_BINS)\"");
+  }
+  fprintf(makeFile, "\n");
+  fprintf(makeFile, "\t@goals=$$(cat $(BUILD_DIR)/affected-goals.txt); "
+                    "[ -z \"$$goals\" ] || \\\n"
+                    "\t  $(MAKE) --no-print-directory -k $$goals\n");
+  fprintf(makeFile, "\n");
+}
+
+/**
+ * Prints the latency rules to the makefile. "latency" runs the command
+ * with a shared histogram for the program to record each operation's time
+ * into through latency.h. The histograms of every run are summed and their
+ * percentiles compared against the baseline, if there is one, failing when
+ * the tail grew by more than LATENCY_THRESHOLD percent. With
+ * LATENCY_INTERVAL set, the percentiles are also corrected for coordinated
+ * omission. "latency-baseline" measures afresh into the baseline.
+ */
+static void printLatencyRules(FILE *makeFile, MakeConfig *config) {
+  fprintf(makeFile, ".PHONY: latency latency-baseline\n");
+  fprintf(makeFile, "\n");
+
+  fprintf(makeFile, "%s: %s.c %s.h\n", LATENCY_TOOL, LATENCY_TOOL,
+          LATENCY_TOOL);
+  fprintf(makeFile, "\t$(CC) -O2 -o $@ %s.c\n", LATENCY_TOOL);
+  fprintf(makeFile, "\n");
+
+  fprintf(makeFile, "latency: all %s\n", LATENCY_TOOL);
+  fprintf(makeFile,
+          "\t%s -n $(LATENCY_RUNS) -w $(LATENCY_WARMUP) "
+          "-i $(LATENCY_INTERVAL) -t $(LATENCY_THRESHOLD) \\\n"
+          "\t  -b $(LATENCY_BASELINE) -o $(LATENCY_RESULTS) "
+          "'export EXE=./%s; $(LATENCY_CMD)'\n",
+          LATENCY_TOOL, config->executableName);
+  fprintf(makeFile, "\n");
+
+  // Storing a new baseline must not fail on a regression against the old.
+  fprintf(makeFile, "latency-baseline: all %s\n", LATENCY_TOOL);
+  fprintf(makeFile,
+          "\t%s -n $(LATENCY_RUNS) -w $(LATENCY_WARMUP) "
+          "-i $(LATENCY_INTERVAL) -o $(LATENCY_BASELINE) \\\n"
+          "\t  'export EXE=./%s; $(LATENCY_CMD)'\n",
+          LATENCY_TOOL, config->executableName);
+  fprintf(makeFile, "\n");
+}
+
+/**
+ * Prints the profiling rules to the makefile. "profile" builds a variant of
+ * the executable with debug information and frame pointers into
+ * PROFILE_DIR, so that its call stacks can be walked cheaply and its
+ * functions named. It is compiled one object per source, so that the
+ * object defining a function can be found.
+ *
+ * "flamegraph" samples the workload with perf record and renders the
+ * stacks with the shipped folding tool. Where perf is missing or not
+ * permitted, the fpsampler shim samples the stacks from inside the process
+ * instead.
+ *
+ * "heapprof" runs the workload with the heapprof shim interposing the
+ * allocation functions, and reports the busiest allocation sites and the
+ * peak heap over time. Only the executable is profiled, not the shell
+ * running the workload.
+ *
+ * "lockprof" does the same with the lockprof shim interposing the pthread
+ * mutex functions, and reports the locks with the most wait time.
+ *
+ * "ioprof" does the same with the ioprof shim interposing the file I/O
+ * functions, and reports the calls made, the bytes moved per file, the call
+ * sites making small transfers and how often data is synced. Where strace
+ * is installed, its count of every system call is added.
+ *
+ * "asm" disassembles the function named by FUNC from the profile object
+ * defining it, with its source interleaved. Once "flamegraph" has sampled
+ * the workload, each instruction shows its share of the function's samples.
+ *
+ * "opt-report" compiles every source again with the compiler's
+ * optimization remarks turned on, and summarizes the loops left scalar and
+ * the calls left in place. Once "flamegraph" has sampled the workload, the
+ * functions are ranked by their share of the samples.
+ */
+static void printProfileRules(FILE *makeFile, MakeConfig *config) {
+  bool amalgamate = config->hotSources.count > 0;
+  const char *run = "sh -c 'export EXE=$(PROFILE_EXE); $(WORKLOAD)'";
+
+  fprintf(makeFile,
+          ".PHONY: profile flamegraph heapprof lockprof ioprof opt-report asm "
+          "cachesim callgraph cachesim-baseline callgraph-baseline\n");
+  fprintf(makeFile, "\n");
+
+  fprintf(makeFile, "profile: $(PROFILE_EXE)\n");
+  fprintf(makeFile, "\n");
+
+  fprintf(makeFile, "$(PROFILE_EXE): $(PROFILE_OBJECTS)\n");
+  fprintf(makeFile,
+          "\t$(CC) $(CFLAGS) $(PROFILE_CFLAGS) -o $@ $(PROFILE_OBJECTS)%s\n",
+          linkLibs(config));
+  fprintf(makeFile, "\n");
+
+  fprintf(makeFile, "$(PROFILE_DIR)/%%.o: %%.c\n");
+  fprintf(makeFile, "\t@mkdir -p $(@D)\n");
+  fprintf(makeFile,
+          "\t$(CC) $(CFLAGS) $(PROFILE_CFLAGS) -MMD -MP -c -o $@ $<\n");
+  fprintf(makeFile, "\n");
+
+  // The hot sources keep their own flags in the profile build too.
+  if (amalgamate) {
+    fprintf(makeFile, "$(PROFILE_DIR)/%s.o: %s.c $(HOT_TARGETS)\n",
+            AMALGAMATION_NAME, AMALGAMATION_NAME);
+    fprintf(makeFile, "\t@mkdir -p $(@D)\n");
+    fprintf(makeFile,
+            "\t$(CC) $(CFLAGS) $(PROFILE_CFLAGS) $(HOT_CFLAGS) -MMD -MP -c -o $@ "
+            "%s.c\n",
+            AMALGAMATION_NAME);
+    fprintf(makeFile, "\n");
+  }
+
+  fprintf(makeFile, "-include $(PROFILE_OBJECTS:.o=.d)\n");
+  fprintf(makeFile, "\n");
+
+  fprintf(makeFile, "%s/flamegraph: %s/flamegraph.c\n", SUPPORT_DIR,
+          SUPPORT_DIR);
+  fprintf(makeFile, "\t$(CC) -O2 -o $@ %s/flamegraph.c\n", SUPPORT_DIR);
+  fprintf(makeFile, "\n");
+
+  // The shims walk their own frames to find call sites, so they keep
+  // their frame pointers too.
+  const char *shims[] = {"fpsampler", "heapprof", "lockprof", "ioprof",
+                         NULL};
+  for (int i = 0; shims[i] != NULL; i++) {
+    fprintf(makeFile, "%s/%s.so: %s/%s.c %s/stacks.h\n", SUPPORT_DIR,
+            shims[i], SUPPORT_DIR, shims[i], SUPPORT_DIR);
+    fprintf(makeFile,
+            "\t$(CC) -O2 -fno-omit-frame-pointer -shared -fPIC -o $@ "
+            "%s/%s.c -ldl -lpthread\n",
+            SUPPORT_DIR, shims[i]);
+    fprintf(makeFile, "\n");
+  }
+
+  fprintf(makeFile, "flamegraph: profile %s/flamegraph %s/fpsampler.so\n",
+          SUPPORT_DIR, SUPPORT_DIR);
+  fprintf(makeFile, "\t@rm -f $(PROFILE_DIR)/stacks.txt\n");
+  fprintf(makeFile,
+          "\t@if command -v perf > /dev/null 2>&1 && "
+          "perf record -q -F $(PERF_FREQUENCY) -g "
+          "-o $(PROFILE_DIR)/perf.data -- %s; then \\\n"
+          "\t  perf script -i $(PROFILE_DIR)/perf.data "
+          "> $(PROFILE_DIR)/stacks.txt; \\\n"
+          "\telse \\\n"
+          "\t  echo \"perf is unavailable, sampling frame pointers "
+          "instead\"; \\\n"
+          "\t  FPSAMPLER_OUTPUT=$(CURDIR)/$(PROFILE_DIR)/stacks.txt "
+          "LD_PRELOAD=$(CURDIR)/%s/fpsampler.so %s; \\\n"
+          "\tfi\n",
+          run, SUPPORT_DIR, run);
+  fprintf(makeFile,
+          "\t%s/flamegraph fold < $(PROFILE_DIR)/stacks.txt "
+          "> $(PROFILE_DIR)/folded.txt\n",
+          SUPPORT_DIR);
+  fprintf(makeFile,
+          "\t%s/flamegraph svg %s < $(PROFILE_DIR)/folded.txt "
+          "> $(FLAMEGRAPH)\n",
+          SUPPORT_DIR, config->executableName);
+  fprintf(makeFile, "\t@echo \"Wrote $(FLAMEGRAPH)\"\n");
+  fprintf(makeFile, "\n");
+
+  fprintf(makeFile, "heapprof: profile %s/heapprof.so\n", SUPPORT_DIR);
+  fprintf(makeFile, "\t@rm -f $(HEAPPROF)\n");
+  fprintf(makeFile,
+          "\tHEAPPROF_OUTPUT=$(CURDIR)/$(HEAPPROF) HEAPPROF_PROGRAM=%s "
+          "LD_PRELOAD=$(CURDIR)/%s/heapprof.so %s\n",
+          config->executableName, SUPPORT_DIR, run);
+  fprintf(makeFile, "\t@cat $(HEAPPROF)\n");
+  fprintf(makeFile, "\n");
+
+  fprintf(makeFile, "lockprof: profile %s/lockprof.so\n", SUPPORT_DIR);
+  fprintf(makeFile, "\t@rm -f $(LOCKPROF)\n");
+  fprintf(makeFile,
+          "\tLOCKPROF_OUTPUT=$(CURDIR)/$(LOCKPROF) LOCKPROF_PROGRAM=%s "
+          "LD_PRELOAD=$(CURDIR)/%s/lockprof.so %s\n",
+          config->executableName, SUPPORT_DIR, run);
+  fprintf(makeFile, "\t@cat $(LOCKPROF)\n");
+  fprintf(makeFile, "\n");
+
+  // strace also sees the calls stdio makes from inside the C library, and
+  // those of the shell running the workload.
+  fprintf(makeFile, "ioprof: profile %s/ioprof.so\n", SUPPORT_DIR);
+  fprintf(makeFile, "\t@rm -f $(IOPROF)\n");
+  fprintf(makeFile,
+          "\tIOPROF_OUTPUT=$(CURDIR)/$(IOPROF) IOPROF_PROGRAM=%s "
+          "LD_PRELOAD=$(CURDIR)/%s/ioprof.so %s\n",
+          config->executableName, SUPPORT_DIR, run);
+  fprintf(makeFile,
+          "\t@if command -v strace > /dev/null 2>&1; then \\\n"
+          "\t  strace -c -f -o $(PROFILE_DIR)/strace.txt %s > /dev/null; "
+          "\\\n"
+          "\t  echo \"All system calls, from strace -c -f:\" >> $(IOPROF); "
+          "\\\n"
+          "\t  cat $(PROFILE_DIR)/strace.txt >> $(IOPROF); \\\n"
+          "\tfi\n",
+          run);
+  fprintf(makeFile, "\t@cat $(IOPROF)\n");
+  fprintf(makeFile, "\n");
+
+  fprintf(makeFile, "%s/cgreport: %s/cgreport.c\n", SUPPORT_DIR,
+          SUPPORT_DIR);
+  fprintf(makeFile, "\t$(CC) -O2 -o $@ %s/cgreport.c\n", SUPPORT_DIR);
+  fprintf(makeFile, "\n");
+
+  // Valgrind wraps the executable rather than the shell running the
+  // workload. Each run writes its own file, and the counts are summed.
+  const char *simulations[][4] = {
+      {"cachesim", "CACHESIM", "cachegrind", "--cache-sim=yes "},
+      {"callgraph", "CALLGRAPH", "callgrind", ""}};
+  for (int i = 0; i < 2; i++) {
+    const char *target = simulations[i][0], *variable = simulations[i][1],
+               *tool = simulations[i][2], *options = simulations[i][3];
+    fprintf(makeFile, "%s: profile %s/cgreport\n", target, SUPPORT_DIR);
+    fprintf(makeFile, "\t@command -v valgrind > /dev/null || "
+                      "{ echo \"valgrind is not installed\"; exit 1; }\n");
+    fprintf(makeFile, "\t@rm -f $(PROFILE_DIR)/%s.out.*\n", tool);
+    fprintf(makeFile,
+            "\tsh -c 'export EXE=\"valgrind -q --tool=%s %s"
+            "--%s-out-file=$(CURDIR)/$(PROFILE_DIR)/%s.out.%%p "
+            "$(PROFILE_EXE)\"; $(WORKLOAD)'\n",
+            tool, options, tool, tool);
+    fprintf(makeFile,
+            "\t%s/cgreport summarize $(%s) $(PROFILE_DIR)/%s.out.*\n",
+            SUPPORT_DIR, variable, tool);
+    fprintf(makeFile,
+            "\t@if [ -f $(%s_BASELINE) ]; then \\\n"
+            "\t  %s/cgreport diff -t $(CG_TOLERANCE) $(%s_BASELINE) $(%s); "
+            "\\\n"
+            "\telse \\\n"
+            "\t  cp $(%s) $(%s_BASELINE); \\\n"
+            "\t  echo \"Stored $(%s_BASELINE) as the baseline\"; \\\n"
+            "\tfi\n",
+            variable, SUPPORT_DIR, variable, variable, variable, variable,
+            variable);
+    fprintf(makeFile, "\n");
+
+    fprintf(makeFile, "%s-baseline:\n", target);
+    fprintf(makeFile, "\tcp $(%s) $(%s_BASELINE)\n", variable, variable);
+    fprintf(makeFile, "\n");
+  }
+
+  // Only the innermost frame of each sample counts towards an instruction.
+  fprintf(makeFile, "asm: profile %s/flamegraph\n", SUPPORT_DIR);
+  fprintf(makeFile, "\t@if [ -z \"$(FUNC)\" ]; then "
+                    "echo \"Usage: make asm FUNC=<function>\"; exit 1; fi\n");
+  fprintf(makeFile,
+          "\t@object=$$(for o in $(PROFILE_OBJECTS); do \\\n"
+          "\t  if nm --defined-only $$o 2>/dev/null | "
+          "grep -q ' [TtWw] $(FUNC)$$'; then \\\n"
+          "\t    echo $$o; break; \\\n"
+          "\t  fi; \\\n"
+          "\tdone); \\\n"
+          "\tif [ -z \"$$object\" ]; then "
+          "echo \"No object defines $(FUNC)\"; exit 1; fi; \\\n"
+          "\techo \"$(FUNC) is defined in $$object\"; \\\n"
+          "\tobjdump -d -S -l --no-show-raw-insn --disassemble=$(FUNC) "
+          "$$object | \\\n"
+          "\t  %s/flamegraph annotate $(FUNC) $(PROFILE_DIR)/stacks.txt\n",
+          SUPPORT_DIR);
+  fprintf(makeFile, "\n");
+
+  fprintf(makeFile, "%s/optreport: %s/optreport.c\n", SUPPORT_DIR,
+          SUPPORT_DIR);
+  fprintf(makeFile, "\t$(CC) -O2 -o $@ %s/optreport.c\n", SUPPORT_DIR);
+  fprintf(makeFile, "\n");
+
+  // GCC prints its remarks, while Clang writes a record next to each
+  // object. Either way the objects themselves are thrown away.
+  fprintf(makeFile, "opt-report: %s/optreport%s\n", SUPPORT_DIR,
+          amalgamate ? " " AMALGAMATION_NAME ".c" : "");
+  fprintf(makeFile, "\t@rm -rf $(OPT_REPORT_DIR) && "
+                    "mkdir -p $(OPT_REPORT_DIR)\n");
+  fprintf(makeFile,
+          "\t@if $(CC) --version 2>/dev/null | grep -q clang; then \\\n"
+          "\t  remarks=\"-Rpass-missed=loop-vectorize "
+          "-fsave-optimization-record\"; format=-c; \\\n"
+          "\telse \\\n"
+          "\t  remarks=\"-fopt-info-vec-all -fopt-info-inline-missed\"; "
+          "format=-g; \\\n"
+          "\tfi; \\\n"
+          "\tfor source in $(TARGETS); do \\\n"
+          "\t  $(CC) $(CFLAGS) $$remarks -c "
+          "-o $(OPT_REPORT_DIR)/$$(echo $$source | tr / _ | sed 's/c$$/o/') "
+          "\\\n"
+          "\t    $$source 2>> $(OPT_REPORT_DIR)/remarks.txt || exit 1; "
+          "\\\n"
+          "\tdone; \\\n");
+  if (amalgamate) {
+    fprintf(makeFile,
+            "\t$(CC) $(CFLAGS) $(HOT_CFLAGS) $$remarks -c "
+            "-o $(OPT_REPORT_DIR)/%s.o %s.c \\\n"
+            "\t  2>> $(OPT_REPORT_DIR)/remarks.txt || exit 1; \\\n",
+            AMALGAMATION_NAME, AMALGAMATION_NAME);
+  }
+  fprintf(makeFile,
+          "\tif [ $$format = -c ]; then \\\n"
+          "\t  %s/optreport -c -p \"$(OPT_PROFILE)\" "
+          "$(OPT_REPORT_DIR)/*.opt.yaml; \\\n"
+          "\telse \\\n"
+          "\t  %s/optreport -g -p \"$(OPT_PROFILE)\" "
+          "$(OPT_REPORT_DIR)/remarks.txt; \\\n"
+          "\tfi\n",
+          SUPPORT_DIR, SUPPORT_DIR);
+  fprintf(makeFile, "\n");
+}
+
+/**
+ * Prints the allocator comparison rules to the makefile. Each allocator
+ * gets its own build of the executable under ALLOCATOR_DIR, which differs
+ * only in what it links against. "allocator-bench" then runs the benchmark
+ * command against every build in interleaved rounds. The table shows the
+ * throughput and peak RSS of each.
+ */
+static void printAllocatorRules(FILE *makeFile, MakeConfig *config) {
+  char *executableName = config->executableName;
+
+  fprintf(makeFile, ".PHONY: allocator-bench\n");
+  fprintf(makeFile, "\n");
+
+  // Per-object builds relink the same objects; otherwise every build
+  // compiles the sources again.
+  fprintf(makeFile, "$(ALLOCATOR_DIR)/%%/%s: ", executableName);
+  if (config->perObject) {
+    fprintf(makeFile, "$(OBJECTS)\n");
+  } else if (config->hotSources.count > 0) {
+    fprintf(makeFile, "$(TARGETS) %s.o\n", AMALGAMATION_NAME);
+  } else {
+    fprintf(makeFile, "$(TARGETS)\n");
+  }
+  fprintf(makeFile, "\t@mkdir -p $(@D)\n");
+  fprintf(makeFile, "\t$(CC) $(CFLAGS) -o $@ %s $(ALLOCATOR_LIBS_$*)\n",
+          config->perObject ? "$(OBJECTS)" : "$^");
+  fprintf(makeFile, "\n");
+
+  fprintf(makeFile,
+          "allocator-bench: $(ALLOCATORS:%%=$(ALLOCATOR_DIR)/%%/%s) %s\n",
+          executableName, BENCH_TOOL);
+  fprintf(makeFile,
+          "\t%s -n $(BENCH_RUNS) -w $(BENCH_WARMUP) -c $(BENCH_CPU) "
+          "-o $(ALLOCATOR_DIR)/results.json -- \\\n"
+          "\t  $(foreach a,$(ALLOCATORS),"
+          "'$(a)' 'export EXE=$(ALLOCATOR_DIR)/$(a)/%s; $(BENCH_CMD)')\n",
+          BENCH_TOOL, executableName);
+  fprintf(makeFile, "\n");
+}
+
+/**
+ * Alerts the user that the makefile was succesfully created.
+ */
+static void alertSuccess() { printf("Successfully created makefile.\n"); }
+
+/**
+ * Finds the link flags of the requested allocators. The system allocator is
+ * always included, so the others can be compared against it. The first
+ * requested allocator that is installed becomes the one linked into the
+ * executable. When none is installed, no allocators are configured.
+ * @param config The invocation configuration.
+ * @param requested The allocator names.
+ */
+static void selectAllocators(MakeConfig *config, ArgList requested) {
+  config->allocators.items = malloc(sizeof(char *) * (requested.count + 1));
+  config->allocatorLibs = malloc(sizeof(char *) * (requested.count + 1));
+  config->allocators.items[0] = SYSTEM_ALLOCATOR;
+  config->allocatorLibs[0] = "";
+  config->allocators.count = 1;
+  config->allocator = -1;
+
+  for (int i = 0; i < requested.count; i++) {
+    char *name = requested.items[i];
+    char *libs =
+        strcmp(name, SYSTEM_ALLOCATOR) == 0 ? "" : findAllocator(config, name);
+    if (libs == NULL) {
+      printf("Allocator \"%s\" is not installed, skipping it.\n", name);
+      continue;
+    }
+
+    int index = 0;
+    while (index < config->allocators.count &&
+           strcmp(config->allocators.items[index], name) != 0) {
+      index++;
+    }
+    if (index == config->allocators.count) {
+      config->allocators.items[index] = name;
+      config->allocatorLibs[index] = libs;
+      config->allocators.count++;
+    }
+    if (config->allocator == -1) {
+      config->allocator = index;
+    }
+  }
+
+  // With only the system allocator there is nothing to switch to or
+  // compare against.
+  if (config->allocators.count == 1) {
+    printf("Warning: none of the requested allocators are installed, so "
+           "there are no allocator rules.\n");
+    config->allocators.count = 0;
+    return;
+  }
+  if (config->allocator == -1) {
+    printf("Linking against the system allocator.\n");
+    config->allocator = 0;
+  }
+}
+
+/**
+ * Finds the link flags for an allocator library. pkg-config is asked
+ * first. Failing that, the library is looked for where the compiler looks
+ * for libraries, then in /usr/local/lib.
+ * @param config The invocation configuration.
+ * @param name The allocator, such as jemalloc or mimalloc.
+ * @return The link flags, or NULL if the allocator is not installed.
+ */
+static char *findAllocator(MakeConfig *config, const char *name) {
+  char command[MAX_LINE_LENGTH], flags[MAX_LINE_LENGTH];
+
+  // tcmalloc's pkg-config module is named after its library.
+  const char *module = strcmp(name, "tcmalloc") == 0 ? "libtcmalloc" : name;
+  snprintf(command, sizeof(command), "pkg-config --libs '%s' 2>/dev/null",
+           module);
+  char *libs = readCommandOutput(command);
+  if (libs != NULL && libs[0] != '\0') {
+    return libs;
+  }
+
+  snprintf(command, sizeof(command), "%s -print-file-name=lib%s.so",
+           config->compiler, name);
+  char *path = readCommandOutput(command);
+  if (path != NULL && strchr(path, '/') != NULL) {
+    snprintf(flags, sizeof(flags), "-l%s", name);
+    return strdup(flags);
+  }
+
+  snprintf(flags, sizeof(flags), "/usr/local/lib/lib%s.so", name);
+  if (access(flags, R_OK) == 0) {
+    snprintf(flags, sizeof(flags),
+             "-L/usr/local/lib -Wl,-rpath,/usr/local/lib -l%s", name);
+    return strdup(flags);
+  }
+  return NULL;
+}
+
+/**
+ * Runs a shell command and reads the first line it prints.
+ * @param command The command to run.
+ * @return The line without its newline, or NULL if the command failed.
+ */
+static char *readCommandOutput(const char *command) {
+  FILE *output = popen(command, "r");
+  if (output == NULL) {
+    return NULL;
+  }
+
+  char line[MAX_LINE_LENGTH] = "";
+  if (fgets(line, sizeof(line), output) == NULL) {
+    line[0] = '\0';
+  }
+  int status = pclose(output);
+  if (status != 0) {
+    return NULL;
+  }
+
+  // Drop the newline and any trailing spaces.
+  size_t length = strlen(line);
+  while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == ' ')) {
+    line[--length] = '\0';
+  }
+  return strdup(line);
+}
+
+/**
+ * Gets what to append to a link line so it links the selected allocator or
+ * the libraries of an imported makefile.
+ */
+static const char *linkLibs(MakeConfig *config) {
+  return config->allocators.count > 0 || config->linkFlags != NULL
+             ? " $(LDLIBS)"
+             : "";
+}
+
+/**
+ * Reads the sources and flags of a per-object build from a compilation
+ * database, as written by CMake, Bear and others. Each C file is kept once,
+ * the flags every file shares become the CFLAGS and the rest stay with
+ * their file.
+ * @param config The invocation configuration to fill in.
+ * @param path The compilation database.
+ * @return True if any sources were imported, false otherwise.
+ */
+static bool importCompileCommands(MakeConfig *config, const char *path) {
+  char *contents = readWholeFile(path);
+  if (contents == NULL) {
+    printf("Unable to read %s.\n", path);
+    return false;
+  }
+
+  // Walk the array of entries, keeping the fields that matter.
+  ArgList *flagLists = NULL;
+  const char *cursor = contents + strspn(contents, " \t\r\n");
+  bool valid = *cursor++ == '[';
+  int skipped = 0;
+  while (valid) {
+    cursor += strspn(cursor, " \t\r\n,");
+    if (*cursor == ']') {
+      break;
+    }
+    valid = *cursor++ == '{';
+    char *directory = NULL, *file = NULL, *command = NULL;
+    ArgList args = {0};
+    while (valid) {
+      cursor += strspn(cursor, " \t\r\n,");
+      if (*cursor == '}') {
+        cursor++;
+        break;
+      }
+      char *key = parseJsonString(&cursor);
+      cursor += strspn(cursor, " \t\r\n");
+      valid = key != NULL && *cursor++ == ':';
+      cursor += strspn(cursor, " \t\r\n");
+      if (!valid) {
+        break;
+      }
+      if (strcmp(key, "arguments") == 0 && *cursor == '[') {
+        cursor++;
+        while (valid) {
+          cursor += strspn(cursor, " \t\r\n,");
+          if (*cursor == ']') {
+            cursor++;
+            break;
+          }
+          char *arg = parseJsonString(&cursor);
+          valid = arg != NULL;
+          if (valid) {
+            appendToList(&args, arg);
+          }
+        }
+      } else if (strcmp(key, "directory") == 0) {
+        valid = (directory = parseJsonString(&cursor)) != NULL;
+      } else if (strcmp(key, "file") == 0) {
+        valid = (file = parseJsonString(&cursor)) != NULL;
+      } else if (strcmp(key, "command") == 0) {
+        valid = (command = parseJsonString(&cursor)) != NULL;
+      } else {
+        valid = skipJsonValue(&cursor);
+      }
+      free(key);
+    }
+    if (valid && args.count == 0 && command != NULL) {
+      args = splitCommand(command);
+    }
+    if (valid && (file == NULL || args.count == 0 ||
+                  !addCompileCommand(config, &flagLists, directory, args,
+                                     file))) {
+      skipped++;
+    }
+  }
+  free(contents);
+
+  if (!valid) {
+    printf("Unable to import %s: it is not a compilation database.\n", path);
+    return false;
+  }
+  if (config->sources.count == 0) {
+    printf("Unable to import %s: it compiles no C files.\n", path);
+    return false;
+  }
+  if (skipped > 0) {
+    printf("Skipped %d entries that were not C files or repeated a file.\n",
+           skipped);
+  }
+
+  // The objects go under makeGen's own directory, since the database
+  // usually sits in the other build system's build directory, which
+  // "make clean" must not remove.
+  factorFlags(config, flagLists);
+  config->perObject = true;
+  config->buildDir = IMPORT_BUILD_DIR;
+  config->mainSource = findMainSource(config);
+
+  int overridden = 0;
+  for (int i = 0; i < config->sources.count; i++) {
+    overridden += config->sourceFlags[i] != NULL;
+  }
+  printf("Imported %d sources compiled by %s, with %d shared flags and %d "
+         "sources keeping flags of their own.\n",
+         config->sources.count, config->compiler, config->cflags.count,
+         overridden);
+  return true;
+}
+
+/**
+ * Adds one entry of a compilation database to the imported sources. The
+ * flags that only name the output, the dependency file or the language are
+ * dropped, and paths are made relative to the current directory, since the
+ * makefile only compiles C and names its own outputs. An option that takes
+ * its value as the next word is kept together with it as one flag, so that
+ * repeated flags are dropped and shared flags factored out whole.
+ * @param config The invocation configuration.
+ * @param flagLists The flags of each source so far, grown to match.
+ * @param directory The directory the command ran in, or NULL.
+ * @param args The command, starting with the compiler.
+ * @param file The file the command compiles.
+ * @return True if the entry was a C file not seen before, false otherwise.
+ */
+static bool addCompileCommand(MakeConfig *config, ArgList **flagLists,
+                              const char *directory, ArgList args,
+                              const char *file) {
+  static const char *const PATH_FLAGS[] = {
+      "-I",       "-isystem", "-iquote",   "-idirafter",
+      "-include", "-imacros", "-isysroot", NULL};
+  static const char *const SKIPPED_WITH_VALUE[] = {"-o",  "-MF", "-MT", "-MQ",
+                                                   "-MJ", "-x",  NULL};
+  static const char *const WITH_VALUE[] = {
+      "-Xclang", "-Xpreprocessor", "-Xassembler", "-Xlinker",
+      "-mllvm",  "-arch",          "-target",     "--param", NULL};
+  static const char *const SKIPPED[] = {"-c", "-MD", "-MMD", "-MP", NULL};
+
+  char *source = rebasePath(directory, file);
+  size_t length = strlen(source);
+  if (length < 3 || strcmp(source + length - 2, ".c") != 0 ||
+      listContains(config->sources, source)) {
+    free(source);
+    return false;
+  }
+
+  ArgList flags = {0};
+  for (int i = 1; i < args.count; i++) {
+    char *arg = args.items[i];
+    char *value = i + 1 < args.count ? args.items[i + 1] : NULL;
+    char flag[MAX_LINE_LENGTH];
+    bool skip = false;
+    for (int f = 0; SKIPPED_WITH_VALUE[f] != NULL && !skip; f++) {
+      size_t flagLength = strlen(SKIPPED_WITH_VALUE[f]);
+      if (strncmp(arg, SKIPPED_WITH_VALUE[f], flagLength) == 0) {
+        skip = true;
+        i += arg[flagLength] == '\0';
+      }
+    }
+    for (int f = 0; SKIPPED[f] != NULL; f++) {
+      skip = skip || strcmp(arg, SKIPPED[f]) == 0;
+    }
+    bool takesValue = false;
+    for (int f = 0; WITH_VALUE[f] != NULL; f++) {
+      takesValue = takesValue || strcmp(arg, WITH_VALUE[f]) == 0;
+    }
+    if (skip) {
+      continue;
+    }
+
+    // The source itself is named on the command.
+    if (arg[0] != '-') {
+      char *path = rebasePath(directory, arg);
+      bool isSource = strcmp(path, source) == 0;
+      free(path);
+      if (isSource) {
+        continue;
+      }
+    }
+
+    // Paths given to include flags are relative to the command's directory.
+    // A file to include that is not there is looked for on the include path,
+    // so it is left as it is.
+    const char *pathFlag = NULL;
+    for (int f = 0; PATH_FLAGS[f] != NULL && pathFlag == NULL; f++) {
+      if (strncmp(arg, PATH_FLAGS[f], strlen(PATH_FLAGS[f])) == 0) {
+        pathFlag = PATH_FLAGS[f];
+      }
+    }
+    if (pathFlag != NULL) {
+      const char *path = arg + strlen(pathFlag);
+      if (*path == '\0' && value != NULL) {
+        path = value;
+        i++;
+      }
+      bool searched = (strcmp(pathFlag, "-include") == 0 ||
+                       strcmp(pathFlag, "-imacros") == 0) &&
+                      !existsInDirectory(directory, path);
+      char *rebased = searched ? strdup(path) : rebasePath(directory, path);
+      char *quoted = quoteFlag(rebased);
+      snprintf(flag, sizeof(flag), "%s%s%s", pathFlag,
+               strcmp(pathFlag, "-I") == 0 ? "" : " ", quoted);
+      free(rebased);
+      free(quoted);
+    } else if ((strcmp(arg, "-D") == 0 || strcmp(arg, "-U") == 0) &&
+               value != NULL) {
+      char *quoted = quoteFlag(value);
+      snprintf(flag, sizeof(flag), "%s%s", arg, quoted);
+      free(quoted);
+      i++;
+    } else if (takesValue && value != NULL) {
+      char *quotedArg = quoteFlag(arg), *quoted = quoteFlag(value);
+      snprintf(flag, sizeof(flag), "%s %s", quotedArg, quoted);
+      free(quotedArg);
+      free(quoted);
+      i++;
+    } else {
+      char *quoted = quoteFlag(arg);
+      snprintf(flag, sizeof(flag), "%s", quoted);
+      free(quoted);
+    }
+
+    // Repeated flags are kept once.
+    if (!listContains(flags, flag)) {
+      appendToList(&flags, strdup(flag));
+    }
+  }
+
+  if (config->compiler == NULL) {
+    config->compiler = strdup(args.items[0]);
+  } else if (strcmp(config->compiler, args.items[0]) != 0) {
+    printf("Note: %s is compiled by %s, but %s is used for every source.\n",
+           source, args.items[0], config->compiler);
+  }
+  appendToList(&config->sources, source);
+  *flagLists = realloc(*flagLists, sizeof(ArgList) * config->sources.count);
+  (*flagLists)[config->sources.count - 1] = flags;
+  return true;
+}
+
+/**
+ * Splits the imported flags into the CFLAGS every source shares, in the
+ * order the first source gives them, and the flags each source adds.
+ * @param config The invocation configuration.
+ * @param flagLists The flags of each source.
+ */
+static void factorFlags(MakeConfig *config, ArgList *flagLists) {
+  int count = config->sources.count;
+  ArgList common = {0};
+  for (int f = 0; f < flagLists[0].count; f++) {
+    bool shared = true;
+    for (int i = 1; i < count && shared; i++) {
+      shared = listContains(flagLists[i], flagLists[0].items[f]);
+    }
+    if (shared) {
+      appendToList(&common, flagLists[0].items[f]);
+    }
+  }
+  config->cflags = common;
+
+  config->sourceFlags = calloc(count, sizeof(char *));
+  for (int i = 0; i < count; i++) {
+    char own[MAX_LINE_LENGTH] = "";
+    size_t used = 0;
+    for (int f = 0; f < flagLists[i].count && used < sizeof(own); f++) {
+      if (!listContains(common, flagLists[i].items[f])) {
+        used += snprintf(own + used, sizeof(own) - used, "%s%s",
+                         used > 0 ? " " : "", flagLists[i].items[f]);
+      }
+    }
+    if (used > 0) {
+      config->sourceFlags[i] = strdup(own);
+    }
+  }
+}
+
+/**
+ * Reads a whole file into memory.
+ * @return The contents, or NULL if the file could not be read.
+ */
+static char *readWholeFile(const char *path) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    return NULL;
+  }
+  char *contents = NULL;
+  size_t length = 0, capacity = 0, got;
+  do {
+    if (length + MAX_LINE_LENGTH + 1 > capacity) {
+      capacity = 2 * capacity + MAX_LINE_LENGTH + 1;
+      contents = realloc(contents, capacity);
+    }
+    got = fread(contents + length, 1, MAX_LINE_LENGTH, file);
+    length += got;
+  } while (got > 0);
+  fclose(file);
+  contents[length] = '\0';
+  return contents;
+}
+
+/**
+ * Parses a JSON string, leaving the cursor after it.
+ * @return The unescaped string, or NULL if the cursor is not at one.
+ */
+static char *parseJsonString(const char **cursor) {
+  const char *c = *cursor;
+  if (*c++ != '"') {
+    return NULL;
+  }
+
+  // Find the closing quote first, since the unescaped string is no longer
+  // than the escaped one.
+  const char *end = c;
+  while (*end != '"') {
+    if (*end == '\0' || (*end == '\\' && *++end == '\0')) {
+      return NULL;
+    }
+    end++;
+  }
+
+  char *text = malloc(end - c + 1);
+  size_t length = 0;
+  while (c < end) {
+    if (*c != '\\') {
+      text[length++] = *c++;
+      continue;
+    }
+    c++;
+    switch (*c) {
+    case 'n':
+      text[length++] = '\n';
+      break;
+    case 't':
+      text[length++] = '\t';
+      break;
+    case 'r':
+      text[length++] = '\r';
+      break;
+    case 'b':
+      text[length++] = '\b';
+      break;
+    case 'f':
+      text[length++] = '\f';
+      break;
+    case 'u': {
+      // Paths and flags are ASCII, so wider characters become '?'.
+      unsigned int code = 0;
+      if (end - c < 5 || !isxdigit((unsigned char)c[1]) ||
+          !isxdigit((unsigned char)c[2]) || !isxdigit((unsigned char)c[3]) ||
+          !isxdigit((unsigned char)c[4]) ||
+          sscanf(c + 1, "%4x", &code) != 1) {
+        free(text);
+        return NULL;
+      }
+      text[length++] = code < 0x80 ? (char)code : '?';
+      c += 4;
+      break;
+    }
+    default:
+      text[length++] = *c;
+    }
+    c++;
+  }
+  text[length] = '\0';
+  *cursor = c + 1;
+  return text;
+}
+
+/**
+ * Skips a JSON value of any kind, leaving the cursor after it.
+ * @return True if a value was skipped, false otherwise.
+ */
+static bool skipJsonValue(const char **cursor) {
+  if (**cursor == '"') {
+    char *text = parseJsonString(cursor);
+    free(text);
+    return text != NULL;
+  }
+  if (**cursor != '[' && **cursor != '{') {
+    size_t length = strcspn(*cursor, ",}] \t\r\n");
+    *cursor += length;
+    return length > 0;
+  }
+
+  // Skip nested arrays and objects by depth, stepping over strings.
+  int depth = 0;
+  do {
+    if (**cursor == '"') {
+      char *text = parseJsonString(cursor);
+      free(text);
+      if (text == NULL) {
+        return false;
+      }
+      continue;
+    }
+    if (**cursor == '\0') {
+      return false;
+    }
+    if (**cursor == '[' || **cursor == '{') {
+      depth++;
+    } else if (**cursor == ']' || **cursor == '}') {
+      depth--;
+    }
+    (*cursor)++;
+  } while (depth > 0);
+  return true;
+}
+
+/**
+ * Splits a shell command into its words, removing quotes and backslashes
+ * the way the shell would.
+ */
+static ArgList splitCommand(const char *command) {
+  ArgList words = {0};
+  const char *c = command;
+  char *word = malloc(strlen(command) + 1);
+  while (true) {
+    c += strspn(c, " \t\r\n");
+    if (*c == '\0') {
+      break;
+    }
+    size_t length = 0;
+    char quote = '\0';
+    for (; *c != '\0' && (quote != '\0' || !isspace((unsigned char)*c));
+         c++) {
+      if (quote == '\0' && (*c == '\'' || *c == '"')) {
+        quote = *c;
+      } else if (quote != '\0' && *c == quote) {
+        quote = '\0';
+      } else if (*c == '\\' && quote != '\'' && c[1] != '\0') {
+        word[length++] = *++c;
+      } else {
+        word[length++] = *c;
+      }
+    }
+    word[length] = '\0';
+    appendToList(&words, strdup(word));
+  }
+  free(word);
+  return words;
+}
+
+/**
+ * Resolves a path given relative to a directory, and gives it relative to
+ * the current directory when it lies within it.
+ * @param directory The directory the path is relative to, or NULL.
+ * @param path The path.
+ * @return The rebased path.
+ */
+static char *rebasePath(const char *directory, const char *path) {
+  char joined[MAX_LINE_LENGTH], resolved[MAX_LINE_LENGTH], cwd[MAX_LINE_LENGTH];
+  if (path[0] == '/' || directory == NULL) {
+    snprintf(joined, sizeof(joined), "%s", path);
+  } else {
+    snprintf(joined, sizeof(joined), "%s/%s", directory, path);
+  }
+  const char *full = realpath(joined, resolved) != NULL ? resolved : joined;
+  if (getcwd(cwd, sizeof(cwd)) != NULL) {
+    size_t length = strlen(cwd);
+    if (strncmp(full, cwd, length) == 0 && full[length] == '/') {
+      return strdup(full + length + 1);
+    }
+    if (strcmp(full, cwd) == 0) {
+      return strdup(".");
+    }
+  }
+  return strdup(full);
+}
+
+/**
+ * Checks if a path names a file, taking a relative path from a directory.
+ * @param directory The directory, or NULL for the current directory.
+ * @param path The path to check.
+ * @return True if the file exists, false otherwise.
+ */
+static bool existsInDirectory(const char *directory, const char *path) {
+  char joined[MAX_LINE_LENGTH];
+  if (path[0] == '/' || directory == NULL) {
+    snprintf(joined, sizeof(joined), "%s", path);
+  } else {
+    snprintf(joined, sizeof(joined), "%s/%s", directory, path);
+  }
+  return access(joined, F_OK) == 0;
+}
+
+/**
+ * Quotes a flag for a makefile recipe, so that the shell passes it on as
+ * one word and make leaves any '$' alone.
+ */
+static char *quoteFlag(const char *flag) {
+  bool plain = flag[0] != '\0';
+  for (const char *c = flag; *c != '\0' && plain; c++) {
+    plain = isalnum((unsigned char)*c) || strchr("-_=+./,:@%", *c) != NULL;
+  }
+  if (plain) {
+    return strdup(flag);
+  }
+
+  char *quoted = malloc(4 * strlen(flag) + 3);
+  size_t length = 0;
+  quoted[length++] = '\'';
+  for (const char *c = flag; *c != '\0'; c++) {
+    if (*c == '\'') {
+      memcpy(quoted + length, "'\\''", 4);
+      length += 4;
+    } else if (*c == '$') {
+      memcpy(quoted + length, "$$", 2);
+      length += 2;
+    } else {
+      quoted[length++] = *c;
+    }
+  }
+  quoted[length++] = '\'';
+  quoted[length] = '\0';
+  return quoted;
+}
+
+/**
+ * Reads what the makefile in the current directory builds from a dry run of
+ * it with its database printed, make -pnB, and sets up a per-object build
+ * of the same program. Sub-makes are followed into their directories, so
+ * their sources are built by the one makefile. The serialization points
+ * that the per-object build does without are reported, and the old
+ * makefile is kept as Makefile.orig.
+ * @param config The invocation configuration to fill in.
+ * @param executableName The program to build, or NULL for the first one
+ *                       linked.
+ * @return True if the makefile was imported, false otherwise.
+ */
+static bool importMakeFile(MakeConfig *config, const char *executableName) {
+  if (!makeFileExists()) {
+    printf("Unable to import: there is no makefile in this directory.\n");
+    return false;
+  }
+  if (access(MAKEFILE_BACKUP, F_OK) != -1) {
+    printf("Unable to import: %s already exists.\n", MAKEFILE_BACKUP);
+    return false;
+  }
+  FILE *output = popen(MAKE_DRY_RUN, "r");
+  if (output == NULL) {
+    printf("Unable to import: make could not be run.\n");
+    return false;
+  }
+
+  char cwd[MAX_LINE_LENGTH];
+  if (getcwd(cwd, sizeof(cwd)) == NULL) {
+    pclose(output);
+    printf("Unable to import: the directory is unknown.\n");
+    return false;
+  }
+  char *directories[MAX_MAKE_DEPTH] = {cwd};
+  int depth = 0;
+  DryRun dryRun = {0};
+  ArgList removed = {0};
+  char *defaultGoal = NULL;
+  bool inDatabase = false;
+
+  // Join continued lines, then sort each into the database or the commands
+  // make would have run.
+  char *line = NULL, *logical = NULL;
+  size_t capacity = 0, logicalLength = 0;
+  ssize_t length;
+  while ((length = getline(&line, &capacity, output)) != -1) {
+    line[strcspn(line, "\n")] = '\0';
+    length = strlen(line);
+    bool continued = length > 0 && line[length - 1] == '\\';
+    logical = realloc(logical, logicalLength + length + 2);
+    memcpy(logical + logicalLength, line, length + 1);
+    logicalLength += continued ? length - 1 : length;
+    if (continued) {
+      logical[logicalLength++] = ' ';
+      continue;
+    }
+    logical[logicalLength] = '\0';
+    logicalLength = 0;
+
+    char *text = strncmp(logical, "# ", 2) == 0 ? logical + 2 : logical;
+    char *entering = strstr(text, "Entering directory '");
+    if (strncmp(logical, "# Make data base", 16) == 0) {
+      inDatabase = true;
+    } else if (strncmp(logical, "# Finished Make data base", 25) == 0) {
+      inDatabase = false;
+    } else if (entering != NULL && depth + 1 < MAX_MAKE_DEPTH) {
+      char *directory = strdup(entering + strlen("Entering directory '"));
+      directory[strcspn(directory, "'")] = '\0';
+      directories[++depth] = directory;
+      char note[MAX_LINE_LENGTH], *rebased = rebasePath(NULL, directory);
+      snprintf(note, sizeof(note),
+               "a recursive make into %s, which ran on its own", rebased);
+      appendToList(&removed, strdup(note));
+      free(rebased);
+    } else if (strstr(text, "Leaving directory '") != NULL) {
+      depth -= depth > 0;
+    } else if (inDatabase) {
+      char note[MAX_LINE_LENGTH], *rebased =
+                                      rebasePath(NULL, directories[depth]);
+      if (strncmp(logical, ".NOTPARALLEL:", 13) == 0) {
+        snprintf(note, sizeof(note), ".NOTPARALLEL in the makefile in %s",
+                 rebased);
+        appendToList(&removed, strdup(note));
+      } else if (strncmp(logical, ".DEFAULT_GOAL := ", 17) == 0) {
+        free(defaultGoal);
+        defaultGoal = strdup(logical + 17);
+      } else if (logical[0] != '#' && logical[0] != '\t' &&
+                 strstr(logical, " .WAIT") != NULL) {
+        snprintf(note, sizeof(note), ".WAIT in the rule %.*s in %s",
+                 (int)strcspn(logical, ":"), logical, rebased);
+        appendToList(&removed, strdup(note));
+      }
+      free(rebased);
+    } else if (logical[0] != '#' && logical[0] != '\0') {
+      readDryRunCommand(&dryRun, logical, directories[depth], &removed);
+    }
+  }
+  free(line);
+  free(logical);
+  if (pclose(output) != 0) {
+    printf("Unable to import: make -pnB failed on the makefile.\n");
+    return false;
+  }
+
+  // Build the program asked for, the default goal or else the first one
+  // linked.
+  BuildStep *link = NULL;
+  for (int i = 0; i < dryRun.linkCount; i++) {
+    char *name = dryRun.links[i].output;
+    char *base = strrchr(name, '/') != NULL ? strrchr(name, '/') + 1 : name;
+    const char *wanted =
+        executableName != NULL ? executableName : defaultGoal;
+    if (wanted != NULL &&
+        (strcmp(name, wanted) == 0 || strcmp(base, wanted) == 0)) {
+      link = &dryRun.links[i];
+      break;
+    }
+  }
+  if (link == NULL && executableName != NULL) {
+    printf("Unable to import: the makefile does not link %s.\n",
+           executableName);
+    return false;
+  }
+  if (link == NULL && dryRun.linkCount > 0) {
+    link = &dryRun.links[0];
+  }
+  if (link == NULL) {
+    printf("Unable to import: the makefile links no program.\n");
+    return false;
+  }
+
+  // Objects that went through an archive are linked directly.
+  ArgList linked = {0};
+  for (int i = 0; i < link->inputs.count; i++) {
+    char *input = link->inputs.items[i];
+    bool archived = false;
+    for (int a = 0; a < dryRun.archiveCount && !archived; a++) {
+      BuildStep *archive = &dryRun.archives[a];
+      if (strcmp(archive->output, input) == 0) {
+        archived = true;
+        for (int m = 0; m < archive->inputs.count; m++) {
+          appendToList(&linked, archive->inputs.items[m]);
+        }
+        char note[MAX_LINE_LENGTH];
+        snprintf(note, sizeof(note),
+                 "the archive %s, which had to be built before linking",
+                 input);
+        appendToList(&removed, strdup(note));
+      }
+    }
+    if (!archived) {
+      appendToList(&linked, input);
+    }
+  }
+
+  // Import the sources of the program's objects.
+  ArgList *flagLists = NULL;
+  int leftOut = 0;
+  for (int i = 0; i < dryRun.compileCount; i++) {
+    BuildStep *compile = &dryRun.compiles[i];
+    if (!listContains(linked, compile->output)) {
+      leftOut++;
+      continue;
+    }
+    addCompileCommand(config, &flagLists, compile->directory, compile->args,
+                      compile->source);
+  }
+  if (config->sources.count == 0) {
+    printf("Unable to import: no C sources are compiled into %s.\n",
+           link->output);
+    return false;
+  }
+  factorFlags(config, flagLists);
+  config->executableName = link->output;
+  config->linkFlags = link->linkFlags;
+  config->perObject = true;
+  config->buildDir = IMPORT_BUILD_DIR;
+  config->mainSource = findMainSource(config);
+
+  // Keep the old makefile for its other targets.
+  if (rename(MAKEFILE_NAME, MAKEFILE_BACKUP) != 0) {
+    printf("Unable to import: %s could not be renamed.\n", MAKEFILE_NAME);
+    return false;
+  }
+
+  printf("Imported %d sources of %s from %s, which is kept as %s.\n",
+         config->sources.count, config->executableName, MAKEFILE_NAME,
+         MAKEFILE_BACKUP);
+  if (leftOut > 0) {
+    printf("Left out %d compiled sources that %s does not link.\n",
+           leftOut, config->executableName);
+  }
+  if (removed.count == 0) {
+    printf("The makefile had no serialization points to remove.\n");
+  } else {
+    printf("Removed serialization points:\n");
+    for (int i = 0; i < removed.count; i++) {
+      printf("  %s\n", removed.items[i]);
+    }
+  }
+  if (dryRun.dependencyFlags == 0) {
+    printf("Headers were not tracked before; dependency files now are.\n");
+  }
+  return true;
+}
+
+/**
+ * Reads one command from a dry run. A command may be several joined by
+ * "&&" or ";" outside quotes, and a "cd" among them moves the later ones.
+ * @param dryRun The steps found so far.
+ * @param line The command line.
+ * @param directory The directory make ran it in.
+ * @param removed The serialization points found so far.
+ */
+static void readDryRunCommand(DryRun *dryRun, const char *line,
+                              const char *directory, ArgList *removed) {
+  char *commands = strdup(line), *current = strdup(directory);
+  char *segment = commands;
+  while (segment != NULL) {
+    // Find the next "&&" or ";" outside quotes, as the shell would.
+    char *next = NULL, quote = '\0';
+    for (char *c = segment; *c != '\0' && next == NULL; c++) {
+      if (*c == '\\' && quote != '\'' && c[1] != '\0') {
+        c++;
+      } else if (quote == '\0' && (*c == '\'' || *c == '"')) {
+        quote = *c;
+      } else if (quote != '\0' && *c == quote) {
+        quote = '\0';
+      } else if (quote == '\0' && (*c == ';' || strncmp(c, "&&", 2) == 0)) {
+        next = c + (*c == ';' ? 1 : 2);
+        *c = '\0';
+      }
+    }
+
+    ArgList args = splitCommand(segment);
+    if (args.count == 2 && strcmp(args.items[0], "cd") == 0) {
+      char path[MAX_LINE_LENGTH], resolved[MAX_LINE_LENGTH];
+      if (args.items[1][0] == '/') {
+        snprintf(path, sizeof(path), "%s", args.items[1]);
+      } else {
+        snprintf(path, sizeof(path), "%s/%s", current, args.items[1]);
+      }
+      free(current);
+      current = strdup(realpath(path, resolved) != NULL ? resolved : path);
+    } else if (args.count > 0) {
+      addBuildStep(dryRun, current, args, removed);
+    }
+    segment = next;
+  }
+  free(commands);
+  free(current);
+}
+
+/**
+ * Sorts a command from a dry run into a compile, archive or link step, and
+ * skips any other. A compiler run with -c compiles each C file it is given.
+ * Run without, it also links them, and objects and archives, into its
+ * output.
+ * @param dryRun The steps found so far.
+ * @param directory The directory the command ran in.
+ * @param args The command.
+ * @param removed The serialization points found so far.
+ */
+static void addBuildStep(DryRun *dryRun, const char *directory, ArgList args,
+                         ArgList *removed) {
+  char *program = strrchr(args.items[0], '/') != NULL
+                      ? strrchr(args.items[0], '/') + 1
+                      : args.items[0];
+
+  // An archive lists its members after the operation and its name.
+  if (strcmp(program, "ar") == 0 && args.count > 3) {
+    BuildStep archive = {0};
+    archive.output = rebasePath(directory, args.items[2]);
+    for (int i = 3; i < args.count; i++) {
+      appendToList(&archive.inputs, rebasePath(directory, args.items[i]));
+    }
+    appendStep(&dryRun->archives, &dryRun->archiveCount, archive);
+    return;
+  }
+  if (!looksLikeCompiler(program)) {
+    return;
+  }
+
+  // Split off the link flags and the files, keeping the rest for compiles.
+  ArgList flags = {0}, sources = {0}, inputs = {0};
+  char linkFlags[MAX_LINE_LENGTH] = "", *output = NULL;
+  size_t used = 0;
+  bool compileOnly = false;
+  appendToList(&flags, args.items[0]);
+  for (int i = 1; i < args.count; i++) {
+    char *arg = args.items[i];
+    size_t length = strlen(arg);
+    if (strcmp(arg, "-o") == 0 && i + 1 < args.count) {
+      output = args.items[++i];
+    } else if (strncmp(arg, "-l", 2) == 0 || strncmp(arg, "-L", 2) == 0 ||
+               strncmp(arg, "-Wl,", 4) == 0) {
+      char *quoted = quoteFlag(arg);
+      if (used < sizeof(linkFlags)) {
+        used += snprintf(linkFlags + used, sizeof(linkFlags) - used, "%s%s",
+                         used > 0 ? " " : "", quoted);
+      }
+      free(quoted);
+    } else if (arg[0] != '-' && length > 2 &&
+               strcmp(arg + length - 2, ".c") == 0) {
+      appendToList(&sources, arg);
+    } else if (arg[0] != '-' && length > 2 &&
+               (strcmp(arg + length - 2, ".o") == 0 ||
+                strcmp(arg + length - 2, ".a") == 0)) {
+      appendToList(&inputs, rebasePath(directory, arg));
+    } else {
+      compileOnly = compileOnly || strcmp(arg, "-c") == 0;
+      if (strcmp(arg, "-MD") == 0 || strcmp(arg, "-MMD") == 0) {
+        dryRun->dependencyFlags++;
+      }
+      appendToList(&flags, arg);
+    }
+  }
+
+  // Each source is compiled on its own flags. Without -c, its object only
+  // stands for it in the link.
+  for (int i = 0; i < sources.count; i++) {
+    BuildStep compile = {0};
+    compile.directory = strdup(directory);
+    for (int f = 0; f < flags.count; f++) {
+      appendToList(&compile.args, flags.items[f]);
+    }
+    appendToList(&compile.args, sources.items[i]);
+    compile.source = sources.items[i];
+    if (compileOnly && output != NULL) {
+      compile.output = rebasePath(directory, output);
+    } else if (compileOnly) {
+      char object[MAX_LINE_LENGTH], *base = strrchr(sources.items[i], '/');
+      base = base != NULL ? base + 1 : sources.items[i];
+      snprintf(object, sizeof(object), "%.*s.o", (int)strlen(base) - 2, base);
+      compile.output = rebasePath(directory, object);
+    } else {
+      compile.output = rebasePath(directory, sources.items[i]);
+      appendToList(&inputs, compile.output);
+    }
+    appendStep(&dryRun->compiles, &dryRun->compileCount, compile);
+  }
+
+  if (!compileOnly && inputs.count > 0) {
+    BuildStep link = {0};
+    link.output = rebasePath(directory, output != NULL ? output : "a.out");
+    link.inputs = inputs;
+    link.linkFlags = used > 0 ? strdup(linkFlags) : NULL;
+    appendStep(&dryRun->links, &dryRun->linkCount, link);
+    if (sources.count > 1) {
+      char note[MAX_LINE_LENGTH];
+      snprintf(note, sizeof(note),
+               "one command compiling %d sources into %s one after another",
+               sources.count, link.output);
+      appendToList(removed, strdup(note));
+    }
+  }
+}
+
+/**
+ * Guesses from its name whether a program is a C compiler.
+ */
+static bool looksLikeCompiler(const char *program) {
+  size_t length = strlen(program);
+  return strcmp(program, "cc") == 0 || strcmp(program, "c99") == 0 ||
+         strstr(program, "gcc") != NULL || strstr(program, "clang") != NULL ||
+         (length > 2 && strcmp(program + length - 3, "-cc") == 0);
+}
+
+/**
+ * Appends a step to a list of steps.
+ */
+static void appendStep(BuildStep **steps, int *count, BuildStep step) {
+  *steps = realloc(*steps, sizeof(BuildStep) * (*count + 1));
+  (*steps)[(*count)++] = step;
+}
@@ -0,0 +1,275 @@
+/**
+ * affected works out what a set of changed files affects, for the generated
+ * affected rule. makeGen writes it into .makegen/.
+ *
+ * Usage:
+ *   affected -c changed.txt [-u untracked.txt] -g goals.txt -e executable
+ *            -o "objects" [-l "library objects"] [-t "test binaries"]
+ *            [-m "microbenchmark binaries"]
+ *
+ * An object is affected when a file it was compiled from changed, going by
+ * the dependency file the compiler wrote beside it. An object without one
+ * has not been built yet, so it counts as affected. The executable is
+ * affected when any of its objects are, and a test or microbenchmark when
+ * its own object or any library object is. A change to the makefile
+ * affects everything, but an untracked makefile does not: makeGen's own
+ * output is often left untracked, and it would otherwise make every run
+ * rebuild everything.
+ *
+ * The affected binaries are written to the goals file for make to build,
+ * with a test's pass stamp standing in for the test so that it is also
+ * run.
+ */
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Some macros to make the code more readable. */
+#define MAX_LINE_LENGTH 4096
+#define MAKEFILE_NAME "Makefile"
+
+/** A list of paths. */
+typedef struct {
+  char **items;
+  int count;
+} PathList;
+
+/** Helper function declarations. */
+static void splitWords(const char *text, PathList *list);
+static void addPath(PathList *list, const char *path);
+static bool contains(PathList *list, const char *path);
+static bool readLines(const char *path, PathList *list);
+static bool objectAffected(const char *object, PathList *changed);
+static bool anyAffected(PathList *objects, PathList *affected);
+static const char *normalize(const char *path);
+
+/**
+ * Main function for the impact analysis.
+ */
+int main(int argc, char **argv) {
+  const char *changedPath = NULL, *untrackedPath = NULL, *goalsPath = NULL,
+             *executable = NULL;
+  PathList objects = {0}, libObjects = {0}, tests = {0}, microbenches = {0};
+  int opt;
+  while ((opt = getopt(argc, argv, "c:u:g:e:o:l:t:m:")) != -1) {
+    switch (opt) {
+    case 'c':
+      changedPath = optarg;
+      break;
+    case 'u':
+      untrackedPath = optarg;
+      break;
+    case 'g':
+      goalsPath = optarg;
+      break;
+    case 'e':
+      executable = optarg;
+      break;
+    case 'o':
+      splitWords(optarg, &objects);
+      break;
+    case 'l':
+      splitWords(optarg, &libObjects);
+      break;
+    case 't':
+      splitWords(optarg, &tests);
+      break;
+    case 'm':
+      splitWords(optarg, &microbenches);
+      break;
+    default:
+      changedPath = NULL;
+    }
+  }
+  if (changedPath == NULL || goalsPath == NULL || executable == NULL) {
+    fprintf(stderr, "Usage:\n");
+    fprintf(stderr, "affected -c changed.txt [-u untracked.txt] "
+                    "-g goals.txt -e executable "
+                    "-o \"objects\" [-l \"library objects\"] "
+                    "[-t \"test binaries\"] "
+                    "[-m \"microbenchmark binaries\"]\n");
+    return 1;
+  }
+
+  PathList changed = {0};
+  if (!readLines(changedPath, &changed)) {
+    fprintf(stderr, "affected: unable to read %s\n", changedPath);
+    return 1;
+  }
+  bool everything = contains(&changed, MAKEFILE_NAME);
+
+  // Untracked files count as changed, except that the makefile does not
+  // affect everything when only its untracked copy exists.
+  if (untrackedPath != NULL && !readLines(untrackedPath, &changed)) {
+    fprintf(stderr, "affected: unable to read %s\n", untrackedPath);
+    return 1;
+  }
+
+  // Find the affected objects, including those of the tests and
+  // microbenchmarks.
+  PathList all = {0}, affected = {0};
+  for (int i = 0; i < objects.count; i++) {
+    addPath(&all, objects.items[i]);
+  }
+  PathList *binaryLists[] = {&tests, &microbenches};
+  for (int b = 0; b < 2; b++) {
+    for (int i = 0; i < binaryLists[b]->count; i++) {
+      char object[MAX_LINE_LENGTH];
+      snprintf(object, sizeof(object), "%s.o", binaryLists[b]->items[i]);
+      addPath(&all, object);
+    }
+  }
+  for (int i = 0; i < all.count; i++) {
+    if (everything || objectAffected(all.items[i], &changed)) {
+      addPath(&affected, all.items[i]);
+    }
+  }
+
+  printf("%d changed files affect %d of %d objects\n", changed.count,
+         affected.count, all.count);
+  for (int i = 0; i < affected.count; i++) {
+    printf("  %s\n", affected.items[i]);
+  }
+
+  FILE *goals = fopen(goalsPath, "w");
+  if (goals == NULL) {
+    fprintf(stderr, "affected: unable to write %s\n", goalsPath);
+    return 1;
+  }
+  int goalCount = 0;
+  if (anyAffected(&objects, &affected)) {
+    fprintf(goals, "%s\n", executable);
+    printf("Affected: %s\n", executable);
+    goalCount++;
+  }
+  bool libraryAffected = anyAffected(&libObjects, &affected);
+  for (int b = 0; b < 2; b++) {
+    for (int i = 0; i < binaryLists[b]->count; i++) {
+      char *binary = binaryLists[b]->items[i];
+      char object[MAX_LINE_LENGTH];
+      snprintf(object, sizeof(object), "%s.o", binary);
+      if (!libraryAffected && !contains(&affected, object)) {
+        continue;
+      }
+      fprintf(goals, b == 0 ? "%s.pass\n" : "%s\n", binary);
+      printf("Affected: %s%s\n", binary, b == 0 ? " (will run)" : "");
+      goalCount++;
+    }
+  }
+  fclose(goals);
+  if (goalCount == 0) {
+    printf("Nothing to build or test\n");
+  }
+  return 0;
+}
+
+/**
+ * Splits space separated words into a list of paths.
+ */
+static void splitWords(const char *text, PathList *list) {
+  char *copy = strdup(text);
+  for (char *word = strtok(copy, " \t\n"); word != NULL;
+       word = strtok(NULL, " \t\n")) {
+    addPath(list, word);
+  }
+  free(copy);
+}
+
+/**
+ * Adds a copy of a path to a list.
+ */
+static void addPath(PathList *list, const char *path) {
+  list->items = realloc(list->items, sizeof(char *) * (list->count + 1));
+  list->items[list->count++] = strdup(normalize(path));
+}
+
+/**
+ * Checks whether a list holds a path.
+ */
+static bool contains(PathList *list, const char *path) {
+  path = normalize(path);
+  for (int i = 0; i < list->count; i++) {
+    if (strcmp(list->items[i], path) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Reads the non-empty lines of a file into a list.
+ * @return True if the file could be read, false otherwise.
+ */
+static bool readLines(const char *path, PathList *list) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    return false;
+  }
+  char line[MAX_LINE_LENGTH];
+  while (fgets(line, sizeof(line), file) != NULL) {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (line[0] != '\0') {
+      addPath(list, line);
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+/**
+ * Checks whether an object depends on a changed file, going by the
+ * dependency file beside it. Every word of the dependency file is a target
+ * or a prerequisite of the object, so any changed one affects it.
+ */
+static bool objectAffected(const char *object, PathList *changed) {
+  char path[MAX_LINE_LENGTH];
+  size_t length = strlen(object);
+  snprintf(path, sizeof(path), "%.*s.d",
+           (int)(length > 2 ? length - 2 : length), object);
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    return true;
+  }
+
+  bool affected = false;
+  char line[MAX_LINE_LENGTH];
+  while (!affected && fgets(line, sizeof(line), file) != NULL) {
+    for (char *word = strtok(line, " \t\n\\"); word != NULL && !affected;
+         word = strtok(NULL, " \t\n\\")) {
+      size_t wordLength = strlen(word);
+      if (wordLength > 0 && word[wordLength - 1] == ':') {
+        word[wordLength - 1] = '\0';
+      }
+      affected = contains(changed, word);
+    }
+  }
+  fclose(file);
+  return affected;
+}
+
+/**
+ * Checks whether any of the objects are affected.
+ */
+static bool anyAffected(PathList *objects, PathList *affected) {
+  for (int i = 0; i < objects->count; i++) {
+    if (contains(affected, objects->items[i])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Drops a leading "./" so that paths compare equal however they were
+ * written.
+ */
+static const char *normalize(const char *path) {
+  while (strncmp(path, "./", 2) == 0) {
+    path += 2;
+  }
+  return path;
+}
@@ -0,0 +1,685 @@
+/**
+ * bench runs one or more shell commands repeatedly and reports how long they
+ * take. makeGen writes it into .makegen/ and builds it when it is needed.
+ *
+ * Usage:
+ *   bench [-n runs] [-w warmup] [-c cpu] [-p] [-o results.json]
+ *         {label} {command} [{label} {command} ...]
+ *   bench -k baseline.json [-t percent] results.json
+ *
+ * Every command is run warmup times before measuring starts. The measured
+ * runs then go in rounds, one run of each command per round, so that slow
+ * drifts in machine state hit every command alike. With -c the benchmark is
+ * pinned to the given CPU, and a warning is printed if that CPU's frequency
+ * governor is not "performance". With -p each command is run once more
+ * under perf stat, when perf is installed, to collect hardware counters.
+ *
+ * The fastest command is compared against the runner-up with Welch's t-test,
+ * and the confidence that it really is faster is reported alongside it.
+ *
+ * With -k the saved results are checked against a baseline instead. A
+ * command regresses when it is more than the threshold percent slower and
+ * the slowdown is significant at 95% confidence. The exit status is 1 when
+ * anything regressed or has no baseline.
+ */
+
+#define _GNU_SOURCE
+#include <math.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Some macros to make the code more readable. */
+#define DEFAULT_RUNS 10
+#define DEFAULT_WARMUP 2
+#define DEFAULT_THRESHOLD 5.0
+#define SIGNIFICANT_CONFIDENCE 0.95
+#define NO_CPU -1
+#define MAX_LINE_LENGTH 4096
+#define PERF_EVENTS "cycles,instructions,cache-misses,branch-misses"
+#define MAX_COUNTERS 8
+
+/** The measurements taken for one command. */
+typedef struct {
+  const char *label;
+  const char *command;
+  double *samples;
+  int count;
+  long maxRssKb;
+  double mean;
+  double median;
+  double p95;
+  double stddev;
+  double ci95;
+  int counterCount;
+  char *counterNames[MAX_COUNTERS];
+  double counterValues[MAX_COUNTERS];
+} Result;
+
+/** Helper function declarations. */
+static void printUsage();
+static double runOnce(const char *command, long *maxRssKb);
+static void pinToCpu(int cpu);
+static void checkGovernor(int cpu, char *governor, size_t size);
+static void collectCounters(Result *result);
+static void summarize(Result *result);
+static int compareDoubles(const void *a, const void *b);
+static double studentCdf(double t, double df);
+static double studentQuantile(double p, double df);
+static double incompleteBeta(double a, double b, double x);
+static double betaFraction(double a, double b, double x);
+static double welchConfidence(Result *fast, Result *slow);
+static void printJsonString(FILE *out, const char *text);
+static void writeJson(FILE *out, Result *results, int count, int runs,
+                      int warmup, const char *governor, int best,
+                      double confidence);
+static int readResults(const char *path, Result **results);
+static int checkBaseline(const char *baselinePath, const char *resultsPath,
+                         double threshold);
+
+/**
+ * Main function for the benchmark runner.
+ */
+int main(int argc, char **argv) {
+  int runs = DEFAULT_RUNS;
+  int warmup = DEFAULT_WARMUP;
+  int cpu = NO_CPU;
+  bool counters = false;
+  const char *outputPath = NULL;
+  const char *baselinePath = NULL;
+  double threshold = DEFAULT_THRESHOLD;
+
+  // Parse the options.
+  int opt;
+  while ((opt = getopt(argc, argv, "+n:w:c:po:k:t:")) != -1) {
+    switch (opt) {
+    case 'n':
+      runs = atoi(optarg);
+      break;
+    case 'w':
+      warmup = atoi(optarg);
+      break;
+    case 'c':
+      cpu = atoi(optarg);
+      break;
+    case 'p':
+      counters = true;
+      break;
+    case 'o':
+      outputPath = optarg;
+      break;
+    case 'k':
+      baselinePath = optarg;
+      break;
+    case 't':
+      threshold = atof(optarg);
+      break;
+    default:
+      printUsage();
+      return 1;
+    }
+  }
+
+  // Checking against a baseline takes just the results to check.
+  if (baselinePath != NULL) {
+    if (argc - optind != 1) {
+      printUsage();
+      return 1;
+    }
+    return checkBaseline(baselinePath, argv[optind], threshold);
+  }
+
+  // The remaining arguments are label and command pairs.
+  int count = (argc - optind) / 2;
+  if (count == 0 || (argc - optind) % 2 != 0 || runs < 2) {
+    printUsage();
+    return 1;
+  }
+
+  Result *results = calloc(count, sizeof(Result));
+  for (int i = 0; i < count; i++) {
+    results[i].label = argv[optind + 2 * i];
+    results[i].command = argv[optind + 2 * i + 1];
+    results[i].samples = malloc(sizeof(double) * runs);
+  }
+
+  char governor[64] = "unknown";
+  if (cpu != NO_CPU) {
+    pinToCpu(cpu);
+  }
+  checkGovernor(cpu == NO_CPU ? 0 : cpu, governor, sizeof(governor));
+
+  // Warm up caches, the page cache and the CPU frequency.
+  for (int w = 0; w < warmup; w++) {
+    for (int i = 0; i < count; i++) {
+      runOnce(results[i].command, &results[i].maxRssKb);
+    }
+  }
+
+  // Measure in rounds so every command sees the same machine state.
+  for (int r = 0; r < runs; r++) {
+    for (int i = 0; i < count; i++) {
+      long maxRssKb;
+      results[i].samples[results[i].count++] =
+          runOnce(results[i].command, &maxRssKb);
+      if (maxRssKb > results[i].maxRssKb) {
+        results[i].maxRssKb = maxRssKb;
+      }
+    }
+  }
+
+  // Summarize each command and find the fastest one.
+  int best = 0;
+  for (int i = 0; i < count; i++) {
+    summarize(&results[i]);
+    if (counters) {
+      collectCounters(&results[i]);
+    }
+    if (results[i].mean < results[best].mean) {
+      best = i;
+    }
+  }
+
+  // Compare the fastest command against the runner-up.
+  int runnerUp = -1;
+  for (int i = 0; i < count; i++) {
+    if (i != best &&
+        (runnerUp == -1 || results[i].mean < results[runnerUp].mean)) {
+      runnerUp = i;
+    }
+  }
+  double confidence = 1.0;
+  if (runnerUp != -1) {
+    confidence = welchConfidence(&results[best], &results[runnerUp]);
+  }
+
+  // Print the summary table.
+  printf("%-24s %12s %12s %12s %12s %10s %10s\n", "label", "mean (s)",
+         "median (s)", "p95 (s)", "95% CI (s)", "runs/s", "max RSS KB");
+  for (int i = 0; i < count; i++) {
+    printf("%-24s %12.6f %12.6f %12.6f %12.6f %10.2f %10ld%s\n",
+           results[i].label, results[i].mean, results[i].median,
+           results[i].p95, results[i].ci95,
+           results[i].mean > 0 ? 1.0 / results[i].mean : 0.0,
+           results[i].maxRssKb, i == best ? "  *" : "");
+    for (int c = 0; c < results[i].counterCount; c++) {
+      printf("    %-20s %16.0f\n", results[i].counterNames[c],
+             results[i].counterValues[c]);
+    }
+  }
+  if (runnerUp != -1) {
+    printf("%s is fastest, %.2f%% faster than %s (confidence %.1f%%)\n",
+           results[best].label,
+           100.0 * (results[runnerUp].mean - results[best].mean) /
+               results[runnerUp].mean,
+           results[runnerUp].label, 100.0 * confidence);
+  }
+
+  // Save the results.
+  if (outputPath != NULL) {
+    FILE *out = fopen(outputPath, "w");
+    if (out == NULL) {
+      fprintf(stderr, "bench: unable to write %s\n", outputPath);
+      return 1;
+    }
+    writeJson(out, results, count, runs, warmup, governor, best, confidence);
+    fclose(out);
+  }
+
+  return 0;
+}
+
+/**
+ * Prints a correct usage message to stderr.
+ */
+static void printUsage() {
+  fprintf(stderr, "Usage:\n");
+  fprintf(stderr, "bench [-n runs] [-w warmup] [-c cpu] [-p] "
+                  "[-o results.json] {label} {command} ...\n");
+  fprintf(stderr, "bench -k baseline.json [-t percent] results.json\n");
+  fprintf(stderr, "At least two runs are needed.\n");
+}
+
+/**
+ * Runs a command once through the shell, discarding its standard output.
+ * Exits if the command fails, since its timings would be meaningless.
+ * @param command The command to run.
+ * @param maxRssKb Set to the peak resident set size of the command.
+ * @return The wall-clock time the command took, in seconds.
+ */
+static double runOnce(const char *command, long *maxRssKb) {
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    freopen("/dev/null", "w", stdout);
+    execl("/bin/sh", "sh", "-c", command, (char *)NULL);
+    _exit(127);
+  }
+
+  int status;
+  struct rusage usage;
+  if (pid < 0 || wait4(pid, &status, 0, &usage) < 0) {
+    fprintf(stderr, "bench: unable to run \"%s\"\n", command);
+    exit(1);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "bench: \"%s\" failed\n", command);
+    exit(1);
+  }
+
+  *maxRssKb = usage.ru_maxrss;
+  return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/**
+ * Pins this process, and so every command it runs, to one CPU.
+ * @param cpu The CPU to run on.
+ */
+static void pinToCpu(int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+    fprintf(stderr, "bench: unable to pin to CPU %d, running unpinned\n", cpu);
+  }
+}
+
+/**
+ * Warns if a CPU's frequency governor may scale the clock during the
+ * benchmark.
+ * @param cpu The CPU the benchmark runs on.
+ * @param governor Set to the name of the governor, if it can be read.
+ * @param size The size of the governor buffer.
+ */
+static void checkGovernor(int cpu, char *governor, size_t size) {
+  char path[MAX_LINE_LENGTH];
+  snprintf(path, sizeof(path),
+           "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor", cpu);
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    return;
+  }
+  if (fgets(governor, size, file) != NULL) {
+    governor[strcspn(governor, "\n")] = '\0';
+  }
+  fclose(file);
+
+  if (strcmp(governor, "performance") != 0) {
+    fprintf(stderr,
+            "bench: CPU %d uses the \"%s\" frequency governor; results may "
+            "be noisy\n",
+            cpu, governor);
+  }
+}
+
+/**
+ * Runs a command once under perf stat and keeps its hardware counters.
+ * Leaves the result without counters if perf is missing or not permitted.
+ * @param result The result whose command to run.
+ */
+static void collectCounters(Result *result) {
+  char outputPath[] = "/tmp/bench-perf-XXXXXX";
+  int fd = mkstemp(outputPath);
+  if (fd < 0) {
+    return;
+  }
+  close(fd);
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    freopen("/dev/null", "w", stdout);
+    freopen("/dev/null", "w", stderr);
+    execlp("perf", "perf", "stat", "-x", ",", "-e", PERF_EVENTS, "-o",
+           outputPath, "/bin/sh", "-c", result->command, (char *)NULL);
+    _exit(127);
+  }
+  int status;
+  if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0) {
+    unlink(outputPath);
+    return;
+  }
+
+  // Each counter is a line of the form "value,unit,event,...".
+  FILE *output = fopen(outputPath, "r");
+  char line[MAX_LINE_LENGTH];
+  while (output != NULL && fgets(line, sizeof(line), output) != NULL &&
+         result->counterCount < MAX_COUNTERS) {
+    char *value = strtok(line, ",");
+    strtok(NULL, ",");
+    char *event = strtok(NULL, ",");
+    char *end;
+    if (value == NULL || event == NULL) {
+      continue;
+    }
+    double number = strtod(value, &end);
+    if (end != value) {
+      result->counterNames[result->counterCount] = strdup(event);
+      result->counterValues[result->counterCount++] = number;
+    }
+  }
+  if (output != NULL) {
+    fclose(output);
+  }
+  unlink(outputPath);
+}
+
+/**
+ * Computes the mean, median, 95th percentile, standard deviation and 95%
+ * confidence interval half-width of a result's samples.
+ * @param result The result to summarize.
+ */
+static void summarize(Result *result) {
+  int n = result->count;
+  double *sorted = malloc(sizeof(double) * n);
+  memcpy(sorted, result->samples, sizeof(double) * n);
+  qsort(sorted, n, sizeof(double), compareDoubles);
+
+  double sum = 0;
+  for (int i = 0; i < n; i++) {
+    sum += sorted[i];
+  }
+  result->mean = sum / n;
+
+  double squares = 0;
+  for (int i = 0; i < n; i++) {
+    squares += (sorted[i] - result->mean) * (sorted[i] - result->mean);
+  }
+  result->stddev = sqrt(squares / (n - 1));
+
+  result->median =
+      n % 2 == 1 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+  result->p95 = sorted[(int)ceil(0.95 * n) - 1];
+  result->ci95 = studentQuantile(0.975, n - 1) * result->stddev / sqrt(n);
+
+  free(sorted);
+}
+
+/**
+ * Orders doubles from smallest to largest for qsort.
+ */
+static int compareDoubles(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * Computes the cumulative distribution function of Student's t distribution.
+ * @param t The t statistic.
+ * @param df The degrees of freedom.
+ * @return The probability of a value at most t.
+ */
+static double studentCdf(double t, double df) {
+  double tail = 0.5 * incompleteBeta(df / 2, 0.5, df / (df + t * t));
+  return t >= 0 ? 1 - tail : tail;
+}
+
+/**
+ * Inverts Student's t distribution by bisection.
+ * @param p The cumulative probability, between 0.5 and 1.
+ * @param df The degrees of freedom.
+ * @return The t value whose cumulative probability is p.
+ */
+static double studentQuantile(double p, double df) {
+  double low = 0, high = 1000;
+  for (int i = 0; i < 100; i++) {
+    double mid = (low + high) / 2;
+    if (studentCdf(mid, df) < p) {
+      low = mid;
+    } else {
+      high = mid;
+    }
+  }
+  return (low + high) / 2;
+}
+
+/**
+ * Computes the regularized incomplete beta function I_x(a, b).
+ */
+static double incompleteBeta(double a, double b, double x) {
+  if (x <= 0) {
+    return 0;
+  }
+  if (x >= 1) {
+    return 1;
+  }
+  double front = exp(lgamma(a + b) - lgamma(a) - lgamma(b) + a * log(x) +
+                     b * log(1 - x));
+
+  // The continued fraction converges quickly on this side of the mean.
+  if (x < (a + 1) / (a + b + 2)) {
+    return front * betaFraction(a, b, x) / a;
+  }
+  return 1 - front * betaFraction(b, a, 1 - x) / b;
+}
+
+/**
+ * Evaluates the continued fraction for the incomplete beta function with
+ * the modified Lentz method.
+ */
+static double betaFraction(double a, double b, double x) {
+  const double tiny = 1e-300;
+  double c = 1, d = 1 - (a + b) * x / (a + 1);
+  d = fabs(d) < tiny ? tiny : d;
+  d = 1 / d;
+  double fraction = d;
+
+  for (int m = 1; m <= 300; m++) {
+    double even = m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m));
+    d = 1 + even * d;
+    d = fabs(d) < tiny ? tiny : d;
+    c = 1 + even / c;
+    c = fabs(c) < tiny ? tiny : c;
+    d = 1 / d;
+    fraction *= d * c;
+
+    double odd = -(a + m) * (a + b + m) * x / ((a + 2 * m) * (a + 2 * m + 1));
+    d = 1 + odd * d;
+    d = fabs(d) < tiny ? tiny : d;
+    c = 1 + odd / c;
+    c = fabs(c) < tiny ? tiny : c;
+    d = 1 / d;
+    double delta = d * c;
+    fraction *= delta;
+
+    if (fabs(delta - 1) < 1e-12) {
+      break;
+    }
+  }
+  return fraction;
+}
+
+/**
+ * Applies a one-sided Welch's t-test to two results.
+ * @param fast The result with the lower mean.
+ * @param slow The result with the higher mean.
+ * @return The confidence that fast really has the lower mean.
+ */
+static double welchConfidence(Result *fast, Result *slow) {
+  double fastVar = fast->stddev * fast->stddev / fast->count;
+  double slowVar = slow->stddev * slow->stddev / slow->count;
+  if (fastVar + slowVar == 0) {
+    return fast->mean < slow->mean ? 1.0 : 0.5;
+  }
+
+  double t = (slow->mean - fast->mean) / sqrt(fastVar + slowVar);
+  double df = (fastVar + slowVar) * (fastVar + slowVar) /
+              (fastVar * fastVar / (fast->count - 1) +
+               slowVar * slowVar / (slow->count - 1));
+  return studentCdf(t, df);
+}
+
+/**
+ * Prints a string as a JSON string literal.
+ */
+static void printJsonString(FILE *out, const char *text) {
+  fputc('"', out);
+  for (const char *c = text; *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\') {
+      fputc('\\', out);
+    }
+    fputc(*c == '\n' || *c == '\t' ? ' ' : *c, out);
+  }
+  fputc('"', out);
+}
+
+/**
+ * Writes the results as JSON. Each field sits on its own line so that the
+ * file is easy to read back with line-oriented tools.
+ */
+static void writeJson(FILE *out, Result *results, int count, int runs,
+                      int warmup, const char *governor, int best,
+                      double confidence) {
+  fprintf(out, "{\n");
+  fprintf(out, "  \"runs\": %d,\n", runs);
+  fprintf(out, "  \"warmup\": %d,\n", warmup);
+  fprintf(out, "  \"governor\": ");
+  printJsonString(out, governor);
+  fprintf(out, ",\n");
+  fprintf(out, "  \"results\": [\n");
+  for (int i = 0; i < count; i++) {
+    Result *result = &results[i];
+    fprintf(out, "    {\n");
+    fprintf(out, "      \"label\": ");
+    printJsonString(out, result->label);
+    fprintf(out, ",\n      \"command\": ");
+    printJsonString(out, result->command);
+    fprintf(out, ",\n");
+    fprintf(out, "      \"n\": %d,\n", result->count);
+    fprintf(out, "      \"mean\": %.9f,\n", result->mean);
+    fprintf(out, "      \"median\": %.9f,\n", result->median);
+    fprintf(out, "      \"p95\": %.9f,\n", result->p95);
+    fprintf(out, "      \"stddev\": %.9f,\n", result->stddev);
+    fprintf(out, "      \"ci95\": %.9f,\n", result->ci95);
+    fprintf(out, "      \"max_rss_kb\": %ld,\n", result->maxRssKb);
+    fprintf(out, "      \"counters\": {");
+    for (int c = 0; c < result->counterCount; c++) {
+      fprintf(out, "%s", c == 0 ? "" : ", ");
+      printJsonString(out, result->counterNames[c]);
+      fprintf(out, ": %.0f", result->counterValues[c]);
+    }
+    fprintf(out, "},\n");
+    fprintf(out, "      \"samples\": [");
+    for (int s = 0; s < result->count; s++) {
+      fprintf(out, "%s%.9f", s == 0 ? "" : ", ", result->samples[s]);
+    }
+    fprintf(out, "]\n");
+    fprintf(out, "    }%s\n", i + 1 < count ? "," : "");
+  }
+  fprintf(out, "  ],\n");
+  fprintf(out, "  \"best\": ");
+  printJsonString(out, results[best].label);
+  fprintf(out, ",\n");
+  fprintf(out, "  \"best_index\": %d,\n", best);
+  fprintf(out, "  \"confidence\": %.6f\n", confidence);
+  fprintf(out, "}\n");
+}
+
+/**
+ * Reads the label, run count, mean and standard deviation of each command
+ * back from a results file written by writeJson.
+ * @param path The results file.
+ * @param results Set to the results read.
+ * @return The number of results, or -1 if the file cannot be read.
+ */
+static int readResults(const char *path, Result **results) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    return -1;
+  }
+
+  int count = 0, capacity = 8;
+  *results = calloc(capacity, sizeof(Result));
+  char line[MAX_LINE_LENGTH], label[MAX_LINE_LENGTH];
+  while (fgets(line, sizeof(line), file) != NULL) {
+    Result *last = count > 0 ? &(*results)[count - 1] : NULL;
+    if (sscanf(line, " \"label\": \"%[^\"]\"", label) == 1) {
+      if (count == capacity) {
+        capacity *= 2;
+        *results = realloc(*results, sizeof(Result) * capacity);
+      }
+      memset(&(*results)[count], 0, sizeof(Result));
+      (*results)[count++].label = strdup(label);
+    } else if (last != NULL) {
+      sscanf(line, " \"n\": %d", &last->count);
+      sscanf(line, " \"mean\": %lf", &last->mean);
+      sscanf(line, " \"stddev\": %lf", &last->stddev);
+    }
+  }
+  fclose(file);
+
+  return count;
+}
+
+/**
+ * Checks saved results against a baseline.
+ * @param baselinePath The baseline results.
+ * @param resultsPath The results to check.
+ * @param threshold The slowdown, in percent, that counts as a regression
+ * when it is also significant.
+ * @return 0 if nothing regressed and every result had a baseline, 1
+ * otherwise.
+ */
+static int checkBaseline(const char *baselinePath, const char *resultsPath,
+                         double threshold) {
+  Result *baseline, *current;
+  int baselineCount = readResults(baselinePath, &baseline);
+  int currentCount = readResults(resultsPath, &current);
+  if (baselineCount < 0 || currentCount < 0) {
+    fprintf(stderr, "bench: unable to read %s\n",
+            baselineCount < 0 ? baselinePath : resultsPath);
+    return 1;
+  }
+
+  int regressions = 0, missing = 0;
+  printf("%-24s %12s %12s %9s %11s\n", "label", "baseline (s)", "current (s)",
+         "change", "confidence");
+  for (int i = 0; i < currentCount; i++) {
+    Result *now = &current[i];
+    Result *before = NULL;
+    for (int j = 0; j < baselineCount; j++) {
+      if (strcmp(baseline[j].label, now->label) == 0) {
+        before = &baseline[j];
+      }
+    }
+    if (before == NULL) {
+      printf("%-24s %12s %12.6f %9s %11s  no baseline\n", now->label, "-",
+             now->mean, "-", "-");
+      missing++;
+      continue;
+    }
+
+    double change = 100.0 * (now->mean - before->mean) / before->mean;
+    double confidence = now->mean > before->mean
+                            ? welchConfidence(before, now)
+                            : welchConfidence(now, before);
+    bool regressed =
+        change > threshold && confidence >= SIGNIFICANT_CONFIDENCE;
+    regressions += regressed;
+    printf("%-24s %12.6f %12.6f %+8.2f%% %10.1f%%%s\n", now->label,
+           before->mean, now->mean, change, 100.0 * confidence,
+           regressed ? "  REGRESSED" : "");
+  }
+
+  if (missing > 0) {
+    fprintf(stderr,
+            "bench: %d benchmark(s) have no baseline; record a new one.\n",
+            missing);
+  }
+  if (regressions > 0) {
+    printf("%d benchmark(s) regressed by more than %.1f%%.\n", regressions,
+           threshold);
+  }
+  return regressions > 0 || missing > 0;
+}
@@ -0,0 +1,437 @@
+/**
+ * benchhistory keeps a history of benchmark results across commits, so
+ * that slow drifts show up that a comparison against one baseline misses.
+ * makeGen writes it into .makegen/ for the generated bench rules.
+ *
+ * Usage:
+ *   benchhistory append history.tsv results.json {commit} {profile}
+ *   benchhistory report history.tsv [chart.html]
+ *
+ * "append" adds a line per command in the results bench wrote, keyed by the
+ * commit and the build profile they were measured at. The history is only
+ * ever appended to.
+ *
+ * "report" groups the history by profile and command and prints each
+ * group's recent results in order, with the change against the previous
+ * and first results and the trend over the whole group. With an HTML path
+ * it also draws each group as a chart in a static page.
+ */
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+/* Some macros to make the code more readable. */
+#define MAX_LINE_LENGTH 4096
+#define MAX_FIELD_LENGTH 512
+#define MAX_RESULTS 256
+#define REPORT_ROWS 20
+#define CHART_WIDTH 720
+#define CHART_HEIGHT 240
+#define MARGIN 50
+#define HISTORY_HEADER                                                         \
+  "time\tcommit\tprofile\tlabel\tn\tmean\tmedian\tci95\tmax_rss_kb\n"
+
+/** One benchmark result in the history. */
+typedef struct {
+  long long time;
+  char commit[MAX_FIELD_LENGTH];
+  char profile[MAX_FIELD_LENGTH];
+  char label[MAX_FIELD_LENGTH];
+  int n;
+  double mean;
+  double median;
+  double ci95;
+  long maxRssKb;
+} Entry;
+
+/** The results of one command at one profile, oldest first. */
+typedef struct {
+  const char *profile;
+  const char *label;
+  int *entries;
+  int count;
+} Series;
+
+/** Helper function declarations. */
+static int append(const char *historyPath, const char *resultsPath,
+                  const char *commit, const char *profile);
+static void copyField(char *field, const char *text);
+static int report(const char *historyPath, const char *htmlPath);
+static int readHistory(const char *path, Entry **entries);
+static int groupSeries(Entry *entries, int count, Series **series);
+static void printSeries(Entry *entries, Series *series);
+static double trendPercent(Entry *entries, Series *series);
+static void writeHtml(const char *path, Entry *entries, Series *series,
+                      int count);
+static void printEscaped(FILE *file, const char *text);
+static void formatTime(char *buffer, size_t size, long long time);
+
+/**
+ * Main function for the benchmark history.
+ */
+int main(int argc, char **argv) {
+  if (argc == 6 && strcmp(argv[1], "append") == 0) {
+    return append(argv[2], argv[3], argv[4], argv[5]);
+  }
+  if ((argc == 3 || argc == 4) && strcmp(argv[1], "report") == 0) {
+    return report(argv[2], argc == 4 ? argv[3] : NULL);
+  }
+
+  fprintf(stderr, "Usage:\n");
+  fprintf(stderr,
+          "benchhistory append history.tsv results.json {commit} {profile}\n");
+  fprintf(stderr, "benchhistory report history.tsv [chart.html]\n");
+  return 1;
+}
+
+/**
+ * Appends the results of a bench run to the history.
+ * @return The exit status.
+ */
+static int append(const char *historyPath, const char *resultsPath,
+                  const char *commit, const char *profile) {
+  FILE *results = fopen(resultsPath, "r");
+  if (results == NULL) {
+    fprintf(stderr, "benchhistory: unable to read %s\n", resultsPath);
+    return 1;
+  }
+
+  // Read back the fields kept for each command.
+  static Entry entries[MAX_RESULTS];
+  int count = 0;
+  char line[MAX_LINE_LENGTH], label[MAX_FIELD_LENGTH];
+  while (fgets(line, sizeof(line), results) != NULL) {
+    Entry *last = count > 0 ? &entries[count - 1] : NULL;
+    if (count < MAX_RESULTS &&
+        sscanf(line, " \"label\": \"%511[^\"]\"", label) == 1) {
+      memset(&entries[count], 0, sizeof(Entry));
+      copyField(entries[count++].label, label);
+    } else if (last != NULL) {
+      sscanf(line, " \"n\": %d", &last->n);
+      sscanf(line, " \"mean\": %lf", &last->mean);
+      sscanf(line, " \"median\": %lf", &last->median);
+      sscanf(line, " \"ci95\": %lf", &last->ci95);
+      sscanf(line, " \"max_rss_kb\": %ld", &last->maxRssKb);
+    }
+  }
+  fclose(results);
+  if (count == 0) {
+    fprintf(stderr, "benchhistory: no results in %s\n", resultsPath);
+    return 1;
+  }
+
+  // Start a new history with its header.
+  struct stat info;
+  bool exists = stat(historyPath, &info) == 0 && info.st_size > 0;
+  FILE *history = fopen(historyPath, "a");
+  if (history == NULL) {
+    fprintf(stderr, "benchhistory: unable to write %s\n", historyPath);
+    return 1;
+  }
+  if (!exists) {
+    fprintf(history, HISTORY_HEADER);
+  }
+
+  char commitField[MAX_FIELD_LENGTH], profileField[MAX_FIELD_LENGTH];
+  copyField(commitField, commit);
+  copyField(profileField, profile);
+  long long now = (long long)time(NULL);
+  for (int i = 0; i < count; i++) {
+    Entry *entry = &entries[i];
+    fprintf(history, "%lld\t%s\t%s\t%s\t%d\t%.9f\t%.9f\t%.9f\t%ld\n", now,
+            commitField, profileField, entry->label, entry->n, entry->mean,
+            entry->median, entry->ci95, entry->maxRssKb);
+  }
+  fclose(history);
+  return 0;
+}
+
+/**
+ * Copies text into a history field, turning tabs and newlines into spaces
+ * so that they cannot split the line, and dropping trailing spaces.
+ */
+static void copyField(char *field, const char *text) {
+  snprintf(field, MAX_FIELD_LENGTH, "%s", text);
+  for (char *c = field; *c != '\0'; c++) {
+    if (*c == '\t' || *c == '\n' || *c == '\r') {
+      *c = ' ';
+    }
+  }
+  size_t length = strlen(field);
+  while (length > 0 && field[length - 1] == ' ') {
+    field[--length] = '\0';
+  }
+}
+
+/**
+ * Prints the history of each command at each profile and draws the chart.
+ * @return The exit status.
+ */
+static int report(const char *historyPath, const char *htmlPath) {
+  Entry *entries;
+  int count = readHistory(historyPath, &entries);
+  if (count <= 0) {
+    fprintf(stderr, "benchhistory: no history in %s; run make bench first\n",
+            historyPath);
+    return 1;
+  }
+
+  Series *series;
+  int seriesCount = groupSeries(entries, count, &series);
+  for (int i = 0; i < seriesCount; i++) {
+    printSeries(entries, &series[i]);
+  }
+
+  if (htmlPath != NULL) {
+    writeHtml(htmlPath, entries, series, seriesCount);
+    printf("Wrote %s\n", htmlPath);
+  }
+  for (int i = 0; i < seriesCount; i++) {
+    free(series[i].entries);
+  }
+  free(series);
+  free(entries);
+  return 0;
+}
+
+/**
+ * Reads every entry of the history.
+ * @return The number of entries read, or -1 on error.
+ */
+static int readHistory(const char *path, Entry **entries) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    return -1;
+  }
+
+  int count = 0, capacity = 64;
+  *entries = malloc(sizeof(Entry) * capacity);
+  char line[MAX_LINE_LENGTH];
+  while (fgets(line, sizeof(line), file) != NULL) {
+    if (count == capacity) {
+      capacity *= 2;
+      *entries = realloc(*entries, sizeof(Entry) * capacity);
+    }
+    Entry *entry = &(*entries)[count];
+    if (sscanf(line,
+               "%lld\t%511[^\t]\t%511[^\t]\t%511[^\t]\t%d\t%lf\t%lf\t%lf\t%ld",
+               &entry->time, entry->commit, entry->profile, entry->label,
+               &entry->n, &entry->mean, &entry->median, &entry->ci95,
+               &entry->maxRssKb) == 9) {
+      count++;
+    }
+  }
+  fclose(file);
+  return count;
+}
+
+/**
+ * Groups the entries by profile and label, in the order each group first
+ * appears.
+ * @return The number of groups.
+ */
+static int groupSeries(Entry *entries, int count, Series **series) {
+  *series = calloc(count, sizeof(Series));
+  int seriesCount = 0;
+  for (int i = 0; i < count; i++) {
+    int s = 0;
+    while (s < seriesCount &&
+           (strcmp((*series)[s].profile, entries[i].profile) != 0 ||
+            strcmp((*series)[s].label, entries[i].label) != 0)) {
+      s++;
+    }
+    if (s == seriesCount) {
+      (*series)[s].profile = entries[i].profile;
+      (*series)[s].label = entries[i].label;
+      (*series)[s].entries = malloc(sizeof(int) * count);
+      seriesCount++;
+    }
+    (*series)[s].entries[(*series)[s].count++] = i;
+  }
+  return seriesCount;
+}
+
+/**
+ * Prints the latest results of a group, marking changes larger than their
+ * uncertainty, followed by its drift and trend.
+ */
+static void printSeries(Entry *entries, Series *series) {
+  Entry *first = &entries[series->entries[0]];
+  printf("%s [%s]\n", series->label, series->profile);
+  printf("  %-16s %-14s %12s %12s %9s %9s\n", "date", "commit", "mean (s)",
+         "95% CI (s)", "vs prev", "vs first");
+
+  int start = series->count > REPORT_ROWS ? series->count - REPORT_ROWS : 0;
+  for (int i = start; i < series->count; i++) {
+    Entry *entry = &entries[series->entries[i]];
+    char date[32], previousChange[16] = "-", firstChange[16] = "-";
+    formatTime(date, sizeof(date), entry->time);
+    if (i > 0) {
+      Entry *previous = &entries[series->entries[i - 1]];
+      double difference = entry->mean - previous->mean;
+      double margin = entry->ci95 * entry->ci95 +
+                      previous->ci95 * previous->ci95;
+      snprintf(previousChange, sizeof(previousChange), "%+.1f%%%s",
+               100.0 * difference / previous->mean,
+               difference * difference > margin ? "*" : "");
+      snprintf(firstChange, sizeof(firstChange), "%+.1f%%",
+               100.0 * (entry->mean - first->mean) / first->mean);
+    }
+    printf("  %-16s %-14.14s %12.6f %12.6f %9s %9s\n", date, entry->commit,
+           entry->mean, entry->ci95, previousChange, firstChange);
+  }
+
+  if (series->count > 1) {
+    Entry *last = &entries[series->entries[series->count - 1]];
+    printf("  Drift: %+.1f%% over %d results, trend %+.2f%% per result\n",
+           100.0 * (last->mean - first->mean) / first->mean, series->count,
+           trendPercent(entries, series));
+  }
+  printf("  (* marks a change larger than its 95%% confidence interval)\n\n");
+}
+
+/**
+ * Fits a line through a group's means by least squares.
+ * @return The slope as a percentage of the average mean.
+ */
+static double trendPercent(Entry *entries, Series *series) {
+  double n = series->count, sumX = 0, sumY = 0, sumXY = 0, sumXX = 0;
+  for (int i = 0; i < series->count; i++) {
+    double y = entries[series->entries[i]].mean;
+    sumX += i;
+    sumY += y;
+    sumXY += i * y;
+    sumXX += (double)i * i;
+  }
+  double denominator = n * sumXX - sumX * sumX;
+  if (denominator == 0 || sumY == 0) {
+    return 0;
+  }
+  double slope = (n * sumXY - sumX * sumY) / denominator;
+  return 100.0 * slope / (sumY / n);
+}
+
+/**
+ * Writes a static page with a chart of each group's means and confidence
+ * intervals. Hovering over a point shows its commit.
+ */
+static void writeHtml(const char *path, Entry *entries, Series *series,
+                      int count) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    fprintf(stderr, "benchhistory: unable to write %s\n", path);
+    return;
+  }
+
+  fprintf(file, "<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\">\n");
+  fprintf(file, "<title>Benchmark history</title>\n");
+  fprintf(file, "<style>body{font-family:sans-serif;margin:2em}"
+                "h2{font-size:1em}code{color:#555}</style>\n");
+  fprintf(file, "</head><body>\n<h1>Benchmark history</h1>\n");
+
+  for (int s = 0; s < count; s++) {
+    Series *group = &series[s];
+    double high = 0;
+    for (int i = 0; i < group->count; i++) {
+      Entry *entry = &entries[group->entries[i]];
+      double top = entry->mean + entry->ci95;
+      high = top > high ? top : high;
+    }
+    high = high > 0 ? high * 1.1 : 1;
+
+    fprintf(file, "<h2>");
+    printEscaped(file, group->label);
+    fprintf(file, " <code>");
+    printEscaped(file, group->profile);
+    fprintf(file, "</code></h2>\n");
+    fprintf(file,
+            "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%d\" "
+            "height=\"%d\">\n",
+            CHART_WIDTH, CHART_HEIGHT);
+    fprintf(file,
+            "<line x1=\"%d\" y1=\"%d\" x2=\"%d\" y2=\"%d\" stroke=\"black\"/>"
+            "\n",
+            MARGIN, CHART_HEIGHT - MARGIN, CHART_WIDTH - 10,
+            CHART_HEIGHT - MARGIN);
+    fprintf(file,
+            "<line x1=\"%d\" y1=\"10\" x2=\"%d\" y2=\"%d\" stroke=\"black\"/>"
+            "\n",
+            MARGIN, MARGIN, CHART_HEIGHT - MARGIN);
+    fprintf(file,
+            "<text x=\"5\" y=\"15\" font-size=\"11\">%.3gs</text>\n"
+            "<text x=\"5\" y=\"%d\" font-size=\"11\">0s</text>\n",
+            high, CHART_HEIGHT - MARGIN);
+
+    // Place the points evenly, one per result.
+    double plotWidth = CHART_WIDTH - MARGIN - 20;
+    double plotHeight = CHART_HEIGHT - MARGIN - 10;
+    double step = group->count > 1 ? plotWidth / (group->count - 1) : 0;
+    fprintf(file, "<polyline fill=\"none\" stroke=\"steelblue\" points=\"");
+    for (int i = 0; i < group->count; i++) {
+      Entry *entry = &entries[group->entries[i]];
+      fprintf(file, "%.1f,%.1f ", MARGIN + 5 + i * step,
+              CHART_HEIGHT - MARGIN - plotHeight * entry->mean / high);
+    }
+    fprintf(file, "\"/>\n");
+    for (int i = 0; i < group->count; i++) {
+      Entry *entry = &entries[group->entries[i]];
+      double x = MARGIN + 5 + i * step;
+      double y = CHART_HEIGHT - MARGIN - plotHeight * entry->mean / high;
+      double spread = plotHeight * entry->ci95 / high;
+      char date[32];
+      formatTime(date, sizeof(date), entry->time);
+      fprintf(file,
+              "<line x1=\"%.1f\" y1=\"%.1f\" x2=\"%.1f\" y2=\"%.1f\" "
+              "stroke=\"lightsteelblue\"/>\n",
+              x, y - spread, x, y + spread);
+      fprintf(file, "<circle cx=\"%.1f\" cy=\"%.1f\" r=\"3\" "
+                    "fill=\"steelblue\"><title>",
+              x, y);
+      printEscaped(file, entry->commit);
+      fprintf(file, " %s: %.6fs &#177; %.6fs</title></circle>\n", date,
+              entry->mean, entry->ci95);
+    }
+    fprintf(file, "</svg>\n");
+  }
+  fprintf(file, "</body></html>\n");
+  fclose(file);
+}
+
+/**
+ * Prints text with the characters HTML treats specially escaped.
+ */
+static void printEscaped(FILE *file, const char *text) {
+  for (const char *c = text; *c != '\0'; c++) {
+    switch (*c) {
+    case '<':
+      fprintf(file, "&lt;");
+      break;
+    case '>':
+      fprintf(file, "&gt;");
+      break;
+    case '&':
+      fprintf(file, "&amp;");
+      break;
+    case '"':
+      fprintf(file, "&quot;");
+      break;
+    default:
+      fputc(*c, file);
+    }
+  }
+}
+
+/**
+ * Formats a Unix time as a local date and time.
+ */
+static void formatTime(char *buffer, size_t size, long long time) {
+  time_t seconds = (time_t)time;
+  struct tm local;
+  localtime_r(&seconds, &local);
+  strftime(buffer, size, "%Y-%m-%d %H:%M", &local);
+}
@@ -0,0 +1,401 @@
+/**
+ * buildtime times the generated Makefile's own builds for the build-budget
+ * rule. makeGen writes it into .makegen/.
+ *
+ * Usage:
+ *   buildtime wrap log.txt compiler [args...]
+ *   buildtime time log.txt command [args...]
+ *   buildtime check [-c seconds] [-r seconds] [-t percent] [-k baseline]
+ *                   [-o results.txt] clean.txt rebuild.txt
+ *
+ * "wrap" stands in for the compiler. It runs the compiler and appends how
+ * long the step took to the log, naming the step by its output and calling
+ * it a compile when it is given -c and a link otherwise. "time" runs a
+ * whole build and appends its total time.
+ *
+ * "check" reads the logs of a clean build and of a rebuild after touching
+ * one source. It fails when either total is over its budget, or when it
+ * grew by more than the threshold percent against the baseline. The steps
+ * that grew the most are then listed, or the slowest steps when there is
+ * no baseline.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Some macros to make the code more readable. */
+#define MAX_LINE_LENGTH 4096
+#define MAX_NAME_LENGTH 1024
+#define DEFAULT_THRESHOLD 10.0
+#define MIN_GROWTH_SECONDS 0.1
+#define REPORT_STEPS 10
+#define PHASE_COUNT 2
+
+/** The names of the two builds, as written to the results. */
+static const char *const PHASES[PHASE_COUNT] = {"clean", "rebuild"};
+
+/** One timed compiler invocation. */
+typedef struct {
+  int phase;
+  char kind[16];
+  char name[MAX_NAME_LENGTH];
+  double seconds;
+  double growth;
+} Step;
+
+/** The timings of both builds. */
+typedef struct {
+  double totals[PHASE_COUNT];
+  Step *steps;
+  int count;
+  int capacity;
+} Timings;
+
+/** Helper function declarations. */
+static double now();
+static int runTimed(char **command, double *seconds);
+static void appendLine(const char *path, const char *line);
+static int wrap(const char *logPath, char **command);
+static int timeBuild(const char *logPath, char **command);
+static int check(int argc, char **argv);
+static bool readLog(const char *path, int phase, Timings *timings);
+static bool readResults(const char *path, Timings *timings);
+static bool writeResults(const char *path, Timings *timings);
+static void addStep(Timings *timings, int phase, const char *kind,
+                    const char *name, double seconds);
+static Step *findStep(Timings *timings, Step *step);
+static int compareGrowth(const void *a, const void *b);
+static int compareSeconds(const void *a, const void *b);
+
+/**
+ * Main function for the build timer.
+ */
+int main(int argc, char **argv) {
+  if (argc >= 4 && strcmp(argv[1], "wrap") == 0) {
+    return wrap(argv[2], argv + 3);
+  }
+  if (argc >= 4 && strcmp(argv[1], "time") == 0) {
+    return timeBuild(argv[2], argv + 3);
+  }
+  if (argc >= 2 && strcmp(argv[1], "check") == 0) {
+    return check(argc - 1, argv + 1);
+  }
+
+  fprintf(stderr, "Usage:\n");
+  fprintf(stderr, "buildtime wrap log.txt compiler [args...]\n");
+  fprintf(stderr, "buildtime time log.txt command [args...]\n");
+  fprintf(stderr, "buildtime check [-c seconds] [-r seconds] [-t percent] "
+                  "[-k baseline] [-o results.txt] clean.txt rebuild.txt\n");
+  return 1;
+}
+
+/**
+ * Reads the monotonic clock in seconds.
+ */
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/**
+ * Runs a command and measures how long it took.
+ * @return The command's exit status.
+ */
+static int runTimed(char **command, double *seconds) {
+  double start = now();
+  pid_t pid = fork();
+  if (pid == 0) {
+    execvp(command[0], command);
+    fprintf(stderr, "buildtime: unable to run %s\n", command[0]);
+    _exit(127);
+  }
+  int status;
+  if (pid < 0 || waitpid(pid, &status, 0) < 0) {
+    return 1;
+  }
+  *seconds = now() - start;
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+/**
+ * Appends a line to a log in a single write, so that lines from parallel
+ * steps do not interleave.
+ */
+static void appendLine(const char *path, const char *line) {
+  int fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+  if (fd >= 0) {
+    if (write(fd, line, strlen(line)) < 0) {
+      fprintf(stderr, "buildtime: unable to write %s\n", path);
+    }
+    close(fd);
+  }
+}
+
+/**
+ * Runs one compiler invocation and logs its time.
+ * @return The compiler's exit status.
+ */
+static int wrap(const char *logPath, char **command) {
+  const char *kind = "link", *output = NULL;
+  for (int i = 1; command[i] != NULL; i++) {
+    if (strcmp(command[i], "-c") == 0) {
+      kind = "compile";
+    } else if (strcmp(command[i], "-o") == 0 && command[i + 1] != NULL) {
+      output = command[i + 1];
+    }
+  }
+
+  double seconds = 0;
+  int status = runTimed(command, &seconds);
+  if (status == 0) {
+    char line[MAX_LINE_LENGTH];
+    snprintf(line, sizeof(line), "step %s %.1000s %.6f\n", kind,
+             output != NULL ? output : "a.out", seconds);
+    appendLine(logPath, line);
+  }
+  return status;
+}
+
+/**
+ * Runs a whole build and logs its total time.
+ * @return The build's exit status.
+ */
+static int timeBuild(const char *logPath, char **command) {
+  double seconds = 0;
+  int status = runTimed(command, &seconds);
+  char line[MAX_LINE_LENGTH];
+  snprintf(line, sizeof(line), "total %.6f\n", seconds);
+  appendLine(logPath, line);
+  printf("Build took %.2fs\n", seconds);
+  return status;
+}
+
+/**
+ * Checks both builds against the budgets and the baseline.
+ * @return 0 when within them, 1 otherwise.
+ */
+static int check(int argc, char **argv) {
+  double budgets[PHASE_COUNT] = {0, 0}, threshold = DEFAULT_THRESHOLD;
+  const char *baselinePath = NULL, *resultsPath = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "c:r:t:k:o:")) != -1) {
+    switch (opt) {
+    case 'c':
+      budgets[0] = atof(optarg);
+      break;
+    case 'r':
+      budgets[1] = atof(optarg);
+      break;
+    case 't':
+      threshold = atof(optarg);
+      break;
+    case 'k':
+      baselinePath = optarg;
+      break;
+    case 'o':
+      resultsPath = optarg;
+      break;
+    default:
+      return 1;
+    }
+  }
+  if (optind != argc - PHASE_COUNT) {
+    fprintf(stderr, "buildtime: expected the clean and rebuild logs\n");
+    return 1;
+  }
+
+  Timings current = {0}, baseline = {0};
+  for (int phase = 0; phase < PHASE_COUNT; phase++) {
+    if (!readLog(argv[optind + phase], phase, &current)) {
+      fprintf(stderr, "buildtime: unable to read %s\n", argv[optind + phase]);
+      return 1;
+    }
+  }
+  if (resultsPath != NULL && !writeResults(resultsPath, &current)) {
+    fprintf(stderr, "buildtime: unable to write %s\n", resultsPath);
+    return 1;
+  }
+  bool hasBaseline = baselinePath != NULL &&
+                     readResults(baselinePath, &baseline);
+
+  // A total fails on its budget, or on growth beyond both the threshold
+  // and the timer noise.
+  bool failed = false;
+  printf("%-8s %10s %10s %10s %8s\n", "build", "seconds", "budget",
+         "baseline", "change");
+  for (int phase = 0; phase < PHASE_COUNT; phase++) {
+    double total = current.totals[phase], before = baseline.totals[phase];
+    char budget[32] = "-", previous[32] = "-", change[32] = "-";
+    bool over = false;
+    if (budgets[phase] > 0) {
+      snprintf(budget, sizeof(budget), "%.2f", budgets[phase]);
+      over = total > budgets[phase];
+    }
+    if (hasBaseline && before > 0) {
+      snprintf(previous, sizeof(previous), "%.2f", before);
+      snprintf(change, sizeof(change), "%+.1f%%",
+               100.0 * (total - before) / before);
+      over = over || (total - before > MIN_GROWTH_SECONDS &&
+                      100.0 * (total - before) / before > threshold);
+    }
+    printf("%-8s %10.2f %10s %10s %8s%s\n", PHASES[phase], total, budget,
+           previous, change, over ? "  over budget" : "");
+    failed = failed || over;
+  }
+
+  // Rank the steps by how much they grew, or by how long they took.
+  for (int i = 0; i < current.count; i++) {
+    Step *step = &current.steps[i];
+    Step *before = hasBaseline ? findStep(&baseline, step) : NULL;
+    step->growth = step->seconds - (before != NULL ? before->seconds : 0);
+  }
+  qsort(current.steps, current.count, sizeof(Step),
+        hasBaseline ? compareGrowth : compareSeconds);
+  printf("\n%s\n",
+         hasBaseline ? "Steps that grew the most:" : "Slowest steps:");
+  for (int i = 0; i < current.count && i < REPORT_STEPS; i++) {
+    Step *step = &current.steps[i];
+    if (hasBaseline && step->growth <= 0) {
+      break;
+    }
+    printf("  %-8s %-8s %10.3fs", PHASES[step->phase], step->kind,
+           step->seconds);
+    if (hasBaseline) {
+      printf(" %+9.3fs", step->growth);
+    }
+    printf("  %s\n", step->name);
+  }
+
+  free(current.steps);
+  free(baseline.steps);
+  return failed ? 1 : 0;
+}
+
+/**
+ * Reads the steps and total of one build's log.
+ * @return True if a total was read, false otherwise.
+ */
+static bool readLog(const char *path, int phase, Timings *timings) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    return false;
+  }
+  bool hasTotal = false;
+  char line[MAX_LINE_LENGTH], kind[16], name[MAX_NAME_LENGTH];
+  double seconds;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    if (sscanf(line, "step %15s %1023s %lf", kind, name, &seconds) == 3) {
+      addStep(timings, phase, kind, name, seconds);
+    } else if (sscanf(line, "total %lf", &seconds) == 1) {
+      timings->totals[phase] = seconds;
+      hasTotal = true;
+    }
+  }
+  fclose(file);
+  return hasTotal;
+}
+
+/**
+ * Reads results saved by writeResults().
+ * @return True on success, false otherwise.
+ */
+static bool readResults(const char *path, Timings *timings) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    return false;
+  }
+  char line[MAX_LINE_LENGTH], phaseName[16], kind[16], name[MAX_NAME_LENGTH];
+  double seconds;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+      if (sscanf(line, "total %15s %lf", phaseName, &seconds) == 2 &&
+          strcmp(phaseName, PHASES[phase]) == 0) {
+        timings->totals[phase] = seconds;
+      } else if (sscanf(line, "step %15s %15s %1023s %lf", phaseName, kind,
+                        name, &seconds) == 4 &&
+                 strcmp(phaseName, PHASES[phase]) == 0) {
+        addStep(timings, phase, kind, name, seconds);
+      }
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+/**
+ * Saves the totals and the steps of both builds.
+ * @return True on success, false otherwise.
+ */
+static bool writeResults(const char *path, Timings *timings) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    return false;
+  }
+  for (int phase = 0; phase < PHASE_COUNT; phase++) {
+    fprintf(file, "total %s %.6f\n", PHASES[phase], timings->totals[phase]);
+  }
+  for (int i = 0; i < timings->count; i++) {
+    Step *step = &timings->steps[i];
+    fprintf(file, "step %s %s %s %.6f\n", PHASES[step->phase], step->kind,
+            step->name, step->seconds);
+  }
+  fclose(file);
+  return true;
+}
+
+/**
+ * Adds a step to the timings.
+ */
+static void addStep(Timings *timings, int phase, const char *kind,
+                    const char *name, double seconds) {
+  if (timings->count == timings->capacity) {
+    timings->capacity = timings->capacity > 0 ? timings->capacity * 2 : 64;
+    timings->steps = realloc(timings->steps, sizeof(Step) * timings->capacity);
+  }
+  Step *step = &timings->steps[timings->count++];
+  step->phase = phase;
+  snprintf(step->kind, sizeof(step->kind), "%s", kind);
+  snprintf(step->name, sizeof(step->name), "%s", name);
+  step->seconds = seconds;
+  step->growth = 0;
+}
+
+/**
+ * Finds the same step of the same build in other timings.
+ * @return The step, or NULL if there is none.
+ */
+static Step *findStep(Timings *timings, Step *step) {
+  for (int i = 0; i < timings->count; i++) {
+    Step *other = &timings->steps[i];
+    if (other->phase == step->phase && strcmp(other->kind, step->kind) == 0 &&
+        strcmp(other->name, step->name) == 0) {
+      return other;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Orders steps from the most grown to the least.
+ */
+static int compareGrowth(const void *a, const void *b) {
+  double first = ((const Step *)a)->growth, second = ((const Step *)b)->growth;
+  return (first < second) - (first > second);
+}
+
+/**
+ * Orders steps from the slowest to the fastest.
+ */
+static int compareSeconds(const void *a, const void *b) {
+  double first = ((const Step *)a)->seconds;
+  double second = ((const Step *)b)->seconds;
+  return (first < second) - (first > second);
+}
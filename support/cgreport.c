@@ -0,0 +1,503 @@
+/**
+ * cgreport sums the per-function counts from valgrind's cachegrind and
+ * callgrind output files and compares them with a stored baseline. makeGen
+ * writes it into .makegen/ for the generated cachesim and callgraph rules.
+ *
+ * Usage:
+ *   cgreport summarize counts.txt {cachegrind.out or callgrind.out}...
+ *   cgreport diff [-t tolerance] baseline.txt counts.txt
+ *
+ * "summarize" writes one line per function to counts.txt with its count of
+ * each event, such as instructions (Ir) and cache misses (D1mr), and prints
+ * the functions with the most instructions. Callgrind files also give each
+ * function's instructions including its callees (Ir:incl). "diff" prints
+ * the totals and the functions that changed most against the baseline, and
+ * fails if the total instruction count grew by more than the tolerance, in
+ * percent. Instruction counts do not depend on the machine's load, so the
+ * comparison is stable from run to run.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Some macros to make the code more readable. */
+#define MAX_LINE_LENGTH 65536
+#define MAX_EVENTS 16
+#define MAX_EVENT_LENGTH 32
+#define INCLUSIVE_SUFFIX ":incl"
+#define REPORT_FUNCTIONS 15
+#define DEFAULT_TOLERANCE 1.0
+
+/** A function's count of each event. */
+typedef struct {
+  char *name;
+  long long counts[MAX_EVENTS];
+} Function;
+
+/** The counts of every function, with the events they count. */
+typedef struct {
+  char events[MAX_EVENTS][MAX_EVENT_LENGTH];
+  int eventCount;
+  Function *functions;
+  int functionCount;
+  int functionCapacity;
+} Counts;
+
+/**
+ * A compressed callgrind name: "(id) name" defines it, "(id)" uses it. Ids
+ * are scoped to one output file, and only function names (fn= and cfn=,
+ * which share ids) are kept.
+ */
+typedef struct {
+  long id;
+  char *name;
+} CompressedName;
+
+static CompressedName *names;
+static int nameCount, nameCapacity;
+
+/** Helper function declarations. */
+static int summarize(const char *outputPath, char **inputs, int inputCount);
+static int diff(const char *baselinePath, const char *currentPath,
+                double tolerance);
+static bool readValgrindFile(const char *path, Counts *counts);
+static void setEvents(Counts *counts, char *list, bool callgrind);
+static int parseCosts(char *text, int skip, long long *costs);
+static const char *expandName(char *text);
+static void clearNames(void);
+static int findFunction(Counts *counts, const char *name);
+static bool readCounts(const char *path, Counts *counts);
+static void writeCounts(FILE *out, Counts *counts);
+static long long total(Counts *counts, int event);
+static int eventIndex(Counts *counts, const char *event);
+static void printTop(Counts *counts);
+
+static long long *sortDeltas;
+static int compareByFirstEvent(const void *a, const void *b);
+static int compareByDelta(const void *a, const void *b);
+
+/**
+ * Main function for the valgrind report tool.
+ */
+int main(int argc, char **argv) {
+  if (argc >= 4 && strcmp(argv[1], "summarize") == 0) {
+    return summarize(argv[2], argv + 3, argc - 3);
+  }
+  if (argc >= 2 && strcmp(argv[1], "diff") == 0) {
+    double tolerance = DEFAULT_TOLERANCE;
+    int opt;
+    optind = 2;
+    while ((opt = getopt(argc, argv, "t:")) != -1) {
+      if (opt == 't') {
+        tolerance = atof(optarg);
+      }
+    }
+    if (argc - optind == 2) {
+      return diff(argv[optind], argv[optind + 1], tolerance);
+    }
+  }
+
+  fprintf(stderr, "Usage:\n");
+  fprintf(stderr, "cgreport summarize counts.txt {valgrind output}...\n");
+  fprintf(stderr, "cgreport diff [-t tolerance] baseline.txt counts.txt\n");
+  return 1;
+}
+
+/**
+ * Sums the functions' counts over all the valgrind output files, writes
+ * them, and prints the busiest functions.
+ * @return The exit status.
+ */
+static int summarize(const char *outputPath, char **inputs, int inputCount) {
+  Counts counts;
+  memset(&counts, 0, sizeof(counts));
+  int read = 0;
+  for (int i = 0; i < inputCount; i++) {
+    read += readValgrindFile(inputs[i], &counts);
+  }
+  if (read == 0) {
+    fprintf(stderr, "cgreport: no valgrind output to read\n");
+    return 1;
+  }
+
+  FILE *out = fopen(outputPath, "w");
+  if (out == NULL) {
+    fprintf(stderr, "cgreport: unable to write %s\n", outputPath);
+    return 1;
+  }
+  writeCounts(out, &counts);
+  fclose(out);
+
+  printTop(&counts);
+  return 0;
+}
+
+/**
+ * Compares counts with a baseline: the total of each event, then the
+ * functions whose first event changed most.
+ * @return 1 if the first event's total grew by more than the tolerance,
+ * 0 otherwise.
+ */
+static int diff(const char *baselinePath, const char *currentPath,
+                double tolerance) {
+  Counts baseline, current;
+  memset(&baseline, 0, sizeof(baseline));
+  memset(&current, 0, sizeof(current));
+  if (!readCounts(baselinePath, &baseline) ||
+      !readCounts(currentPath, &current)) {
+    return 1;
+  }
+
+  printf("%-12s %16s %16s %9s\n", "event", "baseline", "current", "change");
+  for (int e = 0; e < current.eventCount; e++) {
+    int b = eventIndex(&baseline, current.events[e]);
+    long long before = b < 0 ? 0 : total(&baseline, b);
+    long long after = total(&current, e);
+    printf("%-12s %16lld %16lld", current.events[e], before, after);
+    if (before > 0) {
+      printf(" %+8.2f%%", 100.0 * (after - before) / before);
+    }
+    printf("\n");
+  }
+
+  // Functions only in the baseline are added with no counts, so that the
+  // ones that disappeared are shown too.
+  int event = eventIndex(&baseline, current.events[0]);
+  for (int i = 0; i < baseline.functionCount; i++) {
+    findFunction(&current, baseline.functions[i].name);
+  }
+  long long *deltas = malloc(sizeof(long long) * (current.functionCount + 1));
+  int *order = malloc(sizeof(int) * (current.functionCount + 1));
+  for (int i = 0; i < current.functionCount; i++) {
+    int b = findFunction(&baseline, current.functions[i].name);
+    long long before = event < 0 ? 0 : baseline.functions[b].counts[event];
+    deltas[i] = current.functions[i].counts[0] - before;
+    order[i] = i;
+  }
+  sortDeltas = deltas;
+  qsort(order, current.functionCount, sizeof(int), compareByDelta);
+
+  if (current.functionCount == 0 || deltas[order[0]] == 0) {
+    printf("\nNo function's %s changed\n", current.events[0]);
+    return 0;
+  }
+  printf("\nLargest changes in %s:\n", current.events[0]);
+  printf("  %-40s %16s %16s %9s\n", "function", "baseline", "current",
+         "change");
+  for (int i = 0; i < current.functionCount && i < REPORT_FUNCTIONS; i++) {
+    Function *function = &current.functions[order[i]];
+    if (deltas[order[i]] == 0) {
+      break;
+    }
+    long long after = function->counts[0];
+    long long before = after - deltas[order[i]];
+    printf("  %-40s %16lld %16lld", function->name, before, after);
+    if (before > 0) {
+      printf(" %+8.2f%%", 100.0 * (after - before) / before);
+    } else {
+      printf(" %9s", "new");
+    }
+    printf("\n");
+  }
+
+  long long before = event < 0 ? 0 : total(&baseline, event);
+  long long after = total(&current, 0);
+  if (before > 0 && 100.0 * (after - before) / before > tolerance) {
+    printf("\n%s grew by more than %.2f%%\n", current.events[0], tolerance);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * Adds the counts from a cachegrind or callgrind output file. Both have an
+ * "events:" line naming the counted events, "fn=" lines starting each
+ * function, and cost lines giving a source position and then the counts.
+ * In callgrind files a "calls=" line means the next cost line is the cost
+ * of a call, which counts towards the caller's inclusive cost only.
+ * @return True if the file was read, false otherwise.
+ */
+static bool readValgrindFile(const char *path, Counts *counts) {
+  FILE *in = fopen(path, "r");
+  if (in == NULL) {
+    fprintf(stderr, "cgreport: unable to read %s\n", path);
+    return false;
+  }
+
+  // The previous file's compressed names mean nothing in this one.
+  clearNames();
+
+  char line[MAX_LINE_LENGTH];
+  bool callgrind = false, call = false;
+  int positions = 1, function = -1;
+  long long costs[MAX_EVENTS];
+  while (fgets(line, sizeof(line), in) != NULL) {
+    line[strcspn(line, "\n")] = '\0';
+    if (strncmp(line, "# callgrind format", 18) == 0 ||
+        strncmp(line, "creator: callgrind", 18) == 0) {
+      callgrind = true;
+    } else if (strncmp(line, "positions:", 10) == 0) {
+      // Each cost line starts with one number per position kind.
+      positions = 0;
+      for (char *word = strtok(line + 10, " "); word != NULL;
+           word = strtok(NULL, " ")) {
+        positions++;
+      }
+    } else if (strncmp(line, "events:", 7) == 0) {
+      setEvents(counts, line + 7, callgrind);
+    } else if (strncmp(line, "fn=", 3) == 0) {
+      function = findFunction(counts, expandName(line + 3));
+    } else if (strncmp(line, "cfn=", 4) == 0) {
+      // Define the name even though the callee's own costs come later.
+      expandName(line + 4);
+    } else if (strncmp(line, "calls=", 6) == 0) {
+      call = true;
+    } else if (function >= 0 && (line[0] == '+' || line[0] == '-' ||
+                                 line[0] == '*' ||
+                                 (line[0] >= '0' && line[0] <= '9'))) {
+      int count = parseCosts(line, positions, costs);
+      Function *current = &counts->functions[function];
+      int inclusive = callgrind ? counts->eventCount - 1 : -1;
+      if (!call) {
+        for (int e = 0; e < count && e != inclusive; e++) {
+          current->counts[e] += costs[e];
+        }
+      }
+      if (inclusive > 0 && count > 0) {
+        current->counts[inclusive] += costs[0];
+      }
+      call = false;
+    }
+  }
+  fclose(in);
+  return true;
+}
+
+/**
+ * Sets the counted events from an "events:" line, the first time one is
+ * seen. Callgrind counts also get the inclusive count of the first event.
+ */
+static void setEvents(Counts *counts, char *list, bool callgrind) {
+  if (counts->eventCount > 0) {
+    return;
+  }
+  for (char *event = strtok(list, " "); event != NULL;
+       event = strtok(NULL, " ")) {
+    if (counts->eventCount < MAX_EVENTS - 1) {
+      snprintf(counts->events[counts->eventCount++], MAX_EVENT_LENGTH, "%s",
+               event);
+    }
+  }
+  if (callgrind && counts->eventCount > 0) {
+    char first[MAX_EVENT_LENGTH];
+    memcpy(first, counts->events[0], sizeof(first));
+    snprintf(counts->events[counts->eventCount++], MAX_EVENT_LENGTH,
+             "%.*s%s", (int)(MAX_EVENT_LENGTH - sizeof(INCLUSIVE_SUFFIX)),
+             first, INCLUSIVE_SUFFIX);
+  }
+}
+
+/**
+ * Reads the counts from a cost line. Counts left off the end are zero.
+ * @param skip The number of position numbers before the counts.
+ * @param costs Set to the counts.
+ * @return The number of counts read.
+ */
+static int parseCosts(char *text, int skip, long long *costs) {
+  int count = 0;
+  memset(costs, 0, sizeof(long long) * MAX_EVENTS);
+  for (char *word = strtok(text, " "); word != NULL;
+       word = strtok(NULL, " ")) {
+    if (skip > 0) {
+      skip--;
+    } else if (count < MAX_EVENTS) {
+      costs[count++] = atoll(word);
+    }
+  }
+  return count;
+}
+
+/**
+ * Expands a possibly compressed callgrind name. "(id) name" defines the id
+ * and "(id)" refers back to it; other names are used as they are.
+ * @return The name.
+ */
+static const char *expandName(char *text) {
+  long id;
+  int consumed = 0;
+  if (sscanf(text, "(%ld)%n", &id, &consumed) != 1 || consumed == 0) {
+    return text;
+  }
+  const char *name = text + consumed + strspn(text + consumed, " ");
+  for (int i = 0; i < nameCount; i++) {
+    if (names[i].id == id) {
+      return names[i].name;
+    }
+  }
+
+  if (nameCount == nameCapacity) {
+    nameCapacity = nameCapacity == 0 ? 1024 : nameCapacity * 2;
+    names = realloc(names, sizeof(CompressedName) * nameCapacity);
+  }
+  names[nameCount].id = id;
+  names[nameCount].name = strdup(name);
+  return names[nameCount++].name;
+}
+
+/**
+ * Forgets every compressed name.
+ */
+static void clearNames(void) {
+  for (int i = 0; i < nameCount; i++) {
+    free(names[i].name);
+  }
+  nameCount = 0;
+}
+
+/**
+ * Finds a function by name, adding it with no counts if it is new.
+ * @return The index of the function.
+ */
+static int findFunction(Counts *counts, const char *name) {
+  for (int i = 0; i < counts->functionCount; i++) {
+    if (strcmp(counts->functions[i].name, name) == 0) {
+      return i;
+    }
+  }
+
+  if (counts->functionCount == counts->functionCapacity) {
+    counts->functionCapacity =
+        counts->functionCapacity == 0 ? 256 : counts->functionCapacity * 2;
+    counts->functions = realloc(counts->functions,
+                                sizeof(Function) * counts->functionCapacity);
+  }
+  Function *function = &counts->functions[counts->functionCount];
+  memset(function, 0, sizeof(Function));
+  function->name = strdup(name);
+  return counts->functionCount++;
+}
+
+/**
+ * Reads counts written by summarize: an "events:" line, then a line per
+ * function with its name and a count per event, separated by tabs.
+ * @return True if the counts were read, false otherwise.
+ */
+static bool readCounts(const char *path, Counts *counts) {
+  FILE *in = fopen(path, "r");
+  if (in == NULL) {
+    fprintf(stderr, "cgreport: unable to read %s\n", path);
+    return false;
+  }
+  char line[MAX_LINE_LENGTH];
+  while (fgets(line, sizeof(line), in) != NULL) {
+    line[strcspn(line, "\n")] = '\0';
+    if (strncmp(line, "events:", 7) == 0) {
+      setEvents(counts, line + 7, false);
+      continue;
+    }
+    char *name = strtok(line, "\t");
+    if (name == NULL) {
+      continue;
+    }
+    int index = findFunction(counts, name);
+    Function *function = &counts->functions[index];
+    char *count;
+    for (int e = 0; e < counts->eventCount && (count = strtok(NULL, "\t"));
+         e++) {
+      function->counts[e] = atoll(count);
+    }
+  }
+  fclose(in);
+  return counts->eventCount > 0;
+}
+
+/**
+ * Writes counts in the form readCounts reads, busiest function first.
+ */
+static void writeCounts(FILE *out, Counts *counts) {
+  fprintf(out, "events:");
+  for (int e = 0; e < counts->eventCount; e++) {
+    fprintf(out, " %s", counts->events[e]);
+  }
+  fprintf(out, "\n");
+
+  qsort(counts->functions, counts->functionCount, sizeof(Function),
+        compareByFirstEvent);
+  for (int i = 0; i < counts->functionCount; i++) {
+    fprintf(out, "%s", counts->functions[i].name);
+    for (int e = 0; e < counts->eventCount; e++) {
+      fprintf(out, "\t%lld", counts->functions[i].counts[e]);
+    }
+    fprintf(out, "\n");
+  }
+}
+
+/**
+ * Sums an event over all functions. Inclusive counts overlap, so their
+ * total is the largest one instead.
+ */
+static long long total(Counts *counts, int event) {
+  bool inclusive = strstr(counts->events[event], INCLUSIVE_SUFFIX) != NULL;
+  long long sum = 0;
+  for (int i = 0; i < counts->functionCount; i++) {
+    long long count = counts->functions[i].counts[event];
+    sum = inclusive ? (count > sum ? count : sum) : sum + count;
+  }
+  return sum;
+}
+
+/**
+ * Finds an event by name.
+ * @return The index of the event, or -1 if it is not counted.
+ */
+static int eventIndex(Counts *counts, const char *event) {
+  for (int e = 0; e < counts->eventCount; e++) {
+    if (strcmp(counts->events[e], event) == 0) {
+      return e;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Prints the functions with the most of the first event, which the counts
+ * are already sorted by.
+ */
+static void printTop(Counts *counts) {
+  long long sum = total(counts, 0);
+  printf("  %-40s", "function");
+  for (int e = 0; e < counts->eventCount; e++) {
+    printf(" %14s", counts->events[e]);
+  }
+  printf(" %7s\n", "share");
+  for (int i = 0; i < counts->functionCount && i < REPORT_FUNCTIONS; i++) {
+    printf("  %-40s", counts->functions[i].name);
+    for (int e = 0; e < counts->eventCount; e++) {
+      printf(" %14lld", counts->functions[i].counts[e]);
+    }
+    printf(" %6.2f%%\n",
+           sum == 0 ? 0 : 100.0 * counts->functions[i].counts[0] / sum);
+  }
+}
+
+/**
+ * Orders functions by their first event, most first, for qsort.
+ */
+static int compareByFirstEvent(const void *a, const void *b) {
+  long long x = ((const Function *)a)->counts[0];
+  long long y = ((const Function *)b)->counts[0];
+  return (x < y) - (x > y);
+}
+
+/**
+ * Orders function indices by the size of their change, largest first, for
+ * qsort.
+ */
+static int compareByDelta(const void *a, const void *b) {
+  long long x = llabs(sortDeltas[*(const int *)a]);
+  long long y = llabs(sortDeltas[*(const int *)b]);
+  return (x < y) - (x > y);
+}
@@ -0,0 +1,24 @@
+#!/bin/sh
+# Regenerates the embedded copy of each support file. makeGen writes these
+# copies into .makegen/ so that generated Makefiles can build the support
+# tools without makeGen's sources. Run this after editing any support/*.c or
+# support/*.h file.
+
+cd "$(dirname "$0")" || exit 1
+mkdir -p embedded
+
+for file in *.c *.h; do
+  [ -e "$file" ] || continue
+  name=${file%.*}
+  case "$file" in
+  *.c) symbol=$(echo "$name" | tr 'a-z' 'A-Z')_SOURCE ;;
+  *.h) symbol=$(echo "$name" | tr 'a-z' 'A-Z')_HEADER ;;
+  esac
+  {
+    echo "/* Generated from $file by embed.sh. Do not edit. */"
+    echo "static const char *const $symbol[] = {"
+    sed -e 's/\\/\\\\/g' -e 's/"/\\"/g' -e 's/^/    "/' -e 's/$/\\n",/' \
+      "$file"
+    echo "    NULL};"
+  } >"embedded/$file.inc"
+done
@@ -0,0 +1,373 @@
+/**
+ * envtune helps the generated env-tune rule find the runtime settings a
+ * program runs fastest under. makeGen writes it into .makegen/.
+ *
+ * Usage:
+ *   envtune combos {NAME=value,value...}...
+ *   envtune run {combination} -- command [args...]
+ *   envtune report results.json launcher.sh
+ *
+ * Each axis of the matrix names a setting and the values to try, with "-"
+ * leaving the setting alone. "combos" prints every combination of the
+ * axes, one per line, as its settings joined by '+', or "default" when
+ * every setting is left alone.
+ *
+ * "run" applies a combination and replaces itself with the command. Most
+ * names are set as environment variables, with these exceptions:
+ *   THP=never        disables transparent huge pages for the process.
+ *   THP=malloc       has malloc ask for huge pages (glibc.malloc.hugetlb).
+ *   STACK=KB         sets the stack size limit, which is also the default
+ *                    stack size of new threads.
+ *   GLIBC_TUNABLES   values are added to any tunables already set.
+ *
+ * "report" reads the results bench wrote for a sweep labelled by
+ * combination, prints them fastest first against the default settings,
+ * and writes a launcher script that runs a command under the fastest. When
+ * the fastest is not significantly faster than the baseline, the launcher
+ * leaves every setting alone.
+ */
+
+#define _GNU_SOURCE
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Some macros to make the code more readable. */
+#define MAX_LINE_LENGTH 4096
+#define MAX_AXES 16
+#define MAX_COMBINATIONS 1024
+#define DEFAULT_LABEL "default"
+#define KEEP_VALUE "-"
+#define HUGETLB_TUNABLE "glibc.malloc.hugetlb=1"
+
+/** The bench result of one combination. */
+typedef struct {
+  char label[MAX_LINE_LENGTH];
+  double mean;
+  double ci95;
+} Combination;
+
+/** Helper function declarations. */
+static int printCombinations(int count, char **axes);
+static int run(char *label, char **command);
+static void addTunable(char *tunables, const char *tunable);
+static int report(const char *resultsPath, const char *launcherPath,
+                  const char *self);
+static int readCombinations(const char *path, Combination *combinations);
+static int writeLauncher(const char *path, const char *label,
+                         const char *self);
+static int compareCombinations(const void *a, const void *b);
+
+/**
+ * Main function for the environment tuner.
+ */
+int main(int argc, char **argv) {
+  if (argc >= 2 && strcmp(argv[1], "combos") == 0) {
+    return printCombinations(argc - 2, argv + 2);
+  }
+  if (argc >= 5 && strcmp(argv[1], "run") == 0 &&
+      strcmp(argv[3], "--") == 0) {
+    return run(argv[2], argv + 4);
+  }
+  if (argc == 4 && strcmp(argv[1], "report") == 0) {
+    return report(argv[2], argv[3], argv[0]);
+  }
+
+  fprintf(stderr, "Usage:\n");
+  fprintf(stderr, "envtune combos {NAME=value,value...}...\n");
+  fprintf(stderr, "envtune run {combination} -- command...\n");
+  fprintf(stderr, "envtune report results.json launcher.sh\n");
+  return 1;
+}
+
+/**
+ * Prints every combination of the axes' values.
+ * @return The exit status.
+ */
+static int printCombinations(int count, char **axes) {
+  if (count > MAX_AXES) {
+    fprintf(stderr, "envtune: at most %d axes\n", MAX_AXES);
+    return 1;
+  }
+
+  // Split each axis into its name and its values.
+  char names[MAX_AXES][MAX_LINE_LENGTH];
+  char values[MAX_AXES][MAX_LINE_LENGTH];
+  int valueCounts[MAX_AXES], digits[MAX_AXES];
+  for (int i = 0; i < count; i++) {
+    char *equals = strchr(axes[i], '=');
+    if (equals == NULL || equals == axes[i]) {
+      fprintf(stderr, "envtune: expected NAME=value,... but got %s\n",
+              axes[i]);
+      return 1;
+    }
+    snprintf(names[i], MAX_LINE_LENGTH, "%.*s", (int)(equals - axes[i]),
+             axes[i]);
+    snprintf(values[i], MAX_LINE_LENGTH, "%s", equals + 1);
+    valueCounts[i] = 1;
+    for (char *c = values[i]; *c != '\0'; c++) {
+      if (*c == ',') {
+        *c = '\0';
+        valueCounts[i]++;
+      }
+    }
+    digits[i] = 0;
+  }
+
+  // Count through the combinations like an odometer.
+  for (int printed = 0; printed < MAX_COMBINATIONS; printed++) {
+    char label[MAX_LINE_LENGTH] = "";
+    size_t length = 0;
+    for (int i = 0; i < count; i++) {
+      char *value = values[i];
+      for (int d = 0; d < digits[i]; d++) {
+        value += strlen(value) + 1;
+      }
+      if (strcmp(value, KEEP_VALUE) != 0 && length < sizeof(label)) {
+        length += snprintf(label + length, sizeof(label) - length, "%s%s=%s",
+                           length > 0 ? "+" : "", names[i], value);
+      }
+    }
+    printf("%s\n", length > 0 ? label : DEFAULT_LABEL);
+
+    int axis = 0;
+    while (axis < count && ++digits[axis] == valueCounts[axis]) {
+      digits[axis++] = 0;
+    }
+    if (axis == count) {
+      return 0;
+    }
+  }
+  fprintf(stderr, "envtune: stopped after %d combinations\n",
+          MAX_COMBINATIONS);
+  return 0;
+}
+
+/**
+ * Applies the combination's settings and replaces this process with the
+ * command.
+ * @return The exit status, if the command cannot be run.
+ */
+static int run(char *label, char **command) {
+  char tunables[MAX_LINE_LENGTH] = "";
+  if (getenv("GLIBC_TUNABLES") != NULL) {
+    snprintf(tunables, sizeof(tunables), "%s", getenv("GLIBC_TUNABLES"));
+  }
+
+  char *setting = strcmp(label, DEFAULT_LABEL) == 0 ? NULL : label;
+  while (setting != NULL) {
+    char *next = strchr(setting, '+');
+    if (next != NULL) {
+      *next++ = '\0';
+    }
+    char *value = strchr(setting, '=');
+    if (value == NULL) {
+      fprintf(stderr, "envtune: expected NAME=value but got %s\n", setting);
+      return 1;
+    }
+    *value++ = '\0';
+
+    if (strcmp(setting, "THP") == 0 && strcmp(value, "never") == 0) {
+      prctl(PR_SET_THP_DISABLE, 1, 0, 0, 0);
+    } else if (strcmp(setting, "THP") == 0 && strcmp(value, "malloc") == 0) {
+      addTunable(tunables, HUGETLB_TUNABLE);
+    } else if (strcmp(setting, "THP") == 0) {
+      fprintf(stderr, "envtune: THP must be never or malloc\n");
+      return 1;
+    } else if (strcmp(setting, "STACK") == 0) {
+      struct rlimit limit;
+      getrlimit(RLIMIT_STACK, &limit);
+      limit.rlim_cur = strtoull(value, NULL, 10) * 1024;
+      if (limit.rlim_max != RLIM_INFINITY && limit.rlim_cur > limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+      }
+      setrlimit(RLIMIT_STACK, &limit);
+    } else if (strcmp(setting, "GLIBC_TUNABLES") == 0) {
+      addTunable(tunables, value);
+    } else {
+      setenv(setting, value, 1);
+    }
+    setting = next;
+  }
+  if (tunables[0] != '\0') {
+    setenv("GLIBC_TUNABLES", tunables, 1);
+  }
+
+  execvp(command[0], command);
+  fprintf(stderr, "envtune: unable to run %s\n", command[0]);
+  return 127;
+}
+
+/**
+ * Adds a tunable to a colon separated list of them.
+ */
+static void addTunable(char *tunables, const char *tunable) {
+  size_t length = strlen(tunables);
+  snprintf(tunables + length, MAX_LINE_LENGTH - length, "%s%s",
+           length > 0 ? ":" : "", tunable);
+}
+
+/**
+ * Prints the combinations fastest first and writes the launcher for the
+ * fastest, or for the default settings when it is not significantly faster.
+ * @return The exit status.
+ */
+static int report(const char *resultsPath, const char *launcherPath,
+                  const char *self) {
+  static Combination combinations[MAX_COMBINATIONS];
+  int count = readCombinations(resultsPath, combinations);
+  if (count <= 0) {
+    fprintf(stderr, "envtune: unable to read %s\n", resultsPath);
+    return 1;
+  }
+  qsort(combinations, count, sizeof(Combination), compareCombinations);
+
+  // Compare against the default settings when they were swept, and
+  // otherwise against the slowest combination.
+  Combination *baseline = &combinations[count - 1];
+  for (int i = 0; i < count; i++) {
+    if (strcmp(combinations[i].label, DEFAULT_LABEL) == 0) {
+      baseline = &combinations[i];
+    }
+  }
+
+  printf("%12s %12s %10s %9s  %s\n", "mean (s)", "95% CI (s)", "runs/s",
+         "change", "settings");
+  for (int i = 0; i < count; i++) {
+    Combination *combination = &combinations[i];
+    printf("%12.6f %12.6f %10.2f %+8.1f%%  %s\n", combination->mean,
+           combination->ci95,
+           combination->mean > 0 ? 1.0 / combination->mean : 0.0,
+           baseline->mean > 0
+               ? 100.0 * (combination->mean - baseline->mean) / baseline->mean
+               : 0.0,
+           combination->label);
+  }
+
+  // The difference between two means is uncertain by the root of the sum
+  // of the squares of their own uncertainties.
+  Combination *best = &combinations[0];
+  double difference = baseline->mean - best->mean;
+  double margin = sqrt(best->ci95 * best->ci95 +
+                       baseline->ci95 * baseline->ci95);
+  printf("Best: %s\n", best->label);
+  if (best != baseline && baseline->mean > 0) {
+    printf("%.1f%% faster than %s (95%% CI %.1f%% to %.1f%%)%s\n",
+           100.0 * difference / baseline->mean, baseline->label,
+           100.0 * (difference - margin) / baseline->mean,
+           100.0 * (difference + margin) / baseline->mean,
+           difference > margin ? "" : ", not significant");
+  }
+
+  // Settings that are not significantly faster are not worth changing.
+  const char *picked = best->label;
+  if (best != baseline && !(difference > margin)) {
+    picked = DEFAULT_LABEL;
+    printf("Keeping the default settings in the launcher.\n");
+  }
+
+  if (writeLauncher(launcherPath, picked, self) != 0) {
+    fprintf(stderr, "envtune: unable to write %s\n", launcherPath);
+    return 1;
+  }
+  printf("Wrote %s\n", launcherPath);
+  return 0;
+}
+
+/**
+ * Reads back the label, mean and confidence interval of each combination.
+ * @return The number of combinations read, or -1 on error.
+ */
+static int readCombinations(const char *path, Combination *combinations) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    return -1;
+  }
+
+  int count = 0;
+  char line[MAX_LINE_LENGTH];
+  while (fgets(line, sizeof(line), file) != NULL) {
+    Combination *last = count > 0 ? &combinations[count - 1] : NULL;
+    if (count < MAX_COMBINATIONS &&
+        sscanf(line, " \"label\": \"%4095[^\"]\"",
+               combinations[count].label) == 1) {
+      combinations[count].mean = 0;
+      combinations[count++].ci95 = 0;
+    } else if (last != NULL) {
+      sscanf(line, " \"mean\": %lf", &last->mean);
+      sscanf(line, " \"ci95\": %lf", &last->ci95);
+    }
+  }
+  fclose(file);
+  return count;
+}
+
+/**
+ * Writes a shell script that runs its arguments under the combination. The
+ * script sets what the shell can itself and leaves the rest to envtune.
+ * @return 0 on success, or -1 on error.
+ */
+static int writeLauncher(const char *path, const char *label,
+                         const char *self) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    return -1;
+  }
+
+  fprintf(file, "#!/bin/sh\n");
+  fprintf(file, "# Runs a command under the settings picked by make "
+                "env-tune:\n");
+  fprintf(file, "# %s\n", label);
+
+  char settings[MAX_LINE_LENGTH];
+  snprintf(settings, sizeof(settings), "%s", label);
+  char *setting = strcmp(settings, DEFAULT_LABEL) == 0 ? NULL : settings;
+  bool needsSelf = false;
+  while (setting != NULL) {
+    char *next = strchr(setting, '+');
+    if (next != NULL) {
+      *next++ = '\0';
+    }
+    char *value = strchr(setting, '=');
+    if (value != NULL) {
+      *value++ = '\0';
+      if (strcmp(setting, "THP") == 0 ||
+          strcmp(setting, "GLIBC_TUNABLES") == 0) {
+        needsSelf = true;
+      } else if (strcmp(setting, "STACK") == 0) {
+        fprintf(file, "ulimit -s %s\n", value);
+      } else {
+        fprintf(file, "export %s='%s'\n", setting, value);
+      }
+    }
+    setting = next;
+  }
+
+  // Huge pages can only be turned off from inside the process, and the
+  // tunables are merged with any already set, so both go through envtune.
+  char resolved[PATH_MAX];
+  if (needsSelf && realpath(self, resolved) != NULL) {
+    fprintf(file, "exec '%s' run '%s' -- \"$@\"\n", resolved, label);
+  } else {
+    fprintf(file, "exec \"$@\"\n");
+  }
+  fclose(file);
+  chmod(path, 0755);
+  return 0;
+}
+
+/**
+ * Orders combinations from fastest to slowest.
+ */
+static int compareCombinations(const void *a, const void *b) {
+  double first = ((const Combination *)a)->mean;
+  double second = ((const Combination *)b)->mean;
+  return (first > second) - (first < second);
+}
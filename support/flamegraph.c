@@ -0,0 +1,443 @@
+/**
+ * flamegraph folds sampled call stacks and renders them as an SVG flame
+ * graph. makeGen writes it into .makegen/ for the generated flamegraph rule.
+ *
+ * Usage:
+ *   flamegraph fold < stacks.txt > folded.txt
+ *   flamegraph svg [title] < folded.txt > flamegraph.svg
+ *   objdump -d --disassemble=function prog | flamegraph annotate function
+ *       stacks.txt
+ *
+ * "fold" reads stacks in the format printed by perf script, which is also
+ * what the fpsampler shim writes, and prints one line per distinct stack:
+ * the frames from the outermost to the innermost, separated by semicolons,
+ * followed by the number of samples. "svg" draws those lines with the
+ * outermost frames at the bottom and each frame as wide as its share of the
+ * samples. "annotate" prefixes each instruction of a disassembled function
+ * with its share of the samples taken while that function was running.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Some macros to make the code more readable. */
+#define MAX_LINE_LENGTH 65536
+#define MAX_DEPTH 512
+#define IMAGE_WIDTH 1200
+#define FRAME_HEIGHT 16
+#define PADDING 10
+#define TITLE_HEIGHT 30
+#define CHAR_WIDTH 7
+#define MIN_FRAME_WIDTH 0.1
+#define MAX_FUNCTION_SIZE (1 << 20)
+
+/** A frame in the call tree, with the samples spent in it and its callees. */
+typedef struct Node {
+  char *name;
+  long samples;
+  struct Node **children;
+  int childCount;
+} Node;
+
+/** Helper function declarations. */
+static int fold();
+static void finishStack(char **frames, int depth, char ***stacks, int *count,
+                        int *capacity);
+static char *frameName(char *line);
+static int compareStrings(const void *a, const void *b);
+static int render(const char *title);
+static Node *childNamed(Node *parent, const char *name);
+static int treeDepth(Node *node);
+static void drawNode(Node *node, double x, int depth, double scale,
+                     long total, int imageHeight);
+static void printEscaped(const char *text, int maxLength);
+static int annotate(const char *function, const char *stacksPath);
+static long countInstructionSamples(const char *function,
+                                    const char *stacksPath, long *samples);
+
+/**
+ * Main function for the flame graph tool.
+ */
+int main(int argc, char **argv) {
+  if (argc >= 2 && strcmp(argv[1], "fold") == 0) {
+    return fold();
+  }
+  if (argc >= 2 && strcmp(argv[1], "svg") == 0) {
+    return render(argc >= 3 ? argv[2] : "Flame Graph");
+  }
+  if (argc >= 4 && strcmp(argv[1], "annotate") == 0) {
+    return annotate(argv[2], argv[3]);
+  }
+
+  fprintf(stderr, "Usage:\n");
+  fprintf(stderr, "flamegraph fold < stacks.txt > folded.txt\n");
+  fprintf(stderr, "flamegraph svg [title] < folded.txt > flamegraph.svg\n");
+  fprintf(stderr, "flamegraph annotate function stacks.txt < disassembly\n");
+  return 1;
+}
+
+/**
+ * Folds perf script stacks from stdin into counted stack lines on stdout.
+ * @return The exit status.
+ */
+static int fold() {
+  char **stacks = NULL;
+  int count = 0, capacity = 0;
+  char *frames[MAX_DEPTH];
+  int depth = 0;
+  char line[MAX_LINE_LENGTH];
+
+  // A sample is a header line naming the command, then one indented line
+  // per frame from the innermost outwards, then a blank line.
+  while (fgets(line, sizeof(line), stdin) != NULL) {
+    line[strcspn(line, "\n")] = '\0';
+    if (line[0] == '\0') {
+      finishStack(frames, depth, &stacks, &count, &capacity);
+      depth = 0;
+    } else if (line[0] != ' ' && line[0] != '\t') {
+      finishStack(frames, depth, &stacks, &count, &capacity);
+      depth = 0;
+      char *command = strtok(line, " \t");
+      frames[depth++] = strdup(command == NULL ? "[unknown]" : command);
+    } else if (depth > 0 && depth < MAX_DEPTH) {
+      frames[depth++] = frameName(line);
+    }
+  }
+  finishStack(frames, depth, &stacks, &count, &capacity);
+
+  // Count identical stacks.
+  if (count > 0) {
+    qsort(stacks, count, sizeof(char *), compareStrings);
+  }
+  for (int i = 0; i < count;) {
+    int same = 1;
+    while (i + same < count && strcmp(stacks[i], stacks[i + same]) == 0) {
+      same++;
+    }
+    printf("%s %d\n", stacks[i], same);
+    i += same;
+  }
+  return 0;
+}
+
+/**
+ * Joins a sample's frames into a stack line, outermost frame first, with
+ * the command as the root.
+ * @param frames The command followed by the frames, innermost first.
+ * @param depth The number of entries in frames.
+ * @param stacks The stack lines to append to.
+ * @param count The number of stack lines.
+ * @param capacity The capacity of the stack lines array.
+ */
+static void finishStack(char **frames, int depth, char ***stacks, int *count,
+                        int *capacity) {
+  if (depth < 2) {
+    for (int i = 0; i < depth; i++) {
+      free(frames[i]);
+    }
+    return;
+  }
+
+  size_t length = 0;
+  for (int i = 0; i < depth; i++) {
+    length += strlen(frames[i]) + 1;
+  }
+  char *stack = malloc(length);
+  strcpy(stack, frames[0]);
+  for (int i = depth - 1; i >= 1; i--) {
+    strcat(stack, ";");
+    strcat(stack, frames[i]);
+  }
+  for (int i = 0; i < depth; i++) {
+    free(frames[i]);
+  }
+
+  if (*count == *capacity) {
+    *capacity = *capacity == 0 ? 1024 : *capacity * 2;
+    *stacks = realloc(*stacks, sizeof(char *) * *capacity);
+  }
+  (*stacks)[(*count)++] = stack;
+}
+
+/**
+ * Extracts the function name from a perf script frame line of the form
+ * "address symbol+offset (object)".
+ * @param line The frame line.
+ * @return The function name, newly allocated.
+ */
+static char *frameName(char *line) {
+  char *symbol = line + strspn(line, " \t");
+  symbol += strcspn(symbol, " \t");
+  symbol += strspn(symbol, " \t");
+
+  // Drop the object in parentheses and the offset.
+  char *object = strstr(symbol, " (");
+  if (object != NULL) {
+    *object = '\0';
+  }
+  char *offset = strstr(symbol, "+0x");
+  if (offset != NULL) {
+    *offset = '\0';
+  }
+
+  // Semicolons separate frames in the folded output.
+  for (char *c = symbol; *c != '\0'; c++) {
+    *c = *c == ';' ? ':' : *c;
+  }
+  return strdup(*symbol == '\0' ? "[unknown]" : symbol);
+}
+
+/**
+ * Orders strings alphabetically for qsort.
+ */
+static int compareStrings(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * Renders folded stacks from stdin as an SVG flame graph on stdout.
+ * @param title The title of the graph.
+ * @return The exit status.
+ */
+static int render(const char *title) {
+  Node root = {"all", 0, NULL, 0};
+  char line[MAX_LINE_LENGTH];
+
+  // Build the call tree from the folded stacks.
+  while (fgets(line, sizeof(line), stdin) != NULL) {
+    char *countStart = strrchr(line, ' ');
+    if (countStart == NULL) {
+      continue;
+    }
+    *countStart = '\0';
+    long samples = atol(countStart + 1);
+
+    root.samples += samples;
+    Node *node = &root;
+    for (char *frame = strtok(line, ";"); frame != NULL;
+         frame = strtok(NULL, ";")) {
+      node = childNamed(node, frame);
+      node->samples += samples;
+    }
+  }
+
+  int depth = treeDepth(&root);
+  int imageHeight = TITLE_HEIGHT + depth * FRAME_HEIGHT + 2 * PADDING;
+  double scale =
+      root.samples > 0 ? (IMAGE_WIDTH - 2.0 * PADDING) / root.samples : 0;
+
+  printf("<?xml version=\"1.0\" standalone=\"no\"?>\n");
+  printf("<svg version=\"1.1\" width=\"%d\" height=\"%d\" "
+         "xmlns=\"http://www.w3.org/2000/svg\">\n",
+         IMAGE_WIDTH, imageHeight);
+  printf("<rect x=\"0\" y=\"0\" width=\"100%%\" height=\"100%%\" "
+         "fill=\"#f8f8f8\"/>\n");
+  printf("<text x=\"%d\" y=\"%d\" font-family=\"Verdana\" font-size=\"17\" "
+         "text-anchor=\"middle\">",
+         IMAGE_WIDTH / 2, TITLE_HEIGHT - 8);
+  printEscaped(title, MAX_LINE_LENGTH);
+  printf("</text>\n");
+  if (root.samples > 0) {
+    drawNode(&root, PADDING, 0, scale, root.samples, imageHeight);
+  }
+  printf("</svg>\n");
+  return 0;
+}
+
+/**
+ * Finds the child of a node with the given name, adding it if it is new.
+ */
+static Node *childNamed(Node *parent, const char *name) {
+  for (int i = 0; i < parent->childCount; i++) {
+    if (strcmp(parent->children[i]->name, name) == 0) {
+      return parent->children[i];
+    }
+  }
+
+  Node *child = calloc(1, sizeof(Node));
+  child->name = strdup(name);
+  parent->children =
+      realloc(parent->children, sizeof(Node *) * (parent->childCount + 1));
+  parent->children[parent->childCount++] = child;
+  return child;
+}
+
+/**
+ * Counts the levels of the call tree below and including a node.
+ */
+static int treeDepth(Node *node) {
+  int deepest = 0;
+  for (int i = 0; i < node->childCount; i++) {
+    int depth = treeDepth(node->children[i]);
+    deepest = depth > deepest ? depth : deepest;
+  }
+  return deepest + 1;
+}
+
+/**
+ * Draws a frame and, on top of it, its callees.
+ * @param node The frame to draw.
+ * @param x The left edge of the frame.
+ * @param depth How many frames lie below this one.
+ * @param scale The width of one sample.
+ * @param total The total number of samples.
+ * @param imageHeight The height of the image.
+ */
+static void drawNode(Node *node, double x, int depth, double scale,
+                     long total, int imageHeight) {
+  double width = node->samples * scale;
+  if (width < MIN_FRAME_WIDTH) {
+    return;
+  }
+  int y = imageHeight - PADDING - (depth + 1) * FRAME_HEIGHT;
+
+  // Warm colors, derived from the name so a function keeps its color.
+  unsigned hash = 5381;
+  for (const char *c = node->name; *c != '\0'; c++) {
+    hash = hash * 33 + (unsigned char)*c;
+  }
+  int red = 205 + hash % 50;
+  int green = (hash / 50) % 230;
+  int blue = (hash / 11500) % 55;
+
+  printf("<g><title>");
+  printEscaped(node->name, MAX_LINE_LENGTH);
+  printf(" (%ld samples, %.2f%%)</title>", node->samples,
+         100.0 * node->samples / total);
+  printf("<rect x=\"%.1f\" y=\"%d\" width=\"%.1f\" height=\"%d\" "
+         "fill=\"rgb(%d,%d,%d)\" rx=\"2\"/>",
+         x, y, width, FRAME_HEIGHT - 1, red, green, blue);
+  int fits = (int)(width / CHAR_WIDTH) - 1;
+  if (fits >= 3) {
+    printf("<text x=\"%.1f\" y=\"%d\" font-family=\"Verdana\" "
+           "font-size=\"12\">",
+           x + 3, y + FRAME_HEIGHT - 4);
+    printEscaped(node->name, fits);
+    printf("</text>");
+  }
+  printf("</g>\n");
+
+  double childX = x;
+  for (int i = 0; i < node->childCount; i++) {
+    drawNode(node->children[i], childX, depth + 1, scale, total,
+             imageHeight);
+    childX += node->children[i]->samples * scale;
+  }
+}
+
+/**
+ * Prints text escaped for XML, cut to a maximum length with "..".
+ */
+static void printEscaped(const char *text, int maxLength) {
+  int length = (int)strlen(text);
+  bool cut = length > maxLength;
+  int shown = cut ? maxLength - 2 : length;
+
+  for (int i = 0; i < shown; i++) {
+    switch (text[i]) {
+    case '&':
+      printf("&amp;");
+      break;
+    case '<':
+      printf("&lt;");
+      break;
+    case '>':
+      printf("&gt;");
+      break;
+    case '"':
+      printf("&quot;");
+      break;
+    default:
+      putchar(text[i]);
+    }
+  }
+  if (cut) {
+    printf("..");
+  }
+}
+
+/**
+ * Copies objdump output for a function from stdin to stdout, prefixing each
+ * instruction with its share of the function's samples. Without samples
+ * the disassembly is copied as it is.
+ * @param function The disassembled function.
+ * @param stacksPath The perf script stacks to take the samples from.
+ * @return The exit status.
+ */
+static int annotate(const char *function, const char *stacksPath) {
+  long *samples = calloc(MAX_FUNCTION_SIZE, sizeof(long));
+  long total = countInstructionSamples(function, stacksPath, samples);
+  if (total > 0) {
+    printf("%ld samples in %s\n", total, function);
+  } else {
+    printf("No samples in %s; run make flamegraph to take some\n",
+           function);
+  }
+
+  // The function starts at a line such as "0000000000001139 <name>:",
+  // followed by instruction lines such as "    1140:\tmov ...".
+  char line[MAX_LINE_LENGTH], name[MAX_LINE_LENGTH];
+  unsigned long start = 0, address;
+  while (fgets(line, sizeof(line), stdin) != NULL) {
+    int consumed = 0;
+    if (sscanf(line, "%lx <%[^>]>:", &address, name) == 2) {
+      start = address;
+      printf("%8s %s", "", line);
+    } else if (sscanf(line, " %lx:%n", &address, &consumed) == 1 &&
+               consumed > 0 && address >= start &&
+               address - start < MAX_FUNCTION_SIZE && total > 0 &&
+               samples[address - start] > 0) {
+      printf("%7.2f%% %s", 100.0 * samples[address - start] / total, line);
+    } else {
+      printf("%8s %s", "", line);
+    }
+  }
+  free(samples);
+  return 0;
+}
+
+/**
+ * Counts the samples at each instruction of a function, from the innermost
+ * frame of each perf script stack.
+ * @param samples Set to the samples at each offset into the function.
+ * @return The number of samples in the function.
+ */
+static long countInstructionSamples(const char *function,
+                                    const char *stacksPath, long *samples) {
+  FILE *in = fopen(stacksPath, "r");
+  if (in == NULL) {
+    return 0;
+  }
+
+  // The innermost frame is the first frame line after each header line.
+  char line[MAX_LINE_LENGTH];
+  long total = 0;
+  bool innermost = false;
+  size_t length = strlen(function);
+  while (fgets(line, sizeof(line), in) != NULL) {
+    if (line[0] != ' ' && line[0] != '\t') {
+      innermost = line[0] != '\n';
+      continue;
+    }
+    if (!innermost) {
+      continue;
+    }
+    innermost = false;
+
+    // The frame is "address symbol+offset (object)".
+    char *symbol = line + strspn(line, " \t");
+    symbol += strcspn(symbol, " \t");
+    symbol += strspn(symbol, " \t");
+    unsigned long offset;
+    if (strncmp(symbol, function, length) == 0 &&
+        sscanf(symbol + length, "+0x%lx", &offset) == 1 &&
+        offset < MAX_FUNCTION_SIZE) {
+      samples[offset]++;
+      total++;
+    }
+  }
+  fclose(in);
+  return total;
+}
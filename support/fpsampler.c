@@ -0,0 +1,154 @@
+/**
+ * fpsampler is a sampling profiler loaded with LD_PRELOAD. makeGen writes it
+ * into .makegen/ for the generated flamegraph rule to use when perf is not
+ * available.
+ *
+ * Usage:
+ *   FPSAMPLER_OUTPUT=stacks.txt LD_PRELOAD=/path/to/fpsampler.so program
+ *
+ * Every millisecond of CPU time the running thread is interrupted and its
+ * call stack is recorded by following the frame pointers, so the program
+ * should be built with -fno-omit-frame-pointer. At exit the stacks are
+ * appended to the output file in the format printed by perf script, with
+ * function names read from the symbol table of each loaded object.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "stacks.h"
+
+/* Some macros to make the code more readable. */
+#define MAX_SAMPLES 20000
+#define MAX_DEPTH 64
+#define SAMPLE_INTERVAL_USEC 1000
+#define MAX_STACK_SPAN (8 * 1024 * 1024)
+#define MAX_LINE_LENGTH 1024
+
+static uintptr_t samples[MAX_SAMPLES][MAX_DEPTH];
+static int depths[MAX_SAMPLES];
+static atomic_int sampleCount;
+static const char *outputPath;
+
+/** Helper function declarations. */
+static void onSample(int signal, siginfo_t *info, void *context);
+static void writeFrame(int fd, uintptr_t address);
+
+/**
+ * Starts sampling when the library is loaded, if an output file is set.
+ */
+__attribute__((constructor)) static void startSampling(void) {
+  outputPath = getenv("FPSAMPLER_OUTPUT");
+  if (outputPath == NULL) {
+    return;
+  }
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = onSample;
+  action.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGPROF, &action, NULL);
+
+  struct itimerval timer = {{0, SAMPLE_INTERVAL_USEC},
+                            {0, SAMPLE_INTERVAL_USEC}};
+  setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+/**
+ * Stops sampling and writes the stacks when the program exits.
+ */
+__attribute__((destructor)) static void stopSampling(void) {
+  if (outputPath == NULL) {
+    return;
+  }
+  struct itimerval off = {{0, 0}, {0, 0}};
+  setitimer(ITIMER_PROF, &off, NULL);
+
+  int fd = open(outputPath, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (fd < 0) {
+    return;
+  }
+
+  int count = atomic_load(&sampleCount);
+  count = count > MAX_SAMPLES ? MAX_SAMPLES : count;
+  for (int i = 0; i < count; i++) {
+    char header[MAX_LINE_LENGTH];
+    int length = snprintf(header, sizeof(header), "%s %d 0.0: cpu-clock:\n",
+                          program_invocation_short_name, (int)getpid());
+    write(fd, header, length);
+    for (int d = 0; d < depths[i]; d++) {
+      writeFrame(fd, samples[i][d]);
+    }
+    write(fd, "\n", 1);
+  }
+  close(fd);
+}
+
+/**
+ * Records the interrupted call stack. The walk starts from the interrupted
+ * frame pointer and stops at anything that does not look like a frame on
+ * this thread's stack.
+ */
+static void onSample(int signal, siginfo_t *info, void *context) {
+  (void)signal;
+  (void)info;
+  int slot = atomic_fetch_add(&sampleCount, 1);
+  if (slot >= MAX_SAMPLES) {
+    return;
+  }
+
+  ucontext_t *interrupted = context;
+  uintptr_t pc = 0, fp = 0;
+#if defined(__x86_64__)
+  pc = interrupted->uc_mcontext.gregs[REG_RIP];
+  fp = interrupted->uc_mcontext.gregs[REG_RBP];
+#elif defined(__aarch64__)
+  pc = interrupted->uc_mcontext.pc;
+  fp = interrupted->uc_mcontext.regs[29];
+#else
+  (void)interrupted;
+#endif
+
+  // The interrupted frames lie above the handler's frame on the stack.
+  uintptr_t low = (uintptr_t)__builtin_frame_address(0);
+  uintptr_t high = low + MAX_STACK_SPAN;
+  int depth = 0;
+  samples[slot][depth++] = pc;
+  while (depth < MAX_DEPTH && fp > low && fp < high &&
+         fp % sizeof(uintptr_t) == 0) {
+    uintptr_t *frame = (uintptr_t *)fp;
+    if (frame[1] == 0) {
+      break;
+    }
+    // Point into the call instruction rather than after it.
+    samples[slot][depth++] = frame[1] - 1;
+    if (frame[0] <= fp) {
+      break;
+    }
+    fp = frame[0];
+  }
+  depths[slot] = depth;
+}
+
+/**
+ * Writes one frame line in the format printed by perf script.
+ * @param fd The output file.
+ * @param address The code address of the frame.
+ */
+static void writeFrame(int fd, uintptr_t address) {
+  char line[MAX_LINE_LENGTH];
+  int length = snprintf(line, sizeof(line), "\t%lx ", (unsigned long)address);
+  length += formatFrame(line + length, sizeof(line) - length - 1, address);
+  line[length++] = '\n';
+  write(fd, line, length);
+}
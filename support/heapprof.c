@@ -0,0 +1,442 @@
+/**
+ * heapprof is an allocation profiler loaded with LD_PRELOAD. makeGen writes
+ * it into .makegen/ for the generated heapprof rule.
+ *
+ * Usage:
+ *   HEAPPROF_OUTPUT=heapprof.txt [HEAPPROF_PROGRAM=name] \
+ *   LD_PRELOAD=/path/to/heapprof.so program
+ *
+ * malloc, calloc, realloc, free and the aligned allocation functions are
+ * interposed. Each allocation is counted against its call site, the few
+ * innermost frames of its call stack, found by following the frame
+ * pointers. The heap in use is tracked from the usable size of each block,
+ * and its peak is recorded over time. At exit a report of the busiest call
+ * sites and the heap over time is appended to the output file. With
+ * HEAPPROF_PROGRAM set, only processes of that name are profiled.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <malloc.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "stacks.h"
+
+/* Some macros to make the code more readable. */
+#define MAX_SITES 16384
+#define SITE_DEPTH 6
+#define MAX_TIMELINE 4096
+#define TIMELINE_INTERVAL_NSEC 1000000
+#define REPORT_SITES 10
+#define REPORT_ROWS 20
+#define BAR_WIDTH 40
+#define BOOTSTRAP_SIZE 65536
+#define MAX_LINE_LENGTH 1024
+
+/** Allocations made from one call site. */
+typedef struct {
+  uintptr_t frames[SITE_DEPTH];
+  int depth;
+  uint64_t count;
+  uint64_t bytes;
+} Site;
+
+/** The peak heap use during one interval of the run. */
+typedef struct {
+  uint64_t nanoseconds;
+  int64_t peak;
+} TimelinePoint;
+
+static void *(*realMalloc)(size_t);
+static void *(*realCalloc)(size_t, size_t);
+static void *(*realRealloc)(void *, size_t);
+static void (*realFree)(void *);
+static int (*realPosixMemalign)(void **, size_t, size_t);
+static void *(*realAlignedAlloc)(size_t, size_t);
+
+// dlsym may allocate while the real functions are being looked up, so
+// those allocations come from a static buffer.
+static char bootstrap[BOOTSTRAP_SIZE];
+static size_t bootstrapUsed;
+static bool resolving;
+
+static bool enabled;
+static __thread bool busy;
+static atomic_flag siteLock = ATOMIC_FLAG_INIT;
+static Site sites[MAX_SITES];
+static atomic_uint_fast64_t allocations, frees, allocatedBytes;
+static atomic_int_fast64_t heapInUse, heapPeak, intervalPeak;
+static TimelinePoint timeline[MAX_TIMELINE];
+static int timelineCount;
+static uint64_t timelineInterval = TIMELINE_INTERVAL_NSEC;
+static uint64_t startTime, intervalStart;
+
+/** Helper function declarations. */
+static void resolve(void);
+static bool isBootstrap(void *ptr);
+static void recordAllocation(void *ptr, size_t requested);
+static void recordFree(void *ptr);
+static void recordSite(size_t requested);
+static void recordTimeline(void);
+static uint64_t now(void);
+static void report(FILE *out);
+static void printSites(FILE *out, int *order, int count, const char *title);
+static void formatBytes(char *buffer, size_t size, double bytes);
+static int compareByBytes(const void *a, const void *b);
+static int compareByCount(const void *a, const void *b);
+
+/**
+ * Starts profiling when the library is loaded, if an output file is set and
+ * this is the program to profile.
+ */
+__attribute__((constructor)) static void startProfiling(void) {
+  resolve();
+  const char *program = getenv("HEAPPROF_PROGRAM");
+  enabled = getenv("HEAPPROF_OUTPUT") != NULL &&
+            (program == NULL ||
+             strcmp(program, program_invocation_short_name) == 0);
+  startTime = intervalStart = now();
+}
+
+/**
+ * Appends the report to the output file when the program exits.
+ */
+__attribute__((destructor)) static void stopProfiling(void) {
+  if (!enabled) {
+    return;
+  }
+  busy = true;
+  enabled = false;
+  recordTimeline();
+
+  FILE *out = fopen(getenv("HEAPPROF_OUTPUT"), "a");
+  if (out != NULL) {
+    report(out);
+    fclose(out);
+  }
+}
+
+void *malloc(size_t size) {
+  if (realMalloc == NULL) {
+    resolve();
+    if (realMalloc == NULL) {
+      return calloc(1, size);
+    }
+  }
+  void *ptr = realMalloc(size);
+  recordAllocation(ptr, size);
+  return ptr;
+}
+
+void *calloc(size_t count, size_t size) {
+  if (realCalloc == NULL) {
+    resolve();
+  }
+  if (realCalloc == NULL) {
+    // Serve the lookup from the bootstrap buffer, which is zeroed.
+    size_t bytes = (count * size + 15) & ~(size_t)15;
+    if (bootstrapUsed + bytes > BOOTSTRAP_SIZE) {
+      return NULL;
+    }
+    void *ptr = bootstrap + bootstrapUsed;
+    bootstrapUsed += bytes;
+    return ptr;
+  }
+  void *ptr = realCalloc(count, size);
+  recordAllocation(ptr, count * size);
+  return ptr;
+}
+
+void *realloc(void *ptr, size_t size) {
+  if (realRealloc == NULL) {
+    resolve();
+  }
+  if (isBootstrap(ptr)) {
+    void *moved = malloc(size);
+    if (moved != NULL) {
+      size_t available = bootstrap + BOOTSTRAP_SIZE - (char *)ptr;
+      memcpy(moved, ptr, size < available ? size : available);
+    }
+    return moved;
+  }
+  recordFree(ptr);
+  void *result = realRealloc(ptr, size);
+  recordAllocation(result != NULL ? result : (size == 0 ? NULL : ptr), size);
+  return result;
+}
+
+void free(void *ptr) {
+  if (ptr == NULL || isBootstrap(ptr)) {
+    return;
+  }
+  if (realFree == NULL) {
+    resolve();
+  }
+  recordFree(ptr);
+  realFree(ptr);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) {
+  if (realPosixMemalign == NULL) {
+    resolve();
+  }
+  int result = realPosixMemalign(ptr, alignment, size);
+  if (result == 0) {
+    recordAllocation(*ptr, size);
+  }
+  return result;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+  if (realAlignedAlloc == NULL) {
+    resolve();
+  }
+  void *ptr = realAlignedAlloc(alignment, size);
+  recordAllocation(ptr, size);
+  return ptr;
+}
+
+/**
+ * Looks up the allocation functions that the interposed ones forward to.
+ */
+static void resolve(void) {
+  if (resolving || realFree != NULL) {
+    return;
+  }
+  resolving = true;
+  realCalloc = dlsym(RTLD_NEXT, "calloc");
+  realMalloc = dlsym(RTLD_NEXT, "malloc");
+  realRealloc = dlsym(RTLD_NEXT, "realloc");
+  realPosixMemalign = dlsym(RTLD_NEXT, "posix_memalign");
+  realAlignedAlloc = dlsym(RTLD_NEXT, "aligned_alloc");
+  realFree = dlsym(RTLD_NEXT, "free");
+  resolving = false;
+}
+
+/**
+ * Checks if a block came from the bootstrap buffer.
+ */
+static bool isBootstrap(void *ptr) {
+  return (char *)ptr >= bootstrap && (char *)ptr < bootstrap + BOOTSTRAP_SIZE;
+}
+
+/**
+ * Counts an allocation against the heap in use and its call site.
+ * @param ptr The allocated block, or NULL if the allocation failed.
+ * @param requested The number of bytes asked for.
+ */
+__attribute__((noinline)) static void
+recordAllocation(void *ptr, size_t requested) {
+  if (!enabled || busy || ptr == NULL) {
+    return;
+  }
+  busy = true;
+
+  int64_t usable = malloc_usable_size(ptr);
+  int64_t inUse = atomic_fetch_add(&heapInUse, usable) + usable;
+  int64_t peak = atomic_load(&heapPeak);
+  while (inUse > peak && !atomic_compare_exchange_weak(&heapPeak, &peak,
+                                                        inUse)) {
+  }
+  peak = atomic_load(&intervalPeak);
+  while (inUse > peak && !atomic_compare_exchange_weak(&intervalPeak, &peak,
+                                                        inUse)) {
+  }
+  atomic_fetch_add(&allocations, 1);
+  atomic_fetch_add(&allocatedBytes, requested);
+
+  recordSite(requested);
+  busy = false;
+}
+
+/**
+ * Takes a block that is about to be freed off the heap in use.
+ */
+static void recordFree(void *ptr) {
+  if (!enabled || busy || ptr == NULL) {
+    return;
+  }
+  atomic_fetch_sub(&heapInUse, malloc_usable_size(ptr));
+  atomic_fetch_add(&frees, 1);
+}
+
+/**
+ * Counts an allocation against the call site of the interposed function,
+ * and adds a point to the timeline when an interval has passed.
+ */
+__attribute__((noinline)) static void recordSite(size_t requested) {
+  // Leave out this function, recordAllocation and the interposed function.
+  uintptr_t frames[SITE_DEPTH];
+  int depth = walkStack(frames, SITE_DEPTH, 3);
+
+  uint64_t hash = 14695981039346656037ULL;
+  for (int i = 0; i < depth; i++) {
+    hash = (hash ^ frames[i]) * 1099511628211ULL;
+  }
+
+  while (atomic_flag_test_and_set_explicit(&siteLock, memory_order_acquire)) {
+  }
+  for (int probe = 0; probe < MAX_SITES; probe++) {
+    Site *site = &sites[(hash + probe) % MAX_SITES];
+    if (site->count == 0) {
+      memcpy(site->frames, frames, sizeof(uintptr_t) * depth);
+      site->depth = depth;
+    } else if (site->depth != depth ||
+               memcmp(site->frames, frames, sizeof(uintptr_t) * depth) != 0) {
+      continue;
+    }
+    site->count++;
+    site->bytes += requested;
+    break;
+  }
+  if (now() - intervalStart >= timelineInterval) {
+    recordTimeline();
+  }
+  atomic_flag_clear_explicit(&siteLock, memory_order_release);
+}
+
+/**
+ * Ends the current timeline interval. When the timeline is full, adjacent
+ * intervals are merged and the interval doubles, so a run of any length
+ * fits.
+ */
+static void recordTimeline(void) {
+  if (timelineCount == MAX_TIMELINE) {
+    for (int i = 0; i < MAX_TIMELINE / 2; i++) {
+      TimelinePoint *first = &timeline[2 * i], *second = &timeline[2 * i + 1];
+      timeline[i].nanoseconds = second->nanoseconds;
+      timeline[i].peak =
+          first->peak > second->peak ? first->peak : second->peak;
+    }
+    timelineCount = MAX_TIMELINE / 2;
+    timelineInterval *= 2;
+  }
+
+  uint64_t time = now();
+  timeline[timelineCount].nanoseconds = time - startTime;
+  timeline[timelineCount++].peak =
+      atomic_exchange(&intervalPeak, atomic_load(&heapInUse));
+  intervalStart = time;
+}
+
+/**
+ * Reads a cheap monotonic clock, in nanoseconds.
+ */
+static uint64_t now(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &time);
+  return time.tv_sec * 1000000000ULL + time.tv_nsec;
+}
+
+/**
+ * Prints the summary, the busiest call sites and the heap over time.
+ */
+static void report(FILE *out) {
+  char allocated[32], peak[32];
+  formatBytes(allocated, sizeof(allocated), atomic_load(&allocatedBytes));
+  formatBytes(peak, sizeof(peak), atomic_load(&heapPeak));
+
+  fprintf(out, "heapprof: %s (pid %d)\n", program_invocation_short_name,
+          (int)getpid());
+  fprintf(out, "  %llu allocations, %llu frees, %s allocated, "
+               "peak heap %s\n",
+          (unsigned long long)atomic_load(&allocations),
+          (unsigned long long)atomic_load(&frees), allocated, peak);
+
+  int *order = malloc(sizeof(int) * MAX_SITES);
+  int count = 0;
+  for (int i = 0; i < MAX_SITES; i++) {
+    if (sites[i].count > 0) {
+      order[count++] = i;
+    }
+  }
+  qsort(order, count, sizeof(int), compareByBytes);
+  printSites(out, order, count, "Top allocation sites by bytes");
+  qsort(order, count, sizeof(int), compareByCount);
+  printSites(out, order, count, "Top allocation sites by count");
+  free(order);
+
+  // Group the timeline into rows and draw each row's peak as a bar.
+  fprintf(out, "\nPeak heap over time:\n");
+  int perRow = (timelineCount + REPORT_ROWS - 1) / REPORT_ROWS;
+  int64_t highest = atomic_load(&heapPeak);
+  for (int row = 0; perRow > 0 && row * perRow < timelineCount; row++) {
+    int64_t rowPeak = 0;
+    int last = row * perRow;
+    for (int i = row * perRow; i < (row + 1) * perRow && i < timelineCount;
+         i++) {
+      rowPeak = timeline[i].peak > rowPeak ? timeline[i].peak : rowPeak;
+      last = i;
+    }
+    char bytes[32];
+    formatBytes(bytes, sizeof(bytes), rowPeak);
+    int bar = highest > 0 ? (int)(BAR_WIDTH * rowPeak / highest) : 0;
+    fprintf(out, "  %9.3fs %10s |%.*s\n", timeline[last].nanoseconds / 1e9,
+            bytes, bar, "########################################");
+  }
+  fprintf(out, "\n");
+}
+
+/**
+ * Prints the first few call sites in the given order, each with its stack.
+ */
+static void printSites(FILE *out, int *order, int count, const char *title) {
+  fprintf(out, "\n%s:\n", title);
+  fprintf(out, "  %10s %10s  %s\n", "bytes", "count", "call site");
+  for (int i = 0; i < count && i < REPORT_SITES; i++) {
+    Site *site = &sites[order[i]];
+    char bytes[32], frame[MAX_LINE_LENGTH];
+    formatBytes(bytes, sizeof(bytes), site->bytes);
+    if (site->depth == 0) {
+      fprintf(out, "  %10s %10llu  [unknown]\n", bytes,
+              (unsigned long long)site->count);
+      continue;
+    }
+    for (int d = 0; d < site->depth; d++) {
+      formatFrame(frame, sizeof(frame), site->frames[d]);
+      if (d == 0) {
+        fprintf(out, "  %10s %10llu  %s\n", bytes,
+                (unsigned long long)site->count, frame);
+      } else {
+        fprintf(out, "  %21s    <- %s\n", "", frame);
+      }
+    }
+  }
+}
+
+/**
+ * Formats a byte count with a binary unit.
+ */
+static void formatBytes(char *buffer, size_t size, double bytes) {
+  const char *units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+  int unit = 0;
+  while (bytes >= 1024 && unit < 4) {
+    bytes /= 1024;
+    unit++;
+  }
+  snprintf(buffer, size, unit == 0 ? "%.0f %s" : "%.1f %s", bytes,
+           units[unit]);
+}
+
+/**
+ * Orders call sites by bytes allocated, largest first, for qsort.
+ */
+static int compareByBytes(const void *a, const void *b) {
+  uint64_t x = sites[*(const int *)a].bytes;
+  uint64_t y = sites[*(const int *)b].bytes;
+  return (x < y) - (x > y);
+}
+
+/**
+ * Orders call sites by allocation count, largest first, for qsort.
+ */
+static int compareByCount(const void *a, const void *b) {
+  uint64_t x = sites[*(const int *)a].count;
+  uint64_t y = sites[*(const int *)b].count;
+  return (x < y) - (x > y);
+}
@@ -0,0 +1,852 @@
+/**
+ * ioprof is an I/O profiler loaded with LD_PRELOAD. makeGen writes it into
+ * .makegen/ for the generated ioprof rule.
+ *
+ * Usage:
+ *   IOPROF_OUTPUT=ioprof.txt [IOPROF_PROGRAM=name] \
+ *   LD_PRELOAD=/path/to/ioprof.so program
+ *
+ * The C library's open, close, read, write and fsync calls and their
+ * variants are interposed. Each is counted and timed, and the bytes moved
+ * are added to the file the descriptor refers to. Reads and writes smaller
+ * than SMALL_IO_BYTES are also counted against their call site, the few
+ * innermost frames of their call stack, since many small transfers are
+ * what buffering or mmap would save. At exit the report is appended to the
+ * output file. With IOPROF_PROGRAM set, only processes of that name are
+ * profiled.
+ *
+ * The main stdio calls are interposed too: fopen, fclose, fread, fwrite,
+ * fgets, fputs, puts and the printf family, including their fortified
+ * variants. They are counted as the program makes them, and their bytes
+ * are added to the file. Small ones are counted against their call site
+ * like small reads and writes. The system calls stdio makes to fill and flush
+ * its buffers happen inside the C library, where they cannot be
+ * interposed, so only strace sees those.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+
+#include "stacks.h"
+
+/* Some macros to make the code more readable. */
+#define MAX_FDS 4096
+#define MAX_FILES 4096
+#define MAX_SITES 4096
+#define MAX_PATH_LENGTH 256
+#define SITE_DEPTH 4
+#define SMALL_IO_BYTES 4096
+#define REPORT_FILES 10
+#define REPORT_SITES 5
+#define MAX_LINE_LENGTH 1024
+#define NEEDS_MODE(flags)                                                    \
+  (((flags) & O_CREAT) != 0 || ((flags) & O_TMPFILE) == O_TMPFILE)
+
+/** The interposed calls, counted separately. */
+enum {
+  CALL_OPEN,
+  CALL_CLOSE,
+  CALL_READ,
+  CALL_WRITE,
+  CALL_PREAD,
+  CALL_PWRITE,
+  CALL_READV,
+  CALL_WRITEV,
+  CALL_FSYNC,
+  CALL_FDATASYNC,
+  CALL_FOPEN,
+  CALL_FCLOSE,
+  CALL_FREAD,
+  CALL_FWRITE,
+  CALL_FGETS,
+  CALL_FPUTS,
+  CALL_FPRINTF,
+  CALL_COUNT
+};
+
+static const char *callNames[CALL_COUNT] = {
+    "open",   "close",  "read",  "write",  "pread", "pwrite",
+    "readv",  "writev", "fsync", "fdatasync", "fopen", "fclose",
+    "fread",  "fwrite", "fgets", "fputs", "fprintf"};
+
+/** The count and time of one interposed call. */
+typedef struct {
+  uint64_t calls;
+  uint64_t ns;
+  uint64_t bytes;
+} CallStats;
+
+/** The I/O on one file, over every descriptor that referred to it. */
+typedef struct {
+  char path[MAX_PATH_LENGTH];
+  uint64_t opens;
+  uint64_t reads;
+  uint64_t bytesRead;
+  uint64_t writes;
+  uint64_t bytesWritten;
+  uint64_t smallReads;
+  uint64_t smallWrites;
+  uint64_t syncs;
+  uint64_t syncNs;
+} File;
+
+/** The small reads or writes from one call site. */
+typedef struct {
+  uintptr_t frames[SITE_DEPTH];
+  int depth;
+  bool write;
+  uint64_t calls;
+  uint64_t bytes;
+} Site;
+
+static int (*realOpen)(const char *, int, ...);
+static int (*realOpenat)(int, const char *, int, ...);
+static int (*realClose)(int);
+static ssize_t (*realRead)(int, void *, size_t);
+static ssize_t (*realWrite)(int, const void *, size_t);
+static ssize_t (*realPread)(int, void *, size_t, off_t);
+static ssize_t (*realPwrite)(int, const void *, size_t, off_t);
+static ssize_t (*realReadv)(int, const struct iovec *, int);
+static ssize_t (*realWritev)(int, const struct iovec *, int);
+static int (*realFsync)(int);
+static int (*realFdatasync)(int);
+static FILE *(*realFopen)(const char *, const char *);
+static int (*realFclose)(FILE *);
+static size_t (*realFread)(void *, size_t, size_t, FILE *);
+static size_t (*realFreadChk)(void *, size_t, size_t, size_t, FILE *);
+static size_t (*realFwrite)(const void *, size_t, size_t, FILE *);
+static char *(*realFgets)(char *, int, FILE *);
+static char *(*realFgetsChk)(char *, size_t, int, FILE *);
+static int (*realFputs)(const char *, FILE *);
+static int (*realPuts)(const char *);
+static int (*realVfprintf)(FILE *, const char *, va_list);
+static int (*realVfprintfChk)(FILE *, int, const char *, va_list);
+
+static bool enabled;
+static __thread bool busy;
+static atomic_flag tableLock = ATOMIC_FLAG_INIT;
+static uint64_t startNs;
+static CallStats calls[CALL_COUNT];
+static int fdFiles[MAX_FDS]; // One more than the file index, or 0.
+static File files[MAX_FILES];
+static Site sites[MAX_SITES];
+
+/** Helper function declarations. */
+static void resolve(void);
+static int openFile(int call, int fd, const char *path, int dirfd,
+                    uint64_t start);
+static int streamFd(FILE *stream);
+static void recordCall(int call, int fd, ssize_t bytes, uint64_t start);
+static void recordSmall(bool write, ssize_t bytes);
+static File *fileFor(int fd);
+static File *findFile(const char *path);
+static uint64_t now(void);
+static void report(FILE *out);
+static int compareFiles(const void *a, const void *b);
+static int compareSites(const void *a, const void *b);
+
+/**
+ * Starts profiling when the library is loaded, if an output file is set and
+ * this is the program to profile.
+ */
+__attribute__((constructor)) static void startProfiling(void) {
+  resolve();
+  const char *program = getenv("IOPROF_PROGRAM");
+  enabled = getenv("IOPROF_OUTPUT") != NULL &&
+            (program == NULL ||
+             strcmp(program, program_invocation_short_name) == 0);
+  startNs = now();
+}
+
+/**
+ * Appends the report to the output file when the program exits.
+ */
+__attribute__((destructor)) static void stopProfiling(void) {
+  if (!enabled) {
+    return;
+  }
+  busy = true;
+  enabled = false;
+
+  FILE *out = fopen(getenv("IOPROF_OUTPUT"), "a");
+  if (out != NULL) {
+    report(out);
+    fclose(out);
+  }
+}
+
+int open(const char *path, int flags, ...) {
+  if (realOpen == NULL) {
+    resolve();
+  }
+  mode_t mode = 0;
+  if (NEEDS_MODE(flags)) {
+    va_list args;
+    va_start(args, flags);
+    mode = va_arg(args, mode_t);
+    va_end(args);
+  }
+  uint64_t start = now();
+  return openFile(CALL_OPEN, realOpen(path, flags, mode), path, AT_FDCWD,
+                  start);
+}
+
+int open64(const char *path, int flags, ...) {
+  mode_t mode = 0;
+  if (NEEDS_MODE(flags)) {
+    va_list args;
+    va_start(args, flags);
+    mode = va_arg(args, mode_t);
+    va_end(args);
+  }
+  return open(path, flags | O_LARGEFILE, mode);
+}
+
+int openat(int dirfd, const char *path, int flags, ...) {
+  if (realOpenat == NULL) {
+    resolve();
+  }
+  mode_t mode = 0;
+  if (NEEDS_MODE(flags)) {
+    va_list args;
+    va_start(args, flags);
+    mode = va_arg(args, mode_t);
+    va_end(args);
+  }
+  uint64_t start = now();
+  return openFile(CALL_OPEN, realOpenat(dirfd, path, flags, mode), path,
+                  dirfd, start);
+}
+
+int openat64(int dirfd, const char *path, int flags, ...) {
+  mode_t mode = 0;
+  if (NEEDS_MODE(flags)) {
+    va_list args;
+    va_start(args, flags);
+    mode = va_arg(args, mode_t);
+    va_end(args);
+  }
+  return openat(dirfd, path, flags | O_LARGEFILE, mode);
+}
+
+int creat(const char *path, mode_t mode) {
+  return open(path, O_CREAT | O_WRONLY | O_TRUNC, mode);
+}
+
+int close(int fd) {
+  if (realClose == NULL) {
+    resolve();
+  }
+  uint64_t start = now();
+  int result = realClose(fd);
+  recordCall(CALL_CLOSE, -1, 0, start);
+  if (fd >= 0 && fd < MAX_FDS) {
+    fdFiles[fd] = 0;
+  }
+  return result;
+}
+
+ssize_t read(int fd, void *buffer, size_t size) {
+  if (realRead == NULL) {
+    resolve();
+  }
+  uint64_t start = now();
+  ssize_t result = realRead(fd, buffer, size);
+  recordCall(CALL_READ, fd, result, start);
+  return result;
+}
+
+ssize_t write(int fd, const void *buffer, size_t size) {
+  if (realWrite == NULL) {
+    resolve();
+  }
+  uint64_t start = now();
+  ssize_t result = realWrite(fd, buffer, size);
+  recordCall(CALL_WRITE, fd, result, start);
+  return result;
+}
+
+ssize_t pread(int fd, void *buffer, size_t size, off_t offset) {
+  if (realPread == NULL) {
+    resolve();
+  }
+  uint64_t start = now();
+  ssize_t result = realPread(fd, buffer, size, offset);
+  recordCall(CALL_PREAD, fd, result, start);
+  return result;
+}
+
+ssize_t pread64(int fd, void *buffer, size_t size, off64_t offset) {
+  return pread(fd, buffer, size, offset);
+}
+
+ssize_t pwrite(int fd, const void *buffer, size_t size, off_t offset) {
+  if (realPwrite == NULL) {
+    resolve();
+  }
+  uint64_t start = now();
+  ssize_t result = realPwrite(fd, buffer, size, offset);
+  recordCall(CALL_PWRITE, fd, result, start);
+  return result;
+}
+
+ssize_t pwrite64(int fd, const void *buffer, size_t size, off64_t offset) {
+  return pwrite(fd, buffer, size, offset);
+}
+
+ssize_t readv(int fd, const struct iovec *vectors, int count) {
+  if (realReadv == NULL) {
+    resolve();
+  }
+  uint64_t start = now();
+  ssize_t result = realReadv(fd, vectors, count);
+  recordCall(CALL_READV, fd, result, start);
+  return result;
+}
+
+ssize_t writev(int fd, const struct iovec *vectors, int count) {
+  if (realWritev == NULL) {
+    resolve();
+  }
+  uint64_t start = now();
+  ssize_t result = realWritev(fd, vectors, count);
+  recordCall(CALL_WRITEV, fd, result, start);
+  return result;
+}
+
+int fsync(int fd) {
+  if (realFsync == NULL) {
+    resolve();
+  }
+  uint64_t start = now();
+  int result = realFsync(fd);
+  recordCall(CALL_FSYNC, fd, 0, start);
+  return result;
+}
+
+int fdatasync(int fd) {
+  if (realFdatasync == NULL) {
+    resolve();
+  }
+  uint64_t start = now();
+  int result = realFdatasync(fd);
+  recordCall(CALL_FDATASYNC, fd, 0, start);
+  return result;
+}
+
+FILE *fopen(const char *path, const char *mode) {
+  if (realFopen == NULL) {
+    resolve();
+  }
+  uint64_t start = now();
+  FILE *stream = realFopen(path, mode);
+  openFile(CALL_FOPEN, streamFd(stream), path, AT_FDCWD, start);
+  return stream;
+}
+
+FILE *fopen64(const char *path, const char *mode) { return fopen(path, mode); }
+
+int fclose(FILE *stream) {
+  if (realFclose == NULL) {
+    resolve();
+  }
+  int fd = streamFd(stream);
+  uint64_t start = now();
+  int result = realFclose(stream);
+  recordCall(CALL_FCLOSE, -1, 0, start);
+  if (fd >= 0 && fd < MAX_FDS) {
+    fdFiles[fd] = 0;
+  }
+  return result;
+}
+
+size_t fread(void *buffer, size_t size, size_t count, FILE *stream) {
+  if (realFread == NULL) {
+    resolve();
+  }
+  uint64_t start = now();
+  size_t result = realFread(buffer, size, count, stream);
+  recordCall(CALL_FREAD, streamFd(stream), result * size, start);
+  return result;
+}
+
+size_t __fread_chk(void *buffer, size_t bufferSize, size_t size,
+                   size_t count, FILE *stream) {
+  if (realFreadChk == NULL) {
+    resolve();
+  }
+  uint64_t start = now();
+  size_t result = realFreadChk(buffer, bufferSize, size, count, stream);
+  recordCall(CALL_FREAD, streamFd(stream), result * size, start);
+  return result;
+}
+
+size_t fwrite(const void *buffer, size_t size, size_t count, FILE *stream) {
+  if (realFwrite == NULL) {
+    resolve();
+  }
+  uint64_t start = now();
+  size_t result = realFwrite(buffer, size, count, stream);
+  recordCall(CALL_FWRITE, streamFd(stream), result * size, start);
+  return result;
+}
+
+char *fgets(char *buffer, int size, FILE *stream) {
+  if (realFgets == NULL) {
+    resolve();
+  }
+  uint64_t start = now();
+  char *result = realFgets(buffer, size, stream);
+  recordCall(CALL_FGETS, streamFd(stream), result ? strlen(result) : 0,
+             start);
+  return result;
+}
+
+char *__fgets_chk(char *buffer, size_t bufferSize, int size, FILE *stream) {
+  if (realFgetsChk == NULL) {
+    resolve();
+  }
+  uint64_t start = now();
+  char *result = realFgetsChk(buffer, bufferSize, size, stream);
+  recordCall(CALL_FGETS, streamFd(stream), result ? strlen(result) : 0,
+             start);
+  return result;
+}
+
+int fputs(const char *text, FILE *stream) {
+  if (realFputs == NULL) {
+    resolve();
+  }
+  uint64_t start = now();
+  int result = realFputs(text, stream);
+  recordCall(CALL_FPUTS, streamFd(stream),
+             result < 0 ? -1 : (ssize_t)strlen(text), start);
+  return result;
+}
+
+int puts(const char *text) {
+  if (realPuts == NULL) {
+    resolve();
+  }
+  uint64_t start = now();
+  int result = realPuts(text);
+  recordCall(CALL_FPUTS, streamFd(stdout),
+             result < 0 ? -1 : (ssize_t)strlen(text) + 1, start);
+  return result;
+}
+
+int vfprintf(FILE *stream, const char *format, va_list args) {
+  if (realVfprintf == NULL) {
+    resolve();
+  }
+  uint64_t start = now();
+  int result = realVfprintf(stream, format, args);
+  recordCall(CALL_FPRINTF, streamFd(stream), result, start);
+  return result;
+}
+
+int __vfprintf_chk(FILE *stream, int flag, const char *format,
+                   va_list args) {
+  if (realVfprintfChk == NULL) {
+    resolve();
+  }
+  uint64_t start = now();
+  int result = realVfprintfChk(stream, flag, format, args);
+  recordCall(CALL_FPRINTF, streamFd(stream), result, start);
+  return result;
+}
+
+int fprintf(FILE *stream, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  int result = vfprintf(stream, format, args);
+  va_end(args);
+  return result;
+}
+
+int __fprintf_chk(FILE *stream, int flag, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  int result = __vfprintf_chk(stream, flag, format, args);
+  va_end(args);
+  return result;
+}
+
+int printf(const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  int result = vfprintf(stdout, format, args);
+  va_end(args);
+  return result;
+}
+
+int __printf_chk(int flag, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  int result = __vfprintf_chk(stdout, flag, format, args);
+  va_end(args);
+  return result;
+}
+
+/**
+ * Looks up the C library functions that the interposed ones forward to.
+ */
+static void resolve(void) {
+  realOpen = dlsym(RTLD_NEXT, "open");
+  realOpenat = dlsym(RTLD_NEXT, "openat");
+  realClose = dlsym(RTLD_NEXT, "close");
+  realRead = dlsym(RTLD_NEXT, "read");
+  realWrite = dlsym(RTLD_NEXT, "write");
+  realPread = dlsym(RTLD_NEXT, "pread");
+  realPwrite = dlsym(RTLD_NEXT, "pwrite");
+  realReadv = dlsym(RTLD_NEXT, "readv");
+  realWritev = dlsym(RTLD_NEXT, "writev");
+  realFsync = dlsym(RTLD_NEXT, "fsync");
+  realFdatasync = dlsym(RTLD_NEXT, "fdatasync");
+  realFopen = dlsym(RTLD_NEXT, "fopen");
+  realFclose = dlsym(RTLD_NEXT, "fclose");
+  realFread = dlsym(RTLD_NEXT, "fread");
+  realFreadChk = dlsym(RTLD_NEXT, "__fread_chk");
+  realFwrite = dlsym(RTLD_NEXT, "fwrite");
+  realFgets = dlsym(RTLD_NEXT, "fgets");
+  realFgetsChk = dlsym(RTLD_NEXT, "__fgets_chk");
+  realFputs = dlsym(RTLD_NEXT, "fputs");
+  realPuts = dlsym(RTLD_NEXT, "puts");
+  realVfprintf = dlsym(RTLD_NEXT, "vfprintf");
+  realVfprintfChk = dlsym(RTLD_NEXT, "__vfprintf_chk");
+}
+
+/**
+ * Gets the descriptor under a stream, or -1 if there is none.
+ */
+static int streamFd(FILE *stream) {
+  return stream == NULL ? -1 : fileno(stream);
+}
+
+/**
+ * Counts an open and remembers which file the new descriptor refers to.
+ * @param call The open call made.
+ * @param fd The descriptor returned by the open, or -1 if it failed.
+ * @param path The path opened.
+ * @param dirfd The directory a relative path is relative to.
+ * @param start When the open started.
+ * @return The descriptor.
+ */
+static int openFile(int call, int fd, const char *path, int dirfd,
+                    uint64_t start) {
+  int saved = errno;
+  recordCall(call, -1, 0, start);
+  if (!enabled || busy || fd < 0 || fd >= MAX_FDS) {
+    errno = saved;
+    return fd;
+  }
+  busy = true;
+
+  // Relative paths under another directory are named by the kernel.
+  char name[MAX_PATH_LENGTH];
+  if (path[0] != '/' && dirfd != AT_FDCWD) {
+    char link[64];
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+    ssize_t length = readlink(link, name, sizeof(name) - 1);
+    name[length < 0 ? 0 : length] = '\0';
+  } else {
+    snprintf(name, sizeof(name), "%s", path);
+  }
+
+  while (atomic_flag_test_and_set_explicit(&tableLock, memory_order_acquire)) {
+  }
+  File *file = findFile(name);
+  if (file != NULL) {
+    file->opens++;
+    fdFiles[fd] = file - files + 1;
+  }
+  atomic_flag_clear_explicit(&tableLock, memory_order_release);
+  busy = false;
+  errno = saved;
+  return fd;
+}
+
+/**
+ * Counts and times a call, and adds the bytes it moved to the file.
+ * @param call The call made.
+ * @param fd The descriptor, or -1 if the call has no file to count.
+ * @param bytes The bytes moved, or -1 if the call failed.
+ * @param start When the call started.
+ */
+__attribute__((noinline)) static void recordCall(int call, int fd,
+                                                 ssize_t bytes,
+                                                 uint64_t start) {
+  if (!enabled || busy) {
+    return;
+  }
+  int saved = errno;
+  busy = true;
+  uint64_t ns = now() - start;
+  bool isRead = call == CALL_READ || call == CALL_PREAD ||
+                call == CALL_READV || call == CALL_FREAD || call == CALL_FGETS;
+  bool isWrite = call == CALL_WRITE || call == CALL_PWRITE ||
+                 call == CALL_WRITEV || call == CALL_FWRITE ||
+                 call == CALL_FPUTS || call == CALL_FPRINTF;
+  bool isSync = call == CALL_FSYNC || call == CALL_FDATASYNC;
+
+  // Small stdio transfers are buffered, but each is still a call worth
+  // batching, so they count like the system calls.
+  bool small = (isRead || isWrite) && bytes > 0 && bytes < SMALL_IO_BYTES;
+
+  // The call site is only needed for small transfers.
+  if (small) {
+    recordSmall(isWrite, bytes);
+  }
+
+  while (atomic_flag_test_and_set_explicit(&tableLock, memory_order_acquire)) {
+  }
+  calls[call].calls++;
+  calls[call].ns += ns;
+  calls[call].bytes += bytes > 0 ? bytes : 0;
+  File *file = fd < 0 ? NULL : fileFor(fd);
+  if (file != NULL && bytes >= 0) {
+    if (isRead) {
+      file->reads++;
+      file->bytesRead += bytes;
+      file->smallReads += small;
+    } else if (isWrite) {
+      file->writes++;
+      file->bytesWritten += bytes;
+      file->smallWrites += small;
+    } else if (isSync) {
+      file->syncs++;
+      file->syncNs += ns;
+    }
+  }
+  atomic_flag_clear_explicit(&tableLock, memory_order_release);
+  busy = false;
+  errno = saved;
+}
+
+/**
+ * Counts a small read or write against its call site.
+ */
+__attribute__((noinline)) static void recordSmall(bool write, ssize_t bytes) {
+  // Leave out this function, recordCall and the interposed functions, which
+  // may call each other, as printf does vfprintf.
+  uintptr_t walked[SITE_DEPTH + 2], frames[SITE_DEPTH];
+  int walkedDepth = walkStack(walked, SITE_DEPTH + 2, 2);
+  Dl_info self, info;
+  int first = 0;
+  if (dladdr((void *)recordSmall, &self) != 0) {
+    while (first < walkedDepth && dladdr((void *)walked[first], &info) != 0 &&
+           info.dli_fbase == self.dli_fbase) {
+      first++;
+    }
+  }
+  int depth = 0;
+  while (depth < SITE_DEPTH && first + depth < walkedDepth) {
+    frames[depth] = walked[first + depth];
+    depth++;
+  }
+  uint64_t hash = 14695981039346656037ULL ^ write;
+  for (int i = 0; i < depth; i++) {
+    hash = (hash ^ frames[i]) * 1099511628211ULL;
+  }
+
+  while (atomic_flag_test_and_set_explicit(&tableLock, memory_order_acquire)) {
+  }
+  for (int probe = 0; probe < MAX_SITES; probe++) {
+    Site *site = &sites[(hash + probe) % MAX_SITES];
+    if (site->calls == 0) {
+      memcpy(site->frames, frames, sizeof(uintptr_t) * depth);
+      site->depth = depth;
+      site->write = write;
+    } else if (site->write != write || site->depth != depth ||
+               memcmp(site->frames, frames, sizeof(uintptr_t) * depth) != 0) {
+      continue;
+    }
+    site->calls++;
+    site->bytes += bytes;
+    break;
+  }
+  atomic_flag_clear_explicit(&tableLock, memory_order_release);
+}
+
+/**
+ * Finds the file a descriptor refers to. Descriptors that were not opened
+ * while profiling, such as the standard streams and pipes, are named by
+ * the kernel the first time they are used. The table lock must be held.
+ * @return The file, or NULL if the tables are full.
+ */
+static File *fileFor(int fd) {
+  if (fd >= MAX_FDS) {
+    return NULL;
+  }
+  if (fdFiles[fd] == 0) {
+    char link[64], name[MAX_PATH_LENGTH];
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+    ssize_t length = readlink(link, name, sizeof(name) - 1);
+    if (length < 0) {
+      snprintf(name, sizeof(name), "fd %d", fd);
+    } else {
+      name[length] = '\0';
+    }
+    File *file = findFile(name);
+    fdFiles[fd] = file == NULL ? 0 : file - files + 1;
+  }
+  return fdFiles[fd] == 0 ? NULL : &files[fdFiles[fd] - 1];
+}
+
+/**
+ * Finds the entry for a file, adding it if it is new. The table lock must
+ * be held.
+ * @return The entry, or NULL if the table is full.
+ */
+static File *findFile(const char *path) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (const char *c = path; *c != '\0'; c++) {
+    hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+  }
+  for (int probe = 0; probe < MAX_FILES; probe++) {
+    File *file = &files[(hash + probe) % MAX_FILES];
+    if (file->path[0] == '\0') {
+      snprintf(file->path, sizeof(file->path), "%s",
+               path[0] == '\0' ? "?" : path);
+      return file;
+    }
+    if (strcmp(file->path, path) == 0) {
+      return file;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Reads a monotonic clock, in nanoseconds.
+ */
+static uint64_t now(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec * 1000000000ULL + time.tv_nsec;
+}
+
+/**
+ * Prints the calls made, the files with the most I/O, the call sites with
+ * the most small transfers and how often data was synced to disk.
+ */
+static void report(FILE *out) {
+  double seconds = (now() - startNs) / 1e9;
+  fprintf(out, "ioprof: %s (pid %d), %.3f s\n", program_invocation_short_name,
+          (int)getpid(), seconds);
+
+  fprintf(out, "\nCalls:\n");
+  fprintf(out, "  %-10s %12s %11s %14s %12s\n", "call", "count", "time ms",
+          "bytes", "avg bytes");
+  for (int i = 0; i < CALL_COUNT; i++) {
+    if (calls[i].calls == 0) {
+      continue;
+    }
+    fprintf(out, "  %-10s %12llu %11.3f %14llu", callNames[i],
+            (unsigned long long)calls[i].calls, calls[i].ns / 1e6,
+            (unsigned long long)calls[i].bytes);
+    if (calls[i].bytes > 0) {
+      fprintf(out, " %12llu",
+              (unsigned long long)(calls[i].bytes / calls[i].calls));
+    }
+    fprintf(out, "\n");
+  }
+
+  int *order = malloc(sizeof(int) * MAX_FILES);
+  int count = 0;
+  for (int i = 0; i < MAX_FILES; i++) {
+    if (files[i].reads + files[i].writes + files[i].syncs > 0) {
+      order[count++] = i;
+    }
+  }
+  qsort(order, count, sizeof(int), compareFiles);
+
+  fprintf(out, "\nFiles with the most I/O:\n");
+  fprintf(out, "  %-32s %9s %11s %9s %11s %9s %7s\n", "file", "reads",
+          "read KB", "writes", "written KB", "small", "syncs");
+  for (int i = 0; i < count && i < REPORT_FILES; i++) {
+    File *file = &files[order[i]];
+    fprintf(out, "  %-32s %9llu %11.1f %9llu %11.1f %9llu %7llu\n",
+            file->path, (unsigned long long)file->reads,
+            file->bytesRead / 1024.0, (unsigned long long)file->writes,
+            file->bytesWritten / 1024.0,
+            (unsigned long long)(file->smallReads + file->smallWrites),
+            (unsigned long long)file->syncs);
+
+    // Mostly small transfers on a busy file are worth batching.
+    uint64_t transfers = file->reads + file->writes;
+    uint64_t small = file->smallReads + file->smallWrites;
+    if (transfers >= 100 && small * 2 > transfers) {
+      fprintf(out, "    %llu of %llu transfers are under %d bytes; "
+                   "buffer them or map the file\n",
+              (unsigned long long)small, (unsigned long long)transfers,
+              SMALL_IO_BYTES);
+    }
+  }
+
+  int *siteOrder = malloc(sizeof(int) * MAX_SITES);
+  int siteCount = 0;
+  for (int i = 0; i < MAX_SITES; i++) {
+    if (sites[i].calls > 0) {
+      siteOrder[siteCount++] = i;
+    }
+  }
+  qsort(siteOrder, siteCount, sizeof(int), compareSites);
+  fprintf(out, "\nMost small reads and writes (under %d bytes):\n",
+          SMALL_IO_BYTES);
+  for (int i = 0; i < siteCount && i < REPORT_SITES; i++) {
+    Site *site = &sites[siteOrder[i]];
+    char frame[MAX_LINE_LENGTH];
+    fprintf(out, "  %llu %s, %llu bytes at:\n",
+            (unsigned long long)site->calls, site->write ? "writes" : "reads",
+            (unsigned long long)site->bytes);
+    for (int d = 0; d < site->depth; d++) {
+      formatFrame(frame, sizeof(frame), site->frames[d]);
+      fprintf(out, "    %s %s\n", d == 0 ? "  " : "<-", frame);
+    }
+  }
+
+  uint64_t syncs = calls[CALL_FSYNC].calls + calls[CALL_FDATASYNC].calls;
+  uint64_t written = calls[CALL_WRITE].bytes + calls[CALL_PWRITE].bytes +
+                     calls[CALL_WRITEV].bytes + calls[CALL_FWRITE].bytes +
+                     calls[CALL_FPUTS].bytes + calls[CALL_FPRINTF].bytes;
+  fprintf(out, "\nSyncs: %llu (%.1f per second), %.3f ms",
+          (unsigned long long)syncs, seconds > 0 ? syncs / seconds : 0.0,
+          (calls[CALL_FSYNC].ns + calls[CALL_FDATASYNC].ns) / 1e6);
+  if (syncs > 0) {
+    fprintf(out, ", one per %.1f KB written", written / 1024.0 / syncs);
+  }
+  fprintf(out, "\n");
+  fprintf(out, "stdio calls are counted as made; the system calls that fill "
+               "and flush their buffers are only seen by strace.\n\n");
+  free(siteOrder);
+  free(order);
+}
+
+/**
+ * Orders files by bytes moved, most first, for qsort.
+ */
+static int compareFiles(const void *a, const void *b) {
+  const File *x = &files[*(const int *)a], *y = &files[*(const int *)b];
+  uint64_t xBytes = x->bytesRead + x->bytesWritten;
+  uint64_t yBytes = y->bytesRead + y->bytesWritten;
+  return (xBytes < yBytes) - (xBytes > yBytes);
+}
+
+/**
+ * Orders call sites by calls, most first, for qsort.
+ */
+static int compareSites(const void *a, const void *b) {
+  uint64_t x = sites[*(const int *)a].calls;
+  uint64_t y = sites[*(const int *)b].calls;
+  return (x < y) - (x > y);
+}
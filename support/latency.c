@@ -0,0 +1,352 @@
+/**
+ * latency runs a program that records its operations with latency.h and
+ * reports the tail of their latencies. makeGen writes it into .makegen/.
+ *
+ * Usage:
+ *   latency [-n runs] [-w warmup] [-i interval] [-t percent]
+ *           [-b baseline.txt] [-o results.txt] {command}
+ *
+ * The command is run by the shell, warmup times unmeasured and then runs
+ * times, each with a fresh histogram in shared memory. The histograms of the
+ * measured runs are summed and saved.
+ *
+ * A program that issues operations at a fixed rate but waits for each one
+ * to finish stops issuing while it waits, so a stall delays many operations
+ * but is recorded once. With -i set to the intended interval between
+ * operations in nanoseconds, the stall is corrected for: an operation that
+ * took longer than the interval is also counted at its time less the
+ * interval, less two intervals and so on, as the operations that should
+ * have been issued in the meantime would have waited. Percentiles are
+ * reported both raw and corrected.
+ *
+ * With -b the percentiles are compared against a saved baseline. The exit
+ * status is 1 when p99 or p99.9 grew by more than the threshold percent.
+ */
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include "latency.h"
+
+/* Some macros to make the code more readable. */
+#define DEFAULT_RUNS 10
+#define DEFAULT_WARMUP 2
+#define DEFAULT_THRESHOLD 10.0
+#define MAX_LINE_LENGTH 4096
+#define PERCENTILE_COUNT 6
+#define CHECKED_FROM 2
+#define CHECKED_TO 3
+
+/** The percentiles reported, with the last standing for the maximum. */
+static const double PERCENTILES[PERCENTILE_COUNT] = {50, 90, 99, 99.9, 99.99,
+                                                     100};
+static const char *const PERCENTILE_NAMES[PERCENTILE_COUNT] = {
+    "p50", "p90", "p99", "p99.9", "p99.99", "max"};
+
+/** A histogram summed over runs, with the interval it was recorded at. */
+typedef struct {
+  uint64_t counts[LATENCY_BUCKETS];
+  uint64_t total;
+  uint64_t interval;
+} Histogram;
+
+/** Helper function declarations. */
+static bool runOnce(const char *command, Histogram *histogram);
+static void correct(const Histogram *raw, Histogram *corrected);
+static void findPercentiles(const Histogram *histogram, uint64_t *values);
+static bool saveHistogram(const char *path, const Histogram *histogram);
+static bool loadHistogram(const char *path, Histogram *histogram);
+static void printRow(const char *name, const uint64_t *values,
+                     uint64_t count);
+static void formatDuration(char *buffer, size_t size, uint64_t nanoseconds);
+
+/**
+ * Main function for the latency harness.
+ */
+int main(int argc, char **argv) {
+  int runs = DEFAULT_RUNS, warmup = DEFAULT_WARMUP;
+  uint64_t interval = 0;
+  double threshold = DEFAULT_THRESHOLD;
+  const char *baselinePath = NULL, *resultsPath = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "+n:w:i:t:b:o:")) != -1) {
+    switch (opt) {
+    case 'n':
+      runs = atoi(optarg);
+      break;
+    case 'w':
+      warmup = atoi(optarg);
+      break;
+    case 'i':
+      interval = strtoull(optarg, NULL, 10);
+      break;
+    case 't':
+      threshold = atof(optarg);
+      break;
+    case 'b':
+      baselinePath = optarg;
+      break;
+    case 'o':
+      resultsPath = optarg;
+      break;
+    default:
+      runs = 0;
+    }
+  }
+  if (runs < 1 || optind != argc - 1) {
+    fprintf(stderr, "Usage:\n");
+    fprintf(stderr, "latency [-n runs] [-w warmup] [-i interval] "
+                    "[-t percent] [-b baseline.txt] [-o results.txt] "
+                    "{command}\n");
+    return 1;
+  }
+  const char *command = argv[optind];
+
+  // Warm up, then sum the measured runs.
+  static Histogram raw, corrected, baseline, baselineCorrected;
+  raw.interval = interval;
+  for (int i = 0; i < warmup + runs; i++) {
+    static Histogram run;
+    memset(&run, 0, sizeof(run));
+    if (!runOnce(command, &run)) {
+      return 1;
+    }
+    if (i < warmup) {
+      continue;
+    }
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+      raw.counts[b] += run.counts[b];
+    }
+    raw.total += run.total;
+  }
+  if (raw.total == 0) {
+    fprintf(stderr, "latency: nothing was recorded; the program should "
+                    "include latency.h and call latency_record\n");
+    return 1;
+  }
+  if (resultsPath != NULL && !saveHistogram(resultsPath, &raw)) {
+    fprintf(stderr, "latency: unable to write %s\n", resultsPath);
+    return 1;
+  }
+
+  uint64_t rawValues[PERCENTILE_COUNT], values[PERCENTILE_COUNT];
+  findPercentiles(&raw, rawValues);
+  correct(&raw, &corrected);
+  findPercentiles(&corrected, values);
+
+  printf("%-10s", "");
+  for (int p = 0; p < PERCENTILE_COUNT; p++) {
+    printf(" %10s", PERCENTILE_NAMES[p]);
+  }
+  printf(" %12s\n", "operations");
+  printRow("raw", rawValues, raw.total);
+  if (interval > 0) {
+    printRow("corrected", values, corrected.total);
+  }
+
+  // Compare like with like: corrected against corrected when the baseline
+  // was corrected too.
+  if (baselinePath == NULL || !loadHistogram(baselinePath, &baseline)) {
+    return 0;
+  }
+  uint64_t baselineValues[PERCENTILE_COUNT];
+  correct(&baseline, &baselineCorrected);
+  bool bothCorrected = interval > 0 && baseline.interval > 0;
+  findPercentiles(bothCorrected ? &baselineCorrected : &baseline,
+                  baselineValues);
+  uint64_t *currentValues = bothCorrected ? values : rawValues;
+  printRow("baseline", baselineValues,
+           bothCorrected ? baselineCorrected.total : baseline.total);
+
+  bool regressed = false;
+  printf("%-10s", "change");
+  for (int p = 0; p < PERCENTILE_COUNT; p++) {
+    double change = baselineValues[p] > 0
+                        ? 100.0 * ((double)currentValues[p] -
+                                   (double)baselineValues[p]) /
+                              (double)baselineValues[p]
+                        : 0.0;
+    printf(" %+9.1f%%", change);
+    if (p >= CHECKED_FROM && p <= CHECKED_TO && change > threshold) {
+      regressed = true;
+    }
+  }
+  printf("\n");
+  if (regressed) {
+    printf("Tail latency regressed by more than %.1f%% against %s\n",
+           threshold, baselinePath);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * Runs the command once with a fresh shared histogram and reads it back.
+ * @return True if the command ran and succeeded, false otherwise.
+ */
+static bool runOnce(const char *command, Histogram *histogram) {
+  char path[MAX_LINE_LENGTH];
+  const char *directory = access("/dev/shm", W_OK) == 0 ? "/dev/shm" : "/tmp";
+  snprintf(path, sizeof(path), "%s/makegen-latency-XXXXXX", directory);
+  int fd = mkstemp(path);
+  if (fd < 0 || ftruncate(fd, sizeof(LatencyHistogram)) != 0) {
+    fprintf(stderr, "latency: unable to create %s\n", path);
+    return false;
+  }
+  LatencyHistogram *shared = mmap(NULL, sizeof(LatencyHistogram), PROT_READ,
+                                  MAP_SHARED, fd, 0);
+  close(fd);
+  if (shared == MAP_FAILED) {
+    unlink(path);
+    fprintf(stderr, "latency: unable to map %s\n", path);
+    return false;
+  }
+
+  int status = -1;
+  pid_t pid = fork();
+  if (pid == 0) {
+    setenv(LATENCY_ENV, path, 1);
+    execl("/bin/sh", "sh", "-c", command, (char *)NULL);
+    _exit(127);
+  }
+  if (pid > 0) {
+    waitpid(pid, &status, 0);
+  }
+
+  for (int b = 0; b < LATENCY_BUCKETS; b++) {
+    histogram->counts[b] = shared->counts[b];
+    histogram->total += shared->counts[b];
+  }
+  munmap(shared, sizeof(LatencyHistogram));
+  unlink(path);
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "latency: the command failed: %s\n", command);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Corrects a histogram for coordinated omission, adding the operations a
+ * stall kept from being issued. Without an interval it is copied as is.
+ */
+static void correct(const Histogram *raw, Histogram *corrected) {
+  *corrected = *raw;
+  uint64_t interval = raw->interval;
+  if (interval == 0) {
+    return;
+  }
+  for (int b = 0; b < LATENCY_BUCKETS; b++) {
+    uint64_t count = raw->counts[b];
+    uint64_t value = latency_bucket_value(b);
+    if (count == 0 || value <= interval) {
+      continue;
+    }
+    for (uint64_t missed = value - interval; missed >= interval;
+         missed -= interval) {
+      corrected->counts[latency_bucket(missed)] += count;
+      corrected->total += count;
+    }
+  }
+}
+
+/**
+ * Finds the value at each reported percentile.
+ */
+static void findPercentiles(const Histogram *histogram, uint64_t *values) {
+  int p = 0, last = 0;
+  uint64_t seen = 0;
+  for (int b = 0; b < LATENCY_BUCKETS && p < PERCENTILE_COUNT; b++) {
+    if (histogram->counts[b] == 0) {
+      continue;
+    }
+    seen += histogram->counts[b];
+    last = b;
+    while (p < PERCENTILE_COUNT - 1 &&
+           (double)seen >= PERCENTILES[p] / 100.0 * (double)histogram->total) {
+      values[p++] = latency_bucket_value(b);
+    }
+  }
+  while (p < PERCENTILE_COUNT) {
+    values[p++] = latency_bucket_value(last);
+  }
+}
+
+/**
+ * Saves a histogram as its interval followed by a line per bucket in use,
+ * giving the bucket's largest value and its count.
+ * @return True on success, false otherwise.
+ */
+static bool saveHistogram(const char *path, const Histogram *histogram) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    return false;
+  }
+  fprintf(file, "interval %llu\n", (unsigned long long)histogram->interval);
+  for (int b = 0; b < LATENCY_BUCKETS; b++) {
+    if (histogram->counts[b] > 0) {
+      fprintf(file, "%llu %llu\n",
+              (unsigned long long)latency_bucket_value(b),
+              (unsigned long long)histogram->counts[b]);
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+/**
+ * Loads a histogram saved by saveHistogram().
+ * @return True on success, false otherwise.
+ */
+static bool loadHistogram(const char *path, Histogram *histogram) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    return false;
+  }
+  memset(histogram, 0, sizeof(Histogram));
+  unsigned long long interval = 0, value, count;
+  if (fscanf(file, "interval %llu", &interval) != 1) {
+    fclose(file);
+    return false;
+  }
+  histogram->interval = interval;
+  while (fscanf(file, "%llu %llu", &value, &count) == 2) {
+    histogram->counts[latency_bucket(value)] += count;
+    histogram->total += count;
+  }
+  fclose(file);
+  return histogram->total > 0;
+}
+
+/**
+ * Prints a row of percentile values.
+ */
+static void printRow(const char *name, const uint64_t *values,
+                     uint64_t count) {
+  printf("%-10s", name);
+  for (int p = 0; p < PERCENTILE_COUNT; p++) {
+    char duration[32];
+    formatDuration(duration, sizeof(duration), values[p]);
+    printf(" %10s", duration);
+  }
+  printf(" %12llu\n", (unsigned long long)count);
+}
+
+/**
+ * Formats nanoseconds in the largest unit that keeps them above one.
+ */
+static void formatDuration(char *buffer, size_t size, uint64_t nanoseconds) {
+  if (nanoseconds < 1000) {
+    snprintf(buffer, size, "%lluns", (unsigned long long)nanoseconds);
+  } else if (nanoseconds < 1000000) {
+    snprintf(buffer, size, "%.2fus", nanoseconds / 1e3);
+  } else if (nanoseconds < 1000000000) {
+    snprintf(buffer, size, "%.2fms", nanoseconds / 1e6);
+  } else {
+    snprintf(buffer, size, "%.2fs", nanoseconds / 1e9);
+  }
+}
@@ -0,0 +1,112 @@
+/**
+ * latency records how long each operation of a program takes, for the
+ * generated latency rule. makeGen writes it into .makegen/ and adds that
+ * directory to the include path. It needs no library:
+ *
+ *   #include "latency.h"
+ *
+ *   uint64_t start = latency_now();
+ *   handle_request(request);
+ *   latency_record_since(start);
+ *
+ * Timings go into a histogram in memory shared with makeGen's harness,
+ * which sums the histograms of every run and reports the percentiles. When
+ * the program is not run by the harness, recording does nothing.
+ *
+ * The histogram keeps two significant digits or better: values below 256
+ * have buckets of their own, and above that each power of two is split into
+ * 128 buckets.
+ */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+/** The environment variable naming the shared histogram. */
+#define LATENCY_ENV "MAKEGEN_LATENCY"
+
+/** The bucket layout, shared with the harness. */
+#define LATENCY_SUB_BITS 7
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS)
+
+/** The shared histogram, counting values in nanoseconds. */
+typedef struct {
+  uint64_t counts[LATENCY_BUCKETS];
+} LatencyHistogram;
+
+/** The histogram of this translation unit, or NULL when not recording. */
+static LatencyHistogram *latency_histogram;
+
+/**
+ * Maps the harness's histogram before main() runs, if there is one.
+ */
+__attribute__((constructor, unused)) static void latency_attach(void) {
+  const char *path = getenv(LATENCY_ENV);
+  int fd = path != NULL ? open(path, O_RDWR) : -1;
+  if (fd < 0) {
+    return;
+  }
+  void *memory = mmap(NULL, sizeof(LatencyHistogram), PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+  close(fd);
+  if (memory != MAP_FAILED) {
+    latency_histogram = (LatencyHistogram *)memory;
+  }
+}
+
+/**
+ * Finds the bucket a value falls in.
+ */
+static inline int latency_bucket(uint64_t value) {
+  if (value < (2u << LATENCY_SUB_BITS)) {
+    return (int)value;
+  }
+  int shift = 63 - __builtin_clzll(value) - LATENCY_SUB_BITS;
+  return (shift << LATENCY_SUB_BITS) + (int)(value >> shift);
+}
+
+/**
+ * Gives the largest value that falls in a bucket.
+ */
+static inline uint64_t latency_bucket_value(int bucket) {
+  if (bucket < (2 << LATENCY_SUB_BITS)) {
+    return (uint64_t)bucket;
+  }
+  int shift = (bucket >> LATENCY_SUB_BITS) - 1;
+  uint64_t low = (uint64_t)(bucket - (shift << LATENCY_SUB_BITS)) << shift;
+  return low + (1ull << shift) - 1;
+}
+
+/**
+ * Reads the monotonic clock in nanoseconds.
+ */
+static inline uint64_t latency_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * Records one operation that took the given number of nanoseconds.
+ */
+static inline void latency_record(uint64_t nanoseconds) {
+  if (latency_histogram != NULL) {
+    __atomic_fetch_add(&latency_histogram->counts[latency_bucket(nanoseconds)],
+                       1, __ATOMIC_RELAXED);
+  }
+}
+
+/**
+ * Records one operation that started at the given latency_now() time.
+ */
+static inline void latency_record_since(uint64_t start) {
+  latency_record(latency_now() - start);
+}
+
+#endif
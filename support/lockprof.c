@@ -0,0 +1,407 @@
+/**
+ * lockprof is a lock contention profiler loaded with LD_PRELOAD. makeGen
+ * writes it into .makegen/ for the generated lockprof rule.
+ *
+ * Usage:
+ *   LOCKPROF_OUTPUT=lockprof.txt [LOCKPROF_PROGRAM=name] \
+ *   LD_PRELOAD=/path/to/lockprof.so program
+ *
+ * pthread_mutex_lock, pthread_mutex_trylock and pthread_mutex_unlock are
+ * interposed. A lock first tries to take the mutex without blocking; if the
+ * mutex is busy the acquisition counts as contended and the time until the
+ * mutex is taken counts as wait time. The time from taking a mutex to
+ * releasing it counts as hold time, except while pthread_cond_wait has
+ * released it. Each acquisition is also counted against its call site, the
+ * few innermost frames of its call stack. At exit the most contended locks
+ * are appended to the output file with their call sites. With
+ * LOCKPROF_PROGRAM set, only processes of that name are profiled.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "stacks.h"
+
+/* Some macros to make the code more readable. */
+#define MAX_LOCKS 4096
+#define MAX_SITES 16384
+#define SITE_DEPTH 4
+#define REPORT_LOCKS 10
+#define REPORT_SITES 3
+#define MAX_LINE_LENGTH 1024
+
+/** The acquisitions of one mutex. */
+typedef struct {
+  pthread_mutex_t *mutex;
+  uint64_t acquisitions;
+  uint64_t contentions;
+  uint64_t waitNs;
+  uint64_t maxWaitNs;
+  uint64_t holdNs;
+  uint64_t lockedAt;
+  int holder;
+} Lock;
+
+/** The acquisitions of one mutex from one call site. */
+typedef struct {
+  pthread_mutex_t *mutex;
+  uintptr_t frames[SITE_DEPTH];
+  int depth;
+  uint64_t acquisitions;
+  uint64_t contentions;
+  uint64_t waitNs;
+  uint64_t holdNs;
+} Site;
+
+static int (*realLock)(pthread_mutex_t *);
+static int (*realTrylock)(pthread_mutex_t *);
+static int (*realUnlock)(pthread_mutex_t *);
+static int (*realCondWait)(pthread_cond_t *, pthread_mutex_t *);
+static int (*realCondTimedwait)(pthread_cond_t *, pthread_mutex_t *,
+                                const struct timespec *);
+
+static bool enabled;
+static __thread bool busy;
+static atomic_flag tableLock = ATOMIC_FLAG_INIT;
+static Lock locks[MAX_LOCKS];
+static Site sites[MAX_SITES];
+
+/** Helper function declarations. */
+static void resolve(void);
+static void *resolveVersioned(const char *name);
+static void recordAcquire(pthread_mutex_t *mutex, bool contended,
+                          uint64_t waitNs);
+static void recordRelease(pthread_mutex_t *mutex);
+static Lock *findLock(pthread_mutex_t *mutex);
+static uint64_t now(void);
+static void report(FILE *out);
+static int compareLocks(const void *a, const void *b);
+static int compareSites(const void *a, const void *b);
+
+/**
+ * Starts profiling when the library is loaded, if an output file is set and
+ * this is the program to profile.
+ */
+__attribute__((constructor)) static void startProfiling(void) {
+  resolve();
+  const char *program = getenv("LOCKPROF_PROGRAM");
+  enabled = getenv("LOCKPROF_OUTPUT") != NULL &&
+            (program == NULL ||
+             strcmp(program, program_invocation_short_name) == 0);
+}
+
+/**
+ * Appends the report to the output file when the program exits.
+ */
+__attribute__((destructor)) static void stopProfiling(void) {
+  if (!enabled) {
+    return;
+  }
+  busy = true;
+  enabled = false;
+
+  FILE *out = fopen(getenv("LOCKPROF_OUTPUT"), "a");
+  if (out != NULL) {
+    report(out);
+    fclose(out);
+  }
+}
+
+int pthread_mutex_lock(pthread_mutex_t *mutex) {
+  if (realLock == NULL) {
+    resolve();
+  }
+  if (!enabled || busy) {
+    return realLock(mutex);
+  }
+
+  // Only a mutex that is busy makes the caller wait.
+  uint64_t start = now();
+  int result = realTrylock(mutex);
+  bool contended = result == EBUSY;
+  if (contended) {
+    result = realLock(mutex);
+  }
+  if (result == 0) {
+    recordAcquire(mutex, contended, contended ? now() - start : 0);
+  }
+  return result;
+}
+
+int pthread_mutex_trylock(pthread_mutex_t *mutex) {
+  if (realTrylock == NULL) {
+    resolve();
+  }
+  int result = realTrylock(mutex);
+  if (result == 0 && enabled && !busy) {
+    recordAcquire(mutex, false, 0);
+  }
+  return result;
+}
+
+int pthread_mutex_unlock(pthread_mutex_t *mutex) {
+  if (realUnlock == NULL) {
+    resolve();
+  }
+  if (enabled && !busy) {
+    recordRelease(mutex);
+  }
+  return realUnlock(mutex);
+}
+
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex) {
+  if (realCondWait == NULL) {
+    resolve();
+  }
+  if (enabled && !busy) {
+    recordRelease(mutex);
+  }
+  int result = realCondWait(cond, mutex);
+  if (enabled && !busy) {
+    recordAcquire(mutex, false, 0);
+  }
+  return result;
+}
+
+int pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                           const struct timespec *timeout) {
+  if (realCondTimedwait == NULL) {
+    resolve();
+  }
+  if (enabled && !busy) {
+    recordRelease(mutex);
+  }
+  int result = realCondTimedwait(cond, mutex, timeout);
+  if (enabled && !busy) {
+    recordAcquire(mutex, false, 0);
+  }
+  return result;
+}
+
+/**
+ * Looks up the pthread functions that the interposed ones forward to.
+ */
+static void resolve(void) {
+  realLock = dlsym(RTLD_NEXT, "pthread_mutex_lock");
+  realTrylock = dlsym(RTLD_NEXT, "pthread_mutex_trylock");
+  realUnlock = dlsym(RTLD_NEXT, "pthread_mutex_unlock");
+  realCondWait = resolveVersioned("pthread_cond_wait");
+  realCondTimedwait = resolveVersioned("pthread_cond_timedwait");
+}
+
+/**
+ * Looks up a condition variable function. Where glibc keeps an older
+ * version for compatibility, plain dlsym finds that one, so the current
+ * version is asked for first.
+ */
+static void *resolveVersioned(const char *name) {
+  void *function = dlvsym(RTLD_NEXT, name, "GLIBC_2.3.2");
+  return function != NULL ? function : dlsym(RTLD_NEXT, name);
+}
+
+/**
+ * Counts an acquisition against the mutex and its call site, and notes
+ * when the mutex was taken.
+ * @param mutex The mutex taken.
+ * @param contended Whether the mutex was busy when asked for.
+ * @param waitNs How long the caller waited for the mutex.
+ */
+__attribute__((noinline)) static void
+recordAcquire(pthread_mutex_t *mutex, bool contended, uint64_t waitNs) {
+  busy = true;
+
+  // Leave out this function and the interposed function.
+  uintptr_t frames[SITE_DEPTH];
+  int depth = walkStack(frames, SITE_DEPTH, 2);
+  uint64_t hash = 14695981039346656037ULL ^ (uintptr_t)mutex;
+  for (int i = 0; i < depth; i++) {
+    hash = (hash ^ frames[i]) * 1099511628211ULL;
+  }
+
+  while (atomic_flag_test_and_set_explicit(&tableLock, memory_order_acquire)) {
+  }
+  Lock *lock = findLock(mutex);
+  Site *site = NULL;
+  for (int probe = 0; lock != NULL && probe < MAX_SITES; probe++) {
+    site = &sites[(hash + probe) % MAX_SITES];
+    if (site->mutex == NULL) {
+      site->mutex = mutex;
+      memcpy(site->frames, frames, sizeof(uintptr_t) * depth);
+      site->depth = depth;
+      break;
+    }
+    if (site->mutex == mutex && site->depth == depth &&
+        memcmp(site->frames, frames, sizeof(uintptr_t) * depth) == 0) {
+      break;
+    }
+    site = NULL;
+  }
+
+  if (lock != NULL) {
+    lock->acquisitions++;
+    lock->contentions += contended;
+    lock->waitNs += waitNs;
+    lock->maxWaitNs = waitNs > lock->maxWaitNs ? waitNs : lock->maxWaitNs;
+    lock->lockedAt = now();
+    lock->holder = site == NULL ? -1 : (int)(site - sites);
+  }
+  if (site != NULL) {
+    site->acquisitions++;
+    site->contentions += contended;
+    site->waitNs += waitNs;
+  }
+  atomic_flag_clear_explicit(&tableLock, memory_order_release);
+  busy = false;
+}
+
+/**
+ * Adds the time a mutex was held to the mutex and the call site that took
+ * it.
+ */
+static void recordRelease(pthread_mutex_t *mutex) {
+  busy = true;
+  uint64_t time = now();
+  while (atomic_flag_test_and_set_explicit(&tableLock, memory_order_acquire)) {
+  }
+  Lock *lock = findLock(mutex);
+  if (lock != NULL && lock->lockedAt != 0) {
+    uint64_t held = time - lock->lockedAt;
+    lock->holdNs += held;
+    if (lock->holder >= 0) {
+      sites[lock->holder].holdNs += held;
+    }
+    lock->lockedAt = 0;
+  }
+  atomic_flag_clear_explicit(&tableLock, memory_order_release);
+  busy = false;
+}
+
+/**
+ * Finds the entry for a mutex, adding it if it is new. The table lock must
+ * be held.
+ * @return The entry, or NULL if the table is full.
+ */
+static Lock *findLock(pthread_mutex_t *mutex) {
+  uint64_t hash = ((uintptr_t)mutex >> 4) * 11400714819323198485ULL;
+  for (int probe = 0; probe < MAX_LOCKS; probe++) {
+    Lock *lock = &locks[(hash + probe) % MAX_LOCKS];
+    if (lock->mutex == NULL) {
+      lock->mutex = mutex;
+      return lock;
+    }
+    if (lock->mutex == mutex) {
+      return lock;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Reads a monotonic clock, in nanoseconds.
+ */
+static uint64_t now(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec * 1000000000ULL + time.tv_nsec;
+}
+
+/**
+ * Prints the totals and the locks with the most wait time, each with the
+ * call sites that waited longest for it.
+ */
+static void report(FILE *out) {
+  uint64_t acquisitions = 0, contentions = 0, waitNs = 0;
+  int *order = malloc(sizeof(int) * MAX_LOCKS);
+  int count = 0;
+  for (int i = 0; i < MAX_LOCKS; i++) {
+    if (locks[i].acquisitions > 0) {
+      acquisitions += locks[i].acquisitions;
+      contentions += locks[i].contentions;
+      waitNs += locks[i].waitNs;
+      order[count++] = i;
+    }
+  }
+  qsort(order, count, sizeof(int), compareLocks);
+
+  fprintf(out, "lockprof: %s (pid %d)\n", program_invocation_short_name,
+          (int)getpid());
+  fprintf(out, "  %d mutexes, %llu acquisitions, %llu contended (%.1f%%), "
+               "%.3f ms waiting\n",
+          count, (unsigned long long)acquisitions,
+          (unsigned long long)contentions,
+          acquisitions > 0 ? 100.0 * contentions / acquisitions : 0.0,
+          waitNs / 1e6);
+
+  fprintf(out, "\nMost contended locks:\n");
+  fprintf(out, "  %-24s %12s %10s %11s %11s %11s\n", "mutex", "acquisitions",
+          "contended", "wait ms", "max wait ms", "hold ms");
+  int *siteOrder = malloc(sizeof(int) * MAX_SITES);
+  for (int i = 0; i < count && i < REPORT_LOCKS; i++) {
+    Lock *lock = &locks[order[i]];
+    if (lock->contentions == 0) {
+      break;
+    }
+
+    // Name mutexes that are variables; others are shown by address.
+    char name[MAX_LINE_LENGTH];
+    uintptr_t start;
+    const char *object;
+    const char *symbol = lookupSymbol((uintptr_t)lock->mutex, &start, &object);
+    if (symbol != NULL && (uintptr_t)lock->mutex == start) {
+      snprintf(name, sizeof(name), "%s", symbol);
+    } else {
+      snprintf(name, sizeof(name), "%p", (void *)lock->mutex);
+    }
+    fprintf(out, "  %-24s %12llu %10llu %11.3f %11.3f %11.3f\n", name,
+            (unsigned long long)lock->acquisitions,
+            (unsigned long long)lock->contentions, lock->waitNs / 1e6,
+            lock->maxWaitNs / 1e6, lock->holdNs / 1e6);
+
+    int siteCount = 0;
+    for (int s = 0; s < MAX_SITES; s++) {
+      if (sites[s].mutex == lock->mutex && sites[s].acquisitions > 0) {
+        siteOrder[siteCount++] = s;
+      }
+    }
+    qsort(siteOrder, siteCount, sizeof(int), compareSites);
+    for (int s = 0; s < siteCount && s < REPORT_SITES; s++) {
+      Site *site = &sites[siteOrder[s]];
+      char frame[MAX_LINE_LENGTH];
+      fprintf(out, "    %llu contended, %.3f ms wait, %.3f ms hold at:\n",
+              (unsigned long long)site->contentions, site->waitNs / 1e6,
+              site->holdNs / 1e6);
+      for (int d = 0; d < site->depth; d++) {
+        formatFrame(frame, sizeof(frame), site->frames[d]);
+        fprintf(out, "      %s %s\n", d == 0 ? "  " : "<-", frame);
+      }
+    }
+  }
+  fprintf(out, "\n");
+  free(siteOrder);
+  free(order);
+}
+
+/**
+ * Orders locks by wait time, longest first, for qsort.
+ */
+static int compareLocks(const void *a, const void *b) {
+  uint64_t x = locks[*(const int *)a].waitNs;
+  uint64_t y = locks[*(const int *)b].waitNs;
+  return (x < y) - (x > y);
+}
+
+/**
+ * Orders call sites by wait time, longest first, for qsort.
+ */
+static int compareSites(const void *a, const void *b) {
+  uint64_t x = sites[*(const int *)a].waitNs;
+  uint64_t y = sites[*(const int *)b].waitNs;
+  return (x < y) - (x > y);
+}
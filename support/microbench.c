@@ -0,0 +1,188 @@
+/**
+ * The runner for microbench, the microbenchmark harness described in
+ * microbench.h. It provides main() for every microbenchmark binary.
+ *
+ * Usage:
+ *   bench_name [-t seconds] [-r repetitions] [-c cpu] [-f filter]
+ *              [-o results.json]
+ *
+ * Each registered benchmark is first calibrated: the iteration count is
+ * doubled until a run takes a noticeable amount of time, then scaled so a
+ * run takes the target time. The benchmark is then run the given number of
+ * repetitions and the median and minimum time per iteration are reported.
+ */
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "microbench.h"
+
+/* Some macros to make the code more readable. */
+#define MAX_BENCHMARKS 256
+#define DEFAULT_TARGET_SECONDS 0.1
+#define DEFAULT_REPETITIONS 5
+#define CALIBRATION_SECONDS 0.01
+#define NO_CPU -1
+
+/** A registered benchmark. */
+typedef struct {
+  const char *name;
+  MicrobenchFunction function;
+} Benchmark;
+
+static Benchmark benchmarks[MAX_BENCHMARKS];
+static int benchmarkCount = 0;
+
+/** Helper function declarations. */
+static double timeRun(MicrobenchFunction function, uint64_t iterations);
+static uint64_t calibrate(MicrobenchFunction function, double targetSeconds);
+static int compareDoubles(const void *a, const void *b);
+
+void microbench_register(const char *name, MicrobenchFunction function) {
+  if (benchmarkCount < MAX_BENCHMARKS) {
+    benchmarks[benchmarkCount].name = name;
+    benchmarks[benchmarkCount++].function = function;
+  }
+}
+
+/**
+ * Main function for the microbenchmark runner.
+ */
+int main(int argc, char **argv) {
+  double targetSeconds = DEFAULT_TARGET_SECONDS;
+  int repetitions = DEFAULT_REPETITIONS;
+  int cpu = NO_CPU;
+  const char *filter = NULL;
+  const char *outputPath = NULL;
+
+  // Parse the options.
+  int opt;
+  while ((opt = getopt(argc, argv, "t:r:c:f:o:")) != -1) {
+    switch (opt) {
+    case 't':
+      targetSeconds = atof(optarg);
+      break;
+    case 'r':
+      repetitions = atoi(optarg);
+      break;
+    case 'c':
+      cpu = atoi(optarg);
+      break;
+    case 'f':
+      filter = optarg;
+      break;
+    case 'o':
+      outputPath = optarg;
+      break;
+    default:
+      fprintf(stderr, "Usage:\n");
+      fprintf(stderr, "%s [-t seconds] [-r repetitions] [-c cpu] [-f filter] "
+                      "[-o results.json]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+  repetitions = repetitions < 1 ? 1 : repetitions;
+
+  if (cpu != NO_CPU) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+      fprintf(stderr, "%s: unable to pin to CPU %d\n", argv[0], cpu);
+    }
+  }
+
+  FILE *out = NULL;
+  if (outputPath != NULL && (out = fopen(outputPath, "w")) == NULL) {
+    fprintf(stderr, "%s: unable to write %s\n", argv[0], outputPath);
+    return 1;
+  }
+  if (out != NULL) {
+    fprintf(out, "[\n");
+  }
+
+  double *perIteration = malloc(sizeof(double) * repetitions);
+  int reported = 0;
+  for (int b = 0; b < benchmarkCount; b++) {
+    Benchmark *benchmark = &benchmarks[b];
+    if (filter != NULL && strstr(benchmark->name, filter) == NULL) {
+      continue;
+    }
+
+    // Calibrate, then measure.
+    uint64_t iterations = calibrate(benchmark->function, targetSeconds);
+    for (int r = 0; r < repetitions; r++) {
+      perIteration[r] = timeRun(benchmark->function, iterations) / iterations;
+    }
+    qsort(perIteration, repetitions, sizeof(double), compareDoubles);
+    double median = perIteration[repetitions / 2];
+    double minimum = perIteration[0];
+
+    printf("%-32s %14llu iterations %12.2f ns/op (min %.2f)\n",
+           benchmark->name, (unsigned long long)iterations, median * 1e9,
+           minimum * 1e9);
+    if (out != NULL) {
+      fprintf(out,
+              "%s  {\"name\": \"%s\", \"iterations\": %llu, "
+              "\"repetitions\": %d, \"median_ns\": %.3f, \"min_ns\": %.3f}",
+              reported == 0 ? "" : ",\n", benchmark->name,
+              (unsigned long long)iterations, repetitions, median * 1e9,
+              minimum * 1e9);
+    }
+    reported++;
+  }
+
+  if (out != NULL) {
+    fprintf(out, "\n]\n");
+    fclose(out);
+  }
+  free(perIteration);
+  return 0;
+}
+
+/**
+ * Runs a benchmark body once.
+ * @param function The benchmark body.
+ * @param iterations The number of iterations to run.
+ * @return The time the run took, in seconds.
+ */
+static double timeRun(MicrobenchFunction function, uint64_t iterations) {
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  function(iterations);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/**
+ * Finds how many iterations of a benchmark take the target time.
+ * @param function The benchmark body.
+ * @param targetSeconds How long a measured run should take.
+ * @return The iteration count to measure with.
+ */
+static uint64_t calibrate(MicrobenchFunction function, double targetSeconds) {
+  uint64_t iterations = 1;
+  double elapsed = timeRun(function, iterations);
+  while (elapsed < CALIBRATION_SECONDS && iterations < (1ULL << 62)) {
+    iterations *= 2;
+    elapsed = timeRun(function, iterations);
+  }
+
+  double scaled = iterations * targetSeconds / (elapsed > 0 ? elapsed : 1e-9);
+  return scaled < 1 ? 1 : (uint64_t)scaled;
+}
+
+/**
+ * Orders doubles from smallest to largest for qsort.
+ */
+static int compareDoubles(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
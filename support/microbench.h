@@ -0,0 +1,55 @@
+/**
+ * microbench is a small timing harness for microbenchmarks. makeGen writes
+ * it into .makegen/ and links it into every bench_*.c file it finds.
+ *
+ * A benchmark runs its body the given number of iterations:
+ *
+ *   #include "microbench.h"
+ *
+ *   MICROBENCH(parse_number) {
+ *     for (uint64_t i = 0; i < iterations; i++) {
+ *       int value = parse_number("12345");
+ *       microbench_do_not_optimize(value);
+ *     }
+ *   }
+ *
+ * The harness picks the iteration count so that each measurement takes a
+ * fixed amount of time, repeats the measurement and reports the time per
+ * iteration.
+ */
+
+#ifndef MICROBENCH_H
+#define MICROBENCH_H
+
+#include <stdint.h>
+
+/** A benchmark body, run for the given number of iterations. */
+typedef void (*MicrobenchFunction)(uint64_t iterations);
+
+/** Registers a benchmark with the harness. Called by MICROBENCH. */
+void microbench_register(const char *name, MicrobenchFunction function);
+
+/**
+ * Defines and registers a benchmark. The body sees the iteration count as
+ * "iterations".
+ */
+#define MICROBENCH(name)                                                       \
+  static void microbench_##name(uint64_t iterations);                         \
+  __attribute__((constructor)) static void microbench_register_##name(void) { \
+    microbench_register(#name, microbench_##name);                            \
+  }                                                                            \
+  static void microbench_##name(uint64_t iterations)
+
+/**
+ * Keeps the compiler from optimizing away the computation of a value.
+ */
+#define microbench_do_not_optimize(value)                                      \
+  __asm__ volatile("" : : "r,m"(value) : "memory")
+
+/**
+ * Keeps the compiler from assuming anything about memory across this point,
+ * so stores before it are not optimized away.
+ */
+#define microbench_clobber_memory() __asm__ volatile("" : : : "memory")
+
+#endif
@@ -0,0 +1,371 @@
+/**
+ * numarun runs a command under a NUMA placement policy and records where
+ * its memory was allocated. makeGen writes it into .makegen/ for the
+ * generated numa rule.
+ *
+ * Usage:
+ *   numarun [-s stats.txt] -p policy -- command [args...]
+ *   numarun report results.json stats-directory
+ *
+ * The policies are:
+ *   first-touch   the kernel default: pages come from the node of the CPU
+ *                 that first touches them, and threads run anywhere.
+ *   local         run on node 0's CPUs and allocate locally.
+ *   interleave    spread pages round robin over every node.
+ *   bind-N        run on node N's CPUs and allocate only from node N.
+ *
+ * numactl applies the policy when it is installed. Otherwise numarun sets
+ * the CPU affinity and calls set_mempolicy itself, which needs no libnuma.
+ *
+ * With -s the change in the system's NUMA allocation counters over the run
+ * is appended to the stats file. Pages allocated on a node other than the
+ * one the allocating CPU belongs to count as remote. The counters are
+ * system wide, so other activity on the machine is counted too.
+ *
+ * "report" joins the bench results of a policy sweep, labelled by policy,
+ * with the stats file of each policy, and prints the best policy.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Some macros to make the code more readable. */
+#define MAX_LINE_LENGTH 4096
+#define MAX_NODES 1024
+#define MAX_POLICIES 64
+#define MAX_LABEL_LENGTH 64
+#define NODE_DIR "/sys/devices/system/node"
+#define MPOL_BIND_MODE 2
+#define MPOL_INTERLEAVE_MODE 3
+#define MPOL_LOCAL_MODE 4
+#define BITS_PER_WORD (8 * sizeof(unsigned long))
+
+/** The NUMA allocation counters summed over every node. */
+typedef struct {
+  unsigned long long local;
+  unsigned long long remote;
+} NumaStats;
+
+/** The bench result and allocation counts of one policy. */
+typedef struct {
+  char label[MAX_LABEL_LENGTH];
+  double mean;
+  double ci95;
+  NumaStats stats;
+  int runs;
+} Policy;
+
+/** Helper function declarations. */
+static int run(const char *statsPath, const char *policy, char **command);
+static void applyPolicy(const char *policy, char **command);
+static void execNumactl(const char *policy, char **command);
+static bool parseList(const char *text, unsigned long *bits, int maxBits);
+static bool readList(const char *path, unsigned long *bits, int maxBits);
+static void readStats(NumaStats *stats);
+static int report(const char *resultsPath, const char *statsDir);
+
+/**
+ * Main function for the NUMA launcher.
+ */
+int main(int argc, char **argv) {
+  if (argc == 4 && strcmp(argv[1], "report") == 0) {
+    return report(argv[2], argv[3]);
+  }
+
+  const char *statsPath = NULL, *policy = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "+s:p:")) != -1) {
+    switch (opt) {
+    case 's':
+      statsPath = optarg;
+      break;
+    case 'p':
+      policy = optarg;
+      break;
+    default:
+      policy = NULL;
+      optind = argc;
+    }
+  }
+  if (policy == NULL || optind == argc) {
+    fprintf(stderr, "Usage:\n");
+    fprintf(stderr, "numarun [-s stats.txt] -p policy -- command...\n");
+    fprintf(stderr, "numarun report results.json stats-directory\n");
+    fprintf(stderr, "Policies: first-touch local interleave bind-N\n");
+    return 1;
+  }
+  return run(statsPath, policy, argv + optind);
+}
+
+/**
+ * Runs the command under the policy and appends the allocation counts.
+ * @return The command's exit status.
+ */
+static int run(const char *statsPath, const char *policy, char **command) {
+  NumaStats before, after;
+  readStats(&before);
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    applyPolicy(policy, command);
+    _exit(127);
+  }
+  int status;
+  if (pid < 0 || waitpid(pid, &status, 0) < 0) {
+    fprintf(stderr, "numarun: unable to run %s\n", command[0]);
+    return 1;
+  }
+
+  readStats(&after);
+  if (statsPath != NULL) {
+    FILE *out = fopen(statsPath, "a");
+    if (out != NULL) {
+      fprintf(out, "%llu %llu\n", after.local - before.local,
+              after.remote - before.remote);
+      fclose(out);
+    }
+  }
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+/**
+ * Applies the policy to this process and replaces it with the command.
+ * Only returns if the command cannot be run.
+ */
+static void applyPolicy(const char *policy, char **command) {
+  if (strcmp(policy, "first-touch") != 0) {
+    execNumactl(policy, command);
+  }
+
+  // Without numactl, set the CPUs and memory policy here; both are kept
+  // across exec.
+  unsigned long nodes[MAX_NODES / BITS_PER_WORD];
+  memset(nodes, 0, sizeof(nodes));
+  int node = 0, mode = -1;
+  if (strcmp(policy, "local") == 0) {
+    mode = MPOL_LOCAL_MODE;
+  } else if (strcmp(policy, "interleave") == 0) {
+    mode = MPOL_INTERLEAVE_MODE;
+    if (!readList(NODE_DIR "/online", nodes, MAX_NODES)) {
+      nodes[0] = 1;
+    }
+  } else if (sscanf(policy, "bind-%d", &node) == 1 && node >= 0 &&
+             node < MAX_NODES) {
+    mode = MPOL_BIND_MODE;
+    nodes[node / BITS_PER_WORD] |= 1UL << (node % BITS_PER_WORD);
+  } else if (strcmp(policy, "first-touch") != 0) {
+    fprintf(stderr, "numarun: unknown policy %s\n", policy);
+    return;
+  }
+
+  if (mode == MPOL_LOCAL_MODE || mode == MPOL_BIND_MODE) {
+    char path[MAX_LINE_LENGTH];
+    unsigned long cpus[CPU_SETSIZE / BITS_PER_WORD];
+    memset(cpus, 0, sizeof(cpus));
+    snprintf(path, sizeof(path), NODE_DIR "/node%d/cpulist", node);
+    if (readList(path, cpus, CPU_SETSIZE)) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (cpus[cpu / BITS_PER_WORD] & (1UL << (cpu % BITS_PER_WORD))) {
+          CPU_SET(cpu, &set);
+        }
+      }
+      sched_setaffinity(0, sizeof(set), &set);
+    }
+  }
+  if (mode >= 0 &&
+      syscall(SYS_set_mempolicy, mode,
+              mode == MPOL_LOCAL_MODE ? NULL : nodes,
+              mode == MPOL_LOCAL_MODE ? 0 : MAX_NODES) != 0) {
+    fprintf(stderr, "numarun: set_mempolicy failed for %s: %s\n", policy,
+            strerror(errno));
+  }
+
+  execvp(command[0], command);
+  fprintf(stderr, "numarun: unable to run %s\n", command[0]);
+}
+
+/**
+ * Replaces this process with numactl running the command under the policy.
+ * Returns if numactl cannot be run.
+ */
+static void execNumactl(const char *policy, char **command) {
+  char first[64], second[64];
+  int node;
+  if (strcmp(policy, "local") == 0) {
+    snprintf(first, sizeof(first), "--cpunodebind=0");
+    snprintf(second, sizeof(second), "--localalloc");
+  } else if (strcmp(policy, "interleave") == 0) {
+    snprintf(first, sizeof(first), "--interleave=all");
+    second[0] = '\0';
+  } else if (sscanf(policy, "bind-%d", &node) == 1) {
+    snprintf(first, sizeof(first), "--cpunodebind=%d", node);
+    snprintf(second, sizeof(second), "--membind=%d", node);
+  } else {
+    return;
+  }
+
+  int count = 0;
+  while (command[count] != NULL) {
+    count++;
+  }
+  char **args = malloc(sizeof(char *) * (count + 5));
+  int n = 0;
+  args[n++] = "numactl";
+  args[n++] = first;
+  if (second[0] != '\0') {
+    args[n++] = second;
+  }
+  args[n++] = "--";
+  memcpy(args + n, command, sizeof(char *) * (count + 1));
+  execvp("numactl", args);
+  free(args);
+}
+
+/**
+ * Parses a kernel list such as "0-3,8-11" into a bit mask.
+ * @return True if anything was parsed, false otherwise.
+ */
+static bool parseList(const char *text, unsigned long *bits, int maxBits) {
+  bool parsed = false;
+  while (*text != '\0' && *text != '\n') {
+    char *end;
+    long first = strtol(text, &end, 10), last = first;
+    if (end == text) {
+      break;
+    }
+    if (*end == '-') {
+      text = end + 1;
+      last = strtol(text, &end, 10);
+    }
+    for (long i = first; i <= last && i < maxBits; i++) {
+      bits[i / BITS_PER_WORD] |= 1UL << (i % BITS_PER_WORD);
+      parsed = true;
+    }
+    text = *end == ',' ? end + 1 : end;
+  }
+  return parsed;
+}
+
+/**
+ * Reads a kernel list from a sysfs file into a bit mask.
+ * @return True if anything was read, false otherwise.
+ */
+static bool readList(const char *path, unsigned long *bits, int maxBits) {
+  FILE *file = fopen(path, "r");
+  char line[MAX_LINE_LENGTH];
+  bool parsed = false;
+  if (file != NULL) {
+    if (fgets(line, sizeof(line), file) != NULL) {
+      parsed = parseList(line, bits, maxBits);
+    }
+    fclose(file);
+  }
+  return parsed;
+}
+
+/**
+ * Sums the local and remote allocation counters over every node.
+ */
+static void readStats(NumaStats *stats) {
+  memset(stats, 0, sizeof(NumaStats));
+  for (int node = 0; node < MAX_NODES; node++) {
+    char path[MAX_LINE_LENGTH], name[64];
+    snprintf(path, sizeof(path), NODE_DIR "/node%d/numastat", node);
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+      // Nodes may be numbered with gaps, but not many.
+      if (node > 64) {
+        break;
+      }
+      continue;
+    }
+    unsigned long long value;
+    while (fscanf(file, "%63s %llu", name, &value) == 2) {
+      if (strcmp(name, "local_node") == 0) {
+        stats->local += value;
+      } else if (strcmp(name, "other_node") == 0) {
+        stats->remote += value;
+      }
+    }
+    fclose(file);
+  }
+}
+
+/**
+ * Prints each policy's time and allocation counts, best first.
+ * @return The exit status.
+ */
+static int report(const char *resultsPath, const char *statsDir) {
+  FILE *file = fopen(resultsPath, "r");
+  if (file == NULL) {
+    fprintf(stderr, "numarun: unable to read %s\n", resultsPath);
+    return 1;
+  }
+
+  // Read back the label, mean and confidence interval of each policy.
+  Policy policies[MAX_POLICIES];
+  int count = 0;
+  char line[MAX_LINE_LENGTH];
+  while (fgets(line, sizeof(line), file) != NULL) {
+    Policy *last = count > 0 ? &policies[count - 1] : NULL;
+    char label[MAX_LABEL_LENGTH];
+    if (sscanf(line, " \"label\": \"%63[^\"]\"", label) == 1 &&
+        count < MAX_POLICIES) {
+      memset(&policies[count], 0, sizeof(Policy));
+      snprintf(policies[count++].label, MAX_LABEL_LENGTH, "%s", label);
+    } else if (last != NULL) {
+      sscanf(line, " \"mean\": %lf", &last->mean);
+      sscanf(line, " \"ci95\": %lf", &last->ci95);
+    }
+  }
+  fclose(file);
+  if (count == 0) {
+    fprintf(stderr, "numarun: no results in %s\n", resultsPath);
+    return 1;
+  }
+
+  int best = 0;
+  printf("%-14s %12s %12s %10s %14s %14s %8s\n", "policy", "mean (s)",
+         "95% CI (s)", "runs/s", "local pages", "remote pages", "remote");
+  for (int i = 0; i < count; i++) {
+    Policy *policy = &policies[i];
+    char path[MAX_LINE_LENGTH];
+    snprintf(path, sizeof(path), "%.3000s/%.63s.stats", statsDir,
+             policy->label);
+    FILE *stats = fopen(path, "r");
+    unsigned long long local, remote;
+    while (stats != NULL &&
+           fscanf(stats, "%llu %llu", &local, &remote) == 2) {
+      policy->stats.local += local;
+      policy->stats.remote += remote;
+      policy->runs++;
+    }
+    if (stats != NULL) {
+      fclose(stats);
+    }
+
+    // Average the counts over the runs, warmups included.
+    int runs = policy->runs > 0 ? policy->runs : 1;
+    unsigned long long total = policy->stats.local + policy->stats.remote;
+    printf("%-14s %12.6f %12.6f %10.2f %14llu %14llu %7.1f%%\n",
+           policy->label, policy->mean, policy->ci95,
+           policy->mean > 0 ? 1.0 / policy->mean : 0.0,
+           policy->stats.local / runs, policy->stats.remote / runs,
+           total > 0 ? 100.0 * policy->stats.remote / total : 0.0);
+    if (policy->mean < policies[best].mean) {
+      best = i;
+    }
+  }
+  printf("Best policy: %s\n", policies[best].label);
+  return 0;
+}
@@ -0,0 +1,274 @@
+/**
+ * objcache is a compiler wrapper that caches object files by the content of
+ * the preprocessed source and the compiler flags. makeGen writes it into
+ * .makegen/ so that builds of different revisions can share the objects of
+ * sources that did not change between them.
+ *
+ * Usage:
+ *   objcache {cache directory} {compiler} {compiler arguments...}
+ *
+ * Only commands that compile a single source with -c and -o are cached; any
+ * other command is run unchanged. A dependency file written with -MMD or -MD
+ * is cached alongside the object.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Some macros to make the code more readable. */
+#define MAX_PATH_LENGTH 4096
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+/** Helper function declarations. */
+static bool isCacheable(int argc, char **argv, char **output,
+                        char **dependencyFile);
+static bool takesValue(const char *arg);
+static bool hashPreprocessed(int argc, char **argv, uint64_t *hash);
+static uint64_t hashBytes(uint64_t hash, const void *data, size_t length);
+static int run(char **argv);
+static bool copyFile(const char *from, const char *to);
+
+/**
+ * Main function for the object cache.
+ */
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    fprintf(stderr, "Usage:\n");
+    fprintf(stderr, "objcache {cache directory} {compiler} {arguments...}\n");
+    return 1;
+  }
+  const char *cacheDir = argv[1];
+  char **compile = argv + 2;
+  int compileCount = argc - 2;
+
+  // Run anything that does not produce a single object unchanged.
+  char *output, *dependencyFile;
+  uint64_t hash;
+  if (!isCacheable(compileCount, compile, &output, &dependencyFile) ||
+      !hashPreprocessed(compileCount, compile, &hash)) {
+    execvp(compile[0], compile);
+    perror(compile[0]);
+    return 127;
+  }
+
+  char cachedObject[MAX_PATH_LENGTH], cachedDependencies[MAX_PATH_LENGTH];
+  snprintf(cachedObject, sizeof(cachedObject), "%s/%016llx.o", cacheDir,
+           (unsigned long long)hash);
+  snprintf(cachedDependencies, sizeof(cachedDependencies), "%s/%016llx.d",
+           cacheDir, (unsigned long long)hash);
+
+  // Reuse the cached object if there is one. Without its dependency file it
+  // counts as a miss, so that no stale one is left next to the object.
+  if (access(cachedObject, R_OK) == 0 && copyFile(cachedObject, output) &&
+      (dependencyFile == NULL ||
+       copyFile(cachedDependencies, dependencyFile))) {
+    return 0;
+  }
+
+  // Otherwise compile and store the result.
+  int status = run(compile);
+  if (status == 0) {
+    mkdir(cacheDir, 0755);
+    copyFile(output, cachedObject);
+    if (dependencyFile != NULL) {
+      copyFile(dependencyFile, cachedDependencies);
+    }
+  }
+  return status;
+}
+
+/**
+ * Checks if a compiler command compiles one source to one object.
+ * @param argc The number of compiler arguments, including the compiler.
+ * @param argv The compiler arguments.
+ * @param output Set to the object file.
+ * @param dependencyFile Set to the dependency file written alongside the
+ * object, or NULL if there is none.
+ * @return True if the command can be cached, false otherwise.
+ */
+static bool isCacheable(int argc, char **argv, char **output,
+                        char **dependencyFile) {
+  bool compileOnly = false, dependencies = false;
+  int sources = 0;
+  char *explicitDependencyFile = NULL;
+  *output = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-c") == 0) {
+      compileOnly = true;
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      *output = argv[++i];
+    } else if (strcmp(argv[i], "-MF") == 0 && i + 1 < argc) {
+      explicitDependencyFile = argv[++i];
+    } else if (strcmp(argv[i], "-MMD") == 0 || strcmp(argv[i], "-MD") == 0) {
+      dependencies = true;
+    } else if (takesValue(argv[i])) {
+      i++;
+    } else if (argv[i][0] != '-') {
+      sources++;
+    }
+  }
+
+  *dependencyFile = NULL;
+  if (dependencies && explicitDependencyFile != NULL) {
+    *dependencyFile = explicitDependencyFile;
+  } else if (dependencies && *output != NULL) {
+    // The compiler names the dependency file after the object.
+    static char derived[MAX_PATH_LENGTH];
+    snprintf(derived, sizeof(derived), "%s", *output);
+    char *extension = strrchr(derived, '.');
+    if (extension != NULL && strchr(extension, '/') == NULL) {
+      *extension = '\0';
+    }
+    strncat(derived, ".d", sizeof(derived) - strlen(derived) - 1);
+    *dependencyFile = derived;
+  }
+
+  return compileOnly && sources == 1 && *output != NULL;
+}
+
+/**
+ * Checks if a compiler flag takes the next argument as its value.
+ */
+static bool takesValue(const char *arg) {
+  static const char *const flags[] = {
+      "-MT", "-MQ", "-MJ", "-I", "-D", "-U", "-include", "-imacros",
+      "-isystem", "-iquote", "-idirafter", "-isysroot", "-x", "-Xclang",
+      "-Xpreprocessor", "-Xassembler", "-Xlinker", "-mllvm", "-arch",
+      "-target", "--param", NULL};
+  for (int i = 0; flags[i] != NULL; i++) {
+    if (strcmp(arg, flags[i]) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Hashes the compiler flags together with the preprocessed source. Output
+ * and dependency file options are left out of both, since they name files
+ * rather than change the object.
+ * @param argc The number of compiler arguments, including the compiler.
+ * @param argv The compiler arguments.
+ * @param hash Set to the hash.
+ * @return True if the source could be preprocessed, false otherwise.
+ */
+static bool hashPreprocessed(int argc, char **argv, uint64_t *hash) {
+  char **preprocess = malloc(sizeof(char *) * (argc + 3));
+  int count = 0;
+  *hash = FNV_OFFSET;
+
+  for (int i = 0; i < argc; i++) {
+    if (strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "-MF") == 0 ||
+        strcmp(argv[i], "-MT") == 0 || strcmp(argv[i], "-MQ") == 0) {
+      i++;
+      continue;
+    }
+    if (strcmp(argv[i], "-c") == 0 || strncmp(argv[i], "-M", 2) == 0) {
+      continue;
+    }
+    *hash = hashBytes(*hash, argv[i], strlen(argv[i]) + 1);
+    preprocess[count++] = argv[i];
+  }
+  preprocess[count++] = "-E";
+  preprocess[count++] = "-P";
+  preprocess[count] = NULL;
+
+  int pipeFds[2];
+  if (pipe(pipeFds) != 0) {
+    free(preprocess);
+    return false;
+  }
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(pipeFds[0]);
+    dup2(pipeFds[1], STDOUT_FILENO);
+    execvp(preprocess[0], preprocess);
+    _exit(127);
+  }
+  close(pipeFds[1]);
+
+  char buffer[65536];
+  ssize_t length;
+  while ((length = read(pipeFds[0], buffer, sizeof(buffer))) > 0) {
+    *hash = hashBytes(*hash, buffer, length);
+  }
+  close(pipeFds[0]);
+  free(preprocess);
+
+  int status;
+  return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+         WEXITSTATUS(status) == 0;
+}
+
+/**
+ * Folds bytes into a 64-bit FNV-1a hash.
+ */
+static uint64_t hashBytes(uint64_t hash, const void *data, size_t length) {
+  const unsigned char *bytes = data;
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ bytes[i]) * FNV_PRIME;
+  }
+  return hash;
+}
+
+/**
+ * Runs a command and waits for it to finish.
+ * @param argv The command followed by its arguments, ending in NULL.
+ * @return The exit status of the command, or 1 if it could not be run.
+ */
+static int run(char **argv) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    execvp(argv[0], argv);
+    perror(argv[0]);
+    _exit(127);
+  }
+
+  int status;
+  if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status)) {
+    return 1;
+  }
+  return WEXITSTATUS(status);
+}
+
+/**
+ * Copies a file through a temporary file, so that a concurrent reader never
+ * sees it half written.
+ * @param from The file to copy.
+ * @param to Where to copy it.
+ * @return True if the file was copied, false otherwise.
+ */
+static bool copyFile(const char *from, const char *to) {
+  char temporary[MAX_PATH_LENGTH];
+  snprintf(temporary, sizeof(temporary), "%s.%ld.tmp", to, (long)getpid());
+
+  FILE *in = fopen(from, "rb");
+  FILE *out = in == NULL ? NULL : fopen(temporary, "wb");
+  bool copied = out != NULL;
+
+  char buffer[65536];
+  size_t length;
+  while (copied && (length = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+    copied = fwrite(buffer, 1, length, out) == length;
+  }
+  if (in != NULL) {
+    fclose(in);
+  }
+  if (out != NULL) {
+    copied = fclose(out) == 0 && copied;
+  }
+
+  if (copied && rename(temporary, to) == 0) {
+    return true;
+  }
+  unlink(temporary);
+  return false;
+}
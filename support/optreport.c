@@ -0,0 +1,555 @@
+/**
+ * optreport summarizes the optimization remarks of a build: the loops that
+ * were not vectorized and the calls that were not inlined, and why. makeGen
+ * writes it into .makegen/ for the generated opt-report rule.
+ *
+ * Usage:
+ *   optreport -g [-p profile] remarks.txt
+ *   optreport -c [-p profile] file.opt.yaml...
+ *
+ * With -g the remarks are GCC's -fopt-info-vec-all and
+ * -fopt-info-inline-missed output. With -c they are the YAML records Clang
+ * writes with -fsave-optimization-record. The profile may be perf.data or
+ * folded stacks; functions are then ranked by their share of the samples,
+ * hottest first, rather than by how many remarks they have.
+ */
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Some macros to make the code more readable. */
+#define MAX_LINE_LENGTH 8192
+#define MAX_NAME_LENGTH 256
+#define MAX_LOCATION_LENGTH (MAX_NAME_LENGTH + 32)
+#define PERF_MAGIC "PERFILE2"
+#define NOT_PROFILED -1.0
+#define REPORT_REMARKS 5
+
+/** A function with optimization remarks. */
+typedef struct {
+  char name[MAX_NAME_LENGTH];
+  char file[MAX_NAME_LENGTH];
+  int vectorized;
+  int missedLoops;
+  int missedInlines;
+  double hotness;
+} Function;
+
+/** A missed optimization: a loop left scalar or a call left in place. */
+typedef struct {
+  int function;
+  bool inlining;
+  char location[MAX_LOCATION_LENGTH];
+  char *reason;
+} Remark;
+
+static Function *functions;
+static int functionCount, functionCapacity;
+static Remark *remarks;
+static int remarkCount, remarkCapacity;
+
+/** Helper function declarations. */
+static void readGccRemarks(FILE *in);
+static void readClangRecords(FILE *in);
+static void finishClangRecord(const char *type, const char *pass,
+                              const char *function, const char *file,
+                              int line, int column, const char *message);
+static void readProfile(const char *path);
+static void addHotness(const char *name, double share);
+static int findFunction(const char *name, const char *file);
+static void addRemark(int function, bool inlining, const char *location,
+                      const char *reason);
+static bool functionAt(const char *file, int line, int column, char *name);
+static void stripNumber(char *name);
+static void printReport(bool profiled);
+static int compareFunctions(const void *a, const void *b);
+
+/**
+ * Main function for the optimization report tool.
+ */
+int main(int argc, char **argv) {
+  bool clang = false, gcc = false;
+  const char *profile = NULL;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "gcp:")) != -1) {
+    switch (opt) {
+    case 'g':
+      gcc = true;
+      break;
+    case 'c':
+      clang = true;
+      break;
+    case 'p':
+      profile = optarg;
+      break;
+    default:
+      gcc = clang = false;
+      optind = argc;
+    }
+  }
+  if (gcc == clang || optind == argc) {
+    fprintf(stderr, "Usage:\n");
+    fprintf(stderr, "optreport -g [-p profile] remarks.txt\n");
+    fprintf(stderr, "optreport -c [-p profile] file.opt.yaml...\n");
+    return 1;
+  }
+
+  for (int i = optind; i < argc; i++) {
+    FILE *in = fopen(argv[i], "r");
+    if (in == NULL) {
+      fprintf(stderr, "optreport: unable to read %s\n", argv[i]);
+      continue;
+    }
+    if (gcc) {
+      readGccRemarks(in);
+    } else {
+      readClangRecords(in);
+    }
+    fclose(in);
+  }
+
+  bool profiled = profile != NULL && profile[0] != '\0';
+  if (profiled) {
+    readProfile(profile);
+  }
+  printReport(profiled);
+  return 0;
+}
+
+/**
+ * Reads GCC remarks, which have the form "file:line:column: kind: message".
+ * A loop that is not vectorized gets a "couldn't vectorize loop" remark,
+ * followed by remarks giving the reason. The remarks of a function's loops
+ * end with a note at the function saying how many loops were vectorized,
+ * which is how loops are matched to functions. Inlining remarks name the
+ * caller and callee themselves.
+ */
+static void readGccRemarks(FILE *in) {
+  char line[MAX_LINE_LENGTH];
+  int pendingStart = remarkCount;
+  bool needReason = false;
+
+  while (fgets(line, sizeof(line), in) != NULL) {
+    line[strcspn(line, "\n")] = '\0';
+    char file[MAX_NAME_LENGTH], kind[32];
+    int lineNumber, column, consumed = 0;
+    if (sscanf(line, "%255[^:]:%d:%d: %31[^:]: %n", file, &lineNumber,
+               &column, kind, &consumed) != 4 ||
+        consumed == 0) {
+      continue;
+    }
+    char *message = line + consumed;
+    message += strspn(message, " ");
+    char location[MAX_LOCATION_LENGTH];
+    snprintf(location, sizeof(location), "%s:%d:%d", file, lineNumber,
+             column);
+
+    int vectorized;
+    if (strcmp(kind, "missed") == 0 &&
+        strncmp(message, "couldn't vectorize loop", 23) == 0) {
+      // The function is not known until its closing note.
+      addRemark(-1, false, location, "");
+      needReason = true;
+    } else if (strcmp(kind, "missed") == 0 &&
+               strncmp(message, "not inlinable: ", 15) == 0) {
+      // "not inlinable: caller/1 -> callee/2, reason"
+      char caller[MAX_NAME_LENGTH], callee[MAX_NAME_LENGTH];
+      int parsed = 0;
+      if (sscanf(message + 15, "%255s -> %255[^,], %n", caller, callee,
+                 &parsed) == 2 &&
+          parsed > 0) {
+        stripNumber(caller);
+        stripNumber(callee);
+        char reason[MAX_LINE_LENGTH];
+        snprintf(reason, sizeof(reason), "%s: %s", callee,
+                 message + 15 + parsed);
+        int function = findFunction(caller, file);
+        functions[function].missedInlines++;
+        addRemark(function, true, location, reason);
+      }
+    } else if (strcmp(kind, "missed") == 0 && needReason) {
+      if (strncmp(message, "not vectorized: ", 16) == 0) {
+        message += 16;
+      }
+      free(remarks[remarkCount - 1].reason);
+      remarks[remarkCount - 1].reason = strdup(message);
+      needReason = false;
+    } else if (strcmp(kind, "note") == 0 &&
+               sscanf(message, "vectorized %d loops in function.",
+                      &vectorized) == 1) {
+      char name[MAX_NAME_LENGTH];
+      if (!functionAt(file, lineNumber, column, name)) {
+        snprintf(name, sizeof(name), "%.200s:%d", file, lineNumber);
+      }
+      int function = findFunction(name, file);
+      functions[function].vectorized += vectorized;
+      for (int i = pendingStart; i < remarkCount; i++) {
+        if (remarks[i].function == -1) {
+          remarks[i].function = function;
+          functions[function].missedLoops++;
+        }
+      }
+      pendingStart = remarkCount;
+      needReason = false;
+    }
+  }
+}
+
+/**
+ * Reads Clang optimization records. Each record starts with a line such as
+ * "--- !Missed" and has top-level fields such as "Pass:" and "Function:".
+ * Its message is spread over the entries of "Args:".
+ */
+static void readClangRecords(FILE *in) {
+  char line[MAX_LINE_LENGTH];
+  char type[32] = "", pass[MAX_NAME_LENGTH] = "",
+       function[MAX_NAME_LENGTH] = "", file[MAX_NAME_LENGTH] = "";
+  char message[MAX_LINE_LENGTH] = "";
+  int lineNumber = 0, column = 0;
+  bool inArgs = false;
+
+  while (fgets(line, sizeof(line), in) != NULL) {
+    line[strcspn(line, "\n")] = '\0';
+    if (strncmp(line, "--- !", 5) == 0 || strcmp(line, "...") == 0) {
+      finishClangRecord(type, pass, function, file, lineNumber, column,
+                        message);
+      snprintf(type, sizeof(type), "%.31s",
+               strncmp(line, "--- !", 5) == 0 ? line + 5 : "");
+      pass[0] = function[0] = file[0] = message[0] = '\0';
+      lineNumber = column = 0;
+      inArgs = false;
+      continue;
+    }
+
+    if (line[0] != ' ') {
+      char key[64];
+      int consumed = 0;
+      if (sscanf(line, "%63[^:]: %n", key, &consumed) < 1) {
+        continue;
+      }
+      char *value = line + consumed;
+      inArgs = strcmp(key, "Args") == 0;
+      if (strcmp(key, "Pass") == 0) {
+        snprintf(pass, sizeof(pass), "%s", value);
+      } else if (strcmp(key, "Function") == 0) {
+        snprintf(function, sizeof(function), "%s", value);
+      } else if (strcmp(key, "DebugLoc") == 0) {
+        sscanf(value, "{ File: %255[^,], Line: %d, Column: %d", file,
+               &lineNumber, &column);
+      }
+    } else if (inArgs && strncmp(line, "  - ", 4) == 0 &&
+               strstr(line, "DebugLoc:") == NULL) {
+      // Each argument is "  - Key: value", possibly quoted.
+      char *value = strchr(line + 4, ':');
+      if (value != NULL) {
+        value += 1 + strspn(value + 1, " ");
+        size_t length = strlen(value);
+        if (length >= 2 && (value[0] == '\'' || value[0] == '"')) {
+          value[length - 1] = '\0';
+          value++;
+        }
+        strncat(message, value, sizeof(message) - strlen(message) - 1);
+      }
+    }
+  }
+  finishClangRecord(type, pass, function, file, lineNumber, column, message);
+}
+
+/**
+ * Adds a Clang optimization record to the report. A missed loop-vectorize
+ * record marks a loop; the analysis record at the same place says why.
+ */
+static void finishClangRecord(const char *type, const char *pass,
+                              const char *function, const char *file,
+                              int line, int column, const char *message) {
+  if (function[0] == '\0') {
+    return;
+  }
+  char stripped[MAX_NAME_LENGTH];
+  snprintf(stripped, sizeof(stripped), "%s", file);
+  if (stripped[0] == '\'' || stripped[0] == '"') {
+    memmove(stripped, stripped + 1, strlen(stripped));
+    stripped[strcspn(stripped, "'\"")] = '\0';
+  }
+  char location[MAX_LOCATION_LENGTH];
+  snprintf(location, sizeof(location), "%s:%d:%d", stripped, line, column);
+
+  bool vectorize = strcmp(pass, "loop-vectorize") == 0;
+  bool inlining = strcmp(pass, "inline") == 0;
+  if (!vectorize && !inlining) {
+    return;
+  }
+  int index = findFunction(function, stripped);
+
+  if (vectorize && strcmp(type, "Passed") == 0) {
+    functions[index].vectorized++;
+  } else if (vectorize && strcmp(type, "Missed") == 0) {
+    functions[index].missedLoops++;
+    addRemark(index, false, location, message);
+  } else if (vectorize && strcmp(type, "Analysis") == 0) {
+    // Give the reason to the loop at the same place.
+    for (int i = remarkCount - 1; i >= 0; i--) {
+      if (!remarks[i].inlining && remarks[i].function == index &&
+          strcmp(remarks[i].location, location) == 0) {
+        free(remarks[i].reason);
+        remarks[i].reason = strdup(message);
+        break;
+      }
+    }
+  } else if (inlining && strcmp(type, "Missed") == 0) {
+    functions[index].missedInlines++;
+    addRemark(index, true, location, message);
+  }
+}
+
+/**
+ * Reads each function's share of the samples in a profile. perf.data is
+ * read through perf report; anything else is taken to be folded stacks,
+ * where the last frame of each stack is the function that was running.
+ */
+static void readProfile(const char *path) {
+  FILE *in = fopen(path, "r");
+  if (in == NULL) {
+    fprintf(stderr, "optreport: unable to read profile %s\n", path);
+    return;
+  }
+  char magic[8] = "";
+  bool perfData = fread(magic, 1, sizeof(magic), in) == sizeof(magic) &&
+                  memcmp(magic, PERF_MAGIC, sizeof(magic)) == 0;
+  fclose(in);
+
+  char line[MAX_LINE_LENGTH];
+  if (perfData) {
+    char command[MAX_LINE_LENGTH];
+    snprintf(command, sizeof(command),
+             "perf report -i '%s' --stdio --no-children --sort symbol -q "
+             "2>/dev/null",
+             path);
+    FILE *report = popen(command, "r");
+    while (report != NULL && fgets(line, sizeof(line), report) != NULL) {
+      // "    12.34%  [.] function"
+      double percent;
+      char *symbol = strstr(line, "] ");
+      if (sscanf(line, " %lf%%", &percent) == 1 && symbol != NULL) {
+        symbol += 2;
+        symbol[strcspn(symbol, " \n")] = '\0';
+        addHotness(symbol, percent / 100);
+      }
+    }
+    if (report != NULL) {
+      pclose(report);
+    }
+    return;
+  }
+
+  in = fopen(path, "r");
+  double total = 0;
+  while (fgets(line, sizeof(line), in) != NULL) {
+    char *count = strrchr(line, ' ');
+    if (count != NULL) {
+      total += atof(count + 1);
+    }
+  }
+  rewind(in);
+  while (total > 0 && fgets(line, sizeof(line), in) != NULL) {
+    char *count = strrchr(line, ' ');
+    if (count == NULL) {
+      continue;
+    }
+    *count = '\0';
+    char *leaf = strrchr(line, ';');
+    addHotness(leaf == NULL ? line : leaf + 1, atof(count + 1) / total);
+  }
+  fclose(in);
+}
+
+/**
+ * Adds to the share of the samples of every function with the given name.
+ */
+static void addHotness(const char *name, double share) {
+  for (int i = 0; i < functionCount; i++) {
+    if (strcmp(functions[i].name, name) == 0) {
+      functions[i].hotness =
+          (functions[i].hotness == NOT_PROFILED ? 0 : functions[i].hotness) +
+          share;
+    }
+  }
+}
+
+/**
+ * Finds a function by name and file, adding it if it is new.
+ * @return The index of the function.
+ */
+static int findFunction(const char *name, const char *file) {
+  for (int i = 0; i < functionCount; i++) {
+    if (strcmp(functions[i].name, name) == 0 &&
+        strcmp(functions[i].file, file) == 0) {
+      return i;
+    }
+  }
+
+  if (functionCount == functionCapacity) {
+    functionCapacity = functionCapacity == 0 ? 64 : functionCapacity * 2;
+    functions = realloc(functions, sizeof(Function) * functionCapacity);
+  }
+  Function *function = &functions[functionCount];
+  memset(function, 0, sizeof(Function));
+  snprintf(function->name, sizeof(function->name), "%s", name);
+  snprintf(function->file, sizeof(function->file), "%s", file);
+  function->hotness = NOT_PROFILED;
+  return functionCount++;
+}
+
+/**
+ * Records a missed optimization.
+ * @param function The index of the function, or -1 if not yet known.
+ * @param inlining Whether a call was not inlined, rather than a loop not
+ * vectorized.
+ * @param location Where in the source it happened.
+ * @param reason Why the compiler did not optimize.
+ */
+static void addRemark(int function, bool inlining, const char *location,
+                      const char *reason) {
+  if (remarkCount == remarkCapacity) {
+    remarkCapacity = remarkCapacity == 0 ? 256 : remarkCapacity * 2;
+    remarks = realloc(remarks, sizeof(Remark) * remarkCapacity);
+  }
+  Remark *remark = &remarks[remarkCount++];
+  remark->function = function;
+  remark->inlining = inlining;
+  snprintf(remark->location, sizeof(remark->location), "%s", location);
+  remark->reason = strdup(reason);
+}
+
+/**
+ * Reads the name of the function whose definition starts at a place in a
+ * source file.
+ * @param name Set to the function name.
+ * @return True if a name was found, false otherwise.
+ */
+static bool functionAt(const char *file, int line, int column, char *name) {
+  FILE *source = fopen(file, "r");
+  if (source == NULL) {
+    return false;
+  }
+  char text[MAX_LINE_LENGTH];
+  bool found = false;
+  for (int i = 1; i <= line && fgets(text, sizeof(text), source) != NULL;
+       i++) {
+    if (i == line && column >= 1 && column <= (int)strlen(text)) {
+      char *start = text + column - 1;
+      int length = 0;
+      while (isalnum((unsigned char)start[length]) || start[length] == '_') {
+        length++;
+      }
+      found = length > 0 && length < MAX_NAME_LENGTH;
+      if (found) {
+        snprintf(name, MAX_NAME_LENGTH, "%.*s", length, start);
+      }
+    }
+  }
+  fclose(source);
+  return found;
+}
+
+/**
+ * Removes the "/number" GCC appends to function names in inlining remarks.
+ */
+static void stripNumber(char *name) {
+  char *slash = strrchr(name, '/');
+  if (slash != NULL) {
+    *slash = '\0';
+  }
+}
+
+/**
+ * Prints the summary per file, then per function with the reasons.
+ */
+static void printReport(bool profiled) {
+  // Sum the functions of each file.
+  printf("Missed optimizations by file:\n");
+  printf("  %-40s %10s %12s %14s\n", "file", "vectorized", "missed loops",
+         "missed inlines");
+  for (int i = 0; i < functionCount; i++) {
+    bool seen = false;
+    for (int j = 0; j < i && !seen; j++) {
+      seen = strcmp(functions[j].file, functions[i].file) == 0;
+    }
+    if (seen) {
+      continue;
+    }
+    int vectorized = 0, missedLoops = 0, missedInlines = 0;
+    for (int j = i; j < functionCount; j++) {
+      if (strcmp(functions[j].file, functions[i].file) == 0) {
+        vectorized += functions[j].vectorized;
+        missedLoops += functions[j].missedLoops;
+        missedInlines += functions[j].missedInlines;
+      }
+    }
+    printf("  %-40s %10d %12d %14d\n", functions[i].file, vectorized,
+           missedLoops, missedInlines);
+  }
+
+  int *order = malloc(sizeof(int) * (functionCount + 1));
+  int count = 0;
+  for (int i = 0; i < functionCount; i++) {
+    if (functions[i].missedLoops + functions[i].missedInlines > 0) {
+      order[count++] = i;
+    }
+  }
+  qsort(order, count, sizeof(int), compareFunctions);
+
+  printf("\nMissed optimizations by function%s:\n",
+         profiled ? ", hottest first" : "");
+  printf("  %-32s %-24s %8s %12s %14s\n", "function", "file", "samples",
+         "missed loops", "missed inlines");
+  for (int i = 0; i < count; i++) {
+    Function *function = &functions[order[i]];
+    char samples[32] = "-";
+    if (function->hotness != NOT_PROFILED) {
+      snprintf(samples, sizeof(samples), "%.1f%%", 100 * function->hotness);
+    }
+    printf("  %-32s %-24s %8s %12d %14d\n", function->name, function->file,
+           samples, function->missedLoops, function->missedInlines);
+
+    // Loops come first, then calls that could have been inlined, then
+    // calls to functions defined elsewhere.
+    int shown = 0;
+    for (int pass = 0; pass < 3; pass++) {
+      for (int r = 0; r < remarkCount && shown < REPORT_REMARKS; r++) {
+        bool elsewhere = strstr(remarks[r].reason, "not available") != NULL ||
+                         strstr(remarks[r].reason, "unavailable") != NULL;
+        int rank = !remarks[r].inlining ? 0 : elsewhere ? 2 : 1;
+        if (remarks[r].function != order[i] || rank != pass) {
+          continue;
+        }
+        printf("      %-24s %s %s\n", remarks[r].location,
+               remarks[r].inlining ? "not inlined:" : "not vectorized:",
+               remarks[r].reason[0] == '\0' ? "(no reason given)"
+                                             : remarks[r].reason);
+        shown++;
+      }
+    }
+  }
+  free(order);
+}
+
+/**
+ * Orders functions by their share of the samples, then by how many
+ * optimizations they missed, for qsort.
+ */
+static int compareFunctions(const void *a, const void *b) {
+  const Function *x = &functions[*(const int *)a];
+  const Function *y = &functions[*(const int *)b];
+  if (x->hotness != y->hotness) {
+    return (x->hotness < y->hotness) - (x->hotness > y->hotness);
+  }
+  int xMissed = x->missedLoops + x->missedInlines;
+  int yMissed = y->missedLoops + y->missedInlines;
+  return (xMissed < yMissed) - (xMissed > yMissed);
+}
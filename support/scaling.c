@@ -0,0 +1,354 @@
+/**
+ * scaling helps the generated scaling rule measure how a program speeds up
+ * with more threads. makeGen writes it into .makegen/.
+ *
+ * Usage:
+ *   scaling cpus {threads}
+ *   scaling report results.json [scaling.svg]
+ *
+ * "cpus" prints a CPU list for taskset with one CPU per thread. Physical
+ * cores are used before their hyperthread siblings, and cores are spread
+ * across sockets in turn.
+ *
+ * "report" reads the results bench wrote for a sweep whose labels are the
+ * thread counts. It prints each step's throughput, its speedup over one
+ * thread and its efficiency (the speedup per thread), followed by a plot of
+ * the speedup against the ideal. With an SVG path the plot is also drawn
+ * there.
+ */
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Some macros to make the code more readable. */
+#define MAX_LINE_LENGTH 4096
+#define MAX_STEPS 1024
+#define PLOT_HEIGHT 16
+#define PLOT_COLUMN_WIDTH 4
+#define IMAGE_WIDTH 640
+#define IMAGE_HEIGHT 400
+#define MARGIN 50
+
+/** A CPU and where it sits in the machine. */
+typedef struct {
+  int cpu;
+  int package;
+  int core;
+  int rank;
+  int sibling;
+} Cpu;
+
+/** One step of the sweep. */
+typedef struct {
+  int threads;
+  double mean;
+  double ci95;
+  double speedup;
+} Step;
+
+/** Helper function declarations. */
+static int printCpus(int threads);
+static int readTopology(const char *cpu, const char *name);
+static bool isFirstOfCore(Cpu *cpus, int index);
+static int compareCpus(const void *a, const void *b);
+static int report(const char *resultsPath, const char *svgPath);
+static int readSteps(const char *path, Step *steps);
+static void printPlot(Step *steps, int count, double maxSpeedup);
+static void writeSvg(const char *path, Step *steps, int count,
+                     double maxSpeedup);
+static int compareSteps(const void *a, const void *b);
+
+/**
+ * Main function for the scaling tool.
+ */
+int main(int argc, char **argv) {
+  if (argc == 3 && strcmp(argv[1], "cpus") == 0) {
+    return printCpus(atoi(argv[2]));
+  }
+  if ((argc == 3 || argc == 4) && strcmp(argv[1], "report") == 0) {
+    return report(argv[2], argc == 4 ? argv[3] : NULL);
+  }
+
+  fprintf(stderr, "Usage:\n");
+  fprintf(stderr, "scaling cpus {threads}\n");
+  fprintf(stderr, "scaling report results.json [scaling.svg]\n");
+  return 1;
+}
+
+/**
+ * Prints the CPUs to run the given number of threads on, as a taskset list.
+ * Only CPUs this process may run on are used.
+ * @return The exit status.
+ */
+static int printCpus(int threads) {
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    CPU_ZERO(&allowed);
+  }
+
+  Cpu cpus[CPU_SETSIZE];
+  int count = 0;
+  for (int i = 0; i < CPU_SETSIZE; i++) {
+    if (!CPU_ISSET(i, &allowed)) {
+      continue;
+    }
+    char cpu[32];
+    snprintf(cpu, sizeof(cpu), "cpu%d", i);
+    cpus[count].cpu = i;
+    cpus[count].package = readTopology(cpu, "physical_package_id");
+    cpus[count].core = readTopology(cpu, "core_id");
+    count++;
+  }
+  if (count == 0) {
+    fprintf(stderr, "scaling: no CPUs to run on\n");
+    return 1;
+  }
+
+  // Number the hyperthreads of each core, and the cores of each package,
+  // so that the first thread of every core sorts before any second thread
+  // and consecutive cores alternate between packages.
+  for (int i = 0; i < count; i++) {
+    cpus[i].sibling = 0;
+    cpus[i].rank = 0;
+    for (int j = 0; j < count; j++) {
+      if (cpus[j].package != cpus[i].package) {
+        continue;
+      }
+      if (cpus[j].core == cpus[i].core && j < i) {
+        cpus[i].sibling++;
+      } else if (cpus[j].core < cpus[i].core && isFirstOfCore(cpus, j)) {
+        cpus[i].rank++;
+      }
+    }
+  }
+  qsort(cpus, count, sizeof(Cpu), compareCpus);
+
+  for (int i = 0; i < threads && i < count; i++) {
+    printf("%s%d", i == 0 ? "" : ",", cpus[i].cpu);
+  }
+  printf("\n");
+  return 0;
+}
+
+/**
+ * Reads a number from a CPU's topology in sysfs.
+ * @return The number, or 0 if it cannot be read.
+ */
+static int readTopology(const char *cpu, const char *name) {
+  char path[MAX_LINE_LENGTH];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/%s/topology/%s", cpu,
+           name);
+  FILE *file = fopen(path, "r");
+  int value = 0;
+  if (file != NULL) {
+    if (fscanf(file, "%d", &value) != 1) {
+      value = 0;
+    }
+    fclose(file);
+  }
+  return value;
+}
+
+/**
+ * Checks whether a CPU is the first listed of its core's hyperthreads.
+ */
+static bool isFirstOfCore(Cpu *cpus, int index) {
+  for (int i = 0; i < index; i++) {
+    if (cpus[i].package == cpus[index].package &&
+        cpus[i].core == cpus[index].core) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Orders CPUs by hyperthread, then core, then package, for qsort.
+ */
+static int compareCpus(const void *a, const void *b) {
+  const Cpu *x = a, *y = b;
+  if (x->sibling != y->sibling) {
+    return x->sibling - y->sibling;
+  }
+  if (x->rank != y->rank) {
+    return x->rank - y->rank;
+  }
+  if (x->package != y->package) {
+    return x->package - y->package;
+  }
+  return x->cpu - y->cpu;
+}
+
+/**
+ * Prints the speedup table and plot for a sweep's results.
+ * @return The exit status.
+ */
+static int report(const char *resultsPath, const char *svgPath) {
+  Step steps[MAX_STEPS];
+  int count = readSteps(resultsPath, steps);
+  if (count <= 0) {
+    fprintf(stderr, "scaling: unable to read %s\n", resultsPath);
+    return 1;
+  }
+  qsort(steps, count, sizeof(Step), compareSteps);
+
+  // Without a one thread step, the fewest threads are taken to scale
+  // perfectly up to that point.
+  double single = steps[0].mean * steps[0].threads;
+  double maxSpeedup = steps[count - 1].threads;
+  printf("%8s %12s %12s %10s %10s %11s\n", "threads", "mean (s)",
+         "95% CI (s)", "runs/s", "speedup", "efficiency");
+  for (int i = 0; i < count; i++) {
+    Step *step = &steps[i];
+    step->speedup = step->mean > 0 ? single / step->mean : 0;
+    maxSpeedup = step->speedup > maxSpeedup ? step->speedup : maxSpeedup;
+    printf("%8d %12.6f %12.6f %10.2f %9.2fx %10.1f%%\n", step->threads,
+           step->mean, step->ci95, step->mean > 0 ? 1.0 / step->mean : 0.0,
+           step->speedup, 100.0 * step->speedup / step->threads);
+  }
+
+  printPlot(steps, count, maxSpeedup);
+  if (svgPath != NULL) {
+    writeSvg(svgPath, steps, count, maxSpeedup);
+    printf("Wrote %s\n", svgPath);
+  }
+  return 0;
+}
+
+/**
+ * Reads the thread count, mean and confidence interval of each step back
+ * from the results bench wrote.
+ * @param steps Set to the steps read.
+ * @return The number of steps, or -1 if the file cannot be read.
+ */
+static int readSteps(const char *path, Step *steps) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    return -1;
+  }
+  char line[MAX_LINE_LENGTH];
+  int count = 0, threads;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    Step *last = count > 0 ? &steps[count - 1] : NULL;
+    if (sscanf(line, " \"label\": \"%d\"", &threads) == 1 &&
+        count < MAX_STEPS) {
+      memset(&steps[count], 0, sizeof(Step));
+      steps[count++].threads = threads > 0 ? threads : 1;
+    } else if (last != NULL) {
+      sscanf(line, " \"mean\": %lf", &last->mean);
+      sscanf(line, " \"ci95\": %lf", &last->ci95);
+    }
+  }
+  fclose(file);
+  return count;
+}
+
+/**
+ * Prints the speedup of each step as a column of the plot, with the ideal
+ * speedup marked where it is not reached.
+ */
+static void printPlot(Step *steps, int count, double maxSpeedup) {
+  printf("\nSpeedup (* measured, . ideal):\n");
+  for (int row = PLOT_HEIGHT; row >= 1; row--) {
+    double level = maxSpeedup * row / PLOT_HEIGHT;
+    double below = maxSpeedup * (row - 1) / PLOT_HEIGHT;
+    printf("%6.1fx |", level);
+    for (int i = 0; i < count; i++) {
+      char mark = ' ';
+      if (steps[i].speedup > below) {
+        mark = '*';
+      } else if (steps[i].threads > below) {
+        mark = '.';
+      }
+      printf("%*c", PLOT_COLUMN_WIDTH, mark);
+    }
+    printf("\n");
+  }
+  printf("%8s+", "");
+  for (int i = 0; i < count; i++) {
+    printf("%.*s", PLOT_COLUMN_WIDTH, "----------------");
+  }
+  printf("\n%8s ", "threads");
+  for (int i = 0; i < count; i++) {
+    printf("%*d", PLOT_COLUMN_WIDTH, steps[i].threads);
+  }
+  printf("\n");
+}
+
+/**
+ * Draws the measured and ideal speedup against the thread count as an SVG
+ * line chart.
+ */
+static void writeSvg(const char *path, Step *steps, int count,
+                     double maxSpeedup) {
+  FILE *out = fopen(path, "w");
+  if (out == NULL) {
+    fprintf(stderr, "scaling: unable to write %s\n", path);
+    return;
+  }
+  double maxThreads = steps[count - 1].threads;
+  double plotWidth = IMAGE_WIDTH - 2 * MARGIN;
+  double plotHeight = IMAGE_HEIGHT - 2 * MARGIN;
+
+  fprintf(out,
+          "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%d\" "
+          "height=\"%d\" font-family=\"Verdana\" font-size=\"12\">\n",
+          IMAGE_WIDTH, IMAGE_HEIGHT);
+  fprintf(out, "<rect width=\"100%%\" height=\"100%%\" fill=\"white\"/>\n");
+  fprintf(out,
+          "<text x=\"%d\" y=\"24\" text-anchor=\"middle\" "
+          "font-size=\"16\">Speedup by thread count</text>\n",
+          IMAGE_WIDTH / 2);
+  fprintf(out,
+          "<path d=\"M%d %d V%d H%d\" fill=\"none\" stroke=\"black\"/>\n",
+          MARGIN, MARGIN, IMAGE_HEIGHT - MARGIN, IMAGE_WIDTH - MARGIN);
+
+  // Ideal scaling is a straight line through the origin.
+  double idealEnd = maxThreads < maxSpeedup ? maxThreads : maxSpeedup;
+  fprintf(out,
+          "<line x1=\"%d\" y1=\"%d\" x2=\"%.1f\" y2=\"%.1f\" stroke=\"gray\" "
+          "stroke-dasharray=\"4\"/>\n",
+          MARGIN, IMAGE_HEIGHT - MARGIN,
+          MARGIN + plotWidth * idealEnd / maxThreads,
+          IMAGE_HEIGHT - MARGIN - plotHeight * idealEnd / maxSpeedup);
+
+  fprintf(out, "<polyline fill=\"none\" stroke=\"#c0392b\" "
+               "stroke-width=\"2\" points=\"");
+  for (int i = 0; i < count; i++) {
+    fprintf(out, "%.1f,%.1f ",
+            MARGIN + plotWidth * steps[i].threads / maxThreads,
+            IMAGE_HEIGHT - MARGIN - plotHeight * steps[i].speedup / maxSpeedup);
+  }
+  fprintf(out, "\"/>\n");
+  for (int i = 0; i < count; i++) {
+    double x = MARGIN + plotWidth * steps[i].threads / maxThreads;
+    double y = IMAGE_HEIGHT - MARGIN - plotHeight * steps[i].speedup /
+                                           maxSpeedup;
+    fprintf(out,
+            "<circle cx=\"%.1f\" cy=\"%.1f\" r=\"3\" fill=\"#c0392b\">"
+            "<title>%d threads: %.2fx</title></circle>\n",
+            x, y, steps[i].threads, steps[i].speedup);
+    fprintf(out,
+            "<text x=\"%.1f\" y=\"%d\" text-anchor=\"middle\">%d</text>\n", x,
+            IMAGE_HEIGHT - MARGIN + 16, steps[i].threads);
+  }
+  fprintf(out,
+          "<text x=\"%d\" y=\"%d\" text-anchor=\"middle\">threads</text>\n",
+          IMAGE_WIDTH / 2, IMAGE_HEIGHT - 10);
+  fprintf(out,
+          "<text x=\"%d\" y=\"%d\" text-anchor=\"end\">%.1fx</text>\n",
+          MARGIN - 4, MARGIN + 4, maxSpeedup);
+  fprintf(out, "</svg>\n");
+  fclose(out);
+}
+
+/**
+ * Orders steps by thread count for qsort.
+ */
+static int compareSteps(const void *a, const void *b) {
+  return ((const Step *)a)->threads - ((const Step *)b)->threads;
+}
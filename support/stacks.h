@@ -0,0 +1,267 @@
+/**
+ * Call stacks for the LD_PRELOAD shims that makeGen writes into .makegen/:
+ * walking the frame pointers of the calling thread and naming the frames.
+ * Names are read from the symbol table of each loaded object, so static
+ * functions and variables are named too. The program's own table is read
+ * through /proc/self/exe, and stripped objects fall back to their dynamic
+ * symbols.
+ *
+ * Everything here is static, so each shim gets its own copy.
+ */
+
+#ifndef STACKS_H
+#define STACKS_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <link.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/auxv.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Some macros to make the code more readable. */
+#define STACKS_MAX_OBJECTS 64
+#define STACKS_MAIN_OBJECT "/proc/self/exe"
+
+/** A function or variable from an object's symbol table. */
+typedef struct {
+  uintptr_t start;
+  uintptr_t size;
+  const char *name;
+} Symbol;
+
+/** The symbols of a loaded object, sorted by address. */
+typedef struct {
+  const char *path;
+  Symbol *symbols;
+  int count;
+} ObjectSymbols;
+
+static ObjectSymbols stackObjects[STACKS_MAX_OBJECTS];
+static int stackObjectCount;
+static __thread uintptr_t stackLow, stackHigh;
+
+/** Helper function declarations. */
+static int walkStack(uintptr_t *frames, int maxDepth, int skip);
+static const char *lookupSymbol(uintptr_t address, uintptr_t *start,
+                                const char **object);
+static int formatFrame(char *buffer, size_t size, uintptr_t address);
+static ObjectSymbols *loadSymbols(const char *path, uintptr_t base);
+static int compareSymbols(const void *a, const void *b);
+
+/**
+ * Records the return addresses of the calling thread's stack by following
+ * the frame pointers. The walk stops at anything outside the thread's
+ * stack, so frames without a frame pointer end it early rather than crash.
+ * @param frames Set to the return addresses, innermost first.
+ * @param maxDepth The most frames to record.
+ * @param skip How many of the innermost frames to leave out.
+ * @return The number of frames recorded.
+ */
+__attribute__((noinline, unused)) static int
+walkStack(uintptr_t *frames, int maxDepth, int skip) {
+  if (stackHigh == 0) {
+    pthread_attr_t attributes;
+    void *low;
+    size_t size;
+    if (pthread_getattr_np(pthread_self(), &attributes) != 0) {
+      return 0;
+    }
+    pthread_attr_getstack(&attributes, &low, &size);
+    pthread_attr_destroy(&attributes);
+    stackLow = (uintptr_t)low;
+    stackHigh = stackLow + size;
+  }
+
+  uintptr_t fp = (uintptr_t)__builtin_frame_address(0);
+  int depth = 0;
+  while (depth < maxDepth && fp >= stackLow &&
+         fp + 2 * sizeof(uintptr_t) <= stackHigh &&
+         fp % sizeof(uintptr_t) == 0) {
+    uintptr_t *frame = (uintptr_t *)fp;
+    if (frame[1] == 0) {
+      break;
+    }
+    // Point into the call instruction rather than after it.
+    if (skip > 0) {
+      skip--;
+    } else {
+      frames[depth++] = frame[1] - 1;
+    }
+    if (frame[0] <= fp) {
+      break;
+    }
+    fp = frame[0];
+  }
+  return depth;
+}
+
+/**
+ * Finds the function or variable containing an address.
+ * @param address The code or data address.
+ * @param start Set to the start of the symbol.
+ * @param object Set to the object containing the address, or NULL.
+ * @return The symbol name, or NULL if it is unknown.
+ */
+static const char *lookupSymbol(uintptr_t address, uintptr_t *start,
+                                const char **object) {
+  Dl_info info;
+  *object = NULL;
+  if (dladdr((void *)address, &info) == 0) {
+    return NULL;
+  }
+  *object = info.dli_fname;
+
+  // The program's own path may be relative, or empty, so its symbols are
+  // read through /proc instead. Its program headers lie in its first
+  // mapping, which identifies it.
+  const char *path = info.dli_fname;
+  Dl_info program;
+  if (dladdr((void *)getauxval(AT_PHDR), &program) != 0 &&
+      program.dli_fbase == info.dli_fbase) {
+    path = STACKS_MAIN_OBJECT;
+    if ((*object)[0] == '\0') {
+      *object = program_invocation_name;
+    }
+  }
+
+  ObjectSymbols *symbols = loadSymbols(path, (uintptr_t)info.dli_fbase);
+  int low = 0, high = symbols == NULL ? 0 : symbols->count;
+  while (low < high) {
+    int middle = (low + high) / 2;
+    if (symbols->symbols[middle].start <= address) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  if (low > 0 && address < symbols->symbols[low - 1].start +
+                               symbols->symbols[low - 1].size) {
+    *start = symbols->symbols[low - 1].start;
+    return symbols->symbols[low - 1].name;
+  }
+
+  if (info.dli_sname != NULL) {
+    *start = (uintptr_t)info.dli_saddr;
+    return info.dli_sname;
+  }
+  return NULL;
+}
+
+/**
+ * Formats a frame as "function+offset (object)", the way perf script does.
+ * @return The length of the formatted frame.
+ */
+__attribute__((unused)) static int formatFrame(char *buffer, size_t size,
+                                               uintptr_t address) {
+  uintptr_t start = address;
+  const char *object;
+  const char *name = lookupSymbol(address, &start, &object);
+  int length = snprintf(buffer, size, "%s+0x%lx (%s)",
+                        name == NULL ? "[unknown]" : name,
+                        (unsigned long)(address - start),
+                        object == NULL ? "[unknown]" : object);
+  return length < (int)size ? length : (int)size - 1;
+}
+
+/**
+ * Reads the functions and variables from an object's symbol table, once
+ * per object.
+ * @param path The object file.
+ * @param base The address the object is loaded at.
+ * @return The symbols, or NULL if there is no room to keep them.
+ */
+static ObjectSymbols *loadSymbols(const char *path, uintptr_t base) {
+  for (int i = 0; i < stackObjectCount; i++) {
+    if (strcmp(stackObjects[i].path, path) == 0) {
+      return &stackObjects[i];
+    }
+  }
+  if (stackObjectCount == STACKS_MAX_OBJECTS) {
+    return NULL;
+  }
+  ObjectSymbols *symbols = &stackObjects[stackObjectCount++];
+  symbols->path = strdup(path);
+
+  // The file stays mapped, since the symbols point at its string table.
+  int fd = open(path, O_RDONLY);
+  struct stat status;
+  if (fd < 0 || fstat(fd, &status) != 0 ||
+      status.st_size < (off_t)sizeof(ElfW(Ehdr))) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    return symbols;
+  }
+  char *file = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (file == MAP_FAILED) {
+    return symbols;
+  }
+
+  ElfW(Ehdr) *header = (ElfW(Ehdr) *)file;
+  if (memcmp(header->e_ident, ELFMAG, SELFMAG) != 0 ||
+      header->e_shoff + (uintptr_t)header->e_shnum * sizeof(ElfW(Shdr)) >
+          (uintptr_t)status.st_size) {
+    return symbols;
+  }
+
+  // Addresses in shared objects and position independent executables are
+  // relative to where they are loaded.
+  uintptr_t bias = header->e_type == ET_DYN ? base : 0;
+  ElfW(Shdr) *sections = (ElfW(Shdr) *)(file + header->e_shoff);
+
+  // A stripped object only has its dynamic symbols, which still name the
+  // functions it exports.
+  int tableIndex = -1;
+  for (int i = 0; i < header->e_shnum; i++) {
+    if ((sections[i].sh_type == SHT_SYMTAB ||
+         (sections[i].sh_type == SHT_DYNSYM && tableIndex < 0)) &&
+        sections[i].sh_link < header->e_shnum) {
+      tableIndex = i;
+    }
+  }
+  if (tableIndex < 0) {
+    return symbols;
+  }
+
+  ElfW(Shdr) *section = &sections[tableIndex];
+  ElfW(Sym) *table = (ElfW(Sym) *)(file + section->sh_offset);
+  const char *names = file + sections[section->sh_link].sh_offset;
+  int count = section->sh_size / sizeof(ElfW(Sym));
+
+  symbols->symbols = malloc(sizeof(Symbol) * count);
+  for (int s = 0; s < count; s++) {
+    int type = ELF64_ST_TYPE(table[s].st_info);
+    if ((type == STT_FUNC || type == STT_OBJECT) && table[s].st_value != 0 &&
+        table[s].st_size != 0) {
+      Symbol *symbol = &symbols->symbols[symbols->count++];
+      symbol->start = bias + table[s].st_value;
+      symbol->size = table[s].st_size;
+      symbol->name = names + table[s].st_name;
+    }
+  }
+  qsort(symbols->symbols, symbols->count, sizeof(Symbol), compareSymbols);
+  return symbols;
+}
+
+/**
+ * Orders symbols by address for qsort.
+ */
+static int compareSymbols(const void *a, const void *b) {
+  uintptr_t x = ((const Symbol *)a)->start;
+  uintptr_t y = ((const Symbol *)b)->start;
+  return (x > y) - (x < y);
+}
+
+#endif